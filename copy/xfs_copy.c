@@ -22,8 +22,18 @@
 #include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
+#if defined(HAVE_FALLOCATE)
+#include <linux/falloc.h>
+#endif
 #include "xfs_copy.h"
 
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE	0x02
+#endif
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE	0x01
+#endif
+
 #define	rounddown(x, y)	(((x)/(y))*(y))
 
 extern int	platform_check_ismounted(char *, char *, struct stat64 *, int);
@@ -41,12 +51,22 @@ unsigned int	source_sectorsize;	/* source disk sectorsize */
 
 xfs_agblock_t	first_agbno;
 
+/*
+ * Free extents shorter than this are copied across rather than skipped, so
+ * the used space on either side goes out in one I/O.  The free blocks are
+ * zeroed in the buffer, so sparse targets get a hole there.
+ */
+__uint64_t	gap_bytes = 64 * 1024;
+free_range_t	*holes;			/* free extents copied across */
+int		nholes;
+int		holes_size;
+
 __uint64_t	barcount[11];
 
 unsigned int	num_targets;
 target_control	*target;
 
-wbuf		w_buf;
+wbuf		*w_buf;
 wbuf		btree_buf;
 
 pid_t		parent_pid;
@@ -55,11 +75,11 @@ unsigned int	kids;
 thread_control	glob_masks;
 thread_args	*targ;
 
-pthread_mutex_t	mainwait;
-
 #define ACTIVE		1
 #define INACTIVE	2
 
+#define NUM_WBUFS	8		/* how far reads run ahead of writes */
+
 xfs_off_t write_log_trailer(int fd, wbuf *w, xfs_mount_t *mp);
 xfs_off_t write_log_header(int fd, wbuf *w, xfs_mount_t *mp);
 
@@ -157,25 +177,96 @@ check_errors(void)
 	}
 }
 
+static int
+is_zero(char *p, size_t len)
+{
+	return p[0] == 0 && memcmp(p, p + 1, len - 1) == 0;
+}
+
+/*
+ * Without fallocate() there's no way to punch holes, so the zeroes get
+ * written out like everything else.
+ */
+static int
+punch_hole(
+	int		fd,
+	off64_t		offset,
+	size_t		len)
+{
+#if defined(HAVE_FALLOCATE)
+	return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			 offset, len);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * Write a buffer to a regular file target, punching out runs of zeroed
+ * blocks instead of writing them so the image stays sparse.  Blocks that
+ * were never written are already holes, but the log is zeroed over data
+ * that was copied earlier, so we can't just skip them.
+ */
+int
+do_write_sparse(thread_args *args, wbuf *buf)
+{
+	target_control	*t = &target[args->id];
+	size_t		chunk = source_blocksize;
+	size_t		off, len;
+	int		zero;
+
+	for (off = 0; off < buf->length; off += len)  {
+		/* find the run of zeroed or non-zeroed blocks at off */
+		len = MIN(chunk, buf->length - off);
+		zero = is_zero(buf->data + off, len);
+		while (off + len < buf->length &&
+		       is_zero(buf->data + off + len,
+			       MIN(chunk, buf->length - off - len)) == zero)
+			len += MIN(chunk, buf->length - off - len);
+
+		t->position = buf->position + off;
+		if (zero && punch_hole(t->fd, t->position, len) == 0)
+			continue;
+		if (zero && errno != EOPNOTSUPP && errno != ENOSYS)  {
+			t->error = errno;
+			t->err_type = 0;
+			return 2;
+		}
+		if (zero)
+			t->sparse = 0;	/* can't punch, write zeroes */
+		if (pwrite64(t->fd, buf->data + off, len, t->position) != len)  {
+			t->error = errno;
+			t->err_type = 0;
+			return 2;
+		}
+	}
+	t->position = buf->position + buf->length;
+	return 0;
+}
+
 /*
  * don't have to worry about alignment and mins because those
  * are taken care of when the buffer's read in
  */
 int
-do_write(thread_args *args)
+do_write(thread_args *args, wbuf *buf)
 {
 	int	res, error = 0;
 
-	if (target[args->id].position != w_buf.position)  {
-		if (lseek64(args->fd, w_buf.position, SEEK_SET) < 0)  {
+	if (target[args->id].sparse)
+		return do_write_sparse(args, buf);
+
+	if (target[args->id].position != buf->position)  {
+		if (lseek64(args->fd, buf->position, SEEK_SET) < 0)  {
 			error = target[args->id].err_type = 1;
 		} else  {
-			target[args->id].position = w_buf.position;
+			target[args->id].position = buf->position;
 		}
 	}
 
-	if ((res = write(target[args->id].fd, w_buf.data,
-				w_buf.length)) == w_buf.length)  {
+	if ((res = write(target[args->id].fd, buf->data,
+				buf->length)) == buf->length)  {
 		target[args->id].position += res;
 	} else  {
 		error = 2;
@@ -183,7 +274,7 @@ do_write(thread_args *args)
 
 	if (error) {
 		target[args->id].error = errno;
-		target[args->id].position = w_buf.position;
+		target[args->id].position = buf->position;
 	}
 	return error;
 }
@@ -192,14 +283,22 @@ void *
 begin_reader(void *arg)
 {
 	thread_args	*args = arg;
+	wbuf		*buf;
 
 	for (;;) {
-		pthread_mutex_lock(&args->wait);
-		if (do_write(args))
+		pthread_mutex_lock(&glob_masks.mutex);
+		while (args->next == glob_masks.queued)
+			pthread_cond_wait(&glob_masks.filled, &glob_masks.mutex);
+		buf = &glob_masks.buffer[args->next % glob_masks.num_bufs];
+		pthread_mutex_unlock(&glob_masks.mutex);
+
+		if (do_write(args, buf))
 			goto handle_error;
-	        pthread_mutex_lock(&glob_masks.mutex);
-		if (--glob_masks.num_working == 0)
-			pthread_mutex_unlock(&mainwait);
+
+		pthread_mutex_lock(&glob_masks.mutex);
+		args->next++;
+		if (--buf->pending == 0)
+			pthread_cond_signal(&glob_masks.drained);
 		pthread_mutex_unlock(&glob_masks.mutex);
 	}
 	/* NOTREACHED */
@@ -209,8 +308,10 @@ handle_error:
 
 	pthread_mutex_lock(&glob_masks.mutex);
 	target[args->id].state = INACTIVE;
-	if (--glob_masks.num_working == 0)
-		pthread_mutex_unlock(&mainwait);
+	/* give back everything queued that we are never going to write */
+	for (; args->next < glob_masks.queued; args->next++)
+		glob_masks.buffer[args->next % glob_masks.num_bufs].pending--;
+	pthread_cond_signal(&glob_masks.drained);
 	pthread_mutex_unlock(&glob_masks.mutex);
 	pthread_exit(NULL);
 	return NULL;
@@ -282,11 +383,41 @@ void
 usage(void)
 {
 	fprintf(stderr,
-		_("Usage: %s [-bdV] [-L logfile] source target [target ...]\n"),
+		_("Usage: %s [-bdV] [-g gap] [-L logfile] source target [target ...]\n"),
 		progname);
 	exit(1);
 }
 
+/*
+ * Parse a byte count with an optional k, m or g suffix.
+ */
+__uint64_t
+parse_gap(char *s)
+{
+	__uint64_t	val;
+	char		*end;
+
+	errno = 0;
+	val = strtoull(s, &end, 0);
+	if (errno || end == s)
+		usage();
+	switch (*end)  {
+	case 'g': case 'G':
+		val <<= 10;
+		/* fall through */
+	case 'm': case 'M':
+		val <<= 10;
+		/* fall through */
+	case 'k': case 'K':
+		val <<= 10;
+		end++;
+		break;
+	}
+	if (*end != '\0')
+		usage();
+	return val;
+}
+
 void
 init_bar(__uint64_t source_blocks)
 {
@@ -446,26 +577,149 @@ read_ag_header(int fd, xfs_agnumber_t agno, wbuf *buf, ag_header_t *ag,
 }
 
 
+/*
+ * Wait for the next buffer in the ring to be written out by all the
+ * targets, and return it to be filled.
+ */
+wbuf *
+next_wbuf(void)
+{
+	wbuf		*buf;
+
+	buf = &glob_masks.buffer[glob_masks.queued % glob_masks.num_bufs];
+
+	sigrelse(SIGCHLD);
+	pthread_mutex_lock(&glob_masks.mutex);
+	while (buf->pending)
+		pthread_cond_wait(&glob_masks.drained, &glob_masks.mutex);
+	pthread_mutex_unlock(&glob_masks.mutex);
+	sighold(SIGCHLD);
+	return buf;
+}
+
+/*
+ * Queue the buffer from next_wbuf for all the active targets.
+ */
 void
-write_wbuf(void)
+write_wbuf(wbuf *buf)
 {
 	int		i;
 
-	/* verify target threads */
+	pthread_mutex_lock(&glob_masks.mutex);
 	for (i = 0; i < num_targets; i++)
 		if (target[i].state != INACTIVE)
-			glob_masks.num_working++;
+			buf->pending++;
+	glob_masks.queued++;
+	pthread_cond_broadcast(&glob_masks.filled);
+	pthread_mutex_unlock(&glob_masks.mutex);
+}
 
-	/* release target threads */
-	for (i = 0; i < num_targets; i++)
-		if (target[i].state != INACTIVE)
-			pthread_mutex_unlock(&targ[i].wait);	/* wake up */
+/*
+ * Wait for the targets to write out everything queued.
+ */
+void
+drain_wbufs(void)
+{
+	int		i;
 
 	sigrelse(SIGCHLD);
-	pthread_mutex_lock(&mainwait);
+	pthread_mutex_lock(&glob_masks.mutex);
+	for (i = 0; i < glob_masks.num_bufs; i++)
+		while (glob_masks.buffer[i].pending)
+			pthread_cond_wait(&glob_masks.drained,
+					  &glob_masks.mutex);
+	pthread_mutex_unlock(&glob_masks.mutex);
 	sighold(SIGCHLD);
 }
 
+/*
+ * Remember a free extent that is being copied across so that it can be
+ * zeroed in the buffers that cover it.
+ */
+void
+add_hole(xfs_mount_t *mp, xfs_agnumber_t agno, xfs_alloc_rec_t *rec)
+{
+	if (nholes == holes_size)  {
+		holes_size = holes_size ? holes_size * 2 : 64;
+		holes = realloc(holes, holes_size * sizeof(free_range_t));
+		if (holes == NULL)  {
+			do_log(_("Error allocating free extent list\n"));
+			die_perror();
+		}
+	}
+	holes[nholes].start = (xfs_off_t)XFS_AGB_TO_DADDR(mp, agno,
+			be32_to_cpu(rec->ar_startblock)) << BBSHIFT;
+	holes[nholes].end = holes[nholes].start +
+			XFS_FSB_TO_B(mp, be32_to_cpu(rec->ar_blockcount));
+	nholes++;
+}
+
+void
+zero_holes(wbuf *buf)
+{
+	xfs_off_t	start, end;
+	int		i;
+
+	for (i = 0; i < nholes; i++)  {
+		start = MAX(holes[i].start, buf->position);
+		end = MIN(holes[i].end, buf->position + buf->length);
+		if (start < end)
+			memset(buf->data + (start - buf->position), 0,
+				end - start);
+	}
+}
+
+/*
+ * Copy sizeb basic blocks starting at begin through the buffer ring.
+ * Any free extents we decided to copy across on the way are zeroed.
+ */
+void
+copy_extent(
+	xfs_mount_t	*mp,
+	xfs_daddr_t	begin,
+	__uint64_t	sizeb,
+	int		wblocks,
+	int		miniosize,
+	__uint64_t	*numblocks,
+	int		*howfar)
+{
+	__uint64_t	size;
+	xfs_off_t	position;
+	wbuf		*buf;
+
+	size = roundup(sizeb << BBSHIFT, miniosize);
+	position = (xfs_off_t)begin << BBSHIFT;
+
+	while (size > 0)  {
+		buf = next_wbuf();
+		buf->position = position;
+
+		/*
+		 * let lower layer do alignment
+		 */
+		if (size > buf->size)  {
+			buf->length = buf->size;
+			size -= buf->size;
+			sizeb -= wblocks;
+			*numblocks += wblocks;
+		} else  {
+			buf->length = size;
+			*numblocks += sizeb;
+			size = 0;
+		}
+
+		read_wbuf(source_fd, buf, mp);
+		if (nholes)
+			zero_holes(buf);
+		write_wbuf(buf);
+
+		position = buf->position + buf->length;
+
+		*howfar = bump_bar(*howfar, *numblocks);
+	}
+	nholes = 0;
+}
+
 
 int
 main(int argc, char **argv)
@@ -476,7 +730,7 @@ main(int argc, char **argv)
 	xfs_off_t	pos, end_pos;
 	size_t		length;
 	int		c;
-	__uint64_t	size, sizeb;
+	__uint64_t	sizeb;
 	__uint64_t	numblocks = 0;
 	int		wblocks = 0;
 	int		num_threads = 0;
@@ -487,6 +741,7 @@ main(int argc, char **argv)
 	int		source_is_file = 0;
 	int		buffered_output = 0;
 	int		duplicate = 0;
+	wbuf		*buf;
 	uint		btree_levels, current_level;
 	ag_header_t	ag_hdr;
 	xfs_mount_t	*mp;
@@ -511,7 +766,7 @@ main(int argc, char **argv)
 	bindtextdomain(PACKAGE, LOCALEDIR);
 	textdomain(PACKAGE);
 
-	while ((c = getopt(argc, argv, "bdL:V")) != EOF)  {
+	while ((c = getopt(argc, argv, "bdg:L:V")) != EOF)  {
 		switch (c) {
 		case 'b':
 			buffered_output = 1;
@@ -519,6 +774,9 @@ main(int argc, char **argv)
 		case 'd':
 			duplicate = 1;
 			break;
+		case 'g':
+			gap_bytes = parse_gap(optarg);
+			break;
 		case 'L':
 			logfile_name = optarg;
 			break;
@@ -758,6 +1016,7 @@ main(int argc, char **argv)
 					progname);
 				die_perror();
 			}
+			target[i].sparse = 1;
 			if (platform_test_xfs_fd(target[i].fd))  {
 				if (xfsctl(target[i].name, target[i].fd,
 						XFS_IOC_DIOINFO, &d) < 0)  {
@@ -792,17 +1051,32 @@ main(int argc, char **argv)
 
 	/* initialize locks and bufs */
 
-	if (pthread_mutex_init(&glob_masks.mutex, NULL) != 0)  {
+	if (pthread_mutex_init(&glob_masks.mutex, NULL) != 0 ||
+	    pthread_cond_init(&glob_masks.filled, NULL) != 0 ||
+	    pthread_cond_init(&glob_masks.drained, NULL) != 0)  {
 		do_log(_("Couldn't initialize global thread mask\n"));
 		die_perror();
 	}
-	glob_masks.num_working = 0;
+	glob_masks.queued = 0;
 
-	if (wbuf_init(&w_buf, wbuf_size, wbuf_align,
+	if ((glob_masks.buffer = calloc(NUM_WBUFS, sizeof(wbuf))) == NULL)  {
+		do_log(_("Couldn't allocate wbuf ring\n"));
+		die_perror();
+	}
+	w_buf = &glob_masks.buffer[0];
+	if (wbuf_init(w_buf, wbuf_size, wbuf_align,
 					wbuf_miniosize, 0) == NULL)  {
 		do_log(_("Error initializing wbuf 0\n"));
 		die_perror();
 	}
+	/* the rest of the ring is optional, but all the same size */
+	for (i = 1; i < NUM_WBUFS; i++)  {
+		if (wbuf_init(&glob_masks.buffer[i], w_buf->size, wbuf_align,
+				w_buf->size, i) == NULL)
+			break;
+		glob_masks.buffer[i].min_io_size = w_buf->min_io_size;
+	}
+	glob_masks.num_bufs = i;
 
 	wblocks = wbuf_size / BBSIZE;
 
@@ -812,14 +1086,6 @@ main(int argc, char **argv)
 		die_perror();
 	}
 
-	if (pthread_mutex_init(&mainwait,NULL) != 0)  {
-		do_log(_("Error creating first semaphore.\n"));
-		die_perror();
-		exit(1);
-	}
-	/* need to start out blocking */
-	pthread_mutex_lock(&mainwait);
-
 	/* set up sigchild signal handler */
 
 	signal(SIGCHLD, handler);
@@ -839,13 +1105,7 @@ main(int argc, char **argv)
 		else
 			platform_uuid_copy(&tcarg->uuid, &mp->m_sb.sb_uuid);
 
-		if (pthread_mutex_init(&tcarg->wait, NULL) != 0)  {
-			do_log(_("Error creating thread mutex %d\n"), i);
-			die_perror();
-			exit(1);
-		}
-		/* need to start out blocking */
-		pthread_mutex_lock(&tcarg->wait);
+		tcarg->next = 0;
 	}
 
 	for (i = 0, tcarg = targ; i < num_targets; i++, tcarg++)  {
@@ -877,7 +1137,8 @@ main(int argc, char **argv)
 	for (agno = 0; agno < num_ags && kids > 0; agno++)  {
 		/* read in first blocks of the ag */
 
-		read_ag_header(source_fd, agno, &w_buf, &ag_hdr, mp,
+		buf = next_wbuf();
+		read_ag_header(source_fd, agno, buf, &ag_hdr, mp,
 			source_blocksize, source_sectorsize);
 
 		/* set the in_progress bit for the first AG */
@@ -893,7 +1154,7 @@ main(int argc, char **argv)
 
 		/* write the ag header out */
 
-		write_wbuf();
+		write_wbuf(buf);
 
 		/* traverse btree until we get to the leftmost leaf node */
 
@@ -907,7 +1168,7 @@ main(int argc, char **argv)
 				+ source_blocksize / BBSIZE;
 
 		for (;;) {
-			/* none of this touches the w_buf buffer */
+			/* none of this touches the wbuf ring */
 
 			if (current_level >= btree_levels) {
 				do_log(
@@ -945,12 +1206,12 @@ main(int argc, char **argv)
 
 		/* align first data copy but don't overwrite ag header */
 
-		pos = w_buf.position >> BBSHIFT;
-		length = w_buf.length >> BBSHIFT;
+		pos = buf->position >> BBSHIFT;
+		length = buf->length >> BBSHIFT;
 		next_begin = pos + length;
 		ag_begin = next_begin;
 
-		ASSERT(w_buf.position % source_sectorsize == 0);
+		ASSERT(buf->position % source_sectorsize == 0);
 
 		/* handle the rest of the ag */
 
@@ -966,6 +1227,17 @@ main(int argc, char **argv)
 			rec_ptr = XFS_ALLOC_REC_ADDR(mp, block, 1);
 			for (i = 0; i < be16_to_cpu(block->bb_numrecs);
 							i++, rec_ptr++)  {
+				/*
+				 * copy across short free extents, the used
+				 * space on both sides goes out together
+				 */
+				if ((__uint64_t)be32_to_cpu(
+						rec_ptr->ar_blockcount) *
+						source_blocksize < gap_bytes)  {
+					add_hole(mp, agno, rec_ptr);
+					continue;
+				}
+
 				/* calculate in daddr's */
 
 				begin = next_begin;
@@ -987,37 +1259,8 @@ main(int argc, char **argv)
 				sizeb = XFS_AGB_TO_DADDR(mp, agno, 
 					be32_to_cpu(rec_ptr->ar_startblock)) - 
 						begin;
-				size = roundup(sizeb <<BBSHIFT, wbuf_miniosize);
-				if (size > 0)  {
-					/* copy extent */
-
-					w_buf.position = (xfs_off_t)
-						begin << BBSHIFT;
-
-					while (size > 0)  {
-						/*
-						 * let lower layer do alignment
-						 */
-						if (size > w_buf.size)  {
-							w_buf.length = w_buf.size;
-							size -= w_buf.size;
-							sizeb -= wblocks;
-							numblocks += wblocks;
-						} else  {
-							w_buf.length = size;
-							numblocks += sizeb;
-							size = 0;
-						}
-
-						read_wbuf(source_fd, &w_buf, mp);
-						write_wbuf();
-
-						w_buf.position += w_buf.length;
-
-						howfar = bump_bar(
-							howfar, numblocks);
-					}
-				}
+				copy_extent(mp, begin, sizeb, wblocks,
+					wbuf_miniosize, &numblocks, &howfar);
 
 				/* round next starting point down */
 
@@ -1025,7 +1268,7 @@ main(int argc, char **argv)
 						be32_to_cpu(rec_ptr->ar_startblock) +
 					 	be32_to_cpu(rec_ptr->ar_blockcount));
 				next_begin = rounddown(new_begin,
-						w_buf.min_io_size >> BBSHIFT);
+						w_buf->min_io_size >> BBSHIFT);
 			}
 
 			if (be32_to_cpu(block->bb_u.s.bb_rightsib) == NULLAGBLOCK)
@@ -1057,57 +1300,33 @@ main(int argc, char **argv)
 			begin = next_begin;
 
 			sizeb = ag_end - begin;
-			size = roundup(sizeb << BBSHIFT, wbuf_miniosize);
-
-			if (size > 0)  {
-				/* copy extent */
-
-				w_buf.position = (xfs_off_t) begin << BBSHIFT;
-
-				while (size > 0)  {
-					/*
-					 * let lower layer do alignment
-					 */
-					if (size > w_buf.size)  {
-						w_buf.length = w_buf.size;
-						size -= w_buf.size;
-						sizeb -= wblocks;
-						numblocks += wblocks;
-					} else  {
-						w_buf.length = size;
-						numblocks += sizeb;
-						size = 0;
-					}
-
-					read_wbuf(source_fd, &w_buf, mp);
-					write_wbuf();
-
-					w_buf.position += w_buf.length;
-
-					howfar = bump_bar(howfar, numblocks);
-				}
-			}
+			copy_extent(mp, begin, sizeb, wblocks, wbuf_miniosize,
+				&numblocks, &howfar);
 		}
+		nholes = 0;
 	}
 
+	/* the rest is written by this thread, wait for the targets first */
+	drain_wbufs();
+
 	if (kids > 0)  {
 		if (!duplicate)  {
 
 			/* write a clean log using the specified UUID */
 			for (j = 0, tcarg = targ; j < num_targets; j++)  {
-				w_buf.owner = tcarg;
-				w_buf.length = rounddown(w_buf.size,
-							 w_buf.min_io_size);
+				w_buf->owner = tcarg;
+				w_buf->length = rounddown(w_buf->size,
+							 w_buf->min_io_size);
 				pos = write_log_header(
-							source_fd, &w_buf, mp);
+							source_fd, w_buf, mp);
 				end_pos = write_log_trailer(
-							source_fd, &w_buf, mp);
-				w_buf.position = pos;
-				memset(w_buf.data, 0, w_buf.length);
+							source_fd, w_buf, mp);
+				w_buf->position = pos;
+				memset(w_buf->data, 0, w_buf->length);
 
-				while (w_buf.position < end_pos)  {
-					do_write(tcarg);
-					w_buf.position += w_buf.length;
+				while (w_buf->position < end_pos)  {
+					do_write(tcarg, w_buf);
+					w_buf->position += w_buf->length;
 				}
 				tcarg++;
 			}
@@ -1119,7 +1338,7 @@ main(int argc, char **argv)
 		/* [backwards, so inprogress bit only updated when done] */
 
 		for (i = num_ags - 1; i >= 0; i--)  {
-			read_ag_header(source_fd, i, &w_buf, &ag_hdr, mp,
+			read_ag_header(source_fd, i, w_buf, &ag_hdr, mp,
 				source_blocksize, source_sectorsize);
 			if (i == 0)
 				ag_hdr.xfs_sb->sb_inprogress = 0;
@@ -1129,7 +1348,7 @@ main(int argc, char **argv)
 			for (j = 0, tcarg = targ; j < num_targets; j++)  {
 				platform_uuid_copy(&ag_hdr.xfs_sb->sb_uuid,
 							&tcarg->uuid);
-				do_write(tcarg);
+				do_write(tcarg, w_buf);
 				tcarg++;
 			}
 		}
@@ -1149,7 +1368,7 @@ next_log_chunk(xfs_caddr_t p, int offset, void *private)
 	if (buf->length < (int)(p - buf->data) + offset) {
 		/* need to flush this one, then start afresh */
 
-		do_write(buf->owner);
+		do_write(buf->owner, buf);
 		memset(buf->data, 0, buf->length);
 		return buf->data;
 	}
@@ -1184,7 +1403,7 @@ write_log_header(int fd, wbuf *buf, xfs_mount_t *mp)
 			xfs_sb_version_haslogv2(&mp->m_sb) ? 2 : 1,
 			mp->m_sb.sb_logsunit, XLOG_FMT,
 			next_log_chunk, buf);
-	do_write(buf->owner);
+	do_write(buf->owner, buf);
 
 	return roundup(logstart + offset, buf->length);
 }
@@ -1209,7 +1428,7 @@ write_log_trailer(int fd, wbuf *buf, xfs_mount_t *mp)
 		read_wbuf(fd, buf, mp);
 		offset = (int)(logend - buf->position);
 		memset(buf->data, 0, offset);
-		do_write(buf->owner);
+		do_write(buf->owner, buf);
 	}
 
 	return buf->position;
@@ -58,18 +58,27 @@ typedef struct {
 	size_t		length;		/* requested length (bytes) */
 	char		*data;		/* pointer to data buffer */
 	struct t_args	*owner;		/* for non-parallel writes */
+	int		pending;	/* targets yet to write it */
 } wbuf;
 
 typedef struct t_args {
 	int		id;
 	uuid_t		uuid;
-	pthread_mutex_t	wait;
+	__uint64_t	next;		/* next buffer to write */
 	int		fd;
 } thread_args;
 
+/*
+ * The source is read into a ring of buffers, and each target thread
+ * writes them out in order at its own pace.  Buffer n is in slot
+ * n % num_bufs and can be refilled once all the targets have written it.
+ */
 typedef struct {
 	pthread_mutex_t mutex;
-	int		num_working;
+	pthread_cond_t	filled;		/* a buffer was queued */
+	pthread_cond_t	drained;	/* a buffer was written by everyone */
+	__uint64_t	queued;		/* buffers queued so far */
+	int		num_bufs;
 	wbuf		*buffer;
 } thread_control;
 
@@ -85,5 +94,11 @@ typedef struct {
 	int		state;
 	int		error;
 	int		err_type;
+	int		sparse;		/* punch holes for zeroed blocks */
 } target_control;
 
+typedef struct {
+	xfs_off_t	start;		/* in bytes */
+	xfs_off_t	end;
+} free_range_t;
+
@@ -18,6 +18,7 @@
 
 #include <xfs/libxfs.h>
 #include <math.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include "bmap.h"
 #include "check.h"
@@ -58,6 +59,9 @@ typedef struct inodata {
 	xfs_ino_t	ino;
 	struct inodata	*parent;
 	char		*name;
+	__uint64_t	seq;		/* first reference, see find_inode */
+	__uint64_t	name_seq;	/* reference that set name */
+	__uint64_t	parent_seq;	/* reference that set parent, 0 for .. */
 } inodata_t;
 #define	MIN_INODATA_HASH_SIZE	256
 #define	MAX_INODATA_HASH_SIZE	65536
@@ -75,6 +79,7 @@ typedef	struct qdata {
 	xfs_dqid_t	id;
 	qinfo_t		count;
 	qinfo_t		dq;
+	__uint64_t	seq;		/* first reference */
 } qdata_t;
 
 typedef struct blkent {
@@ -110,22 +115,26 @@ typedef struct dirhash {
 #define	DIR_HASH_SIZE	1024
 #define	DIR_HASH_FUNC(h,a)	(((h) ^ (a)) % DIR_HASH_SIZE)
 
-static xfs_extlen_t	agffreeblks;
-static xfs_extlen_t	agflongest;
-static __uint64_t	agf_aggr_freeblks;	/* aggregate count over all */
-static __uint32_t	agfbtreeblks;
-static int		lazycount;
-static xfs_agino_t	agicount;
-static xfs_agino_t	agifreecount;
+/*
+ * The counters and the scratch state used while scanning an AG are per
+ * thread, see scan_ags_parallel.
+ */
+static __thread xfs_extlen_t	agffreeblks;
+static __thread xfs_extlen_t	agflongest;
+static __thread __uint64_t	agf_aggr_freeblks;	/* summed over all AGs */
+static __thread __uint32_t	agfbtreeblks;
+static __thread int		lazycount;
+static __thread xfs_agino_t	agicount;
+static __thread xfs_agino_t	agifreecount;
 static xfs_fsblock_t	*blist;
 static int		blist_size;
 static char		**dbmap;	/* really dbm_t:8 */
-static dirhash_t	**dirhash;
-static int		error;
-static __uint64_t	fdblocks;
-static __uint64_t	frextents;
-static __uint64_t	icount;
-static __uint64_t	ifree;
+static __thread dirhash_t	**dirhash;
+static __thread int	error;
+static __thread __uint64_t	fdblocks;
+static __thread __uint64_t	frextents;
+static __thread __uint64_t	icount;
+static __thread __uint64_t	ifree;
 static inodata_t	***inodata;
 static int		inodata_hash_size;
 static inodata_t	***inomap;
@@ -138,9 +147,9 @@ static qdata_t		**qudata;
 static int		qudo;
 static qdata_t		**qgdata;
 static int		qgdo;
-static unsigned		sbversion;
-static int		sbver_err;
-static int		serious_error;
+static __thread unsigned	sbversion;
+static __thread int	sbver_err;
+static __thread int	serious_error;
 static int		sflag;
 static xfs_suminfo_t	*sumcompute;
 static xfs_suminfo_t	*sumfile;
@@ -173,6 +182,36 @@ static const char	*typename[] = {
 	NULL
 };
 static int		verbose;
+static int		nthreads;	/* AGs to scan at once, -j */
+
+/*
+ * Scanning AGs in parallel: dbmap, inomap and the inodata table of an AG
+ * are protected by its entry in ag_locks, the last of which covers the
+ * realtime maps.  The quota tables have a lock of their own.  Everything
+ * a thread prints and counts while scanning an AG is kept in an agscan_t
+ * and added up in AG order once all the AGs are done.
+ */
+typedef struct agscan {
+	dbout_t		out;
+	int		lazycount;	/* as it is when the AG is reached */
+	int		error;
+	int		serious_error;
+	int		sbver_err;
+	unsigned	sbversion;
+	__uint64_t	agf_aggr_freeblks;
+	__uint64_t	fdblocks;
+	__uint64_t	frextents;
+	__uint64_t	icount;
+	__uint64_t	ifree;
+} agscan_t;
+
+static pthread_mutex_t	*ag_locks;
+static pthread_mutex_t	quota_lock = PTHREAD_MUTEX_INITIALIZER;
+static agscan_t		*agscans;
+static xfs_agnumber_t	agscan_next;
+static unsigned		agscan_sbversion;
+static int		scan_conflict;
+static __thread __uint64_t	scan_seq;	/* see find_inode */
 
 #define	CHECK_BLIST(b)	(blist_size && check_blist(b))
 #define	CHECK_BLISTA(a,b)	\
@@ -199,7 +238,8 @@ typedef void	(*scan_sbtree_f_t)(struct xfs_btree_block *block,
 static void		add_blist(xfs_fsblock_t	bno);
 static void		add_ilist(xfs_ino_t ino);
 static void		addlink_inode(inodata_t *id);
-static void		addname_inode(inodata_t *id, char *name, int namelen);
+static void		addname_inode(inodata_t *id, inodata_t *pid, char *name,
+				      int namelen);
 static void		addparent_inode(inodata_t *id, xfs_ino_t parent);
 static void		blkent_append(blkent_t **entp, xfs_fsblock_t b,
 				      xfs_extlen_t c);
@@ -262,6 +302,7 @@ static inodata_t	*find_inode(xfs_ino_t ino, int add);
 static void		free_inodata(xfs_agnumber_t agno);
 static int		init(int argc, char **argv);
 static char		*inode_name(xfs_ino_t ino, inodata_t **ipp);
+static void		lock_ag(xfs_agnumber_t agno);
 static int		ncheck_f(int argc, char **argv);
 static char		*prepend_path(char *oldpath, char *parent);
 static xfs_ino_t	process_block_dir_v2(blkmap_t *blkmap, int *dot,
@@ -318,8 +359,11 @@ static void		quota_add1(qdata_t **qt, xfs_dqid_t id, int dq,
 				   xfs_qcnt_t bc, xfs_qcnt_t ic,
 				   xfs_qcnt_t rc);
 static void		quota_check(char *s, qdata_t **qt);
+static void		quota_free(qdata_t **qt);
 static void		quota_init(void);
 static void		scan_ag(xfs_agnumber_t agno);
+static void		*scan_ag_worker(void *arg);
+static int		scan_ags_parallel(void);
 static void		scan_freelist(xfs_agf_t *agf);
 static void		scan_lbtree(xfs_fsblock_t root, int nlevels,
 				    scan_lbtree_f_t func, dbm_t type,
@@ -356,13 +400,16 @@ static void		set_rinomap(xfs_drfsbno_t bno, xfs_extlen_t len,
 				    inodata_t *id);
 static void		setlink_inode(inodata_t *id, nlink_t nlink, int isdir,
 				       int security);
+static inodata_t	*sort_inodata_chain(inodata_t *head);
+static qdata_t		*sort_qdata_chain(qdata_t *head);
+static void		unlock_ag(xfs_agnumber_t agno);
 
 static const cmdinfo_t	blockfree_cmd =
 	{ "blockfree", NULL, blockfree_f, 0, 0, 0,
 	  NULL, N_("free block usage information"), NULL };
 static const cmdinfo_t	blockget_cmd =
 	{ "blockget", "check", blockget_f, 0, -1, 0,
-	  N_("[-s|-v] [-n] [-t] [-b bno]... [-i ino] ..."),
+	  N_("[-s|-v] [-n] [-t] [-j threads] [-b bno]... [-i ino] ..."),
 	  N_("get block usage and check consistency"), NULL };
 static const cmdinfo_t	blocktrash_cmd =
 	{ "blocktrash", NULL, blocktrash_f, 0, -1, 0,
@@ -405,23 +452,46 @@ static void
 addlink_inode(
 	inodata_t	*id)
 {
+	xfs_agnumber_t	agno = XFS_INO_TO_AGNO(mp, id->ino);
+
+	lock_ag(agno);
 	id->link_add++;
+	unlock_ag(agno);
 	if (verbose || id->ilist)
 		dbprintf(_("inode %lld add link, now %u\n"), id->ino,
 			id->link_add);
 }
 
+/*
+ * Keep the first name found for an inode, first in the order of the serial
+ * scan, and the directory it was found in unless a parent was set from the
+ * inode's own .. entry.
+ */
 static void
 addname_inode(
 	inodata_t	*id,
+	inodata_t	*pid,
 	char		*name,
 	int		namelen)
 {
-	if (!nflag || id->name)
-		return;
-	id->name = xmalloc(namelen + 1);
-	memcpy(id->name, name, namelen);
-	id->name[namelen] = '\0';
+	xfs_agnumber_t	agno = XFS_INO_TO_AGNO(mp, id->ino);
+	__uint64_t	seq;
+
+	seq = ++scan_seq;
+	lock_ag(agno);
+	if (!id->parent || id->parent_seq > seq) {
+		id->parent = pid;
+		id->parent_seq = seq;
+	}
+	if (nflag && (!id->name || id->name_seq > seq)) {
+		if (id->name)
+			xfree(id->name);
+		id->name = xmalloc(namelen + 1);
+		memcpy(id->name, name, namelen);
+		id->name[namelen] = '\0';
+		id->name_seq = seq;
+	}
+	unlock_ag(agno);
 }
 
 static void
@@ -429,10 +499,14 @@ addparent_inode(
 	inodata_t	*id,
 	xfs_ino_t	parent)
 {
+	xfs_agnumber_t	agno = XFS_INO_TO_AGNO(mp, id->ino);
 	inodata_t	*pid;
 
 	pid = find_inode(parent, 1);
+	lock_ag(agno);
 	id->parent = pid;
+	id->parent_seq = 0;
+	unlock_ag(agno);
 	if (verbose || id->ilist || (pid && pid->ilist))
 		dbprintf(_("inode %lld parent %lld\n"), id->ino, parent);
 }
@@ -811,12 +885,27 @@ blockget_f(
 	}
 	oldprefix = dbprefix;
 	dbprefix |= pflag;
-	for (agno = 0, sbyell = 0; agno < mp->m_sb.sb_agcount; agno++) {
-		scan_ag(agno);
-		if (sbver_err > 4 && !sbyell && sbver_err >= agno) {
-			sbyell = 1;
-			dbprintf(_("WARNING: this may be a newer XFS "
-				 "filesystem.\n"));
+	if (nthreads > 1 && !scan_ags_parallel()) {
+		/* start again from scratch and do it the slow way */
+		blockfree_f(0, NULL);
+		quota_free(qudata);
+		quota_free(qgdata);
+		quota_free(qpdata);
+		qudata = qgdata = qpdata = NULL;
+		if (!init(argc, argv)) {
+			dbprefix = oldprefix;
+			return 0;
+		}
+		nthreads = 1;
+	}
+	if (nthreads <= 1) {
+		for (agno = 0, sbyell = 0; agno < mp->m_sb.sb_agcount; agno++) {
+			scan_ag(agno);
+			if (sbver_err > 4 && !sbyell && sbver_err >= agno) {
+				sbyell = 1;
+				dbprintf(_("WARNING: this may be a newer XFS "
+					 "filesystem.\n"));
+			}
 		}
 	}
 	if (blist_size) {
@@ -1257,6 +1346,8 @@ check_dbmap(
 
 	for (i = 0, p = &dbmap[agno][agbno]; i < len; i++, p++) {
 		if ((dbm_t)*p != type) {
+			if (ag_locks)
+				scan_conflict = 1;
 			if (!sflag || CHECK_BLISTA(agno, agbno + i))
 				dbprintf(_("block %u/%u expected type %s got "
 					 "%s\n"),
@@ -1296,6 +1387,8 @@ check_inomap(
 	}
 	for (i = 0, rval = 1, idp = &inomap[agno][agbno]; i < len; i++, idp++) {
 		if (*idp) {
+			if (ag_locks)
+				scan_conflict = 1;
 			if (!sflag || (*idp)->ilist ||
 			    CHECK_BLISTA(agno, agbno + i))
 				dbprintf(_("block %u/%u claimed by inode %lld, "
@@ -1423,6 +1516,8 @@ check_rdbmap(
 
 	for (i = 0, p = &dbmap[mp->m_sb.sb_agcount][bno]; i < len; i++, p++) {
 		if ((dbm_t)*p != type) {
+			if (ag_locks)
+				scan_conflict = 1;
 			if (!sflag || CHECK_BLIST(bno + i))
 				dbprintf(_("rtblock %llu expected type %s got "
 					 "%s\n"),
@@ -1452,6 +1547,8 @@ check_rinomap(
 	     i < len;
 	     i++, idp++) {
 		if (*idp) {
+			if (ag_locks)
+				scan_conflict = 1;
 			if (!sflag || (*idp)->ilist || CHECK_BLIST(bno + i))
 				dbprintf(_("rtblock %llu claimed by inode %lld, "
 					 "previous inum %lld\n"),
@@ -1520,6 +1617,7 @@ check_set_dbmap(
 			agbno, agbno + len - 1, c_agno, c_agbno);
 		return;
 	}
+	lock_ag(agno);
 	check_dbmap(agno, agbno, len, type1);
 	mayprint = verbose | blist_size;
 	for (i = 0, p = &dbmap[agno][agbno]; i < len; i++, p++) {
@@ -1528,6 +1626,7 @@ check_set_dbmap(
 			dbprintf(_("setting block %u/%u to %s\n"), agno, agbno + i,
 				typename[type2]);
 	}
+	unlock_ag(agno);
 }
 
 static void
@@ -1543,6 +1642,7 @@ check_set_rdbmap(
 
 	if (!check_rrange(bno, len))
 		return;
+	lock_ag(mp->m_sb.sb_agcount);
 	check_rdbmap(bno, len, type1);
 	mayprint = verbose | blist_size;
 	for (i = 0, p = &dbmap[mp->m_sb.sb_agcount][bno]; i < len; i++, p++) {
@@ -1551,6 +1651,7 @@ check_set_rdbmap(
 			dbprintf(_("setting rtblock %llu to %s\n"),
 				bno + i, typename[type2]);
 	}
+	unlock_ag(mp->m_sb.sb_agcount);
 }
 
 static void
@@ -1713,6 +1814,7 @@ find_inode(
 	inodata_t	*ent;
 	inodata_t	**htab;
 	xfs_agino_t	ih;
+	__uint64_t	seq;
 
 	agno = XFS_INO_TO_AGNO(mp, ino);
 	agino = XFS_INO_TO_AGINO(mp, ino);
@@ -1721,18 +1823,33 @@ find_inode(
 		return NULL;
 	htab = inodata[agno];
 	ih = agino % inodata_hash_size;
+	lock_ag(agno);
 	ent = htab[ih];
 	while (ent) {
 		if (ent->ino == ino)
-			return ent;
+			break;
 		ent = ent->next;
 	}
 	if (!add)
-		return NULL;
+		goto out;
+	/*
+	 * The serial scan would have created the entry on the first of
+	 * all these calls; remember which one that was so the hash chains
+	 * can be put back into that order after a parallel scan.
+	 */
+	seq = ++scan_seq;
+	if (ent) {
+		if (seq < ent->seq)
+			ent->seq = seq;
+		goto out;
+	}
 	ent = xcalloc(1, sizeof(*ent));
 	ent->ino = ino;
+	ent->seq = seq;
 	ent->next = htab[ih];
 	htab[ih] = ent;
+out:
+	unlock_ag(agno);
 	return ent;
 }
 
@@ -1768,6 +1885,7 @@ init(
 	int		c;
 	xfs_ino_t	ino;
 	int		rt;
+	int		traced = 0;
 
 	serious_error = 0;
 	if (mp->m_sb.sb_magicnum != XFS_SB_MAGIC) {
@@ -1799,15 +1917,23 @@ init(
 		sumcompute = xcalloc(mp->m_rsumsize, 1);
 	}
 	nflag = sflag = tflag = verbose = optind = 0;
-	while ((c = getopt(argc, argv, "b:i:npstv")) != EOF) {
+	nthreads = 1;
+	while ((c = getopt(argc, argv, "b:i:j:npstv")) != EOF) {
 		switch (c) {
 		case 'b':
 			bno = strtoll(optarg, NULL, 10);
 			add_blist(bno);
+			traced = 1;
 			break;
 		case 'i':
 			ino = strtoll(optarg, NULL, 10);
 			add_ilist(ino);
+			traced = 1;
+			break;
+		case 'j':
+			nthreads = (int)strtol(optarg, NULL, 10);
+			if (nthreads < 1)
+				nthreads = 1;
 			break;
 		case 'n':
 			nflag = 1;
@@ -1829,6 +1955,12 @@ init(
 			return 0;
 		}
 	}
+	/*
+	 * Tracing prints every step as it happens, which only makes sense
+	 * one AG at a time.
+	 */
+	if (traced || verbose)
+		nthreads = 1;
 	error = sbver_err = serious_error = 0;
 	fdblocks = frextents = icount = ifree = 0;
 	sbversion = XFS_SB_VERSION_4;
@@ -1876,6 +2008,18 @@ inode_name(
 	return path;
 }
 
+/*
+ * Lock the maps and inode table of an AG, or the realtime maps for
+ * agno == sb_agcount, while AGs are being scanned in parallel.
+ */
+static void
+lock_ag(
+	xfs_agnumber_t	agno)
+{
+	if (ag_locks && agno <= mp->m_sb.sb_agcount)
+		pthread_mutex_lock(&ag_locks[agno]);
+}
+
 static int
 ncheck_f(
 	int		argc,
@@ -2363,12 +2507,9 @@ process_data_dir_v2(
 				parent = cid ? lino : NULLFSINO;
 			(*dotdot)++;
 		} else if (dep->namelen != 1 || dep->name[0] != '.') {
-			if (cid != NULL) {
-				if (!cid->parent)
-					cid->parent = id;
-				addname_inode(cid, (char *)dep->name,
+			if (cid != NULL)
+				addname_inode(cid, id, (char *)dep->name,
 					dep->namelen);
-			}
 		} else {
 			if (lino != id->ino) {
 				if (!sflag || v)
@@ -3465,9 +3606,8 @@ process_sf_dir_v2(
 			error++;
 		} else {
 			addlink_inode(cid);
-			if (!cid->parent)
-				cid->parent = id;
-			addname_inode(cid, (char *)sfe->name, sfe->namelen);
+			addname_inode(cid, id, (char *)sfe->name,
+				sfe->namelen);
 		}
 		if (v)
 			dbprintf(_("dir %lld entry %*.*s offset %d %lld\n"),
@@ -3555,8 +3695,11 @@ quota_add1(
 	qdata_t		*qe;
 	int		qh;
 	qinfo_t		*qi;
+	__uint64_t	seq;
 
 	qh = (int)(id % QDATA_HASH_SIZE);
+	seq = ++scan_seq;
+	pthread_mutex_lock(&quota_lock);
 	qe = qt[qh];
 	while (qe) {
 		if (qe->id == id) {
@@ -3564,12 +3707,16 @@ quota_add1(
 			qi->bc += bc;
 			qi->ic += ic;
 			qi->rc += rc;
+			if (seq < qe->seq)
+				qe->seq = seq;
+			pthread_mutex_unlock(&quota_lock);
 			return;
 		}
 		qe = qe->next;
 	}
 	qe = xmalloc(sizeof(*qe));
 	qe->id = id;
+	qe->seq = seq;
 	qi = dq ? &qe->dq : &qe->count;
 	qi->bc = bc;
 	qi->ic = ic;
@@ -3578,6 +3725,7 @@ quota_add1(
 	qi->bc = qi->ic = qi->rc = 0;
 	qe->next = qt[qh];
 	qt[qh] = qe;
+	pthread_mutex_unlock(&quota_lock);
 }
 
 static void
@@ -3622,6 +3770,25 @@ quota_check(
 	xfree(qt);
 }
 
+static void
+quota_free(
+	qdata_t	**qt)
+{
+	int	i;
+	qdata_t	*next;
+	qdata_t	*qp;
+
+	if (!qt)
+		return;
+	for (i = 0; i < QDATA_HASH_SIZE; i++) {
+		for (qp = qt[i]; qp; qp = next) {
+			next = qp->next;
+			xfree(qp);
+		}
+	}
+	xfree(qt);
+}
+
 static void
 quota_init(void)
 {
@@ -3820,6 +3987,163 @@ pop1_out:
 	pop_cur();
 }
 
+static void *
+scan_ag_worker(
+	void		*arg)
+{
+	agscan_t	*as;
+	xfs_agnumber_t	agno;
+
+	while (!scan_conflict) {
+		agno = __sync_fetch_and_add(&agscan_next, 1);
+		if (agno >= mp->m_sb.sb_agcount)
+			break;
+		as = &agscans[agno];
+
+		agf_aggr_freeblks = fdblocks = frextents = icount = ifree = 0;
+		error = serious_error = sbver_err = 0;
+		lazycount = as->lazycount;
+		sbversion = agscan_sbversion;
+		scan_seq = (__uint64_t)(agno + 1) << 40;
+
+		dbprintf_capture(&as->out);
+		scan_ag(agno);
+		dbprintf_capture(NULL);
+
+		as->agf_aggr_freeblks = agf_aggr_freeblks;
+		as->fdblocks = fdblocks;
+		as->frextents = frextents;
+		as->icount = icount;
+		as->ifree = ifree;
+		as->error = error;
+		as->serious_error = serious_error;
+		as->sbver_err = sbver_err;
+		as->sbversion = sbversion;
+	}
+
+	free(dirhash);
+	xfree(iocur_base);
+	return NULL;
+}
+
+/*
+ * Scan the AGs on nthreads threads and then add up what was found as if
+ * they had been scanned one after the other.  All the messages and every
+ * count are kept per AG, and the inode and quota hash chains are sorted
+ * back into the order they would have been built in.
+ *
+ * What gets reported when a block or inode is claimed twice depends on
+ * which claim is seen first, so if that happens we give up and return 0,
+ * and the caller starts again with a serial scan.
+ */
+static int
+scan_ags_parallel(void)
+{
+	xfs_agnumber_t	agcount = mp->m_sb.sb_agcount;
+	agscan_t	*as;
+	xfs_agnumber_t	agno;
+	pthread_t	*threads;
+	int		err;
+	int		i;
+	int		lazy;
+	int		nt;
+	int		sbyell;
+	xfs_sb_t	tsb;
+
+	agscans = xcalloc(agcount, sizeof(*agscans));
+	threads = xcalloc(nthreads, sizeof(*threads));
+
+	/*
+	 * lazycount is turned on by the first AG superblock that has it,
+	 * work out where that is before the AGs are scanned out of order.
+	 */
+	for (agno = 0, lazy = lazycount; agno < agcount; agno++) {
+		agscans[agno].lazycount = lazy;
+		if (lazy)
+			continue;
+		push_cur();
+		set_cur(&typtab[TYP_SB],
+			XFS_AG_DADDR(mp, agno, XFS_SB_DADDR),
+			XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
+		if (iocur_top->data) {
+			libxfs_sb_from_disk(&tsb, iocur_top->data);
+			lazy = xfs_sb_version_haslazysbcount(&tsb);
+		}
+		pop_cur();
+	}
+
+	ag_locks = xmalloc((agcount + 1) * sizeof(*ag_locks));
+	for (agno = 0; agno <= agcount; agno++)
+		pthread_mutex_init(&ag_locks[agno], NULL);
+	agscan_next = 0;
+	agscan_sbversion = sbversion;
+	scan_conflict = 0;
+
+	for (nt = 0; nt < nthreads && nt < agcount; nt++) {
+		err = pthread_create(&threads[nt], NULL, scan_ag_worker, NULL);
+		if (err) {
+			dbprintf(_("can't start check thread: %s\n"),
+				strerror(err));
+			if (!nt)
+				scan_conflict = 1;
+			break;
+		}
+	}
+	for (i = 0; i < nt; i++)
+		pthread_join(threads[i], NULL);
+
+	for (agno = 0; agno <= agcount; agno++)
+		pthread_mutex_destroy(&ag_locks[agno]);
+	xfree(ag_locks);
+	ag_locks = NULL;
+	xfree(threads);
+
+	if (scan_conflict) {
+		for (agno = 0; agno < agcount; agno++)
+			dbprintf_discard(&agscans[agno].out);
+		xfree(agscans);
+		agscans = NULL;
+		return 0;
+	}
+
+	for (agno = 0, sbyell = 0; agno < agcount; agno++) {
+		as = &agscans[agno];
+		dbprintf_flush(&as->out);
+		agf_aggr_freeblks += as->agf_aggr_freeblks;
+		fdblocks += as->fdblocks;
+		frextents += as->frextents;
+		icount += as->icount;
+		ifree += as->ifree;
+		error += as->error;
+		serious_error += as->serious_error;
+		sbver_err += as->sbver_err;
+		sbversion |= as->sbversion & ~XFS_SB_VERSION_ALIGNBIT;
+		if (!(as->sbversion & XFS_SB_VERSION_ALIGNBIT))
+			sbversion &= ~XFS_SB_VERSION_ALIGNBIT;
+		if (sbver_err > 4 && !sbyell && sbver_err >= agno) {
+			sbyell = 1;
+			dbprintf(_("WARNING: this may be a newer XFS "
+				 "filesystem.\n"));
+		}
+	}
+	lazycount = lazy;
+	xfree(agscans);
+	agscans = NULL;
+
+	for (agno = 0; agno < agcount; agno++)
+		for (i = 0; i < inodata_hash_size; i++)
+			inodata[agno][i] = sort_inodata_chain(inodata[agno][i]);
+	for (i = 0; i < QDATA_HASH_SIZE; i++) {
+		if (qudo)
+			qudata[i] = sort_qdata_chain(qudata[i]);
+		if (qgdo)
+			qgdata[i] = sort_qdata_chain(qgdata[i]);
+		if (qpdo)
+			qpdata[i] = sort_qdata_chain(qpdata[i]);
+	}
+	return 1;
+}
+
 static void
 scan_freelist(
 	xfs_agf_t	*agf)
@@ -4299,8 +4623,11 @@ set_inomap(
 	inodata_t	**idp;
 	int		mayprint;
 
-	if (!check_inomap(agno, agbno, len, id->ino))
+	lock_ag(agno);
+	if (!check_inomap(agno, agbno, len, id->ino)) {
+		unlock_ag(agno);
 		return;
+	}
 	mayprint = verbose | id->ilist | blist_size;
 	for (i = 0, idp = &inomap[agno][agbno]; i < len; i++, idp++) {
 		*idp = id;
@@ -4309,6 +4636,7 @@ set_inomap(
 			dbprintf(_("setting inode to %lld for block %u/%u\n"),
 				id->ino, agno, agbno + i);
 	}
+	unlock_ag(agno);
 }
 
 static void
@@ -4330,8 +4658,11 @@ set_rinomap(
 	inodata_t	**idp;
 	int		mayprint;
 
-	if (!check_rinomap(bno, len, id->ino))
+	lock_ag(mp->m_sb.sb_agcount);
+	if (!check_rinomap(bno, len, id->ino)) {
+		unlock_ag(mp->m_sb.sb_agcount);
 		return;
+	}
 	mayprint = verbose | id->ilist | blist_size;
 	for (i = 0, idp = &inomap[mp->m_sb.sb_agcount][bno];
 	     i < len;
@@ -4341,6 +4672,7 @@ set_rinomap(
 			dbprintf(_("setting inode to %lld for rtblock %llu\n"),
 				id->ino, bno + i);
 	}
+	unlock_ag(mp->m_sb.sb_agcount);
 }
 
 static void
@@ -4350,10 +4682,64 @@ setlink_inode(
 	int		isdir,
 	int		security)
 {
+	xfs_agnumber_t	agno = XFS_INO_TO_AGNO(mp, id->ino);
+
+	lock_ag(agno);
 	id->link_set = nlink;
 	id->isdir = isdir;
 	id->security = security;
+	unlock_ag(agno);
 	if (verbose || id->ilist)
 		dbprintf(_("inode %lld nlink %u %s dir\n"), id->ino, nlink,
 			isdir ? "is" : "not");
 }
+
+/*
+ * Put a hash chain back into the order the serial scan would have built
+ * it in, newest entry first.
+ */
+static inodata_t *
+sort_inodata_chain(
+	inodata_t	*head)
+{
+	inodata_t	*ent;
+	inodata_t	**entp;
+	inodata_t	*sorted = NULL;
+
+	while ((ent = head) != NULL) {
+		head = ent->next;
+		for (entp = &sorted; *entp && (*entp)->seq > ent->seq;
+		     entp = &(*entp)->next)
+			;
+		ent->next = *entp;
+		*entp = ent;
+	}
+	return sorted;
+}
+
+static qdata_t *
+sort_qdata_chain(
+	qdata_t		*head)
+{
+	qdata_t		*qe;
+	qdata_t		**qep;
+	qdata_t		*sorted = NULL;
+
+	while ((qe = head) != NULL) {
+		head = qe->next;
+		for (qep = &sorted; *qep && (*qep)->seq > qe->seq;
+		     qep = &(*qep)->next)
+			;
+		qe->next = *qep;
+		*qep = qe;
+	}
+	return sorted;
+}
+
+static void
+unlock_ag(
+	xfs_agnumber_t	agno)
+{
+	if (ag_locks && agno <= mp->m_sb.sb_agcount)
+		pthread_mutex_unlock(&ag_locks[agno]);
+}
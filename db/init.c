@@ -44,7 +44,8 @@ static void
 usage(void)
 {
 	fprintf(stderr, _(
-		"Usage: %s [-ifFrxV] [-p prog] [-l logdev] [-c cmd]... device\n"
+		"Usage: %s [-ifFrxV] [-p prog] [-l logdev] [-C policy] [-c cmd]... "
+		"device\n"
 		), progname);
 	exit(1);
 }
@@ -63,12 +64,21 @@ init(
 	textdomain(PACKAGE);
 
 	progname = basename(argv[0]);
-	while ((c = getopt(argc, argv, "c:fFip:rxVl:")) != EOF) {
+	while ((c = getopt(argc, argv, "c:C:fFip:rxVl:")) != EOF) {
 		switch (c) {
 		case 'c':
 			cmdline = xrealloc(cmdline, (ncmdline+1)*sizeof(char*));
 			cmdline[ncmdline++] = optarg;
 			break;
+		case 'C':
+			libxfs_bcache_operations.policy =
+				cache_policy_find(optarg);
+			if (!libxfs_bcache_operations.policy) {
+				fprintf(stderr, _("%s: unknown cache policy "
+					"%s\n"), progname, optarg);
+				usage();
+			}
+			break;
 		case 'f':
 			x.disfile = 1;
 			break;
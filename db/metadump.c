@@ -18,6 +18,7 @@
 
 #include <libxfs.h>
 #include <libxlog.h>
+#include <pthread.h>
 #include "bmap.h"
 #include "command.h"
 #include "metadump.h"
@@ -31,6 +32,9 @@
 #include "faddr.h"
 #include "field.h"
 #include "dir2.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #define DEFAULT_MAX_EXT_SIZE	1000
 
@@ -57,19 +61,40 @@ static void	metadump_help(void);
 
 static const cmdinfo_t	metadump_cmd =
 	{ "metadump", NULL, metadump_f, 0, -1, 0,
-		N_("[-a] [-e] [-g] [-m max_extent] [-w] [-o] filename"),
+		N_("[-a] [-e] [-g] [-j threads] [-m max_extent] [-w] [-o] [-z] filename"),
 		N_("dump metadata to a file"), metadump_help };
 
-static FILE		*outf;		/* metadump file */
+/*
+ * With -j the AGs are scanned by several threads, each of which writes
+ * what it copies to a spill file of its own, so the output state is per
+ * thread.  See scan_ags_parallel().
+ */
+static __thread FILE	*outf;		/* metadump file */
+
+static __thread xfs_metablock_t *metablock; /* header + index + buffers */
+static __thread __be64	*block_index;
+static __thread char	*block_buffer;
 
-static xfs_metablock_t 	*metablock;	/* header + index + buffers */
-static __be64		*block_index;
-static char		*block_buffer;
+static __thread int	num_indicies;
+static __thread int	cur_index;
 
-static int		num_indicies;
-static int		cur_index;
+/* version 2 dumps, see xfs_metadump.h */
+static __thread int	dump_version;
+static int		compress_method;
+static __int64_t	out_offset;	/* bytes written to outf so far */
+static char		*zbuf;		/* compressed chunk */
+static size_t		zbuf_size;
+static xfs_metadump_chunkrec_t *chunk_recs;
+static int		nchunks;
+static int		chunk_recs_size;
+static xfs_metadump_extent_t *extents;
+static int		nextents;
+static int		extents_size;
 
-static xfs_ino_t	cur_ino;
+static int		dump_to_stdout;
+static int		nr_threads;
+
+static __thread xfs_ino_t cur_ino;
 
 static int		show_progress = 0;
 static int		stop_on_read_error = 0;
@@ -97,9 +122,11 @@ metadump_help(void)
 "   -a -- Copy full metadata blocks without zeroing unused space\n"
 "   -e -- Ignore read errors and keep going\n"
 "   -g -- Display dump progress\n"
+"   -j -- Scan AGs with this many threads\n"
 "   -m -- Specify max extent size in blocks to copy (default = %d blocks)\n"
 "   -o -- Don't obfuscate names and extended attributes\n"
 "   -w -- Show warnings of bad metadata information\n"
+"   -z -- Write a compressed, indexed (version 2) dump\n"
 "\n"), DEFAULT_MAX_EXT_SIZE);
 }
 
@@ -137,7 +164,7 @@ print_progress(const char *fmt, ...)
 	va_end(ap);
 	buf[sizeof(buf)-1] = '\0';
 
-	f = (outf == stdout) ? stderr : stdout;
+	f = dump_to_stdout ? stderr : stdout;
 	fprintf(f, "\r%-59s", buf);
 	fflush(f);
 	progress_since_warning = 1;
@@ -152,9 +179,14 @@ print_progress(const char *fmt, ...)
  * Return 0 for success, -1 for failure.
  */
 
+static int	write_chunk(void);
+
 static int
 write_index(void)
 {
+	if (dump_version == 2)
+		return write_chunk();
+
 	/*
 	 * write index block and following data blocks (streaming)
 	 */
@@ -169,6 +201,275 @@ write_index(void)
 	return 0;
 }
 
+#ifdef HAVE_ZLIB
+/*
+ * Compress the chunk's daddrs and blocks into zbuf.  Returns the compressed
+ * length, or zero if the chunk didn't get any smaller.
+ */
+static size_t
+compress_chunk(
+	size_t		ilen,
+	size_t		dlen)
+{
+	static z_stream	zs;
+	static int	zs_init;
+
+	if (!zs_init) {
+		if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK)
+			return 0;
+		zs_init = 1;
+	} else
+		deflateReset(&zs);
+
+	zs.next_in = (Bytef *)block_index;
+	zs.avail_in = ilen;
+	zs.next_out = (Bytef *)zbuf;
+	zs.avail_out = ilen + dlen;
+	if (deflate(&zs, Z_NO_FLUSH) != Z_OK)
+		return 0;
+	zs.next_in = (Bytef *)block_buffer;
+	zs.avail_in = dlen;
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+		return 0;
+	return zs.total_out;
+}
+#else
+static size_t
+compress_chunk(
+	size_t		ilen,
+	size_t		dlen)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Remember where the blocks in the chunk being written went, coalescing
+ * adjacent daddrs into one extent.
+ */
+static int
+index_chunk(
+	__int64_t	offset,
+	size_t		len)
+{
+	xfs_metadump_chunkrec_t	*rec;
+	xfs_metadump_extent_t	*ext = NULL;
+	__int64_t		daddr, next = -1;
+	int			i;
+
+	if (nchunks == chunk_recs_size) {
+		chunk_recs_size = chunk_recs_size ? chunk_recs_size * 2 : 256;
+		rec = realloc(chunk_recs,
+			chunk_recs_size * sizeof(xfs_metadump_chunkrec_t));
+		if (!rec)
+			return -ENOMEM;
+		chunk_recs = rec;
+	}
+	rec = &chunk_recs[nchunks];
+	rec->mr_offset = cpu_to_be64(offset);
+	rec->mr_count = cpu_to_be32(cur_index);
+	rec->mr_len = cpu_to_be32(len);
+
+	for (i = 0; i < cur_index; i++) {
+		daddr = be64_to_cpu(block_index[i]);
+		if (daddr == next) {
+			be32_add_cpu(&ext->me_len, 1);
+			next++;
+			continue;
+		}
+		if (nextents == extents_size) {
+			extents_size = extents_size ? extents_size * 2 : 4096;
+			ext = realloc(extents,
+				extents_size * sizeof(xfs_metadump_extent_t));
+			if (!ext)
+				return -ENOMEM;
+			extents = ext;
+		}
+		ext = &extents[nextents++];
+		ext->me_daddr = cpu_to_be64(daddr);
+		ext->me_len = cpu_to_be32(1);
+		ext->me_chunk = cpu_to_be32(nchunks);
+		ext->me_block = cpu_to_be32(i);
+		ext->me_reserved = 0;
+		next = daddr + 1;
+	}
+	nchunks++;
+	return 0;
+}
+
+/*
+ * Write the blocks gathered so far out as a version 2 chunk.  An empty
+ * chunk marks the end of the dump.
+ *
+ * Return 0 for success, -errno for failure.
+ */
+static int
+write_chunk(void)
+{
+	xfs_metadump_chunk_t	hdr;
+	size_t			ilen = cur_index * sizeof(__be64);
+	size_t			dlen = (size_t)cur_index << BBSHIFT;
+	size_t			len = 0;
+
+	if (cur_index && compress_method != XFS_MD2_COMPRESS_NONE)
+		len = compress_chunk(ilen, dlen);
+
+	hdr.mc_magic = cpu_to_be32(XFS_MD2_CHUNK_MAGIC);
+	hdr.mc_count = cpu_to_be32(cur_index);
+	hdr.mc_len = cpu_to_be32(len ? len : ilen + dlen);
+	hdr.mc_compress = cpu_to_be32(len ? compress_method :
+					   XFS_MD2_COMPRESS_NONE);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, outf) != 1 ||
+	    (len && fwrite(zbuf, len, 1, outf) != 1) ||
+	    (!len && cur_index &&
+	     (fwrite(block_index, ilen, 1, outf) != 1 ||
+	      fwrite(block_buffer, dlen, 1, outf) != 1))) {
+		print_warning("error writing to file: %s", strerror(errno));
+		return -errno;
+	}
+
+	if (cur_index && index_chunk(out_offset, be32_to_cpu(hdr.mc_len))) {
+		print_warning("cannot allocate dump index");
+		return -ENOMEM;
+	}
+	out_offset += sizeof(hdr) + be32_to_cpu(hdr.mc_len);
+	cur_index = 0;
+	return 0;
+}
+
+static int
+extent_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const xfs_metadump_extent_t *ea = a;
+	const xfs_metadump_extent_t *eb = b;
+
+	if (be64_to_cpu(ea->me_daddr) != be64_to_cpu(eb->me_daddr))
+		return be64_to_cpu(ea->me_daddr) < be64_to_cpu(eb->me_daddr) ?
+			-1 : 1;
+	/* later copies of a block win on restore, keep them last */
+	return be32_to_cpu(ea->me_chunk) - be32_to_cpu(eb->me_chunk);
+}
+
+/*
+ * Finish a version 2 dump: the end marker, then the chunk and extent
+ * index and the trailer that points at them.
+ *
+ * Return 0 for success, -errno for failure.
+ */
+static int
+write_md2_index(void)
+{
+	xfs_metadump_trailer_t	trailer;
+	int			ret;
+
+	if (cur_index) {
+		ret = write_chunk();
+		if (ret)
+			return ret;
+	}
+	ret = write_chunk();
+	if (ret)
+		return ret;
+
+	qsort(extents, nextents, sizeof(xfs_metadump_extent_t), extent_cmp);
+
+	memset(&trailer, 0, sizeof(trailer));
+	trailer.mt_index = cpu_to_be64(out_offset);
+	trailer.mt_nchunks = cpu_to_be32(nchunks);
+	trailer.mt_nextents = cpu_to_be32(nextents);
+	trailer.mt_magic = cpu_to_be32(XFS_MD2_INDEX_MAGIC);
+
+	if ((nchunks && fwrite(chunk_recs, sizeof(xfs_metadump_chunkrec_t),
+				nchunks, outf) != nchunks) ||
+	    (nextents && fwrite(extents, sizeof(xfs_metadump_extent_t),
+				nextents, outf) != nextents) ||
+	    fwrite(&trailer, sizeof(trailer), 1, outf) != 1) {
+		print_warning("error writing to file: %s", strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+/*
+ * Set up the buffers for a version 2 dump and write its header.
+ *
+ * Return 0 for success, -errno for failure.
+ */
+static int
+init_md2(void)
+{
+	xfs_metadump_header_t	hdr;
+
+	num_indicies = XFS_MD2_CHUNK_BLOCKS;
+#ifdef HAVE_ZLIB
+	compress_method = XFS_MD2_COMPRESS_ZLIB;
+#else
+	compress_method = XFS_MD2_COMPRESS_NONE;
+#endif
+	block_index = malloc(num_indicies * sizeof(__be64));
+	block_buffer = malloc(num_indicies << BBSHIFT);
+	zbuf_size = num_indicies * (sizeof(__be64) + BBSIZE);
+	zbuf = malloc(zbuf_size);
+	if (!block_index || !block_buffer || !zbuf) {
+		print_warning("memory allocation failure");
+		return -ENOMEM;
+	}
+
+	hdr.mh_magic = cpu_to_be32(XFS_MD2_MAGIC);
+	hdr.mh_compress = cpu_to_be32(compress_method);
+	hdr.mh_chunk_blocks = cpu_to_be32(num_indicies);
+	hdr.mh_reserved = 0;
+	if (fwrite(&hdr, sizeof(hdr), 1, outf) != 1) {
+		print_warning("error writing to file: %s", strerror(errno));
+		return -errno;
+	}
+	out_offset = sizeof(hdr);
+	return 0;
+}
+
+/*
+ * Set up the buffers for a version 1 dump.
+ *
+ * Return 0 for success, -errno for failure.
+ */
+static int
+init_md1(void)
+{
+	metablock = (xfs_metablock_t *)calloc(BBSIZE + 1, BBSIZE);
+	if (metablock == NULL) {
+		print_warning("memory allocation failure");
+		return -ENOMEM;
+	}
+	metablock->mb_blocklog = BBSHIFT;
+	metablock->mb_magic = cpu_to_be32(XFS_MD_MAGIC);
+
+	block_index = (__be64 *)((char *)metablock + sizeof(xfs_metablock_t));
+	block_buffer = (char *)metablock + BBSIZE;
+	num_indicies = (BBSIZE - sizeof(xfs_metablock_t)) / sizeof(__be64);
+	cur_index = 0;
+	return 0;
+}
+
+static void
+free_md2(void)
+{
+	free(block_index);
+	free(block_buffer);
+	free(zbuf);
+	free(chunk_recs);
+	free(extents);
+	block_index = NULL;
+	block_buffer = NULL;
+	zbuf = NULL;
+	chunk_recs = NULL;
+	extents = NULL;
+	nchunks = chunk_recs_size = 0;
+	nextents = extents_size = 0;
+}
+
 /*
  * Return 0 for success, -errno for failure.
  */
@@ -534,7 +835,7 @@ struct name_ent {
 
 #define NAME_TABLE_SIZE		4096
 
-static struct name_ent		*nametable[NAME_TABLE_SIZE];
+static __thread struct name_ent	*nametable[NAME_TABLE_SIZE];
 
 static void
 nametable_clear(void)
@@ -1431,7 +1732,7 @@ process_symlink_block(
 
 #define MAX_REMOTE_VALS		4095
 
-static struct attr_data_s {
+static __thread struct attr_data_s {
 	int			remote_val_count;
 	xfs_dablk_t		remote_vals[MAX_REMOTE_VALS];
 } attr_data;
@@ -1670,8 +1971,8 @@ out_pop:
 /*
  * Static map to aggregate multiple extents into a single directory block.
  */
-static struct bbmap mfsb_map;
-static int mfsb_length;
+static __thread struct bbmap mfsb_map;
+static __thread int mfsb_length;
 
 static int
 process_multi_fsb_objects(
@@ -2117,6 +2418,7 @@ copy_inode_chunk(
 	xfs_agblock_t		agbno;
 	int			i;
 	int			rval = 0;
+	__uint32_t		copied;
 
 	agino = be32_to_cpu(rp->ir_startino);
 	agbno = XFS_AGINO_TO_AGBNO(mp, agino);
@@ -2177,11 +2479,11 @@ skip_processing:
 	if (write_buf(iocur_top))
 		goto pop_out;
 
-	inodes_copied += XFS_INODES_PER_CHUNK;
+	copied = __sync_add_and_fetch(&inodes_copied, XFS_INODES_PER_CHUNK);
 
 	if (show_progress)
 		print_progress("Copied %u of %u inodes (%u of %u AGs)",
-				inodes_copied, mp->m_sb.sb_icount, agno,
+				copied, mp->m_sb.sb_icount, agno,
 				mp->m_sb.sb_agcount);
 	rval = 1;
 pop_out:
@@ -2521,6 +2823,201 @@ done:
 	return !write_buf(iocur_top);
 }
 
+/*
+ * Scanning AGs in parallel.  Each thread takes the next AG to copy and
+ * writes the blocks it finds to a spill file of its own as a version 1
+ * stream.  The main thread feeds the spill files back through write_buf
+ * in AG order, so the dump comes out just as a serial scan would have
+ * written it (obfuscated names aside, as the threads share the random
+ * number sequence).
+ *
+ * AG 0 holds the root directory, and so the lost+found entry the
+ * obfuscation needs to know about.  It is copied by the main thread
+ * before any of the other threads start.
+ */
+struct ag_spill {
+	FILE		*f;
+	int		done;
+	int		ok;
+};
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	struct ag_spill	*ags;
+	xfs_agnumber_t	next_ag;	/* next AG to scan */
+	xfs_agnumber_t	next_merge;	/* next AG to write out */
+	int		abort;
+} md_scan;
+
+/* how far the scanning threads may get ahead of the writer */
+#define	SPILL_WINDOW	(2 * nr_threads)
+
+static void *
+scan_ag_thread(
+	void		*arg)
+{
+	struct ag_spill	*spill;
+	xfs_agnumber_t	agno;
+
+	dump_version = 1;
+	if (init_md1() < 0) {
+		pthread_mutex_lock(&md_scan.lock);
+		md_scan.abort = 1;
+		pthread_cond_broadcast(&md_scan.cond);
+		pthread_mutex_unlock(&md_scan.lock);
+		return NULL;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&md_scan.lock);
+		while (!md_scan.abort &&
+		       md_scan.next_ag < mp->m_sb.sb_agcount &&
+		       md_scan.next_ag >= md_scan.next_merge + SPILL_WINDOW)
+			pthread_cond_wait(&md_scan.cond, &md_scan.lock);
+		if (md_scan.abort || md_scan.next_ag >= mp->m_sb.sb_agcount) {
+			pthread_mutex_unlock(&md_scan.lock);
+			break;
+		}
+		agno = md_scan.next_ag++;
+		pthread_mutex_unlock(&md_scan.lock);
+
+		spill = &md_scan.ags[agno];
+		outf = tmpfile();
+		if (outf == NULL)
+			print_warning("cannot create spill file: %s",
+					strerror(errno));
+		else
+			spill->ok = scan_ag(agno) && write_index() == 0;
+
+		pthread_mutex_lock(&md_scan.lock);
+		spill->f = outf;
+		spill->done = 1;
+		pthread_cond_broadcast(&md_scan.cond);
+		pthread_mutex_unlock(&md_scan.lock);
+	}
+
+	free(metablock);
+	free(iocur_base);
+	return NULL;
+}
+
+/*
+ * Copy the blocks in a spill file into the dump.
+ */
+static int
+merge_spill(
+	FILE		*f)
+{
+	xfs_metablock_t	*mb;
+	__be64		*index;
+	char		*data;
+	int		count;
+	int		i;
+	int		rval = 0;
+
+	mb = calloc(BBSIZE + 1, BBSIZE);
+	if (mb == NULL) {
+		print_warning("memory allocation failure");
+		return 0;
+	}
+	index = (__be64 *)((char *)mb + sizeof(xfs_metablock_t));
+	data = (char *)mb + BBSIZE;
+
+	rewind(f);
+	while (fread(mb, BBSIZE, 1, f) == 1) {
+		count = be16_to_cpu(mb->mb_count);
+		if (count && fread(data, count << BBSHIFT, 1, f) != 1)
+			break;
+		for (i = 0; i < count; i++)
+			if (write_buf_segment(data + (i << BBSHIFT),
+					be64_to_cpu(index[i]), 1))
+				goto out;
+	}
+	if (ferror(f))
+		print_warning("error reading spill file: %s", strerror(errno));
+	else
+		rval = 1;
+out:
+	free(mb);
+	return rval;
+}
+
+static int
+scan_ags_parallel(void)
+{
+	pthread_t	*threads;
+	struct ag_spill	*spill;
+	xfs_agnumber_t	agno;
+	int		nthreads;
+	int		rval = 1;
+	int		err;
+	int		i;
+
+	if (!scan_ag(0))
+		return 0;
+
+	nthreads = min(nr_threads, (int)mp->m_sb.sb_agcount - 1);
+	threads = calloc(nthreads, sizeof(pthread_t));
+	md_scan.ags = calloc(mp->m_sb.sb_agcount, sizeof(struct ag_spill));
+	if (threads == NULL || md_scan.ags == NULL) {
+		print_warning("memory allocation failure");
+		free(threads);
+		free(md_scan.ags);
+		return 0;
+	}
+	pthread_mutex_init(&md_scan.lock, NULL);
+	pthread_cond_init(&md_scan.cond, NULL);
+	md_scan.next_ag = 1;
+	md_scan.next_merge = 1;
+	md_scan.abort = 0;
+
+	for (i = 0; i < nthreads; i++) {
+		err = pthread_create(&threads[i], NULL, scan_ag_thread, NULL);
+		if (err) {
+			print_warning("cannot create scan thread: %s",
+					strerror(err));
+			nthreads = i;
+			rval = 0;
+			break;
+		}
+	}
+
+	for (agno = 1; agno < mp->m_sb.sb_agcount && rval && nthreads;
+	     agno++) {
+		spill = &md_scan.ags[agno];
+		pthread_mutex_lock(&md_scan.lock);
+		while (!spill->done && !md_scan.abort)
+			pthread_cond_wait(&md_scan.cond, &md_scan.lock);
+		pthread_mutex_unlock(&md_scan.lock);
+		if (!spill->done)
+			rval = 0;
+		else if (spill->f)
+			rval = merge_spill(spill->f) && spill->ok;
+		else
+			rval = 0;
+
+		pthread_mutex_lock(&md_scan.lock);
+		md_scan.next_merge = agno + 1;
+		if (!rval)
+			md_scan.abort = 1;
+		pthread_cond_broadcast(&md_scan.cond);
+		pthread_mutex_unlock(&md_scan.lock);
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)
+		if (md_scan.ags[agno].f)
+			fclose(md_scan.ags[agno].f);
+	free(md_scan.ags);
+	free(threads);
+	pthread_mutex_destroy(&md_scan.lock);
+	pthread_cond_destroy(&md_scan.cond);
+	return rval;
+}
+
 static int
 metadump_f(
 	int 		argc,
@@ -2535,6 +3032,8 @@ metadump_f(
 	show_progress = 0;
 	show_warnings = 0;
 	stop_on_read_error = 0;
+	dump_version = 1;
+	nr_threads = 1;
 
 	if (mp->m_sb.sb_magicnum != XFS_SB_MAGIC) {
 		print_warning("bad superblock magic number %x, giving up",
@@ -2542,7 +3041,7 @@ metadump_f(
 		return 0;
 	}
 
-	while ((c = getopt(argc, argv, "aegm:ow")) != EOF) {
+	while ((c = getopt(argc, argv, "aegj:m:owz")) != EOF) {
 		switch (c) {
 			case 'a':
 				zero_stale_data = 0;
@@ -2553,6 +3052,14 @@ metadump_f(
 			case 'g':
 				show_progress = 1;
 				break;
+			case 'j':
+				nr_threads = (int)strtol(optarg, &p, 0);
+				if (*p != '\0' || nr_threads <= 0) {
+					print_warning("bad thread count %s",
+							optarg);
+					return 0;
+				}
+				break;
 			case 'm':
 				max_extent_size = (int)strtol(optarg, &p, 0);
 				if (*p != '\0' || max_extent_size <= 0) {
@@ -2567,6 +3074,9 @@ metadump_f(
 			case 'w':
 				show_warnings = 1;
 				break;
+			case 'z':
+				dump_version = 2;
+				break;
 			default:
 				print_warning("bad option for metadump command");
 				return 0;
@@ -2578,17 +3088,8 @@ metadump_f(
 		return 0;
 	}
 
-	metablock = (xfs_metablock_t *)calloc(BBSIZE + 1, BBSIZE);
-	if (metablock == NULL) {
-		print_warning("memory allocation failure");
+	if (dump_version == 1 && init_md1() < 0)
 		return 0;
-	}
-	metablock->mb_blocklog = BBSHIFT;
-	metablock->mb_magic = cpu_to_be32(XFS_MD_MAGIC);
-
-	block_index = (__be64 *)((char *)metablock + sizeof(xfs_metablock_t));
-	block_buffer = (char *)metablock + BBSIZE;
-	num_indicies = (BBSIZE - sizeof(xfs_metablock_t)) / sizeof(__be64);
 	cur_index = 0;
 	start_iocur_sp = iocur_sp;
 
@@ -2599,7 +3100,9 @@ metadump_f(
 			return 0;
 		}
 		outf = stdout;
+		dump_to_stdout = 1;
 	} else {
+		dump_to_stdout = 0;
 		outf = fopen(argv[optind], "wb");
 		if (outf == NULL) {
 			print_warning("cannot create dump file");
@@ -2609,11 +3112,18 @@ metadump_f(
 	}
 
 	exitcode = 0;
+	if (dump_version == 2)
+		exitcode = init_md2() < 0;
 
-	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
-		if (!scan_ag(agno)) {
-			exitcode = 1;
-			break;
+	if (nr_threads > 1 && mp->m_sb.sb_agcount > 1 && !exitcode) {
+		exitcode = !scan_ags_parallel();
+	} else {
+		for (agno = 0; agno < mp->m_sb.sb_agcount && !exitcode;
+		     agno++) {
+			if (!scan_ag(agno)) {
+				exitcode = 1;
+				break;
+			}
 		}
 	}
 
@@ -2626,11 +3136,13 @@ metadump_f(
 		exitcode = !copy_log();
 
 	/* write the remaining index */
-	if (!exitcode)
+	if (!exitcode && dump_version == 2)
+		exitcode = write_md2_index() < 0;
+	else if (!exitcode)
 		exitcode = write_index() < 0;
 
 	if (progress_since_warning)
-		fputc('\n', (outf == stdout) ? stderr : stdout);
+		fputc('\n', dump_to_stdout ? stderr : stdout);
 
 	if (outf != stdout)
 		fclose(outf);
@@ -2639,7 +3151,10 @@ metadump_f(
 	while (iocur_sp > start_iocur_sp)
 		pop_cur();
 
+	if (dump_version == 2)
+		free_md2();
 	free(metablock);
+	metablock = NULL;
 
 	return 0;
 }
@@ -34,6 +34,86 @@ int		dbprefix;
 static FILE	*log_file;
 static char	*log_file_name;
 
+/*
+ * Output of the calling thread is being saved up rather than printed.
+ */
+static __thread dbout_t	*dbout;
+
+static void
+dbout_append(
+	char		**bufp,
+	size_t		*lenp,
+	size_t		*sizep,
+	const char	*fmt,
+	va_list		ap)
+{
+	va_list		aq;
+	int		n;
+
+	va_copy(aq, ap);
+	n = vsnprintf(*bufp ? *bufp + *lenp : NULL,
+		      *bufp ? *sizep - *lenp : 0, fmt, aq);
+	va_end(aq);
+	if (n < 0)
+		return;
+	if (!*bufp || *lenp + n >= *sizep) {
+		*sizep = MAX(*sizep * 2, *lenp + n + 256);
+		*bufp = xrealloc(*bufp, *sizep);
+		vsnprintf(*bufp + *lenp, *sizep - *lenp, fmt, ap);
+	}
+	*lenp += n;
+}
+
+static void
+dbout_printf(
+	dbout_t		*o,
+	const char	*fmt,
+	...)
+{
+	va_list		ap;
+
+	va_start(ap, fmt);
+	dbout_append(&o->out, &o->outlen, &o->outsize, fmt, ap);
+	va_end(ap);
+}
+
+/*
+ * Save the calling thread's output in o until called again with NULL, so
+ * that work done by several threads can be printed in a fixed order.
+ */
+void
+dbprintf_capture(
+	dbout_t		*o)
+{
+	dbout = o;
+}
+
+/*
+ * Print and free output saved by dbprintf_capture.
+ */
+void
+dbprintf_flush(
+	dbout_t		*o)
+{
+	if (o->out && !seenint()) {
+		blockint();
+		fwrite(o->out, 1, o->outlen, stdout);
+		unblockint();
+	}
+	if (o->log && log_file)
+		fwrite(o->log, 1, o->loglen, log_file);
+	dbprintf_discard(o);
+}
+
+void
+dbprintf_discard(
+	dbout_t		*o)
+{
+	xfree(o->out);
+	xfree(o->log);
+	memset(o, 0, sizeof(*o));
+}
+
 int
 dbprintf(const char *fmt, ...)
 {
@@ -42,6 +122,22 @@ dbprintf(const char *fmt, ...)
 
 	if (seenint())
 		return 0;
+	if (dbout) {
+		i = dbout->outlen;
+		if (dbprefix)
+			dbout_printf(dbout, "%s: ", fsdevice);
+		va_start(ap, fmt);
+		dbout_append(&dbout->out, &dbout->outlen, &dbout->outsize,
+			     fmt, ap);
+		va_end(ap);
+		if (log_file) {
+			va_start(ap, fmt);
+			dbout_append(&dbout->log, &dbout->loglen,
+				     &dbout->logsize, fmt, ap);
+			va_end(ap);
+		}
+		return dbout->outlen - i;
+	}
 	va_start(ap, fmt);
 	blockint();
 	i = 0;
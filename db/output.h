@@ -16,8 +16,23 @@
  * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+/*
+ * Output saved up by a thread, see dbprintf_capture.
+ */
+typedef struct dbout {
+	char		*out;		/* for stdout */
+	size_t		outlen;
+	size_t		outsize;
+	char		*log;		/* for the log file */
+	size_t		loglen;
+	size_t		logsize;
+} dbout_t;
+
 extern int	dbprefix;
 
 extern int	dbprintf(const char *, ...);
 extern void	logprintf(const char *, ...);
+extern void	dbprintf_capture(dbout_t *o);
+extern void	dbprintf_flush(dbout_t *o);
+extern void	dbprintf_discard(dbout_t *o);
 extern void	output_init(void);
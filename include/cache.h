@@ -64,13 +64,42 @@ typedef void *cache_key_t;
 
 typedef void (*cache_walk_t)(struct cache_node *);
 typedef struct cache_node * (*cache_node_alloc_t)(cache_key_t);
-typedef void (*cache_node_flush_t)(struct cache_node *);
+typedef int (*cache_node_flush_t)(struct cache_node *);
 typedef void (*cache_node_relse_t)(struct cache_node *);
 typedef unsigned int (*cache_node_hash_t)(cache_key_t, unsigned int,
 					  unsigned int);
 typedef int (*cache_node_compare_t)(struct cache_node *, cache_key_t);
 typedef unsigned int (*cache_bulk_relse_t)(struct cache *, struct list_head *);
 
+/*
+ * Replacement policy.
+ *
+ * Unreferenced nodes of each priority are kept on one of CACHE_NR_QUEUES
+ * MRU lists. The policy picks the list a node goes on when its last
+ * reference is dropped (insert), the list a node that was used again while
+ * queued is moved to when the list is shaken (promote), and the list the
+ * shaker reclaims from first (victim). promote must never return a queue
+ * numbered higher than the one the node is on.
+ *
+ * The default "mru" policy only uses CACHE_QUEUE_MAIN. The "2q" policy puts
+ * new nodes on CACHE_QUEUE_PROBATION and only promotes them to the main
+ * list if they are used again before they are reclaimed, so a large scan
+ * of blocks that are touched once can't push the working set out.
+ */
+#define CACHE_QUEUE_MAIN	0
+#define CACHE_QUEUE_PROBATION	1
+#define CACHE_NR_QUEUES		2
+
+struct cache_policy {
+	const char	*name;
+	int		(*insert)(struct cache *, struct cache_node *);
+	int		(*promote)(struct cache *, struct cache_node *);
+	int		(*victim)(struct cache *, int);
+};
+
+extern struct cache_policy	cache_policy_mru;
+extern struct cache_policy	cache_policy_2q;
+
 struct cache_operations {
 	cache_node_hash_t	hash;
 	cache_node_alloc_t	alloc;
@@ -78,12 +107,17 @@ struct cache_operations {
 	cache_node_relse_t	relse;
 	cache_node_compare_t	compare;
 	cache_bulk_relse_t	bulkrelse;	/* optional */
+	struct cache_policy	*policy;	/* optional */
 };
 
+/*
+ * Hash chains are read-mostly: lookups only take ch_lock shared, it is held
+ * exclusive only to insert or remove nodes.
+ */
 struct cache_hash {
 	struct list_head	ch_list;	/* hash chain head */
 	unsigned int		ch_count;	/* hash chain length */
-	pthread_mutex_t		ch_mutex;	/* hash chain mutex */
+	pthread_rwlock_t	ch_lock;	/* hash chain lock */
 };
 
 struct cache_mru {
@@ -92,12 +126,27 @@ struct cache_mru {
 	pthread_mutex_t		cm_mutex;	/* MRU lock */
 };
 
+/*
+ * Nodes are put on an MRU list when their reference count first drops to
+ * zero and are left there while they are in use, so the hit path normally
+ * does not touch the MRU locks at all. cn_referenced gives recently used
+ * nodes a second chance when the list is shaken, and cn_mruidx and
+ * cn_mruq record which list the node is on in case its priority changes.
+ * cn_mruidx is -1 until the node has been put for the first time.
+ * cn_hits counts hits under cn_mutex, which the hit path holds anyway; they
+ * are added to the cache totals when the node leaves the cache or changes
+ * priority, see cache_hits().
+ */
 struct cache_node {
 	struct list_head	cn_hash;	/* hash chain */
 	struct list_head	cn_mru;		/* MRU chain */
 	unsigned int		cn_count;	/* reference count */
 	unsigned int		cn_hashidx;	/* hash chain index */
 	int			cn_priority;	/* priority, -1 = free list */
+	int			cn_mruidx;	/* MRU priority the node is on */
+	int			cn_mruq;	/* MRU queue the node is on */
+	int			cn_referenced;	/* used since last shake */
+	unsigned long		cn_hits;	/* hits not yet in c_hits */
 	pthread_mutex_t		cn_mutex;	/* node mutex */
 };
 
@@ -115,9 +164,13 @@ struct cache {
 	unsigned int		c_hashsize;	/* hash bucket count */
 	unsigned int		c_hashshift;	/* hash key shift */
 	struct cache_hash	*c_hash;	/* hash table buckets */
-	struct cache_mru	c_mrus[CACHE_MAX_PRIORITY + 1];
+	struct cache_policy	*c_policy;	/* replacement policy */
+	struct cache_mru	c_mrus[CACHE_NR_QUEUES][CACHE_MAX_PRIORITY + 1];
 	unsigned long long	c_misses;	/* cache misses */
-	unsigned long long	c_hits;		/* cache hits */
+	unsigned long long	c_hits;		/* hits of nodes since gone */
+	/* the same per priority, and misses by priority at first release */
+	unsigned long long	c_prio_hits[CACHE_MAX_PRIORITY + 1];
+	unsigned long long	c_prio_misses[CACHE_MAX_PRIORITY + 1];
 	unsigned int 		c_max;		/* max nodes ever used */
 };
 
@@ -125,7 +178,7 @@ struct cache *cache_init(int, unsigned int, struct cache_operations *);
 void cache_destroy(struct cache *);
 void cache_walk(struct cache *, cache_walk_t);
 void cache_purge(struct cache *);
-void cache_flush(struct cache *);
+int cache_flush(struct cache *);
 
 int cache_node_get(struct cache *, cache_key_t, struct cache_node **);
 void cache_node_put(struct cache *, struct cache_node *);
@@ -133,6 +186,8 @@ void cache_node_set_priority(struct cache *, struct cache_node *, int);
 int cache_node_get_priority(struct cache_node *);
 int cache_node_purge(struct cache *, cache_key_t, struct cache_node *);
 void cache_report(FILE *fp, const char *, struct cache *);
+unsigned long long cache_hits(struct cache *, unsigned long long *);
 int cache_overflowed(struct cache *);
+struct cache_policy *cache_policy_find(const char *);
 
 #endif	/* __CACHE_H__ */
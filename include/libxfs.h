@@ -344,9 +344,11 @@ enum xfs_buf_flags_t {	/* b_flags bits */
 #define XFS_BUF_SIZE(bp)		((bp)->b_bcount)
 #define XFS_BUF_COUNT(bp)		((bp)->b_bcount)
 #define XFS_BUF_TARGET(bp)		((bp)->b_dev)
+/* like the kernel's xfs_buf_associate_memory(), evaluates to 0 */
 #define XFS_BUF_SET_PTR(bp,p,cnt)	({	\
 	(bp)->b_addr = (char *)(p);		\
 	XFS_BUF_SET_COUNT(bp,cnt);		\
+	0;					\
 })
 
 #define XFS_BUF_SET_ADDR(bp,blk)	((bp)->b_bn = (blk))
@@ -440,7 +442,7 @@ extern void	libxfs_readbuf_verify(struct xfs_buf *bp,
 			const struct xfs_buf_ops *ops);
 extern xfs_buf_t *libxfs_getsb(xfs_mount_t *, int);
 extern void	libxfs_bcache_purge(void);
-extern void	libxfs_bcache_flush(void);
+extern int	libxfs_bcache_flush(void);
 extern void	libxfs_purgebuf(xfs_buf_t *);
 extern int	libxfs_bcache_overflowed(void);
 extern int	libxfs_bcache_usage(void);
@@ -454,6 +456,20 @@ extern int	libxfs_writebufr(struct xfs_buf *);
 extern int	libxfs_readbufr(struct xfs_buftarg *, xfs_daddr_t, xfs_buf_t *, int, int);
 extern int	libxfs_readbufr_map(struct xfs_buftarg *, struct xfs_buf *, int);
 
+/*
+ * Reads and writes done by the buffer I/O routines, both in total and by
+ * the calling thread alone.
+ */
+struct libxfs_iostats {
+	unsigned long long	reads;
+	unsigned long long	read_bytes;
+	unsigned long long	writes;
+	unsigned long long	write_bytes;
+};
+
+extern void	libxfs_iostats(struct libxfs_iostats *,
+			       struct libxfs_iostats *);
+
 extern int libxfs_bhash_size;
 
 #define LIBXFS_BREAD	0x1
@@ -743,6 +759,9 @@ void xfs_bmbt_disk_get_all(xfs_bmbt_rec_t *r, xfs_bmbt_irec_t *s);
 #define libxfs_dir2_data_use_free	xfs_dir2_data_use_free
 #define libxfs_dir2_shrink_inode	xfs_dir2_shrink_inode
 
+/* xfs_ialloc.h */
+#define libxfs_imap			xfs_imap
+
 /* xfs_inode.h */
 #define libxfs_dinode_from_disk		xfs_dinode_from_disk
 #define libxfs_dinode_to_disk		xfs_dinode_to_disk
@@ -751,6 +770,7 @@ void	xfs_dinode_from_disk(struct xfs_icdinode *,
 #define libxfs_dinode_calc_crc		xfs_dinode_calc_crc
 #define libxfs_idata_realloc		xfs_idata_realloc
 #define libxfs_idestroy_fork		xfs_idestroy_fork
+#define libxfs_imap_to_bp		xfs_imap_to_bp
 
 #define libxfs_dinode_verify		xfs_dinode_verify
 bool xfs_dinode_verify(struct xfs_mount *mp, xfs_ino_t ino,
@@ -45,6 +45,9 @@ struct xlog {
 	uint		l_sectbb_mask;  /* sector size (in BBs)
 					 * alignment mask */
 	int		l_sectBBsize;   /* size of log sector in 512 byte chunks */
+	struct xlog_replay *l_replay;	/* replay state, see xlog_recover_replay */
+	xfs_lsn_t	l_recover_start;/* if set, only recover transactions */
+	xfs_lsn_t	l_recover_end;	/* starting in this range of LSNs */
 };
 
 #include <xfs/xfs_log_recover.h>
@@ -66,6 +69,24 @@ struct xlog {
 #define XFS_MOUNT_WAS_CLEAN		0x1
 #define unlikely(x)			(x)
 
+/*
+ * Compare two LSNs: cycle numbers first, then block numbers within the
+ * same cycle.
+ */
+static inline int
+_lsn_cmp(xfs_lsn_t lsn1, xfs_lsn_t lsn2)
+{
+	if (CYCLE_LSN(lsn1) != CYCLE_LSN(lsn2))
+		return (CYCLE_LSN(lsn1)<CYCLE_LSN(lsn2))? -999 : 999;
+
+	if (BLOCK_LSN(lsn1) != BLOCK_LSN(lsn2))
+		return (BLOCK_LSN(lsn1)<BLOCK_LSN(lsn2))? -999 : 999;
+
+	return 0;
+}
+
+#define	XFS_LSN_CMP(x,y) _lsn_cmp(x,y)
+
 extern void xlog_warn(char *fmt,...);
 extern void xlog_exit(char *fmt,...);
 extern void xlog_panic(char *fmt,...);
@@ -105,10 +126,18 @@ extern int	xlog_print_find_oldest(struct xlog *log, xfs_daddr_t *last_blk);
 extern void	xlog_recover_print_trans_head(xlog_recover_t *tr);
 extern void	xlog_recover_print_trans(xlog_recover_t *trans,
 				struct list_head *itemq, int print);
+extern __le32	xlog_cksum(struct xlog *log, struct xlog_rec_header *rhead,
+				char *dp, int size);
 extern int	xlog_do_recovery_pass(struct xlog *log, xfs_daddr_t head_blk,
 				xfs_daddr_t tail_blk, int pass);
 extern int	xlog_recover_do_trans(struct xlog *log, xlog_recover_t *trans,
 				int pass);
+extern int	xlog_recover_replay(struct xlog *log, xfs_daddr_t head_blk,
+				xfs_daddr_t tail_blk, int nthreads);
+extern int	xlog_recover_replay_trans(struct xlog *log,
+				xlog_recover_t *trans, int pass);
+extern xfs_inode_log_format_t *
+	xfs_inode_item_format_convert(char *, uint, xfs_inode_log_format_t *);
 extern int	xlog_header_check_recover(xfs_mount_t *mp, 
 				xlog_rec_header_t *head);
 extern int	xlog_header_check_mount(xfs_mount_t *mp,
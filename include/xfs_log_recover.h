@@ -22,11 +22,16 @@
  * Macros, structures, prototypes for internal log manager use.
  */
 
-#define XLOG_RHASH_BITS  4
-#define XLOG_RHASH_SIZE	16
-#define XLOG_RHASH_SHIFT 2
-#define XLOG_RHASH(tid)	\
-	((((__uint32_t)tid)>>XLOG_RHASH_SHIFT) & (XLOG_RHASH_SIZE-1))
+/*
+ * The table of in-flight transactions starts out with 1 << XLOG_RHASH_BITS
+ * buckets and doubles whenever it holds more than XLOG_RHASH_LOAD
+ * transactions per bucket, up to 1 << XLOG_RHASH_MAX_BITS buckets.
+ */
+#define XLOG_RHASH_BITS		4
+#define XLOG_RHASH_MAX_BITS	20
+#define XLOG_RHASH_LOAD		2
+#define XLOG_RHASH(tid, bits)	\
+	((((__uint32_t)(tid)) * 0x9e370001U) >> (32 - (bits)))
 
 #define XLOG_MAX_REGIONS_IN_ITEM   (XFS_MAX_BLOCKSIZE / XFS_BLF_CHUNK / 2 + 1)
 
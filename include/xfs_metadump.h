@@ -29,4 +29,67 @@ typedef struct xfs_metablock {
 	/* followed by an array of xfs_daddr_t */
 } xfs_metablock_t;
 
+/*
+ * Version 2 dumps start with an xfs_metadump_header_t, followed by a
+ * sequence of chunks.  Each chunk is an xfs_metadump_chunk_t header and
+ * mc_len bytes of data which, once uncompressed with the mc_compress
+ * method, is an array of mc_count __be64 daddrs followed by the mc_count
+ * basic blocks they belong to.  mh_compress is the method the dump was
+ * written with; chunks that don't shrink are stored as they are.  A chunk
+ * with a zero count ends the dump, so the chunks can be restored one after
+ * the other from a pipe.
+ *
+ * The end marker is followed by the index: an xfs_metadump_chunkrec_t for
+ * each chunk, then xfs_metadump_extent_t records for the daddr ranges held
+ * in the chunks sorted by daddr, and finally an xfs_metadump_trailer_t as
+ * the last thing in the file.  With a seekable dump the index lets chunks
+ * be decoded in parallel, or single blocks be found without reading the
+ * rest of the dump.
+ */
+#define	XFS_MD2_MAGIC		0x584d4432	/* 'XMD2' */
+#define	XFS_MD2_CHUNK_MAGIC	0x584d4443	/* 'XMDC' */
+#define	XFS_MD2_INDEX_MAGIC	0x584d4449	/* 'XMDI' */
+
+#define	XFS_MD2_COMPRESS_NONE	0
+#define	XFS_MD2_COMPRESS_ZLIB	1
+
+#define	XFS_MD2_CHUNK_BLOCKS	2048		/* default basic blocks/chunk */
+#define	XFS_MD2_MAX_CHUNK_BLOCKS 65536
+
+typedef struct xfs_metadump_header {
+	__be32		mh_magic;
+	__be32		mh_compress;	/* XFS_MD2_COMPRESS_* */
+	__be32		mh_chunk_blocks; /* most basic blocks in a chunk */
+	__be32		mh_reserved;
+} xfs_metadump_header_t;
+
+typedef struct xfs_metadump_chunk {
+	__be32		mc_magic;
+	__be32		mc_count;	/* basic blocks in the chunk */
+	__be32		mc_len;		/* bytes of chunk data following */
+	__be32		mc_compress;	/* NONE if it didn't compress */
+} xfs_metadump_chunk_t;
+
+typedef struct xfs_metadump_chunkrec {
+	__be64		mr_offset;	/* file offset of the chunk header */
+	__be32		mr_count;
+	__be32		mr_len;
+} xfs_metadump_chunkrec_t;
+
+typedef struct xfs_metadump_extent {
+	__be64		me_daddr;	/* first basic block */
+	__be32		me_len;		/* basic blocks in the range */
+	__be32		me_chunk;	/* chunk holding the range */
+	__be32		me_block;	/* where in the chunk it starts */
+	__be32		me_reserved;
+} xfs_metadump_extent_t;
+
+typedef struct xfs_metadump_trailer {
+	__be64		mt_index;	/* file offset of the index */
+	__be32		mt_nchunks;
+	__be32		mt_nextents;
+	__be32		mt_reserved;
+	__be32		mt_magic;	/* XFS_MD2_INDEX_MAGIC */
+} xfs_metadump_trailer_t;
+
 #endif /* _XFS_METADUMP_H_ */
@@ -37,6 +37,93 @@
 
 static unsigned int cache_generic_bulkrelse(struct cache *, struct list_head *);
 
+/*
+ * Plain MRU: one list per priority, recently used nodes get a second
+ * chance when the list is shaken.
+ */
+static int
+cache_queue_main(
+	struct cache *		cache,
+	struct cache_node *	node)
+{
+	return CACHE_QUEUE_MAIN;
+}
+
+static int
+cache_mru_victim(
+	struct cache *		cache,
+	int			priority)
+{
+	return CACHE_QUEUE_MAIN;
+}
+
+struct cache_policy cache_policy_mru = {
+	.name		= "mru",
+	.insert		= cache_queue_main,
+	.promote	= cache_queue_main,
+	.victim		= cache_mru_victim,
+};
+
+/*
+ * Simplified 2Q: nodes start out on the probation (A1) list and are only
+ * moved to the main (Am) list if they are used again before the shaker
+ * gets to them. The probation list is reclaimed first as long as it holds
+ * more than a quarter of the nodes at that priority. We have no way of
+ * remembering keys that have already been reclaimed, so there is no ghost
+ * (A1out) list; a second use while still cached is what gets a node
+ * promoted.
+ */
+#define CACHE_2Q_KIN_SHIFT	2
+
+static int
+cache_2q_insert(
+	struct cache *		cache,
+	struct cache_node *	node)
+{
+	if (node->cn_mruidx < 0)
+		return CACHE_QUEUE_PROBATION;
+	return node->cn_mruq;
+}
+
+static int
+cache_2q_victim(
+	struct cache *		cache,
+	int			priority)
+{
+	unsigned int		a1, am;
+
+	a1 = cache->c_mrus[CACHE_QUEUE_PROBATION][priority].cm_count;
+	am = cache->c_mrus[CACHE_QUEUE_MAIN][priority].cm_count;
+	if (a1 > (a1 + am) >> CACHE_2Q_KIN_SHIFT)
+		return CACHE_QUEUE_PROBATION;
+	return CACHE_QUEUE_MAIN;
+}
+
+struct cache_policy cache_policy_2q = {
+	.name		= "2q",
+	.insert		= cache_2q_insert,
+	.promote	= cache_queue_main,
+	.victim		= cache_2q_victim,
+};
+
+static struct cache_policy *cache_policies[] = {
+	&cache_policy_mru,
+	&cache_policy_2q,
+	NULL
+};
+
+struct cache_policy *
+cache_policy_find(
+	const char *		name)
+{
+	int			i;
+
+	for (i = 0; cache_policies[i]; i++)
+		if (!strcmp(cache_policies[i]->name, name))
+			return cache_policies[i];
+	return NULL;
+}
+
 struct cache *
 cache_init(
 	int			flags,
@@ -44,11 +131,11 @@ cache_init(
 	struct cache_operations	*cache_operations)
 {
 	struct cache *		cache;
-	unsigned int		i, maxcount;
+	unsigned int		i, q, maxcount;
 
 	maxcount = hashsize * HASH_CACHE_RATIO;
 
-	if (!(cache = malloc(sizeof(struct cache))))
+	if (!(cache = calloc(1, sizeof(struct cache))))
 		return NULL;
 	if (!(cache->c_hash = calloc(hashsize, sizeof(struct cache_hash)))) {
 		free(cache);
@@ -70,18 +157,22 @@ cache_init(
 	cache->compare = cache_operations->compare;
 	cache->bulkrelse = cache_operations->bulkrelse ?
 		cache_operations->bulkrelse : cache_generic_bulkrelse;
+	cache->c_policy = cache_operations->policy ?
+		cache_operations->policy : &cache_policy_mru;
 	pthread_mutex_init(&cache->c_mutex, NULL);
 
 	for (i = 0; i < hashsize; i++) {
 		list_head_init(&cache->c_hash[i].ch_list);
 		cache->c_hash[i].ch_count = 0;
-		pthread_mutex_init(&cache->c_hash[i].ch_mutex, NULL);
+		pthread_rwlock_init(&cache->c_hash[i].ch_lock, NULL);
 	}
 
-	for (i = 0; i <= CACHE_MAX_PRIORITY; i++) {
-		list_head_init(&cache->c_mrus[i].cm_list);
-		cache->c_mrus[i].cm_count = 0;
-		pthread_mutex_init(&cache->c_mrus[i].cm_mutex, NULL);
+	for (q = 0; q < CACHE_NR_QUEUES; q++) {
+		for (i = 0; i <= CACHE_MAX_PRIORITY; i++) {
+			list_head_init(&cache->c_mrus[q][i].cm_list);
+			cache->c_mrus[q][i].cm_count = 0;
+			pthread_mutex_init(&cache->c_mrus[q][i].cm_mutex, NULL);
+		}
 	}
 	return cache;
 }
@@ -111,10 +202,10 @@ cache_walk(
 	for (i = 0; i < cache->c_hashsize; i++) {
 		hash = &cache->c_hash[i];
 		head = &hash->ch_list;
-		pthread_mutex_lock(&hash->ch_mutex);
+		pthread_rwlock_rdlock(&hash->ch_lock);
 		for (pos = head->next; pos != head; pos = pos->next)
 			visit((struct cache_node *)pos);
-		pthread_mutex_unlock(&hash->ch_mutex);
+		pthread_rwlock_unlock(&hash->ch_lock);
 	}
 }
 
@@ -144,16 +235,18 @@ void
 cache_destroy(
 	struct cache *		cache)
 {
-	unsigned int		i;
+	unsigned int		i, q;
 
 	cache_destroy_check(cache);
 	for (i = 0; i < cache->c_hashsize; i++) {
 		list_head_destroy(&cache->c_hash[i].ch_list);
-		pthread_mutex_destroy(&cache->c_hash[i].ch_mutex);
+		pthread_rwlock_destroy(&cache->c_hash[i].ch_lock);
 	}
-	for (i = 0; i <= CACHE_MAX_PRIORITY; i++) {
-		list_head_destroy(&cache->c_mrus[i].cm_list);
-		pthread_mutex_destroy(&cache->c_mrus[i].cm_mutex);
+	for (q = 0; q < CACHE_NR_QUEUES; q++) {
+		for (i = 0; i <= CACHE_MAX_PRIORITY; i++) {
+			list_head_destroy(&cache->c_mrus[q][i].cm_list);
+			pthread_mutex_destroy(&cache->c_mrus[q][i].cm_mutex);
+		}
 	}
 	pthread_mutex_destroy(&cache->c_mutex);
 	free(cache->c_hash);
@@ -180,32 +273,121 @@ cache_generic_bulkrelse(
 }
 
 /*
- * We've hit the limit on cache size, so we need to start reclaiming
- * nodes we've used. The MRU specified by the priority is shaken.
- * Returns new priority at end of the call (in case we call again).
+ * Drop the reference cache_shake_mru() pinned a victim with. Called with
+ * the node locked.
+ */
+static void
+cache_shake_unpin(
+	struct cache *		cache,
+	struct cache_node *	node)
+{
+	if (node->cn_count > 1 || !list_empty(&node->cn_mru)) {
+		node->cn_count--;
+		pthread_mutex_unlock(&node->cn_mutex);
+		return;
+	}
+	/* another shaker took it off its MRU, put it back */
+	pthread_mutex_unlock(&node->cn_mutex);
+	cache_node_put(cache, node);
+}
+
+/*
+ * Write back a victim pinned by cache_shake_mru() and take it out of the
+ * cache, unless it was looked up again meanwhile or couldn't be written.
+ * It is written while still hashed and locked: once it is off the hash
+ * chain a lookup misses, and would read the old contents from disk if
+ * bulkrelse hadn't written the new ones yet. A node that can't be written
+ * stays in the cache for the final flush. Returns 1 if the node was moved
+ * to the release list.
+ */
+/*
+ * Add the hits counted in a node to the cache totals, before it leaves the
+ * cache or changes priority.  Called with the node mutex held.
+ */
+static void
+cache_node_fold_hits(
+	struct cache *		cache,
+	struct cache_node *	node)
+{
+	if (!node->cn_hits)
+		return;
+	__sync_fetch_and_add(&cache->c_hits, node->cn_hits);
+	__sync_fetch_and_add(&cache->c_prio_hits[node->cn_priority],
+			     node->cn_hits);
+	node->cn_hits = 0;
+}
+
+static int
+cache_shake_victim(
+	struct cache *		cache,
+	struct cache_node *	node,
+	struct list_head *	temp)
+{
+	struct cache_hash *	hash;
+	struct cache_mru *	mru;
+
+	pthread_mutex_lock(&node->cn_mutex);
+	hash = cache->c_hash + node->cn_hashidx;
+	if (node->cn_count > 1 ||
+	    (cache->flush && cache->flush(node)) ||
+	    pthread_rwlock_trywrlock(&hash->ch_lock) != 0) {
+		cache_shake_unpin(cache, node);
+		return 0;
+	}
+	if (!list_empty(&node->cn_mru)) {
+		mru = &cache->c_mrus[node->cn_mruq][node->cn_mruidx];
+		pthread_mutex_lock(&mru->cm_mutex);
+		list_del_init(&node->cn_mru);
+		mru->cm_count--;
+		pthread_mutex_unlock(&mru->cm_mutex);
+	}
+	cache_node_fold_hits(cache, node);
+	node->cn_count = 0;
+	node->cn_priority = -1;
+	list_del_init(&node->cn_hash);
+	hash->ch_count--;
+	pthread_rwlock_unlock(&hash->ch_lock);
+	pthread_mutex_unlock(&node->cn_mutex);
+
+	list_add(&node->cn_mru, temp);
+	return 1;
+}
+
+/*
+ * Shake one MRU list. Nodes that are still referenced are simply taken off
+ * the list; they go back on when the last reference is dropped. Nodes that
+ * have been used since the last shake get a second chance: they are moved
+ * back to the head of the list, or to the list the policy promotes them
+ * to, unless we are purging everything. Returns the number of nodes freed.
  */
 static unsigned int
-cache_shake(
+cache_shake_mru(
 	struct cache *		cache,
 	unsigned int		priority,
-	int			all)
+	int			queue,
+	int			all,
+	unsigned int *		rotatedp)
 {
 	struct cache_mru	*mru;
+	struct cache_mru	*pmru;
 	struct cache_hash *	hash;
 	struct list_head	temp;
+	struct list_head	rotate;
 	struct list_head *	head;
 	struct list_head *	pos;
 	struct list_head *	n;
 	struct cache_node *	node;
+	struct cache_node *	victims[CACHE_SHAKE_COUNT];
+	unsigned int		nvictims;
 	unsigned int		count;
+	unsigned int		rotated;
+	unsigned int		i;
+	int			pq;
 
-	ASSERT(priority <= CACHE_MAX_PRIORITY);
-	if (priority > CACHE_MAX_PRIORITY)
-		priority = 0;
-
-	mru = &cache->c_mrus[priority];
-	count = 0;
+	mru = &cache->c_mrus[queue][priority];
+	count = rotated = nvictims = 0;
 	list_head_init(&temp);
+	list_head_init(&rotate);
 	head = &mru->cm_list;
 
 	pthread_mutex_lock(&mru->cm_mutex);
@@ -216,28 +398,75 @@ cache_shake(
 		if (pthread_mutex_trylock(&node->cn_mutex) != 0)
 			continue;
 
+		ASSERT(node->cn_mruidx == priority);
+		ASSERT(node->cn_mruq == queue);
+		if (node->cn_count > 0) {
+			list_del_init(&node->cn_mru);
+			mru->cm_count--;
+			pthread_mutex_unlock(&node->cn_mutex);
+			continue;
+		}
+		if (node->cn_referenced && !all) {
+			node->cn_referenced = 0;
+			pq = cache->c_policy->promote(cache, node);
+			ASSERT(pq <= queue);
+			if (pq == queue) {
+				list_move(&node->cn_mru, &rotate);
+			} else {
+				/* lower queues are always locked second */
+				pmru = &cache->c_mrus[pq][priority];
+				pthread_mutex_lock(&pmru->cm_mutex);
+				list_move(&node->cn_mru, &pmru->cm_list);
+				pmru->cm_count++;
+				mru->cm_count--;
+				node->cn_mruq = pq;
+				pthread_mutex_unlock(&pmru->cm_mutex);
+			}
+			pthread_mutex_unlock(&node->cn_mutex);
+			rotated++;
+			continue;
+		}
+
+		/*
+		 * Victims may be dirty, and writing them back with the MRU
+		 * locked would stall everyone else using it, so pin them
+		 * and deal with them once it is unlocked. A purge runs with
+		 * nothing else using the cache and releases all nodes, so
+		 * leave the writeback to bulkrelse there.
+		 */
+		if (!all) {
+			node->cn_count++;
+			pthread_mutex_unlock(&node->cn_mutex);
+			victims[nvictims++] = node;
+			if (nvictims == CACHE_SHAKE_COUNT)
+				break;
+			continue;
+		}
+
 		hash = cache->c_hash + node->cn_hashidx;
-		if (pthread_mutex_trylock(&hash->ch_mutex) != 0) {
+		if (pthread_rwlock_trywrlock(&hash->ch_lock) != 0) {
 			pthread_mutex_unlock(&node->cn_mutex);
 			continue;
 		}
-		ASSERT(node->cn_count == 0);
 		ASSERT(node->cn_priority == priority);
+		cache_node_fold_hits(cache, node);
 		node->cn_priority = -1;
 
 		list_move(&node->cn_mru, &temp);
 		list_del_init(&node->cn_hash);
 		hash->ch_count--;
 		mru->cm_count--;
-		pthread_mutex_unlock(&hash->ch_mutex);
+		pthread_rwlock_unlock(&hash->ch_lock);
 		pthread_mutex_unlock(&node->cn_mutex);
 
 		count++;
-		if (!all && count == CACHE_SHAKE_COUNT)
-			break;
 	}
+	list_splice(&rotate, head);
 	pthread_mutex_unlock(&mru->cm_mutex);
 
+	for (i = 0; i < nvictims; i++)
+		count += cache_shake_victim(cache, victims[i], &temp);
+
 	if (count > 0) {
 		cache->bulkrelse(cache, &temp);
 
@@ -246,7 +475,52 @@ cache_shake(
 		pthread_mutex_unlock(&cache->c_mutex);
 	}
 
-	return (count == CACHE_SHAKE_COUNT) ? priority : ++priority;
+	*rotatedp = rotated;
+	return count;
+}
+
+/*
+ * We've hit the limit on cache size, so we need to start reclaiming
+ * nodes we've used. The MRUs specified by the priority are shaken, the
+ * one the replacement policy picks first. Returns new priority at end of
+ * the call (in case we call again).
+ */
+static unsigned int
+cache_shake(
+	struct cache *		cache,
+	unsigned int		priority,
+	int			all)
+{
+	unsigned int		count;
+	unsigned int		rotated;
+	int			queue;
+	int			q;
+
+	ASSERT(priority <= CACHE_MAX_PRIORITY);
+	if (priority > CACHE_MAX_PRIORITY)
+		priority = 0;
+
+	if (all) {
+		for (q = 0; q < CACHE_NR_QUEUES; q++)
+			cache_shake_mru(cache, priority, q, 1, &rotated);
+		return ++priority;
+	}
+
+	queue = cache->c_policy->victim(cache, priority);
+	count = cache_shake_mru(cache, priority, queue, 0, &rotated);
+	for (q = 0; q < CACHE_NR_QUEUES && !count && !rotated; q++) {
+		if (q != queue)
+			count = cache_shake_mru(cache, priority, q, 0,
+						&rotated);
+	}
+
+	/*
+	 * If we only gave nodes a second chance, shake this priority again
+	 * before moving on to higher priorities or growing the cache.
+	 */
+	if (count == CACHE_SHAKE_COUNT || rotated)
+		return priority;
+	return ++priority;
 }
 
 /*
@@ -283,6 +557,10 @@ cache_node_allocate(
 	list_head_init(&node->cn_mru);
 	node->cn_count = 1;
 	node->cn_priority = 0;
+	node->cn_mruidx = -1;
+	node->cn_mruq = CACHE_QUEUE_MAIN;
+	node->cn_referenced = 0;
+	node->cn_hits = 0;
 	return node;
 }
 
@@ -308,11 +586,14 @@ __cache_node_purge(
 		pthread_mutex_unlock(&node->cn_mutex);
 		return count;
 	}
-	mru = &cache->c_mrus[node->cn_priority];
-	pthread_mutex_lock(&mru->cm_mutex);
-	list_del_init(&node->cn_mru);
-	mru->cm_count--;
-	pthread_mutex_unlock(&mru->cm_mutex);
+	if (!list_empty(&node->cn_mru)) {
+		mru = &cache->c_mrus[node->cn_mruq][node->cn_mruidx];
+		pthread_mutex_lock(&mru->cm_mutex);
+		list_del_init(&node->cn_mru);
+		mru->cm_count--;
+		pthread_mutex_unlock(&mru->cm_mutex);
+	}
+	cache_node_fold_hits(cache, node);
 
 	pthread_mutex_unlock(&node->cn_mutex);
 	pthread_mutex_destroy(&node->cn_mutex);
@@ -328,6 +609,10 @@ __cache_node_purge(
  * cache beyond the requested maximum size (shrink it if it would).
  * Returns one if hit in cache, otherwise zero.  A node is _always_
  * returned, however.
+ *
+ * The hash chain is only locked shared for the lookup, so lookups of
+ * different nodes on the same chain don't serialise. If we find a node
+ * that has to be purged we retry with the chain locked exclusive.
  */
 int
 cache_node_get(
@@ -337,20 +622,23 @@ cache_node_get(
 {
 	struct cache_node *	node = NULL;
 	struct cache_hash *	hash;
-	struct cache_mru *	mru;
 	struct list_head *	head;
 	struct list_head *	pos;
 	struct list_head *	n;
 	unsigned int		hashidx;
 	int			priority = 0;
 	int			purged = 0;
+	int			exclusive = 0;
 
 	hashidx = cache->hash(key, cache->c_hashsize, cache->c_hashshift);
 	hash = cache->c_hash + hashidx;
 	head = &hash->ch_list;
 
 	for (;;) {
-		pthread_mutex_lock(&hash->ch_mutex);
+		if (exclusive)
+			pthread_rwlock_wrlock(&hash->ch_lock);
+		else
+			pthread_rwlock_rdlock(&hash->ch_lock);
 		for (pos = head->next, n = pos->next; pos != head;
 						pos = n, n = pos->next) {
 			int result;
@@ -361,10 +649,15 @@ cache_node_get(
 			case CACHE_HIT:
 				break;
 			case CACHE_PURGE:
-				if ((cache->c_flags & CACHE_MISCOMPARE_PURGE) &&
-				    !__cache_node_purge(cache, node)) {
-					purged++;
-					hash->ch_count--;
+				if (cache->c_flags & CACHE_MISCOMPARE_PURGE) {
+					if (!exclusive) {
+						exclusive = 1;
+						goto retry;
+					}
+					if (!__cache_node_purge(cache, node)) {
+						purged++;
+						hash->ch_count--;
+					}
 				}
 				/* FALL THROUGH */
 			case CACHE_MISS:
@@ -372,35 +665,22 @@ cache_node_get(
 			}
 
 			/*
-			 * node found, bump node's reference count, remove it
-			 * from its MRU list, and update stats.
+			 * node found, bump node's reference count and hit
+			 * count. The node stays on its MRU list, if any;
+			 * cache_node_put and cache_shake sort that out.
 			 */
 			pthread_mutex_lock(&node->cn_mutex);
-
-			if (node->cn_count == 0) {
-				ASSERT(node->cn_priority >= 0);
-				ASSERT(!list_empty(&node->cn_mru));
-				mru = &cache->c_mrus[node->cn_priority];
-				pthread_mutex_lock(&mru->cm_mutex);
-				mru->cm_count--;
-				list_del_init(&node->cn_mru);
-				pthread_mutex_unlock(&mru->cm_mutex);
-			}
 			node->cn_count++;
-
+			node->cn_hits++;
 			pthread_mutex_unlock(&node->cn_mutex);
-			pthread_mutex_unlock(&hash->ch_mutex);
-
-			pthread_mutex_lock(&cache->c_mutex);
-			cache->c_hits++;
-			pthread_mutex_unlock(&cache->c_mutex);
+			pthread_rwlock_unlock(&hash->ch_lock);
 
 			*nodep = node;
 			return 0;
 next_object:
 			continue;	/* what the hell, gcc? */
 		}
-		pthread_mutex_unlock(&hash->ch_mutex);
+		pthread_rwlock_unlock(&hash->ch_lock);
 		/*
 		 * not found, allocate a new entry
 		 */
@@ -417,15 +697,18 @@ next_object:
 			priority = 0;
 			cache_expand(cache);
 		}
+		continue;
+retry:
+		pthread_rwlock_unlock(&hash->ch_lock);
 	}
 
 	node->cn_hashidx = hashidx;
 
 	/* add new node to appropriate hash */
-	pthread_mutex_lock(&hash->ch_mutex);
+	pthread_rwlock_wrlock(&hash->ch_lock);
 	hash->ch_count++;
 	list_add(&node->cn_hash, &hash->ch_list);
-	pthread_mutex_unlock(&hash->ch_mutex);
+	pthread_rwlock_unlock(&hash->ch_lock);
 
 	if (purged) {
 		pthread_mutex_lock(&cache->c_mutex);
@@ -437,12 +720,19 @@ next_object:
 	return 1;
 }
 
+/*
+ * Drop a reference to a node. When the last reference goes away the node
+ * has to be on an MRU list matching its priority; most of the time it
+ * already is, and then all we do is mark it as recently used. Otherwise
+ * the replacement policy decides which of the lists it goes on.
+ */
 void
 cache_node_put(
 	struct cache *		cache,
 	struct cache_node *	node)
 {
 	struct cache_mru *	mru;
+	int			queue;
 
 	pthread_mutex_lock(&node->cn_mutex);
 #ifdef CACHE_DEBUG
@@ -451,23 +741,40 @@ cache_node_put(
 				__FUNCTION__, node->cn_count, node);
 		cache_abort();
 	}
-	if (!list_empty(&node->cn_mru)) {
-		fprintf(stderr, "%s: node put on node (%p) in MRU list\n",
-				__FUNCTION__, node);
-		cache_abort();
-	}
 #endif
 	node->cn_count--;
 
 	if (node->cn_count == 0) {
+		if (!list_empty(&node->cn_mru)) {
+			if (node->cn_mruidx == node->cn_priority) {
+				node->cn_referenced = 1;
+				goto out_unlock;
+			}
+			/* priority changed, move to the right MRU */
+			mru = &cache->c_mrus[node->cn_mruq][node->cn_mruidx];
+			pthread_mutex_lock(&mru->cm_mutex);
+			mru->cm_count--;
+			list_del_init(&node->cn_mru);
+			pthread_mutex_unlock(&mru->cm_mutex);
+		} else if (node->cn_mruidx < 0) {
+			/* first release of a node we missed on */
+			__sync_fetch_and_add(
+				&cache->c_prio_misses[node->cn_priority], 1);
+		}
+
 		/* add unreferenced node to appropriate MRU for shaker */
-		mru = &cache->c_mrus[node->cn_priority];
+		queue = cache->c_policy->insert(cache, node);
+		mru = &cache->c_mrus[queue][node->cn_priority];
 		pthread_mutex_lock(&mru->cm_mutex);
 		mru->cm_count++;
 		list_add(&node->cn_mru, &mru->cm_list);
+		node->cn_mruidx = node->cn_priority;
+		node->cn_mruq = queue;
+		node->cn_referenced = 0;
 		pthread_mutex_unlock(&mru->cm_mutex);
 	}
 
+out_unlock:
 	pthread_mutex_unlock(&node->cn_mutex);
 }
 
@@ -484,6 +791,8 @@ cache_node_set_priority(
 
 	pthread_mutex_lock(&node->cn_mutex);
 	ASSERT(node->cn_count > 0);
+	if (node->cn_priority != priority)
+		cache_node_fold_hits(cache, node);
 	node->cn_priority = priority;
 	pthread_mutex_unlock(&node->cn_mutex);
 }
@@ -520,7 +829,7 @@ cache_node_purge(
 	hash = cache->c_hash + cache->hash(key, cache->c_hashsize,
 					   cache->c_hashshift);
 	head = &hash->ch_list;
-	pthread_mutex_lock(&hash->ch_mutex);
+	pthread_rwlock_wrlock(&hash->ch_lock);
 	for (pos = head->next, n = pos->next; pos != head;
 						pos = n, n = pos->next) {
 		if ((struct cache_node *)pos != node)
@@ -531,7 +840,7 @@ cache_node_purge(
 			hash->ch_count--;
 		break;
 	}
-	pthread_mutex_unlock(&hash->ch_mutex);
+	pthread_rwlock_unlock(&hash->ch_lock);
 
 	if (count == 0) {
 		pthread_mutex_lock(&cache->c_mutex);
@@ -577,9 +886,10 @@ cache_purge(
 }
 
 /*
- * Flush all nodes in the cache to disk.
+ * Flush all nodes in the cache to disk.  Returns the number of nodes that
+ * couldn't be written and are still dirty.
  */
-void
+int
 cache_flush(
 	struct cache *		cache)
 {
@@ -587,24 +897,61 @@ cache_flush(
 	struct list_head *	head;
 	struct list_head *	pos;
 	struct cache_node *	node;
+	int			dirty = 0;
 	int			i;
 
 	if (!cache->flush)
-		return;
+		return 0;
 
 	for (i = 0; i < cache->c_hashsize; i++) {
 		hash = &cache->c_hash[i];
 
-		pthread_mutex_lock(&hash->ch_mutex);
+		pthread_rwlock_rdlock(&hash->ch_lock);
 		head = &hash->ch_list;
 		for (pos = head->next; pos != head; pos = pos->next) {
 			node = (struct cache_node *)pos;
 			pthread_mutex_lock(&node->cn_mutex);
-			cache->flush(node);
+			if (cache->flush(node))
+				dirty++;
+			pthread_mutex_unlock(&node->cn_mutex);
+		}
+		pthread_rwlock_unlock(&hash->ch_lock);
+	}
+	return dirty;
+}
+
+/*
+ * Total hits, with the hits per priority in prio_hits if it isn't NULL:
+ * what nodes that have left the cache or changed priority have added to
+ * the cache totals, plus what the nodes still hold.
+ */
+unsigned long long
+cache_hits(
+	struct cache *		cache,
+	unsigned long long *	prio_hits)
+{
+	struct cache_hash *	hash;
+	struct cache_node *	node;
+	unsigned long long	hits;
+	int			i;
+
+	hits = cache->c_hits;
+	if (prio_hits)
+		memcpy(prio_hits, cache->c_prio_hits,
+		       sizeof(cache->c_prio_hits));
+	for (i = 0; i < cache->c_hashsize; i++) {
+		hash = &cache->c_hash[i];
+		pthread_rwlock_rdlock(&hash->ch_lock);
+		list_for_each_entry(node, &hash->ch_list, cn_hash) {
+			pthread_mutex_lock(&node->cn_mutex);
+			hits += node->cn_hits;
+			if (prio_hits && node->cn_priority >= 0)
+				prio_hits[node->cn_priority] += node->cn_hits;
 			pthread_mutex_unlock(&node->cn_mutex);
 		}
-		pthread_mutex_unlock(&hash->ch_mutex);
+		pthread_rwlock_unlock(&hash->ch_lock);
 	}
+	return hits;
 }
 
 #define	HASH_REPORT	(3 * HASH_CACHE_RATIO)
@@ -617,8 +964,12 @@ cache_report(
 	int 			i;
 	unsigned long 		count, index, total;
 	unsigned long 		hash_bucket_lengths[HASH_REPORT + 2];
+	unsigned int		mrucount, a1count;
+	unsigned long long	hits, misses;
+	unsigned long long	prio_hits[CACHE_MAX_PRIORITY + 1];
 
-	if ((cache->c_hits + cache->c_misses) == 0)
+	hits = cache_hits(cache, prio_hits);
+	if ((hits + cache->c_misses) == 0)
 		return;
 
 	/* report cache summary */
@@ -629,22 +980,42 @@ cache_report(
 			"Hash table size = %u\n"
 			"Hits = %llu\n"
 			"Misses = %llu\n"
-			"Hit ratio = %5.2f\n",
+			"Hit ratio = %5.2f\n"
+			"Replacement policy = %s\n",
 			name, cache,
 			cache->c_maxcount,
 			cache->c_max,
 			cache->c_count,
 			cache->c_hashsize,
-			cache->c_hits,
+			hits,
 			cache->c_misses,
-			(double)cache->c_hits * 100 /
-				(cache->c_hits + cache->c_misses)
+			(double)hits * 100 / (hits + cache->c_misses),
+			cache->c_policy->name
 	);
 
-	for (i = 0; i <= CACHE_MAX_PRIORITY; i++)
-		fprintf(fp, "MRU %d entries = %6u (%3u%%)\n",
-			i, cache->c_mrus[i].cm_count,
-			cache->c_mrus[i].cm_count * 100 / cache->c_count);
+	for (i = 0; i <= CACHE_MAX_PRIORITY; i++) {
+		a1count = cache->c_mrus[CACHE_QUEUE_PROBATION][i].cm_count;
+		mrucount = cache->c_mrus[CACHE_QUEUE_MAIN][i].cm_count + a1count;
+		if (cache->c_policy == &cache_policy_mru)
+			fprintf(fp, "MRU %d entries = %6u (%3u%%)\n",
+				i, mrucount, mrucount * 100 / cache->c_count);
+		else
+			fprintf(fp, "MRU %d entries = %6u (%3u%%), "
+					"%6u on probation\n",
+				i, mrucount, mrucount * 100 / cache->c_count,
+				a1count);
+	}
+
+	/* report per-priority hits and misses */
+	for (i = 0; i <= CACHE_MAX_PRIORITY; i++) {
+		hits = prio_hits[i];
+		misses = cache->c_prio_misses[i];
+		if (hits + misses == 0)
+			continue;
+		fprintf(fp, "Priority %2d hits = %10llu, misses = %10llu, "
+				"hit ratio = %6.2f\n",
+			i, hits, misses, (double)hits * 100 / (hits + misses));
+	}
 
 	/* report hash bucket lengths */
 	bzero(hash_bucket_lengths, sizeof(hash_bucket_lengths));
@@ -0,0 +1,198 @@
+/*
+ * Microbenchmark for the generic cache in cache.c.
+ *
+ * A number of threads repeatedly look up and release random keys from a
+ * working set, the same pattern libxfs_getbuf/libxfs_putbuf put on the
+ * buffer cache from the xfs_repair worker and prefetch threads. The run is
+ * repeated for 1, 2, 4, ... threads so the scalability of the hit path can
+ * be compared across cache implementations. It is not built by default;
+ * use "make cachebench" in this directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <xfs/libxfs.h>
+
+struct bench_node {
+	struct cache_node	node;
+	unsigned long		key;
+};
+
+static unsigned int	nthreads = 8;
+static unsigned int	hashsize = 4096;
+static unsigned long	nkeys = 16384;
+static unsigned long	nops = 1000000;
+
+static unsigned int
+bench_hash(
+	cache_key_t		key,
+	unsigned int		hashsize,
+	unsigned int		hashshift)
+{
+	unsigned long		k = *(unsigned long *)key;
+
+	return (k ^ (k >> hashshift)) % hashsize;
+}
+
+static struct cache_node *
+bench_alloc(
+	cache_key_t		key)
+{
+	struct bench_node	*bn = calloc(1, sizeof(*bn));
+
+	if (!bn)
+		return NULL;
+	bn->key = *(unsigned long *)key;
+	return &bn->node;
+}
+
+static void
+bench_relse(
+	struct cache_node	*node)
+{
+	free(node);
+}
+
+static int
+bench_compare(
+	struct cache_node	*node,
+	cache_key_t		key)
+{
+	return ((struct bench_node *)node)->key == *(unsigned long *)key ?
+		CACHE_HIT : CACHE_MISS;
+}
+
+static struct cache_operations bench_operations = {
+	.hash		= bench_hash,
+	.alloc		= bench_alloc,
+	.relse		= bench_relse,
+	.compare	= bench_compare,
+};
+
+struct bench_thread {
+	pthread_t		thread;
+	struct cache		*cache;
+	unsigned int		seed;
+};
+
+static void *
+bench_worker(
+	void			*arg)
+{
+	struct bench_thread	*bt = arg;
+	struct cache_node	*node;
+	unsigned long		key;
+	unsigned long		i;
+
+	for (i = 0; i < nops; i++) {
+		key = rand_r(&bt->seed) % nkeys;
+		cache_node_get(bt->cache, &key, &node);
+		if (node)
+			cache_node_put(bt->cache, node);
+	}
+	return NULL;
+}
+
+static double
+bench_run(
+	unsigned int		threads)
+{
+	struct bench_thread	*bt;
+	struct cache		*cache;
+	struct timeval		start, end;
+	unsigned long long	hits;
+	double			secs;
+	unsigned int		i;
+
+	cache = cache_init(0, hashsize, &bench_operations);
+	if (!cache) {
+		fprintf(stderr, "%s: cannot create cache\n", progname);
+		exit(1);
+	}
+	bt = calloc(threads, sizeof(*bt));
+	if (!bt) {
+		fprintf(stderr, "%s: out of memory\n", progname);
+		exit(1);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < threads; i++) {
+		bt[i].cache = cache;
+		bt[i].seed = i + 1;
+		pthread_create(&bt[i].thread, NULL, bench_worker, &bt[i]);
+	}
+	for (i = 0; i < threads; i++)
+		pthread_join(bt[i].thread, NULL);
+	gettimeofday(&end, NULL);
+
+	secs = (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0;
+	hits = cache_hits(cache, NULL);
+	printf("%3u threads: %12.0f ops/s, %6.2f%% hits, %u nodes\n",
+		threads, (double)threads * nops / secs,
+		(double)hits * 100 / (hits + cache->c_misses),
+		cache->c_count);
+
+	cache_purge(cache);
+	cache_destroy(cache);
+	free(bt);
+	return secs;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+"Usage: %s [-t maxthreads] [-b hashsize] [-k keys] [-n ops_per_thread]\n"
+"          [-p policy]\n",
+		progname);
+	exit(1);
+}
+
+int
+main(
+	int			argc,
+	char			**argv)
+{
+	unsigned int		t;
+	int			c;
+
+	progname = basename(argv[0]);
+	while ((c = getopt(argc, argv, "b:k:n:p:t:")) != EOF) {
+		switch (c) {
+		case 'b':
+			hashsize = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			nkeys = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nops = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			bench_operations.policy = cache_policy_find(optarg);
+			if (!bench_operations.policy)
+				usage();
+			break;
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!hashsize || !nkeys || !nops || !nthreads)
+		usage();
+
+	printf("%u hash buckets, %u max entries, %lu keys, %lu ops/thread, "
+		"%s policy\n", hashsize, hashsize * HASH_CACHE_RATIO, nkeys, nops,
+		bench_operations.policy ? bench_operations.policy->name : "mru");
+	for (t = 1; t <= nthreads; t *= 2)
+		bench_run(t);
+	return 0;
+}
@@ -701,12 +701,36 @@ libxfs_balloc(cache_key_t key)
 }
 
 
+static struct libxfs_iostats		io_total;
+static __thread struct libxfs_iostats	io_thread;
+
+void
+libxfs_iostats(
+	struct libxfs_iostats	*total,
+	struct libxfs_iostats	*thread)
+{
+	if (total) {
+		total->reads = __sync_fetch_and_add(&io_total.reads, 0);
+		total->read_bytes = __sync_fetch_and_add(&io_total.read_bytes, 0);
+		total->writes = __sync_fetch_and_add(&io_total.writes, 0);
+		total->write_bytes = __sync_fetch_and_add(&io_total.write_bytes, 0);
+	}
+	if (thread)
+		*thread = io_thread;
+}
+
 static int
 __read_buf(int fd, void *buf, int len, off64_t offset, int flags)
 {
 	int	sts;
 
 	sts = pread64(fd, buf, len, offset);
+	if (sts > 0) {
+		__sync_fetch_and_add(&io_total.reads, 1);
+		__sync_fetch_and_add(&io_total.read_bytes, sts);
+		io_thread.reads++;
+		io_thread.read_bytes += sts;
+	}
 	if (sts < 0) {
 		int error = errno;
 		fprintf(stderr, _("%s: read failed: %s\n"),
@@ -875,6 +899,12 @@ __write_buf(int fd, void *buf, int len, off64_t offset, int flags)
 	int	sts;
 
 	sts = pwrite64(fd, buf, len, offset);
+	if (sts > 0) {
+		__sync_fetch_and_add(&io_total.writes, 1);
+		__sync_fetch_and_add(&io_total.write_bytes, sts);
+		io_thread.writes++;
+		io_thread.write_bytes += sts;
+	}
 	if (sts < 0) {
 		int error = errno;
 		fprintf(stderr, _("%s: pwrite64 failed: %s\n"),
@@ -1054,13 +1084,19 @@ libxfs_bulkrelse(
 	return count;
 }
 
-static void
+/*
+ * Write back a dirty buffer. Returns non-zero if the buffer is still dirty
+ * afterwards; stale buffers are never written, so they count as clean.
+ */
+static int
 libxfs_bflush(struct cache_node *node)
 {
 	xfs_buf_t		*bp = (xfs_buf_t *)node;
 
-	if ((bp != NULL) && (bp->b_flags & LIBXFS_B_DIRTY))
-		libxfs_writebufr(bp);
+	if ((bp != NULL) && (bp->b_flags & LIBXFS_B_DIRTY) &&
+	    !(bp->b_flags & LIBXFS_B_STALE))
+		return libxfs_writebufr(bp);
+	return 0;
 }
 
 void
@@ -1076,10 +1112,10 @@ libxfs_bcache_purge(void)
 	cache_purge(libxfs_bcache);
 }
 
-void
+int
 libxfs_bcache_flush(void)
 {
-	cache_flush(libxfs_bcache);
+	return cache_flush(libxfs_bcache);
 }
 
 int
@@ -25,6 +25,14 @@
 
 kmem_zone_t	*xfs_log_item_desc_zone;
 
+/*
+ * Transactions can be committed by several threads at once, e.g. when
+ * xfs_repair fixes directories in parallel.  The in-core superblock
+ * counters are only changed under this lock, and reservations check them
+ * under it.
+ */
+pthread_mutex_t	trans_sb_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Initialize the precomputed transaction reservation values
  * in the mount structure.
@@ -182,6 +190,7 @@ libxfs_trans_reserve(
 	uint			rtextents)
 {
 	xfs_sb_t	*mpsb = &tp->t_mountp->m_sb;
+	int		error = 0;
 
 	/*
 	 * Attempt to reserve the needed disk blocks by decrementing
@@ -189,8 +198,12 @@ libxfs_trans_reserve(
 	 * fail if the count would go below zero.
 	 */
 	if (blocks > 0) {
+		pthread_mutex_lock(&trans_sb_lock);
 		if (mpsb->sb_fdblocks < blocks)
-			return ENOSPC;
+			error = ENOSPC;
+		pthread_mutex_unlock(&trans_sb_lock);
+		if (error)
+			return error;
 	}
 	/* user space, don't need log/RT stuff (preserve the API though) */
 	return 0;
@@ -828,6 +841,12 @@ libxfs_trans_commit(
 
 	if (tp->t_flags & XFS_TRANS_SB_DIRTY) {
 		sbp = &(tp->t_mountp->m_sb);
+		/*
+		 * Join the superblock buffer first, so that we never wait
+		 * for its lock while holding trans_sb_lock.
+		 */
+		xfs_trans_getsb(tp, tp->t_mountp, 0);
+		pthread_mutex_lock(&trans_sb_lock);
 		if (tp->t_icount_delta)
 			sbp->sb_icount += tp->t_icount_delta;
 		if (tp->t_ifree_delta)
@@ -837,6 +856,7 @@ libxfs_trans_commit(
 		if (tp->t_frextents_delta)
 			sbp->sb_frextents += tp->t_frextents_delta;
 		xfs_mod_sb(tp, XFS_SB_ALL_BITS);
+		pthread_mutex_unlock(&trans_sb_lock);
 	}
 
 #ifdef XACT_DEBUG
@@ -496,11 +496,14 @@ libxfs_mod_incore_sb(
 
 	switch (field) {
 	case XFS_SBS_FDBLOCKS:
+		pthread_mutex_lock(&trans_sb_lock);
 		lcounter = (long long)mp->m_sb.sb_fdblocks;
 		lcounter += delta;
+		if (lcounter >= 0)
+			mp->m_sb.sb_fdblocks = lcounter;
+		pthread_mutex_unlock(&trans_sb_lock);
 		if (lcounter < 0)
 			return XFS_ERROR(ENOSPC);
-		mp->m_sb.sb_fdblocks = lcounter;
 		return 0;
 	default:
 		ASSERT(0);
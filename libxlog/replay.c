@@ -0,0 +1,1295 @@
+/*
+ * Copyright (c) 2000-2006 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxlog.h>
+#include <pthread.h>
+
+/*
+ * Userspace log replay.
+ *
+ * xlog_recover_replay() runs the two kernel recovery passes over the
+ * active part of the log.  Pass 1 builds the table of cancelled buffers
+ * and notes quotaoff items.  Pass 2 replays the buffer, inode, dquot and
+ * inode create items of each transaction into the libxfs buffer cache as
+ * the transaction commits, so later transactions land on top of earlier
+ * ones in LSN order.  The buffers that were modified are remembered, and
+ * once the whole log has been applied they are written back in disk
+ * address order by a pool of threads; each buffer is independent of the
+ * others by then.
+ *
+ * Extent free intents and the AGI unlinked lists are not processed here.
+ * Unlinked inodes with no links left are freed by xfs_repair in phase 3,
+ * and the blocks an intent covers aren't owned by anything once the
+ * transaction that logged it has been replayed, so the free space that
+ * phase 5 rebuilds picks them up.
+ *
+ * On a failure the buffers that haven't been written are thrown away, but
+ * any the cache had to write back to make room during pass 2 are already
+ * on disk.  That is only safe because the log itself is left alone, so it
+ * can be replayed again over them.
+ */
+
+#define XLOG_BUF_CANCEL_BUCKET(rp, blkno) \
+	(&(rp)->r_buf_cancel[(__uint64_t)(blkno) % XLOG_BC_TABLE_SIZE])
+
+#define XLOG_REPLAY_BUFS	4096	/* initial size of the buffer list */
+
+struct xlog_buf_cancel {
+	struct list_head	bc_list;
+	xfs_daddr_t		bc_blkno;
+	uint			bc_len;
+	int			bc_refcount;
+};
+
+struct xlog_replay_buf {
+	xfs_daddr_t		rb_blkno;
+	int			rb_len;		/* basic blocks */
+	xfs_lsn_t		rb_lsn;		/* last transaction applied */
+};
+
+struct xlog_replay {
+	struct list_head	r_buf_cancel[XLOG_BC_TABLE_SIZE];
+	uint			r_quotaoffs;	/* XFS_DQ_* turned off */
+	struct xlog_replay_buf	*r_bufs;	/* buffers modified */
+	int			r_nbufs;
+	int			r_maxbufs;
+	int			r_next;		/* next buffer to write back */
+	int			r_error;	/* first write back error */
+	struct xlog		*r_log;
+};
+
+static int
+xlog_replay_buf_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct xlog_replay_buf *ra = a;
+	const struct xlog_replay_buf *rb = b;
+
+	if (ra->rb_blkno != rb->rb_blkno)
+		return ra->rb_blkno < rb->rb_blkno ? -1 : 1;
+	if (ra->rb_len != rb->rb_len)
+		return ra->rb_len < rb->rb_len ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Sort the buffer list by disk address and fold repeated entries for a
+ * buffer into one, keeping the LSN of the last transaction applied to it.
+ */
+STATIC void
+xlog_replay_sort_bufs(
+	struct xlog_replay	*rp)
+{
+	struct xlog_replay_buf	*rb;
+	int			i, n;
+
+	if (rp->r_nbufs < 2)
+		return;
+
+	qsort(rp->r_bufs, rp->r_nbufs, sizeof(struct xlog_replay_buf),
+	      xlog_replay_buf_cmp);
+	for (i = 1, n = 0; i < rp->r_nbufs; i++) {
+		rb = &rp->r_bufs[i];
+		if (!xlog_replay_buf_cmp(rb, &rp->r_bufs[n])) {
+			if (XFS_LSN_CMP(rb->rb_lsn, rp->r_bufs[n].rb_lsn) > 0)
+				rp->r_bufs[n].rb_lsn = rb->rb_lsn;
+			continue;
+		}
+		rp->r_bufs[++n] = *rb;
+	}
+	rp->r_nbufs = n + 1;
+}
+
+/*
+ * Mark a replayed buffer dirty, remember it for write back and release it.
+ * The buffer list is only grown once folding duplicates no longer frees
+ * enough room, so it stays in proportion to the number of buffers the log
+ * touches rather than the number of times they were logged.
+ */
+STATIC void
+xlog_replay_dirty_buf(
+	struct xlog		*log,
+	struct xfs_buf		*bp,
+	xfs_lsn_t		lsn)
+{
+	struct xlog_replay	*rp = log->l_replay;
+	struct xlog_replay_buf	*rb;
+
+	if (rp->r_nbufs == rp->r_maxbufs) {
+		xlog_replay_sort_bufs(rp);
+		if (rp->r_nbufs >= rp->r_maxbufs / 2) {
+			rp->r_maxbufs = rp->r_maxbufs ? rp->r_maxbufs * 2 :
+							XLOG_REPLAY_BUFS;
+			rp->r_bufs = realloc(rp->r_bufs, rp->r_maxbufs *
+					     sizeof(struct xlog_replay_buf));
+			if (!rp->r_bufs)
+				xlog_exit(_("%s: cannot allocate replay buffer list"),
+					  __func__);
+		}
+	}
+
+	rb = &rp->r_bufs[rp->r_nbufs++];
+	rb->rb_blkno = XFS_BUF_ADDR(bp);
+	rb->rb_len = bp->b_length;
+	rb->rb_lsn = lsn;
+	libxfs_writebuf(bp, 0);
+}
+
+/*
+ * Find where a CRC enabled metadata block keeps the LSN of its last write.
+ * Returns NULL for blocks that don't have one or that belong to some other
+ * filesystem, which are always replayed.  Inode and dquot buffers hold an
+ * LSN per inode or dquot and are dealt with by their own items.
+ */
+STATIC __be64 *
+xlog_recover_buf_lsnp(
+	struct xfs_mount	*mp,
+	struct xfs_buf		*bp)
+{
+	void			*blk = bp->b_addr;
+	__be64			*lsnp = NULL;
+	uuid_t			*uuid = NULL;
+
+	switch (be32_to_cpu(*(__be32 *)blk)) {
+	case XFS_ABTB_CRC_MAGIC:
+	case XFS_ABTC_CRC_MAGIC:
+	case XFS_IBT_CRC_MAGIC:
+	case XFS_FIBT_CRC_MAGIC: {
+		struct xfs_btree_block *btb = blk;
+
+		lsnp = &btb->bb_u.s.bb_lsn;
+		uuid = &btb->bb_u.s.bb_uuid;
+		break;
+	}
+	case XFS_BMAP_CRC_MAGIC: {
+		struct xfs_btree_block *btb = blk;
+
+		lsnp = &btb->bb_u.l.bb_lsn;
+		uuid = &btb->bb_u.l.bb_uuid;
+		break;
+	}
+	case XFS_AGF_MAGIC:
+		lsnp = &((struct xfs_agf *)blk)->agf_lsn;
+		uuid = &((struct xfs_agf *)blk)->agf_uuid;
+		break;
+	case XFS_AGFL_MAGIC:
+		lsnp = &((struct xfs_agfl *)blk)->agfl_lsn;
+		uuid = &((struct xfs_agfl *)blk)->agfl_uuid;
+		break;
+	case XFS_AGI_MAGIC:
+		lsnp = &((struct xfs_agi *)blk)->agi_lsn;
+		uuid = &((struct xfs_agi *)blk)->agi_uuid;
+		break;
+	case XFS_SYMLINK_MAGIC:
+		lsnp = &((struct xfs_dsymlink_hdr *)blk)->sl_lsn;
+		uuid = &((struct xfs_dsymlink_hdr *)blk)->sl_uuid;
+		break;
+	case XFS_DIR3_BLOCK_MAGIC:
+	case XFS_DIR3_DATA_MAGIC:
+	case XFS_DIR3_FREE_MAGIC:
+		lsnp = &((struct xfs_dir3_blk_hdr *)blk)->lsn;
+		uuid = &((struct xfs_dir3_blk_hdr *)blk)->uuid;
+		break;
+	case XFS_ATTR3_RMT_MAGIC:
+		lsnp = &((struct xfs_attr3_rmt_hdr *)blk)->rm_lsn;
+		uuid = &((struct xfs_attr3_rmt_hdr *)blk)->rm_uuid;
+		break;
+	case XFS_SB_MAGIC:
+		lsnp = &((struct xfs_dsb *)blk)->sb_lsn;
+		uuid = &((struct xfs_dsb *)blk)->sb_uuid;
+		break;
+	default:
+		switch (be16_to_cpu(((struct xfs_da_blkinfo *)blk)->magic)) {
+		case XFS_DIR3_LEAF1_MAGIC:
+		case XFS_DIR3_LEAFN_MAGIC:
+		case XFS_DA3_NODE_MAGIC:
+		case XFS_ATTR3_LEAF_MAGIC:
+			lsnp = &((struct xfs_da3_blkinfo *)blk)->lsn;
+			uuid = &((struct xfs_da3_blkinfo *)blk)->uuid;
+			break;
+		}
+		break;
+	}
+
+	if (!lsnp || platform_uuid_compare(uuid, &mp->m_sb.sb_uuid))
+		return NULL;
+	return lsnp;
+}
+
+/*
+ * Once a buffer has been replayed on a CRC enabled filesystem, attach the
+ * verifier for its type so that the CRC is recalculated when it is written.
+ */
+STATIC void
+xlog_recover_validate_buf_type(
+	struct xfs_mount	*mp,
+	struct xfs_buf		*bp,
+	xfs_buf_log_format_t	*buf_f)
+{
+	__uint32_t		magic32 = be32_to_cpu(*(__be32 *)bp->b_addr);
+	__uint16_t		magicda;
+
+	if (!xfs_sb_version_hascrc(&mp->m_sb))
+		return;
+
+	magicda = be16_to_cpu(((struct xfs_da_blkinfo *)bp->b_addr)->magic);
+	switch (xfs_blft_from_flags(buf_f)) {
+	case XFS_BLFT_BTREE_BUF:
+		switch (magic32) {
+		case XFS_ABTB_CRC_MAGIC:
+		case XFS_ABTC_CRC_MAGIC:
+			bp->b_ops = &xfs_allocbt_buf_ops;
+			break;
+		case XFS_IBT_CRC_MAGIC:
+		case XFS_FIBT_CRC_MAGIC:
+			bp->b_ops = &xfs_inobt_buf_ops;
+			break;
+		case XFS_BMAP_CRC_MAGIC:
+			bp->b_ops = &xfs_bmbt_buf_ops;
+			break;
+		}
+		break;
+	case XFS_BLFT_AGF_BUF:
+		if (magic32 == XFS_AGF_MAGIC)
+			bp->b_ops = &xfs_agf_buf_ops;
+		break;
+	case XFS_BLFT_AGFL_BUF:
+		if (magic32 == XFS_AGFL_MAGIC)
+			bp->b_ops = &xfs_agfl_buf_ops;
+		break;
+	case XFS_BLFT_AGI_BUF:
+		if (magic32 == XFS_AGI_MAGIC)
+			bp->b_ops = &xfs_agi_buf_ops;
+		break;
+	case XFS_BLFT_DINO_BUF:
+		bp->b_ops = &xfs_inode_buf_ops;
+		break;
+	case XFS_BLFT_SYMLINK_BUF:
+		if (magic32 == XFS_SYMLINK_MAGIC)
+			bp->b_ops = &xfs_symlink_buf_ops;
+		break;
+	case XFS_BLFT_DIR_BLOCK_BUF:
+		if (magic32 == XFS_DIR3_BLOCK_MAGIC)
+			bp->b_ops = &xfs_dir3_block_buf_ops;
+		break;
+	case XFS_BLFT_DIR_DATA_BUF:
+		if (magic32 == XFS_DIR3_DATA_MAGIC)
+			bp->b_ops = &xfs_dir3_data_buf_ops;
+		break;
+	case XFS_BLFT_DIR_FREE_BUF:
+		if (magic32 == XFS_DIR3_FREE_MAGIC)
+			bp->b_ops = &xfs_dir3_free_buf_ops;
+		break;
+	case XFS_BLFT_DIR_LEAF1_BUF:
+		if (magicda == XFS_DIR3_LEAF1_MAGIC)
+			bp->b_ops = &xfs_dir3_leaf1_buf_ops;
+		break;
+	case XFS_BLFT_DIR_LEAFN_BUF:
+		if (magicda == XFS_DIR3_LEAFN_MAGIC)
+			bp->b_ops = &xfs_dir3_leafn_buf_ops;
+		break;
+	case XFS_BLFT_DA_NODE_BUF:
+		if (magicda == XFS_DA3_NODE_MAGIC)
+			bp->b_ops = &xfs_da3_node_buf_ops;
+		break;
+	case XFS_BLFT_ATTR_LEAF_BUF:
+		if (magicda == XFS_ATTR3_LEAF_MAGIC)
+			bp->b_ops = &xfs_attr3_leaf_buf_ops;
+		break;
+	case XFS_BLFT_ATTR_RMT_BUF:
+		if (magic32 == XFS_ATTR3_RMT_MAGIC)
+			bp->b_ops = &xfs_attr3_rmt_buf_ops;
+		break;
+	case XFS_BLFT_SB_BUF:
+		if (magic32 == XFS_SB_MAGIC)
+			bp->b_ops = &xfs_sb_buf_ops;
+		break;
+	default:
+		/* dquot buffers carry their own CRCs, see the dquot item */
+		break;
+	}
+}
+
+/*
+ * Pass 1: build the table of cancelled buffers.  A buffer can be freed and
+ * reused several times in the active part of the log, so each cancel is
+ * counted and matched against the cancel records seen again in pass 2.
+ */
+STATIC int
+xlog_recover_buffer_pass1(
+	struct xlog		*log,
+	xlog_recover_item_t	*item)
+{
+	xfs_buf_log_format_t	*buf_f = item->ri_buf[0].i_addr;
+	struct list_head	*bucket;
+	struct xlog_buf_cancel	*bcp;
+
+	if (!(buf_f->blf_flags & XFS_BLF_CANCEL))
+		return 0;
+
+	bucket = XLOG_BUF_CANCEL_BUCKET(log->l_replay, buf_f->blf_blkno);
+	list_for_each_entry(bcp, bucket, bc_list) {
+		if (bcp->bc_blkno == buf_f->blf_blkno &&
+		    bcp->bc_len == buf_f->blf_len) {
+			bcp->bc_refcount++;
+			return 0;
+		}
+	}
+
+	bcp = kmem_alloc(sizeof(struct xlog_buf_cancel), KM_SLEEP);
+	bcp->bc_blkno = buf_f->blf_blkno;
+	bcp->bc_len = buf_f->blf_len;
+	bcp->bc_refcount = 1;
+	list_add_tail(&bcp->bc_list, bucket);
+	return 0;
+}
+
+/*
+ * Check whether a buffer was cancelled later in the log.  Cancel records
+ * themselves drop the count taken in pass 1, so a buffer is only replayed
+ * again once every cancel for it has been passed.
+ */
+STATIC int
+xlog_check_buffer_cancelled(
+	struct xlog		*log,
+	xfs_daddr_t		blkno,
+	uint			len,
+	ushort			flags)
+{
+	struct list_head	*bucket;
+	struct xlog_buf_cancel	*bcp;
+
+	bucket = XLOG_BUF_CANCEL_BUCKET(log->l_replay, blkno);
+	list_for_each_entry(bcp, bucket, bc_list) {
+		if (bcp->bc_blkno == blkno && bcp->bc_len == len)
+			goto found;
+	}
+	return 0;
+
+found:
+	if (flags & XFS_BLF_CANCEL) {
+		if (--bcp->bc_refcount == 0) {
+			list_del(&bcp->bc_list);
+			kmem_free(bcp);
+		}
+	}
+	return 1;
+}
+
+STATIC int
+xlog_recover_quotaoff_pass1(
+	struct xlog		*log,
+	xlog_recover_item_t	*item)
+{
+	xfs_qoff_logformat_t	*qoff_f = item->ri_buf[0].i_addr;
+
+	if (qoff_f->qf_flags & XFS_UQUOTA_ACCT)
+		log->l_replay->r_quotaoffs |= XFS_DQ_USER;
+	if (qoff_f->qf_flags & XFS_PQUOTA_ACCT)
+		log->l_replay->r_quotaoffs |= XFS_DQ_PROJ;
+	if (qoff_f->qf_flags & XFS_GQUOTA_ACCT)
+		log->l_replay->r_quotaoffs |= XFS_DQ_GROUP;
+	return 0;
+}
+
+/*
+ * Dquots of a type are only replayed if the superblock says that quota is
+ * being accounted and it wasn't turned off in the active part of the log.
+ */
+STATIC int
+xlog_recover_quota_enabled(
+	struct xlog		*log,
+	uint			type)
+{
+	struct xfs_sb		*sbp = &log->l_mp->m_sb;
+	uint			enabled = 0;
+
+	if (!xfs_sb_version_hasquota(sbp))
+		return 0;
+	if (sbp->sb_qflags & XFS_UQUOTA_ACCT)
+		enabled |= XFS_DQ_USER;
+	if (sbp->sb_qflags & XFS_PQUOTA_ACCT)
+		enabled |= XFS_DQ_PROJ;
+	if (sbp->sb_qflags & XFS_GQUOTA_ACCT)
+		enabled |= XFS_DQ_GROUP;
+	enabled &= ~log->l_replay->r_quotaoffs;
+	return (enabled & type) != 0;
+}
+
+/*
+ * Copy the logged regions of a buffer back into it.
+ */
+STATIC int
+xlog_recover_do_reg_buffer(
+	struct xfs_mount	*mp,
+	xlog_recover_item_t	*item,
+	struct xfs_buf		*bp,
+	xfs_buf_log_format_t	*buf_f)
+{
+	int			i = 1;	/* 0 is the buf format structure */
+	int			bit = 0;
+	int			nbits;
+
+	while (1) {
+		bit = xfs_next_bit(buf_f->blf_data_map,
+				   buf_f->blf_map_size, bit);
+		if (bit == -1)
+			break;
+		nbits = xfs_contig_bits(buf_f->blf_data_map,
+					buf_f->blf_map_size, bit);
+		if (i >= item->ri_cnt ||
+		    item->ri_buf[i].i_len % XFS_BLF_CHUNK ||
+		    ((bit + nbits) << XFS_BLF_SHIFT) > XFS_BUF_COUNT(bp)) {
+			xfs_warn(mp, "%s: bad region %d in buffer 0x%llx",
+				__func__, i, (unsigned long long)buf_f->blf_blkno);
+			return XFS_ERROR(EFSCORRUPTED);
+		}
+
+		/*
+		 * A dirty range may have been split over several regions at
+		 * a page boundary in the buffer, so only copy what this
+		 * region holds.
+		 */
+		if (item->ri_buf[i].i_len < (nbits << XFS_BLF_SHIFT))
+			nbits = item->ri_buf[i].i_len >> XFS_BLF_SHIFT;
+
+		memcpy(xfs_buf_offset(bp, (uint)bit << XFS_BLF_SHIFT),
+		       item->ri_buf[i].i_addr, nbits << XFS_BLF_SHIFT);
+		i++;
+		bit += nbits;
+	}
+	return 0;
+}
+
+/*
+ * Inode buffers are logged for the unlinked list pointers only, everything
+ * else in them is logged through inode items.  Copy just the pointers.
+ */
+STATIC int
+xlog_recover_do_inode_buffer(
+	struct xfs_mount	*mp,
+	xlog_recover_item_t	*item,
+	struct xfs_buf		*bp,
+	xfs_buf_log_format_t	*buf_f)
+{
+	int			i;
+	int			item_index = 0;
+	int			bit = 0;
+	int			nbits = 0;
+	int			reg_buf_offset = 0;
+	int			reg_buf_bytes = 0;
+	int			next_unlinked_offset;
+	int			inodes_per_buf;
+	xfs_agino_t		*logged_nextp;
+	xfs_agino_t		*buffer_nextp;
+
+	if (xfs_sb_version_hascrc(&mp->m_sb))
+		bp->b_ops = &xfs_inode_buf_ops;
+
+	inodes_per_buf = XFS_BUF_COUNT(bp) >> mp->m_sb.sb_inodelog;
+	for (i = 0; i < inodes_per_buf; i++) {
+		next_unlinked_offset = (i * mp->m_sb.sb_inodesize) +
+			offsetof(xfs_dinode_t, di_next_unlinked);
+
+		while (next_unlinked_offset >=
+		       (reg_buf_offset + reg_buf_bytes)) {
+			/*
+			 * The next di_next_unlinked field is beyond the
+			 * current logged region, find the region that
+			 * contains or follows it.
+			 */
+			bit += nbits;
+			bit = xfs_next_bit(buf_f->blf_data_map,
+					   buf_f->blf_map_size, bit);
+			if (bit == -1)
+				return 0;
+
+			nbits = xfs_contig_bits(buf_f->blf_data_map,
+						buf_f->blf_map_size, bit);
+			reg_buf_offset = bit << XFS_BLF_SHIFT;
+			reg_buf_bytes = nbits << XFS_BLF_SHIFT;
+			item_index++;
+		}
+
+		/* the region starts past this inode's pointer */
+		if (next_unlinked_offset < reg_buf_offset)
+			continue;
+
+		if (item_index >= item->ri_cnt ||
+		    reg_buf_offset + reg_buf_bytes > XFS_BUF_COUNT(bp) ||
+		    next_unlinked_offset - reg_buf_offset +
+				sizeof(xfs_agino_t) > item->ri_buf[item_index].i_len) {
+			xfs_warn(mp, "%s: bad region %d in inode buffer 0x%llx",
+				__func__, item_index,
+				(unsigned long long)buf_f->blf_blkno);
+			return XFS_ERROR(EFSCORRUPTED);
+		}
+
+		logged_nextp = item->ri_buf[item_index].i_addr +
+				next_unlinked_offset - reg_buf_offset;
+		if (*logged_nextp == 0) {
+			xfs_alert(mp,
+		"Bad inode buffer log record (ptr = 0x%p, bp = 0x%p). "
+		"Trying to replay bad (0) inode di_next_unlinked field.",
+				item, bp);
+			return XFS_ERROR(EFSCORRUPTED);
+		}
+
+		buffer_nextp = (xfs_agino_t *)xfs_buf_offset(bp,
+					next_unlinked_offset);
+		*buffer_nextp = *logged_nextp;
+
+		/* the pointer is covered by the v3 inode CRC */
+		xfs_dinode_calc_crc(mp, (struct xfs_dinode *)
+				xfs_buf_offset(bp, i * mp->m_sb.sb_inodesize));
+	}
+	return 0;
+}
+
+STATIC int
+xlog_recover_buffer_pass2(
+	struct xlog		*log,
+	xlog_recover_item_t	*item,
+	xfs_lsn_t		current_lsn)
+{
+	xfs_buf_log_format_t	*buf_f = item->ri_buf[0].i_addr;
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_buf		*bp;
+	__be64			*lsnp;
+	xfs_lsn_t		lsn;
+	uint			type;
+	int			error;
+
+	/*
+	 * Skip buffers that are freed later on in the log; their blocks may
+	 * have been reused for something that isn't logged, such as data.
+	 */
+	if (xlog_check_buffer_cancelled(log, buf_f->blf_blkno,
+			buf_f->blf_len, buf_f->blf_flags))
+		return 0;
+
+	bp = libxfs_readbuf(mp->m_ddev_targp, buf_f->blf_blkno,
+			    buf_f->blf_len, 0, NULL);
+	if (!bp)
+		return XFS_ERROR(ENOMEM);
+	error = bp->b_error;
+	if (error) {
+		xfs_warn(mp, "%s: cannot read buffer 0x%llx, error %d",
+			__func__, (unsigned long long)buf_f->blf_blkno, error);
+		libxfs_putbuf(bp);
+		return error;
+	}
+
+	/*
+	 * A CRC enabled block that was written after this transaction is
+	 * newer than anything we could replay into it.
+	 */
+	if (xfs_sb_version_hascrc(&mp->m_sb)) {
+		lsnp = xlog_recover_buf_lsnp(mp, bp);
+		lsn = lsnp ? be64_to_cpu(*lsnp) : 0;
+		if (lsn && lsn != NULLCOMMITLSN &&
+		    XFS_LSN_CMP(lsn, current_lsn) >= 0) {
+			libxfs_putbuf(bp);
+			return 0;
+		}
+	}
+
+	if (buf_f->blf_flags & XFS_BLF_INODE_BUF) {
+		error = xlog_recover_do_inode_buffer(mp, item, bp, buf_f);
+	} else if (buf_f->blf_flags &
+		  (XFS_BLF_UDQUOT_BUF|XFS_BLF_PDQUOT_BUF|XFS_BLF_GDQUOT_BUF)) {
+		type = 0;
+		if (buf_f->blf_flags & XFS_BLF_UDQUOT_BUF)
+			type |= XFS_DQ_USER;
+		if (buf_f->blf_flags & XFS_BLF_PDQUOT_BUF)
+			type |= XFS_DQ_PROJ;
+		if (buf_f->blf_flags & XFS_BLF_GDQUOT_BUF)
+			type |= XFS_DQ_GROUP;
+		if (!xlog_recover_quota_enabled(log, type)) {
+			libxfs_putbuf(bp);
+			return 0;
+		}
+		error = xlog_recover_do_reg_buffer(mp, item, bp, buf_f);
+	} else {
+		error = xlog_recover_do_reg_buffer(mp, item, bp, buf_f);
+		if (!error)
+			xlog_recover_validate_buf_type(mp, bp, buf_f);
+	}
+	if (error) {
+		libxfs_putbuf(bp);
+		return error;
+	}
+
+	/*
+	 * Inode buffers logged at anything other than the cluster size
+	 * would alias the cluster buffers the inode items read, so write
+	 * them straight away and drop them from the cache.
+	 */
+	if (be16_to_cpu(*(__be16 *)bp->b_addr) == XFS_DINODE_MAGIC &&
+	    XFS_BUF_COUNT(bp) != MAX(mp->m_sb.sb_blocksize,
+				     (__uint32_t)XFS_INODE_CLUSTER_SIZE(mp))) {
+		error = libxfs_writebufr(bp);
+		libxfs_putbuf(bp);
+		libxfs_purgebuf(bp);
+		return error;
+	}
+
+	xlog_replay_dirty_buf(log, bp, current_lsn);
+	return 0;
+}
+
+STATIC int
+xlog_recover_inode_pass2(
+	struct xlog		*log,
+	xlog_recover_item_t	*item,
+	xfs_lsn_t		current_lsn)
+{
+	xfs_inode_log_format_t	*in_f, in_buf;
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_buf		*bp;
+	xfs_dinode_t		*dip;
+	xfs_icdinode_t		*dicp;
+	xfs_caddr_t		src, dest;
+	xfs_lsn_t		lsn;
+	uint			fields, isize;
+	int			len, attr_index;
+	int			error;
+
+	len = item->ri_buf[0].i_len;
+	if (len != sizeof(xfs_inode_log_format_t) &&
+	    len != sizeof(xfs_inode_log_format_32_t) &&
+	    len != sizeof(xfs_inode_log_format_64_t))
+		return XFS_ERROR(EFSCORRUPTED);
+	in_f = xfs_inode_item_format_convert(item->ri_buf[0].i_addr, len,
+					     &in_buf);
+
+	if (xlog_check_buffer_cancelled(log, in_f->ilf_blkno, in_f->ilf_len, 0))
+		return 0;
+
+	if (item->ri_cnt < in_f->ilf_size || in_f->ilf_size < 2 ||
+	    in_f->ilf_size > 4 ||
+	    item->ri_buf[1].i_len < xfs_icdinode_size(1) ||
+	    in_f->ilf_boffset + mp->m_sb.sb_inodesize > BBTOB(in_f->ilf_len)) {
+		xfs_warn(mp, "%s: bad inode log item for inode %llu",
+			__func__, (unsigned long long)in_f->ilf_ino);
+		return XFS_ERROR(EFSCORRUPTED);
+	}
+
+	/* The v5 swapext owner change needs the bmbt walked, leave it */
+	if (in_f->ilf_fields & (XFS_ILOG_DOWNER | XFS_ILOG_AOWNER)) {
+		xfs_warn(mp, "%s: cannot replay fork owner change for inode %llu",
+			__func__, (unsigned long long)in_f->ilf_ino);
+		return XFS_ERROR(EOPNOTSUPP);
+	}
+
+	bp = libxfs_readbuf(mp->m_ddev_targp, in_f->ilf_blkno, in_f->ilf_len,
+			    0, NULL);
+	if (!bp)
+		return XFS_ERROR(ENOMEM);
+	error = bp->b_error;
+	if (error) {
+		xfs_warn(mp, "%s: cannot read inode %llu, error %d", __func__,
+			(unsigned long long)in_f->ilf_ino, error);
+		goto out_release;
+	}
+
+	error = EFSCORRUPTED;
+	dip = (xfs_dinode_t *)xfs_buf_offset(bp, in_f->ilf_boffset);
+	if (dip->di_magic != cpu_to_be16(XFS_DINODE_MAGIC)) {
+		xfs_alert(mp, "%s: Bad inode magic number, ino = %llu",
+			__func__, (unsigned long long)in_f->ilf_ino);
+		goto out_release;
+	}
+	dicp = item->ri_buf[1].i_addr;
+	if (dicp->di_magic != XFS_DINODE_MAGIC) {
+		xfs_alert(mp, "%s: Bad inode log record, ino = %llu",
+			__func__, (unsigned long long)in_f->ilf_ino);
+		goto out_release;
+	}
+	error = 0;
+
+	/* skip inodes that were written after this transaction */
+	if (dip->di_version >= 3) {
+		lsn = be64_to_cpu(dip->di_lsn);
+		if (lsn && lsn != NULLCOMMITLSN &&
+		    XFS_LSN_CMP(lsn, current_lsn) >= 0)
+			goto out_release;
+	}
+
+	/*
+	 * Without an LSN in the inode, di_flushiter tells whether the copy on
+	 * disk was flushed after this one was logged.  It only goes
+	 * backwards if it wrapped past DI_MAX_FLUSH.
+	 */
+	if (!xfs_sb_version_hascrc(&mp->m_sb) &&
+	    dicp->di_flushiter < be16_to_cpu(dip->di_flushiter)) {
+		if (be16_to_cpu(dip->di_flushiter) != DI_MAX_FLUSH ||
+		    dicp->di_flushiter >= (DI_MAX_FLUSH >> 1))
+			goto out_release;
+	}
+	dicp->di_flushiter = 0;
+
+	isize = xfs_icdinode_size(dicp->di_version);
+	if (item->ri_buf[1].i_len < isize ||
+	    dicp->di_nextents + dicp->di_anextents > dicp->di_nblocks ||
+	    dicp->di_forkoff > mp->m_sb.sb_inodesize) {
+		xfs_alert(mp, "%s: Bad inode log record, ino = %llu",
+			__func__, (unsigned long long)in_f->ilf_ino);
+		error = EFSCORRUPTED;
+		goto out_release;
+	}
+
+	/* The core is in in-core format */
+	xfs_dinode_to_disk(dip, dicp);
+
+	fields = in_f->ilf_fields;
+	switch (fields & (XFS_ILOG_DEV | XFS_ILOG_UUID)) {
+	case XFS_ILOG_DEV:
+		xfs_dinode_put_rdev(dip, in_f->ilf_u.ilfu_rdev);
+		break;
+	case XFS_ILOG_UUID:
+		memcpy(XFS_DFORK_DPTR(dip), &in_f->ilf_u.ilfu_uuid,
+		       sizeof(uuid_t));
+		break;
+	}
+
+	if (in_f->ilf_size == 2)
+		goto write_inode_buffer;
+
+	len = item->ri_buf[2].i_len;
+	src = item->ri_buf[2].i_addr;
+	switch (fields & XFS_ILOG_DFORK) {
+	case XFS_ILOG_DDATA:
+	case XFS_ILOG_DEXT:
+		if (len > XFS_DFORK_DSIZE(dip, mp)) {
+			error = EFSCORRUPTED;
+			goto out_release;
+		}
+		memcpy(XFS_DFORK_DPTR(dip), src, len);
+		break;
+	case XFS_ILOG_DBROOT:
+		xfs_bmbt_to_bmdr(mp, (struct xfs_btree_block *)src, len,
+				 (xfs_bmdr_block_t *)XFS_DFORK_DPTR(dip),
+				 XFS_DFORK_DSIZE(dip, mp));
+		break;
+	}
+
+	if (fields & XFS_ILOG_AFORK) {
+		attr_index = (fields & XFS_ILOG_DFORK) ? 3 : 2;
+		if (attr_index >= in_f->ilf_size) {
+			error = EFSCORRUPTED;
+			goto out_release;
+		}
+		len = item->ri_buf[attr_index].i_len;
+		src = item->ri_buf[attr_index].i_addr;
+		dest = XFS_DFORK_APTR(dip);
+
+		switch (fields & XFS_ILOG_AFORK) {
+		case XFS_ILOG_ADATA:
+		case XFS_ILOG_AEXT:
+			if (len > XFS_DFORK_ASIZE(dip, mp)) {
+				error = EFSCORRUPTED;
+				goto out_release;
+			}
+			memcpy(dest, src, len);
+			break;
+		case XFS_ILOG_ABROOT:
+			xfs_bmbt_to_bmdr(mp, (struct xfs_btree_block *)src,
+					 len, (xfs_bmdr_block_t *)dest,
+					 XFS_DFORK_ASIZE(dip, mp));
+			break;
+		default:
+			xfs_warn(mp, "%s: Invalid flag", __func__);
+			error = EFSCORRUPTED;
+			goto out_release;
+		}
+	}
+
+write_inode_buffer:
+	xfs_dinode_calc_crc(mp, dip);
+	if (xfs_sb_version_hascrc(&mp->m_sb))
+		bp->b_ops = &xfs_inode_buf_ops;
+	xlog_replay_dirty_buf(log, bp, current_lsn);
+	return 0;
+
+out_release:
+	libxfs_putbuf(bp);
+	return error;
+}
+
+STATIC int
+xlog_recover_dquot_pass2(
+	struct xlog		*log,
+	xlog_recover_item_t	*item,
+	xfs_lsn_t		current_lsn)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	xfs_dq_logformat_t	*dq_f = item->ri_buf[0].i_addr;
+	xfs_disk_dquot_t	*recddq, *ddq;
+	struct xfs_dqblk	*dqb;
+	struct xfs_buf		*bp;
+	xfs_lsn_t		lsn;
+	uint			type;
+	int			error;
+
+	if (item->ri_cnt < 2 ||
+	    item->ri_buf[1].i_len < sizeof(xfs_disk_dquot_t)) {
+		xfs_alert(mp, "NULL dquot in %s.", __func__);
+		return XFS_ERROR(EIO);
+	}
+	recddq = item->ri_buf[1].i_addr;
+
+	type = recddq->d_flags & (XFS_DQ_USER | XFS_DQ_PROJ | XFS_DQ_GROUP);
+	if (!xlog_recover_quota_enabled(log, type))
+		return 0;
+
+	if (xfs_dqcheck(mp, recddq, dq_f->qlf_id, 0, XFS_QMOPT_DOWARN,
+			"xlog_recover_dquot_pass2 (log copy)"))
+		return XFS_ERROR(EIO);
+	if (dq_f->qlf_len != 1 || item->ri_buf[1].i_len > sizeof(*dqb) ||
+	    dq_f->qlf_boffset + sizeof(*dqb) > mp->m_sb.sb_blocksize)
+		return XFS_ERROR(EFSCORRUPTED);
+
+	bp = libxfs_readbuf(mp->m_ddev_targp, dq_f->qlf_blkno,
+			    XFS_FSB_TO_BB(mp, dq_f->qlf_len), 0, NULL);
+	if (!bp)
+		return XFS_ERROR(ENOMEM);
+	error = bp->b_error;
+	if (error) {
+		libxfs_putbuf(bp);
+		return error;
+	}
+
+	ddq = (xfs_disk_dquot_t *)xfs_buf_offset(bp, dq_f->qlf_boffset);
+	dqb = (struct xfs_dqblk *)ddq;
+	if (xfs_sb_version_hascrc(&mp->m_sb)) {
+		lsn = be64_to_cpu(dqb->dd_lsn);
+		if (lsn && lsn != NULLCOMMITLSN &&
+		    XFS_LSN_CMP(lsn, current_lsn) >= 0) {
+			libxfs_putbuf(bp);
+			return 0;
+		}
+	}
+
+	memcpy(ddq, recddq, item->ri_buf[1].i_len);
+	if (xfs_sb_version_hascrc(&mp->m_sb))
+		xfs_update_cksum((char *)dqb, sizeof(struct xfs_dqblk),
+				 XFS_DQUOT_CRC_OFF);
+
+	xlog_replay_dirty_buf(log, bp, current_lsn);
+	return 0;
+}
+
+/*
+ * Inode chunks on CRC enabled filesystems are logged as a single create
+ * item rather than as physical buffer changes; initialise the chunk's
+ * cluster buffers again unless they were freed later on.
+ */
+STATIC int
+xlog_recover_do_icreate_pass2(
+	struct xlog		*log,
+	xlog_recover_item_t	*item,
+	xfs_lsn_t		current_lsn)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_icreate_log	*icl = item->ri_buf[0].i_addr;
+	xfs_agnumber_t		agno;
+	xfs_agblock_t		agbno;
+	unsigned int		count, isize, length;
+	int			blks_per_cluster, nbufs;
+	int			cancel_count = 0;
+	int			i, error;
+	xfs_daddr_t		daddr;
+	struct xfs_buf		*bp;
+
+	if (item->ri_buf[0].i_len != sizeof(struct xfs_icreate_log) ||
+	    icl->icl_type != XFS_LI_ICREATE || icl->icl_size != 1)
+		goto bad;
+
+	agno = be32_to_cpu(icl->icl_ag);
+	agbno = be32_to_cpu(icl->icl_agbno);
+	isize = be32_to_cpu(icl->icl_isize);
+	count = be32_to_cpu(icl->icl_count);
+	length = be32_to_cpu(icl->icl_length);
+	if (agno >= mp->m_sb.sb_agcount || !agbno ||
+	    agbno == NULLAGBLOCK || agbno >= mp->m_sb.sb_agblocks ||
+	    isize != mp->m_sb.sb_inodesize ||
+	    count != XFS_IALLOC_INODES(mp) || length != XFS_IALLOC_BLOCKS(mp))
+		goto bad;
+
+	/* this matches the cluster layout xfs_ialloc_inode_init uses */
+	blks_per_cluster = MAX(1, XFS_INODE_CLUSTER_SIZE(mp) >>
+				  mp->m_sb.sb_blocklog);
+	nbufs = length / blks_per_cluster;
+	for (i = 0; i < nbufs; i++) {
+		daddr = XFS_AGB_TO_DADDR(mp, agno, agbno + i * blks_per_cluster);
+		if (xlog_check_buffer_cancelled(log, daddr,
+				XFS_FSB_TO_BB(mp, blks_per_cluster), 0))
+			cancel_count++;
+	}
+	if (cancel_count == nbufs)
+		return 0;
+	if (cancel_count) {
+		xfs_warn(mp,
+	"%s: partial inode chunk cancellation, agno %u agbno %u",
+			__func__, agno, agbno);
+		return XFS_ERROR(EINVAL);
+	}
+
+	error = xfs_ialloc_inode_init(mp, NULL, NULL, agno, agbno, length,
+				      be32_to_cpu(icl->icl_gen));
+	if (error)
+		return error;
+
+	/* xfs_ialloc_inode_init left the cluster buffers dirty in the cache */
+	for (i = 0; i < nbufs; i++) {
+		daddr = XFS_AGB_TO_DADDR(mp, agno, agbno + i * blks_per_cluster);
+		bp = libxfs_getbuf(mp->m_ddev_targp, daddr,
+				   XFS_FSB_TO_BB(mp, blks_per_cluster));
+		if (!bp)
+			return XFS_ERROR(ENOMEM);
+		xlog_replay_dirty_buf(log, bp, current_lsn);
+	}
+	return 0;
+
+bad:
+	xfs_warn(mp, "%s: bad inode create log item", __func__);
+	return XFS_ERROR(EFSCORRUPTED);
+}
+
+/*
+ * The order items are replayed in within a transaction, as the kernel
+ * reorders them: inode chunk creation and ordinary buffers first, then
+ * inodes and dquots, then inode buffers and finally the cancel records.
+ */
+#define XLOG_ITEM_ORDER_BUF	0
+#define XLOG_ITEM_ORDER_INODE	1
+#define XLOG_ITEM_ORDER_INOBUF	2
+#define XLOG_ITEM_ORDER_CANCEL	3
+#define XLOG_ITEM_ORDERS	4
+
+STATIC int
+xlog_recover_item_order(
+	xlog_recover_item_t	*item)
+{
+	xfs_buf_log_format_t	*buf_f;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_BUF:
+		buf_f = item->ri_buf[0].i_addr;
+		if (buf_f->blf_flags & XFS_BLF_CANCEL)
+			return XLOG_ITEM_ORDER_CANCEL;
+		if (buf_f->blf_flags & XFS_BLF_INODE_BUF)
+			return XLOG_ITEM_ORDER_INOBUF;
+		return XLOG_ITEM_ORDER_BUF;
+	case XFS_LI_ICREATE:
+		return XLOG_ITEM_ORDER_BUF;
+	default:
+		return XLOG_ITEM_ORDER_INODE;
+	}
+}
+
+/*
+ * Check that an item has the regions its format structure needs before
+ * anything looks inside it.
+ */
+STATIC int
+xlog_recover_item_valid(
+	struct xlog		*log,
+	xlog_recover_item_t	*item)
+{
+	xfs_buf_log_format_t	*buf_f;
+
+	if (item->ri_cnt < 1 || item->ri_buf[0].i_len < sizeof(__uint32_t))
+		goto bad;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_BUF:
+		buf_f = item->ri_buf[0].i_addr;
+		if (item->ri_buf[0].i_len <
+				offsetof(xfs_buf_log_format_t, blf_data_map) ||
+		    buf_f->blf_map_size > XFS_BLF_DATAMAP_SIZE ||
+		    item->ri_buf[0].i_len <
+				offsetof(xfs_buf_log_format_t, blf_data_map) +
+				buf_f->blf_map_size * sizeof(uint))
+			goto bad;
+		return 0;
+	case XFS_LI_QUOTAOFF:
+		if (item->ri_buf[0].i_len < sizeof(xfs_qoff_logformat_t))
+			goto bad;
+		return 0;
+	case XFS_LI_DQUOT:
+		if (item->ri_buf[0].i_len < sizeof(xfs_dq_logformat_t))
+			goto bad;
+		return 0;
+	case XFS_LI_INODE:
+	case XFS_LI_ICREATE:
+	case XFS_LI_EFI:
+	case XFS_LI_EFD:
+		return 0;
+	default:
+		xfs_warn(log->l_mp, "%s: invalid item type (%d)",
+			__func__, ITEM_TYPE(item));
+		return XFS_ERROR(EIO);
+	}
+
+bad:
+	xfs_warn(log->l_mp, "%s: bad log item format", __func__);
+	return XFS_ERROR(EFSCORRUPTED);
+}
+
+STATIC int
+xlog_recover_items_pass2(
+	struct xlog		*log,
+	xlog_recover_t		*trans,
+	int			order)
+{
+	xlog_recover_item_t	*item;
+	int			error = 0;
+
+	list_for_each_entry(item, &trans->r_itemq, ri_list) {
+		if (xlog_recover_item_order(item) != order)
+			continue;
+
+		switch (ITEM_TYPE(item)) {
+		case XFS_LI_BUF:
+			error = xlog_recover_buffer_pass2(log, item,
+							  trans->r_lsn);
+			break;
+		case XFS_LI_INODE:
+			error = xlog_recover_inode_pass2(log, item,
+							 trans->r_lsn);
+			break;
+		case XFS_LI_DQUOT:
+			error = xlog_recover_dquot_pass2(log, item,
+							 trans->r_lsn);
+			break;
+		case XFS_LI_ICREATE:
+			error = xlog_recover_do_icreate_pass2(log, item,
+							      trans->r_lsn);
+			break;
+		default:
+			/* EFIs, EFDs and quotaoffs need nothing here */
+			break;
+		}
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+/*
+ * Called for each transaction as its commit record is found while the log
+ * is being replayed by xlog_recover_replay().
+ */
+int
+xlog_recover_replay_trans(
+	struct xlog		*log,
+	xlog_recover_t		*trans,
+	int			pass)
+{
+	xlog_recover_item_t	*item;
+	int			order;
+	int			error;
+
+	list_for_each_entry(item, &trans->r_itemq, ri_list) {
+		error = xlog_recover_item_valid(log, item);
+		if (error)
+			return error;
+	}
+
+	if (pass == XLOG_RECOVER_PASS1) {
+		list_for_each_entry(item, &trans->r_itemq, ri_list) {
+			switch (ITEM_TYPE(item)) {
+			case XFS_LI_BUF:
+				error = xlog_recover_buffer_pass1(log, item);
+				break;
+			case XFS_LI_QUOTAOFF:
+				error = xlog_recover_quotaoff_pass1(log, item);
+				break;
+			default:
+				error = 0;
+				break;
+			}
+			if (error)
+				return error;
+		}
+		return 0;
+	}
+
+	for (order = 0; order < XLOG_ITEM_ORDERS; order++) {
+		error = xlog_recover_items_pass2(log, trans, order);
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+/*
+ * Write back thread.  The buffer list is sorted and has no duplicates, so
+ * the threads can each take the next buffer without getting in each
+ * other's way.  A buffer that the cache had to reclaim during replay was
+ * written then, and comes back clean.
+ */
+static void *
+xlog_replay_writer(
+	void			*arg)
+{
+	struct xlog_replay	*rp = arg;
+	struct xlog		*log = rp->r_log;
+	struct xfs_mount	*mp = log->l_mp;
+	struct xlog_replay_buf	*rb;
+	struct xfs_buf		*bp;
+	__be64			*lsnp;
+	int			error;
+	int			i;
+
+	while ((i = __sync_fetch_and_add(&rp->r_next, 1)) < rp->r_nbufs) {
+		rb = &rp->r_bufs[i];
+		bp = libxfs_getbuf(mp->m_ddev_targp, rb->rb_blkno, rb->rb_len);
+		if (!bp) {
+			__sync_bool_compare_and_swap(&rp->r_error, 0, ENOMEM);
+			continue;
+		}
+		if ((bp->b_flags & LIBXFS_B_DIRTY) &&
+		    !(bp->b_flags & LIBXFS_B_STALE)) {
+			/* stamp the block with the last LSN replayed into it */
+			if (xfs_sb_version_hascrc(&mp->m_sb)) {
+				lsnp = xlog_recover_buf_lsnp(mp, bp);
+				if (lsnp)
+					*lsnp = cpu_to_be64(rb->rb_lsn);
+			}
+			error = libxfs_writebufr(bp);
+			if (error) {
+				xfs_warn(mp, "%s: write error %d on block 0x%llx",
+					__func__, error,
+					(unsigned long long)rb->rb_blkno);
+				__sync_bool_compare_and_swap(&rp->r_error, 0,
+							     error);
+			}
+		}
+		libxfs_putbuf(bp);
+	}
+	return NULL;
+}
+
+STATIC int
+xlog_replay_flush(
+	struct xlog_replay	*rp,
+	int			nthreads)
+{
+	pthread_t		*threads;
+	int			i, err;
+
+	xlog_replay_sort_bufs(rp);
+	if (nthreads > rp->r_nbufs)
+		nthreads = rp->r_nbufs;
+	if (nthreads <= 1) {
+		xlog_replay_writer(rp);
+		return rp->r_error;
+	}
+
+	threads = calloc(nthreads, sizeof(pthread_t));
+	if (!threads)
+		return XFS_ERROR(ENOMEM);
+	for (i = 0; i < nthreads; i++) {
+		err = pthread_create(&threads[i], NULL, xlog_replay_writer, rp);
+		if (err) {
+			xfs_warn(rp->r_log->l_mp,
+				"%s: cannot create writer thread, error %d",
+				__func__, err);
+			break;
+		}
+	}
+	/* whatever couldn't be started, do here */
+	if (i < nthreads)
+		xlog_replay_writer(rp);
+	while (--i >= 0)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	return rp->r_error;
+}
+
+/*
+ * Throw away whatever was replayed into the cache but not written, after a
+ * failure.  The log is still intact, so it can be replayed again later.
+ */
+STATIC void
+xlog_replay_discard(
+	struct xlog_replay	*rp)
+{
+	struct xfs_mount	*mp = rp->r_log->l_mp;
+	struct xfs_buf		*bp;
+	int			i;
+
+	for (i = 0; i < rp->r_nbufs; i++) {
+		bp = libxfs_getbuf(mp->m_ddev_targp, rp->r_bufs[i].rb_blkno,
+				   rp->r_bufs[i].rb_len);
+		if (!bp)
+			continue;
+		bp->b_flags &= ~(LIBXFS_B_DIRTY | LIBXFS_B_UPTODATE);
+		libxfs_putbuf(bp);
+		libxfs_purgebuf(bp);
+	}
+}
+
+/*
+ * Replay the log between tail_blk and head_blk into the filesystem, and
+ * write the result back with up to nthreads threads.  The caller clears
+ * the log afterwards if it wants to.
+ */
+int
+xlog_recover_replay(
+	struct xlog		*log,
+	xfs_daddr_t		head_blk,
+	xfs_daddr_t		tail_blk,
+	int			nthreads)
+{
+	struct xlog_replay	replay;
+	struct xlog_buf_cancel	*bcp, *n;
+	int			error;
+	int			i;
+
+	memset(&replay, 0, sizeof(replay));
+	for (i = 0; i < XLOG_BC_TABLE_SIZE; i++)
+		INIT_LIST_HEAD(&replay.r_buf_cancel[i]);
+	replay.r_log = log;
+	log->l_replay = &replay;
+
+	error = xlog_do_recovery_pass(log, head_blk, tail_blk,
+				      XLOG_RECOVER_PASS1);
+	if (!error)
+		error = xlog_do_recovery_pass(log, head_blk, tail_blk,
+					      XLOG_RECOVER_PASS2);
+	if (!error)
+		error = xlog_replay_flush(&replay, nthreads);
+	else
+		xlog_replay_discard(&replay);
+
+	for (i = 0; i < XLOG_BC_TABLE_SIZE; i++) {
+		list_for_each_entry_safe(bcp, n, &replay.r_buf_cancel[i],
+					 bc_list) {
+			list_del(&bcp->bc_list);
+			kmem_free(bcp);
+		}
+	}
+	free(replay.r_bufs);
+	log->l_replay = NULL;
+	return error;
+}
@@ -992,15 +992,92 @@ bp_err:
 	return -1;
 }
 
+/*
+ * In-flight transactions are kept in a hash table keyed by tid that grows
+ * with the number of transactions open at once, so a large log doesn't
+ * turn every op header into a long chain walk.  Transactions and items are
+ * carved out of chunks and recycled through free lists instead of being
+ * allocated one at a time; the chunks are freed at the end of the pass.
+ */
+#define XLOG_RECOVER_CHUNK	64	/* transactions or items per chunk */
+
+struct xlog_recover_chunk {
+	struct list_head	rc_list;
+	/* followed by XLOG_RECOVER_CHUNK objects */
+};
+
+struct xlog_rhash {
+	struct hlist_head	*rh_buckets;
+	int			rh_bits;
+	int			rh_count;	/* transactions in the table */
+	struct list_head	rh_chunks;
+	struct hlist_head	rh_free_trans;
+	struct list_head	rh_free_items;
+};
+
+STATIC void *
+xlog_recover_alloc_chunk(
+	struct xlog_rhash	*rh,
+	size_t			size)
+{
+	struct xlog_recover_chunk *chunk;
+
+	chunk = kmem_alloc(sizeof(*chunk) + XLOG_RECOVER_CHUNK * size,
+			   KM_SLEEP);
+	list_add(&chunk->rc_list, &rh->rh_chunks);
+	return chunk + 1;
+}
+
+STATIC void
+xlog_rhash_init(
+	struct xlog_rhash	*rh)
+{
+	rh->rh_bits = XLOG_RHASH_BITS;
+	rh->rh_count = 0;
+	rh->rh_buckets = kmem_zalloc(sizeof(struct hlist_head) << rh->rh_bits,
+				     KM_SLEEP);
+	INIT_LIST_HEAD(&rh->rh_chunks);
+	rh->rh_free_trans.first = NULL;
+	INIT_LIST_HEAD(&rh->rh_free_items);
+}
+
+/*
+ * Double the number of buckets and rehash the transactions into them.
+ */
+STATIC void
+xlog_rhash_grow(
+	struct xlog_rhash	*rh)
+{
+	struct hlist_head	*old = rh->rh_buckets;
+	int			old_bits = rh->rh_bits;
+	xlog_recover_t		*trans;
+	int			i;
+
+	rh->rh_bits++;
+	rh->rh_buckets = kmem_zalloc(sizeof(struct hlist_head) << rh->rh_bits,
+				     KM_SLEEP);
+	for (i = 0; i < (1 << old_bits); i++) {
+		while (old[i].first) {
+			trans = hlist_entry(old[i].first, xlog_recover_t,
+					    r_list);
+			hlist_del(&trans->r_list);
+			hlist_add_head(&trans->r_list, &rh->rh_buckets[
+				XLOG_RHASH(trans->r_log_tid, rh->rh_bits)]);
+		}
+	}
+	kmem_free(old);
+}
+
 STATIC xlog_recover_t *
 xlog_recover_find_tid(
-	struct hlist_head	*head,
+	struct xlog_rhash	*rh,
 	xlog_tid_t		tid)
 {
 	xlog_recover_t		*trans;
 	struct hlist_node	*n;
 
-	hlist_for_each_entry(trans, n, head, r_list) {
+	hlist_for_each_entry(trans, n,
+			&rh->rh_buckets[XLOG_RHASH(tid, rh->rh_bits)], r_list) {
 		if (trans->r_log_tid == tid)
 			return trans;
 	}
@@ -1009,28 +1086,53 @@ xlog_recover_find_tid(
 
 STATIC void
 xlog_recover_new_tid(
-	struct hlist_head	*head,
+	struct xlog_rhash	*rh,
 	xlog_tid_t		tid,
 	xfs_lsn_t		lsn)
 {
 	xlog_recover_t		*trans;
+	int			i;
 
-	trans = kmem_zalloc(sizeof(xlog_recover_t), KM_SLEEP);
+	if (!rh->rh_free_trans.first) {
+		trans = xlog_recover_alloc_chunk(rh, sizeof(xlog_recover_t));
+		for (i = 0; i < XLOG_RECOVER_CHUNK; i++)
+			hlist_add_head(&trans[i].r_list, &rh->rh_free_trans);
+	}
+	trans = hlist_entry(rh->rh_free_trans.first, xlog_recover_t, r_list);
+	hlist_del(&trans->r_list);
+
+	memset(trans, 0, sizeof(xlog_recover_t));
 	trans->r_log_tid   = tid;
 	trans->r_lsn	   = lsn;
 	INIT_LIST_HEAD(&trans->r_itemq);
 
+	if (++rh->rh_count > (XLOG_RHASH_LOAD << rh->rh_bits) &&
+	    rh->rh_bits < XLOG_RHASH_MAX_BITS)
+		xlog_rhash_grow(rh);
+
 	INIT_HLIST_NODE(&trans->r_list);
-	hlist_add_head(&trans->r_list, head);
+	hlist_add_head(&trans->r_list,
+		       &rh->rh_buckets[XLOG_RHASH(tid, rh->rh_bits)]);
 }
 
 STATIC void
 xlog_recover_add_item(
+	struct xlog_rhash	*rh,
 	struct list_head	*head)
 {
 	xlog_recover_item_t	*item;
+	int			i;
+
+	if (list_empty(&rh->rh_free_items)) {
+		item = xlog_recover_alloc_chunk(rh,
+					sizeof(xlog_recover_item_t));
+		for (i = 0; i < XLOG_RECOVER_CHUNK; i++)
+			list_add_tail(&item[i].ri_list, &rh->rh_free_items);
+	}
+	item = list_entry(rh->rh_free_items.next, xlog_recover_item_t, ri_list);
+	list_del(&item->ri_list);
 
-	item = kmem_zalloc(sizeof(xlog_recover_item_t), KM_SLEEP);
+	memset(item, 0, sizeof(xlog_recover_item_t));
 	INIT_LIST_HEAD(&item->ri_list);
 	list_add_tail(&item->ri_list, head);
 }
@@ -1040,6 +1142,7 @@ xlog_recover_add_item(
 STATIC int
 xlog_recover_add_to_cont_trans(
 	struct xlog		*log,
+	struct xlog_rhash	*rh,
 	struct xlog_recover	*trans,
 	xfs_caddr_t		dp,
 	int			len)
@@ -1050,7 +1153,7 @@ xlog_recover_add_to_cont_trans(
 
 	if (list_empty(&trans->r_itemq)) {
 		/* finish copying rest of trans header */
-		xlog_recover_add_item(&trans->r_itemq);
+		xlog_recover_add_item(rh, &trans->r_itemq);
 		ptr = (xfs_caddr_t) &trans->r_theader +
 				sizeof(xfs_trans_header_t) - len;
 		memcpy(ptr, dp, len); /* d, s, l */
@@ -1086,6 +1189,7 @@ xlog_recover_add_to_cont_trans(
 STATIC int
 xlog_recover_add_to_trans(
 	struct xlog		*log,
+	struct xlog_rhash	*rh,
 	struct xlog_recover	*trans,
 	xfs_caddr_t		dp,
 	int			len)
@@ -1105,7 +1209,7 @@ xlog_recover_add_to_trans(
 			return XFS_ERROR(EIO);
 		}
 		if (len == sizeof(xfs_trans_header_t))
-			xlog_recover_add_item(&trans->r_itemq);
+			xlog_recover_add_item(rh, &trans->r_itemq);
 		memcpy(&trans->r_theader, dp, len); /* d, s, l */
 		return 0;
 	}
@@ -1119,7 +1223,7 @@ xlog_recover_add_to_trans(
 	if (item->ri_total != 0 &&
 	     item->ri_total == item->ri_cnt) {
 		/* tail item is in use, get a new one */
-		xlog_recover_add_item(&trans->r_itemq);
+		xlog_recover_add_item(rh, &trans->r_itemq);
 		item = list_entry(trans->r_itemq.prev,
 					xlog_recover_item_t, ri_list);
 	}
@@ -1156,6 +1260,7 @@ xlog_recover_add_to_trans(
  */
 STATIC void
 xlog_recover_free_trans(
+	struct xlog_rhash	*rh,
 	struct xlog_recover	*trans)
 {
 	xlog_recover_item_t	*item, *n;
@@ -1166,12 +1271,39 @@ xlog_recover_free_trans(
 		list_del(&item->ri_list);
 		for (i = 0; i < item->ri_cnt; i++)
 			kmem_free(item->ri_buf[i].i_addr);
-		/* Free the item itself */
 		kmem_free(item->ri_buf);
-		kmem_free(item);
+		/* Put the item itself back on the free list */
+		list_add(&item->ri_list, &rh->rh_free_items);
+	}
+	/* Put the transaction recover structure back on the free list */
+	hlist_add_head(&trans->r_list, &rh->rh_free_trans);
+}
+
+/*
+ * Free the transactions that never committed and the chunks everything
+ * was allocated from.
+ */
+STATIC void
+xlog_rhash_destroy(
+	struct xlog_rhash	*rh)
+{
+	struct xlog_recover_chunk *chunk, *n;
+	xlog_recover_t		*trans;
+	int			i;
+
+	for (i = 0; i < (1 << rh->rh_bits); i++) {
+		while (rh->rh_buckets[i].first) {
+			trans = hlist_entry(rh->rh_buckets[i].first,
+					    xlog_recover_t, r_list);
+			hlist_del(&trans->r_list);
+			xlog_recover_free_trans(rh, trans);
+		}
+	}
+	list_for_each_entry_safe(chunk, n, &rh->rh_chunks, rc_list) {
+		list_del(&chunk->rc_list);
+		kmem_free(chunk);
 	}
-	/* Free the transaction recover structure */
-	kmem_free(trans);
+	kmem_free(rh->rh_buckets);
 }
 
 /*
@@ -1183,17 +1315,21 @@ xlog_recover_free_trans(
 STATIC int
 xlog_recover_commit_trans(
 	struct xlog		*log,
+	struct xlog_rhash	*rh,
 	struct xlog_recover	*trans,
 	int			pass)
 {
 	int			error = 0;
 
 	hlist_del(&trans->r_list);
-	if ((error = xlog_recover_do_trans(log, trans, pass)))
-		return error;
+	rh->rh_count--;
+	if (log->l_replay)
+		error = xlog_recover_replay_trans(log, trans, pass);
+	else
+		error = xlog_recover_do_trans(log, trans, pass);
 
-	xlog_recover_free_trans(trans);
-	return 0;
+	xlog_recover_free_trans(rh, trans);
+	return error;
 }
 
 STATIC int
@@ -1205,6 +1341,38 @@ xlog_recover_unmount_trans(
 	return 0;
 }
 
+/*
+ * Callers that only want part of the log can restrict recovery to the
+ * transactions that start in a range of LSNs.  Transactions starting
+ * anywhere else are never put in the table, so the rest of their ops are
+ * skipped as they are found.
+ */
+static inline int
+xlog_recover_lsn_wanted(
+	struct xlog		*log,
+	xfs_lsn_t		lsn)
+{
+	if (log->l_recover_start && XFS_LSN_CMP(lsn, log->l_recover_start) < 0)
+		return 0;
+	if (log->l_recover_end && XFS_LSN_CMP(lsn, log->l_recover_end) > 0)
+		return 0;
+	return 1;
+}
+
+/*
+ * Once a record starts past the end of the range and every transaction
+ * from inside it has committed, there is nothing left to recover.
+ */
+static inline int
+xlog_recover_past_end(
+	struct xlog		*log,
+	struct xlog_rec_header	*rhead,
+	struct xlog_rhash	*rh)
+{
+	return log->l_recover_end && !rh->rh_count &&
+	       XFS_LSN_CMP(be64_to_cpu(rhead->h_lsn), log->l_recover_end) > 0;
+}
+
 /*
  * There are two valid states of the r_state field.  0 indicates that the
  * transaction structure is in a normal state.  We have either seen the
@@ -1217,7 +1385,7 @@ xlog_recover_unmount_trans(
 STATIC int
 xlog_recover_process_data(
 	struct xlog		*log,
-	struct hlist_head	rhash[],
+	struct xlog_rhash	*rh,
 	struct xlog_rec_header	*rhead,
 	xfs_caddr_t		dp,
 	int			pass)
@@ -1228,7 +1396,6 @@ xlog_recover_process_data(
 	xlog_recover_t		*trans;
 	xlog_tid_t		tid;
 	int			error;
-	unsigned long		hash;
 	uint			flags;
 
 	lp = dp + be32_to_cpu(rhead->h_len);
@@ -1250,11 +1417,12 @@ xlog_recover_process_data(
 			return (XFS_ERROR(EIO));
 		}
 		tid = be32_to_cpu(ohead->oh_tid);
-		hash = XLOG_RHASH(tid);
-		trans = xlog_recover_find_tid(&rhash[hash], tid);
+		trans = xlog_recover_find_tid(rh, tid);
 		if (trans == NULL) {		   /* not found; add new tid */
-			if (ohead->oh_flags & XLOG_START_TRANS)
-				xlog_recover_new_tid(&rhash[hash], tid,
+			if ((ohead->oh_flags & XLOG_START_TRANS) &&
+			    xlog_recover_lsn_wanted(log,
+					be64_to_cpu(rhead->h_lsn)))
+				xlog_recover_new_tid(rh, tid,
 					be64_to_cpu(rhead->h_lsn));
 		} else {
 			if (dp + be32_to_cpu(ohead->oh_len) > lp) {
@@ -1267,7 +1435,7 @@ xlog_recover_process_data(
 				flags &= ~XLOG_CONTINUE_TRANS;
 			switch (flags) {
 			case XLOG_COMMIT_TRANS:
-				error = xlog_recover_commit_trans(log,
+				error = xlog_recover_commit_trans(log, rh,
 								trans, pass);
 				break;
 			case XLOG_UNMOUNT_TRANS:
@@ -1275,7 +1443,7 @@ xlog_recover_process_data(
 				break;
 			case XLOG_WAS_CONT_TRANS:
 				error = xlog_recover_add_to_cont_trans(log,
-						trans, dp,
+						rh, trans, dp,
 						be32_to_cpu(ohead->oh_len));
 				break;
 			case XLOG_START_TRANS:
@@ -1286,8 +1454,9 @@ xlog_recover_process_data(
 				break;
 			case 0:
 			case XLOG_CONTINUE_TRANS:
-				error = xlog_recover_add_to_trans(log, trans,
-						dp, be32_to_cpu(ohead->oh_len));
+				error = xlog_recover_add_to_trans(log, rh,
+						trans, dp,
+						be32_to_cpu(ohead->oh_len));
 				break;
 			default:
 				xfs_warn(log->l_mp, "%s: bad flag 0x%x",
@@ -1305,6 +1474,50 @@ xlog_recover_process_data(
 	return 0;
 }
 
+/*
+ * Calculate the checksum of a log record, as it was written: the header,
+ * the cycle data in any extended headers, which must follow the header in
+ * memory, and the record data before the cycle data is unpacked.
+ *
+ * The number of extended headers covered is worked out from the size of
+ * the record, not the iclog size it was written with, but never goes past
+ * the headers the record says it has.
+ */
+__le32
+xlog_cksum(
+	struct xlog		*log,
+	struct xlog_rec_header	*rhead,
+	char			*dp,
+	int			size)
+{
+	__uint32_t		crc;
+
+	/* first generate the crc for the record header ... */
+	crc = xfs_start_cksum((char *)rhead,
+			      sizeof(struct xlog_rec_header),
+			      offsetof(struct xlog_rec_header, h_crc));
+
+	/* ... then for additional cycle data for v2 logs ... */
+	if (be32_to_cpu(rhead->h_version) & XLOG_VERSION_2) {
+		union xlog_in_core2 *xhdr = (union xlog_in_core2 *)rhead;
+		int		i;
+		int		xheads;
+
+		xheads = howmany(size, XLOG_HEADER_CYCLE_SIZE);
+		xheads = MIN(xheads,
+			be32_to_cpu(rhead->h_size) / XLOG_HEADER_CYCLE_SIZE);
+		for (i = 1; i < xheads; i++) {
+			crc = crc32c(crc, &xhdr[i].hic_xheader,
+				     sizeof(struct xlog_rec_ext_header));
+		}
+	}
+
+	/* ... and finally for the payload */
+	crc = crc32c(crc, dp, size);
+
+	return xfs_end_cksum(crc);
+}
+
 /*
  * Upack the log buffer data and crc check it. If the check fails, issue a
  * warning if and only if the CRC in the header is non-zero. This makes the
@@ -1314,11 +1527,7 @@ xlog_recover_process_data(
  *
  * When filesystems are CRC enabled, this CRC mismatch becomes a fatal log
  * corruption failure
- *
- * XXX: we do not calculate the CRC here yet. It's not clear what we should do
- * with CRC errors here in userspace, so we'll address that problem later on.
  */
-#define xlog_cksum(l,r,dp,len)	((r)->h_crc)
 STATIC int
 xlog_unpack_data_crc(
 	struct xlog_rec_header	*rhead,
@@ -1439,7 +1648,7 @@ xlog_do_recovery_pass(
 	int			error = 0, h_size;
 	int			bblks, split_bblks;
 	int			hblks, split_hblks, wrapped_hblks;
-	struct hlist_head	rhash[XLOG_RHASH_SIZE];
+	struct xlog_rhash	rhash;
 
 	ASSERT(head_blk != tail_blk);
 
@@ -1491,7 +1700,7 @@ xlog_do_recovery_pass(
 		return ENOMEM;
 	}
 
-	memset(rhash, 0, sizeof(rhash));
+	xlog_rhash_init(&rhash);
 	if (tail_blk <= head_blk) {
 		for (blk_no = tail_blk; blk_no < head_blk; ) {
 			error = xlog_bread(log, blk_no, hblks, hbp, &offset);
@@ -1502,6 +1711,8 @@ xlog_do_recovery_pass(
 			error = xlog_valid_rec_header(log, rhead, blk_no);
 			if (error)
 				goto bread_err2;
+			if (xlog_recover_past_end(log, rhead, &rhash))
+				goto bread_err2;
 
 			/* blocks in data section */
 			bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
@@ -1515,7 +1726,7 @@ xlog_do_recovery_pass(
 				goto bread_err2;
 
 			error = xlog_recover_process_data(log,
-						rhash, rhead, offset, pass);
+						&rhash, rhead, offset, pass);
 			if (error)
 				goto bread_err2;
 			blk_no += bblks + hblks;
@@ -1578,6 +1789,8 @@ xlog_do_recovery_pass(
 						split_hblks ? blk_no : 0);
 			if (error)
 				goto bread_err2;
+			if (xlog_recover_past_end(log, rhead, &rhash))
+				goto bread_err2;
 
 			bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
 			blk_no += hblks;
@@ -1631,7 +1844,7 @@ xlog_do_recovery_pass(
 			if (error)
 				goto bread_err2;
 
-			error = xlog_recover_process_data(log, rhash,
+			error = xlog_recover_process_data(log, &rhash,
 							rhead, offset, pass);
 			if (error)
 				goto bread_err2;
@@ -1651,6 +1864,8 @@ xlog_do_recovery_pass(
 			error = xlog_valid_rec_header(log, rhead, blk_no);
 			if (error)
 				goto bread_err2;
+			if (xlog_recover_past_end(log, rhead, &rhash))
+				goto bread_err2;
 
 			bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
 			error = xlog_bread(log, blk_no+hblks, bblks, dbp,
@@ -1662,7 +1877,7 @@ xlog_do_recovery_pass(
 			if (error)
 				goto bread_err2;
 
-			error = xlog_recover_process_data(log, rhash,
+			error = xlog_recover_process_data(log, &rhash,
 							rhead, offset, pass);
 			if (error)
 				goto bread_err2;
@@ -1671,6 +1886,7 @@ xlog_do_recovery_pass(
 	}
 
  bread_err2:
+	xlog_rhash_destroy(&rhash);
 	xlog_put_bp(dbp);
  bread_err1:
 	xlog_put_bp(hbp);
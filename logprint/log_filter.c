@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2000-2001,2005 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "logprint.h"
+
+/*
+ * Item filters for the transactional view.
+ *
+ * Items are matched on their log format header alone, before anything is
+ * decoded or printed, so an item that is filtered out costs next to
+ * nothing.  The LSN range isn't handled here: it is passed down to the
+ * recovery code, which never builds the transactions outside of it.
+ */
+struct logprint_filter	print_filter;
+
+static struct {
+	uint		type;
+	char		*name;
+} item_types[] = {
+	{ XFS_LI_BUF,		"buf" },
+	{ XFS_LI_INODE,		"inode" },
+	{ XFS_LI_DQUOT,		"dquot" },
+	{ XFS_LI_QUOTAOFF,	"quotaoff" },
+	{ XFS_LI_EFI,		"efi" },
+	{ XFS_LI_EFD,		"efd" },
+	{ XFS_LI_ICREATE,	"icreate" },
+};
+
+#define ITEM_TYPE_BIT(t)	\
+	((t) >= XFS_LI_EFI && (t) <= XFS_LI_ICREATE ? \
+		1U << ((t) - XFS_LI_EFI) : 0)
+
+char *
+xlog_item_type_name(
+	uint		type)
+{
+	int		i;
+
+	for (i = 0; i < ARRAY_SIZE(item_types); i++)
+		if (item_types[i].type == type)
+			return item_types[i].name;
+	return "unknown";
+}
+
+static int
+parse_u64(
+	char		*s,
+	char		**end,
+	__uint64_t	*val)
+{
+	errno = 0;
+	*val = strtoull(s, end, 0);
+	return errno || *end == s;
+}
+
+/* -I ino */
+int
+logprint_filter_ino(
+	char		*arg)
+{
+	char		*p;
+	__uint64_t	ino;
+
+	if (parse_u64(arg, &p, &ino) || *p)
+		return EINVAL;
+	print_filter.ino = ino;
+	print_filter.has_ino = 1;
+	print_filter.active = 1;
+	return 0;
+}
+
+/* -a start[-end], end inclusive */
+int
+logprint_filter_daddr(
+	char		*arg)
+{
+	char		*p;
+	__uint64_t	start, end;
+
+	if (parse_u64(arg, &p, &start))
+		return EINVAL;
+	end = start;
+	if (*p == '-' && parse_u64(p + 1, &p, &end))
+		return EINVAL;
+	if (*p || end < start)
+		return EINVAL;
+	print_filter.daddr_start = start;
+	print_filter.daddr_end = end;
+	print_filter.has_daddr = 1;
+	print_filter.active = 1;
+	return 0;
+}
+
+/* -T type[,type...] */
+int
+logprint_filter_types(
+	char		*arg)
+{
+	char		*p, *s;
+	int		i;
+
+	for (s = arg; s && *s; s = p) {
+		p = strchr(s, ',');
+		if (p)
+			*p++ = '\0';
+		for (i = 0; i < ARRAY_SIZE(item_types); i++)
+			if (!strcmp(s, item_types[i].name))
+				break;
+		if (i == ARRAY_SIZE(item_types))
+			return EINVAL;
+		print_filter.types |= ITEM_TYPE_BIT(item_types[i].type);
+	}
+	print_filter.active = 1;
+	return 0;
+}
+
+/*
+ * An LSN is given as cycle:block.  Without a block, the start of a range
+ * is the start of the cycle and the end of a range is the end of it.
+ */
+static int
+parse_lsn(
+	char		*s,
+	char		**end,
+	int		is_end,
+	xfs_lsn_t	*lsn)
+{
+	__uint64_t	cycle, block;
+
+	if (parse_u64(s, end, &cycle) || cycle > UINT_MAX)
+		return EINVAL;
+	block = is_end ? UINT_MAX : 0;
+	if (**end == ':' &&
+	    (parse_u64(*end + 1, end, &block) || block > UINT_MAX))
+		return EINVAL;
+	*lsn = xlog_assign_lsn(cycle, block);
+	return 0;
+}
+
+/* -L lsn[-lsn], either end may be left off */
+int
+logprint_filter_lsn(
+	char		*arg,
+	xfs_lsn_t	*start,
+	xfs_lsn_t	*end)
+{
+	char		*p = arg;
+
+	*start = 0;
+	*end = 0;
+	if (*p != '-' && parse_lsn(p, &p, 0, start))
+		return EINVAL;
+	if (*p == '-') {
+		p++;
+		if (*p && parse_lsn(p, &p, 1, end))
+			return EINVAL;
+	} else
+		*end = xlog_assign_lsn(CYCLE_LSN(*start), UINT_MAX);
+	if (*p || (*start && *end && XFS_LSN_CMP(*start, *end) > 0))
+		return EINVAL;
+	return 0;
+}
+
+/*
+ * The EFI format in the log depends on the kernel that wrote it, so give
+ * back a native copy.  The caller frees it.
+ */
+xfs_efi_log_format_t *
+xlog_recover_efi_format(
+	struct xlog_recover_item *item)
+{
+	xfs_efi_log_format_t	*src_f, *f;
+	uint			dst_len;
+
+	src_f = (xfs_efi_log_format_t *)item->ri_buf[0].i_addr;
+	dst_len = sizeof(xfs_efi_log_format_t) +
+		(src_f->efi_nextents - 1) * sizeof(xfs_extent_t);
+	if ((f = (xfs_efi_log_format_t *)malloc(dst_len)) == NULL) {
+		fprintf(stderr, _("%s: %s: malloc failed\n"),
+			progname, __FUNCTION__);
+		exit(1);
+	}
+	if (xfs_efi_copy_format((char *)src_f, item->ri_buf[0].i_len, f, 0)) {
+		free(f);
+		return NULL;
+	}
+	return f;
+}
+
+/*
+ * Inode chunk allocations and the extents in an EFI are in filesystem
+ * blocks, which can only be mapped to disk addresses when the superblock
+ * was read.
+ */
+static int
+has_geometry(
+	struct xfs_mount	*mp)
+{
+	return mp && mp->m_sb.sb_agblklog;
+}
+
+/*
+ * Dquot buffer lengths are logged in filesystem blocks.  Returns the length
+ * in basic blocks, or 0 without the geometry to convert it.
+ */
+int
+xlog_recover_dquot_bblen(
+	xfs_dq_logformat_t	*f,
+	struct xfs_mount	*mp)
+{
+	if (!has_geometry(mp))
+		return 0;
+	return XFS_FSB_TO_BB(mp, f->qlf_len);
+}
+
+static int
+daddr_overlaps(
+	xfs_daddr_t		blkno,
+	__int64_t		len)
+{
+	return blkno <= print_filter.daddr_end &&
+	       blkno + len > print_filter.daddr_start;
+}
+
+static int
+filter_match_daddr(
+	struct xlog_recover_item *item,
+	struct xfs_mount	*mp)
+{
+	xfs_buf_log_format_t	*bf;
+	xfs_inode_log_format_t	f_buf, *f;
+	xfs_dq_logformat_t	*qf;
+	xfs_efi_log_format_t	*ef;
+	struct xfs_icreate_log	*icl;
+	xfs_daddr_t		blkno;
+	int			i, len, match = 0;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_BUF:
+		bf = (xfs_buf_log_format_t *)item->ri_buf[0].i_addr;
+		return daddr_overlaps(bf->blf_blkno, bf->blf_len);
+	case XFS_LI_INODE:
+		f = xfs_inode_item_format_convert(item->ri_buf[0].i_addr,
+				item->ri_buf[0].i_len, &f_buf);
+		return daddr_overlaps(f->ilf_blkno, f->ilf_len);
+	case XFS_LI_DQUOT:
+		qf = (xfs_dq_logformat_t *)item->ri_buf[0].i_addr;
+		/* without the geometry only the first sector is known */
+		len = xlog_recover_dquot_bblen(qf, mp);
+		return daddr_overlaps(qf->qlf_blkno, len ? len : 1);
+	case XFS_LI_ICREATE:
+		if (!has_geometry(mp))
+			return 0;
+		icl = (struct xfs_icreate_log *)item->ri_buf[0].i_addr;
+		blkno = XFS_AGB_TO_DADDR(mp, be32_to_cpu(icl->icl_ag),
+					 be32_to_cpu(icl->icl_agbno));
+		return daddr_overlaps(blkno,
+			XFS_FSB_TO_BB(mp, (__int64_t)be32_to_cpu(icl->icl_length)));
+	case XFS_LI_EFI:
+		if (!has_geometry(mp) || !(ef = xlog_recover_efi_format(item)))
+			return 0;
+		for (i = 0; i < ef->efi_nextents && !match; i++)
+			match = daddr_overlaps(
+				XFS_FSB_TO_DADDR(mp, ef->efi_extents[i].ext_start),
+				XFS_FSB_TO_BB(mp,
+				    (__int64_t)ef->efi_extents[i].ext_len));
+		free(ef);
+		return match;
+	}
+	return 0;
+}
+
+static int
+filter_match_ino(
+	struct xlog_recover_item *item,
+	struct xfs_mount	*mp)
+{
+	xfs_inode_log_format_t	f_buf, *f;
+	struct xfs_icreate_log	*icl;
+	xfs_agblock_t		agbno;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_INODE:
+		f = xfs_inode_item_format_convert(item->ri_buf[0].i_addr,
+				item->ri_buf[0].i_len, &f_buf);
+		return f->ilf_ino == print_filter.ino;
+	case XFS_LI_ICREATE:
+		/* the chunk allocation that brought the inode into being */
+		if (!has_geometry(mp))
+			return 0;
+		icl = (struct xfs_icreate_log *)item->ri_buf[0].i_addr;
+		agbno = XFS_INO_TO_AGBNO(mp, print_filter.ino);
+		return XFS_INO_TO_AGNO(mp, print_filter.ino) ==
+				be32_to_cpu(icl->icl_ag) &&
+		       agbno >= be32_to_cpu(icl->icl_agbno) &&
+		       agbno < be32_to_cpu(icl->icl_agbno) +
+				be32_to_cpu(icl->icl_length);
+	}
+	return 0;
+}
+
+int
+xlog_recover_filter_item(
+	struct xlog_recover_item *item,
+	struct xfs_mount	*mp)
+{
+	if (!print_filter.active)
+		return 1;
+	if (print_filter.types &&
+	    !(print_filter.types & ITEM_TYPE_BIT(ITEM_TYPE(item))))
+		return 0;
+	if (print_filter.has_ino && !filter_match_ino(item, mp))
+		return 0;
+	if (print_filter.has_daddr && !filter_match_daddr(item, mp))
+		return 0;
+	return 1;
+}
+
+int
+xlog_recover_filter_trans(
+	xlog_recover_t		*trans,
+	struct xfs_mount	*mp)
+{
+	xlog_recover_item_t	*item;
+
+	if (!print_filter.active)
+		return 1;
+	list_for_each_entry(item, &trans->r_itemq, ri_list)
+		if (xlog_recover_filter_item(item, mp))
+			return 1;
+	return 0;
+}
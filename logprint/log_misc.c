@@ -20,8 +20,6 @@
 
 #define CLEARED_BLKS	(-5)
 #define ZEROED_LOG	(-4)
-#define FULL_READ	(-3)
-#define PARTIAL_READ	(-2)
 #define BAD_HEADER	(-1)
 #define NO_ERROR	(0)
 
@@ -892,21 +890,21 @@ print_lsn(xfs_caddr_t	string,
 }
 
 
+/*
+ * Print the ops in a log record whose data has been read in and unpacked
+ * by the log stream.
+ */
 int
 xlog_print_record(
 	struct xlog		*log,
-	int			fd,
 	int			num_ops,
 	int			len,
-	int			*read_type,
-	xfs_caddr_t		*partial_buf,
-	xlog_rec_header_t	*rhead,
-	xlog_rec_ext_header_t	*xhdrs,
+	xfs_caddr_t		buf,
 	int			bad_hdr_warn)
 {
-    xfs_caddr_t		buf, ptr;
-    int			read_len, skip, lost_context = 0;
-    int			ret, n, i, j, k;
+    xfs_caddr_t		ptr;
+    int			skip, lost_context = 0;
+    int			n, i;
 
     if (print_no_print)
 	    return NO_ERROR;
@@ -916,88 +914,6 @@ xlog_print_record(
 	return NO_ERROR;
     }
 
-    /* read_len must read up to some block boundary */
-    read_len = (int) BBTOB(BTOBB(len));
-
-    /* read_type => don't malloc() new buffer, use old one */
-    if (*read_type == FULL_READ) {
-	if ((ptr = buf = (xfs_caddr_t)malloc(read_len)) == NULL) {
-	    fprintf(stderr, _("%s: xlog_print_record: malloc failed\n"), progname);
-	    exit(1);
-	}
-    } else {
-	read_len -= *read_type;
-	buf = (xfs_caddr_t)((__psint_t)(*partial_buf) + (__psint_t)(*read_type));
-	ptr = *partial_buf;
-    }
-    if ((ret = (int) read(fd, buf, read_len)) == -1) {
-	fprintf(stderr, _("%s: xlog_print_record: read error\n"), progname);
-	exit(1);
-    }
-    /* Did we overflow the end? */
-    if (*read_type == FULL_READ &&
-	BLOCK_LSN(be64_to_cpu(rhead->h_lsn)) + BTOBB(read_len) >=
-		logBBsize) {
-	*read_type = BBTOB(logBBsize - BLOCK_LSN(be64_to_cpu(rhead->h_lsn))-1);
-	*partial_buf = buf;
-	return PARTIAL_READ;
-    }
-
-    /* Did we read everything? */
-    if ((ret == 0 && read_len != 0) || ret != read_len) {
-	*read_type = ret;
-	*partial_buf = buf;
-	return PARTIAL_READ;
-    }
-    if (*read_type != FULL_READ)
-	read_len += *read_type;
-
-    /* Everything read in.  Start from beginning of buffer
-     * Unpack the data, by putting the saved cycle-data back
-     * into the first word of each BB.
-     * Do some checks.
-     */
-    buf = ptr;
-    for (i = 0; ptr < buf + read_len; ptr += BBSIZE, i++) {
-	xlog_rec_header_t *rechead = (xlog_rec_header_t *)ptr;
-
-	/* sanity checks */
-	if (be32_to_cpu(rechead->h_magicno) == XLOG_HEADER_MAGIC_NUM) {
-	    /* data should not have magicno as first word
-	     * as it should by cycle#
-	     */
-	    free(buf);
-	    return -1;
-	} else {
-	    /* verify cycle#
-	     * FIXME: cycle+1 should be a macro pv#900369
-	     */
-	    if (be32_to_cpu(rhead->h_cycle) !=
-			be32_to_cpu(*(__be32 *)ptr)) {
-		if ((*read_type == FULL_READ) ||
-		    (be32_to_cpu(rhead->h_cycle) + 1 !=
-				be32_to_cpu(*(__be32 *)ptr))) {
-			free(buf);
-			return -1;
-		}
-	    }
-	}
-
-	/* copy back the data from the header */
-	if (i < XLOG_HEADER_CYCLE_SIZE / BBSIZE) {
-		/* from 1st header */
-		*(__be32 *)ptr = rhead->h_cycle_data[i];
-	}
-	else {
-		ASSERT(xhdrs != NULL);
-		/* from extra headers */
-		j = i / (XLOG_HEADER_CYCLE_SIZE / BBSIZE);
-		k = i % (XLOG_HEADER_CYCLE_SIZE / BBSIZE);
-		*(__be32 *)ptr = xhdrs[j-1].xh_cycle_data[k];
-	}
-
-    }
-
     ptr = buf;
     for (i=0; i<num_ops; i++) {
 	int continued;
@@ -1090,10 +1006,8 @@ xlog_print_record(
 				fprintf(stderr,
 			_("%s: unknown log operation type (%x)\n"),
 					progname, *(unsigned short *)ptr);
-				if (print_exit) {
-					free(buf);
+				if (print_exit)
 					return BAD_HEADER;
-				}
 			} else {
 				printf(
 			_("Left over region from split log item\n"));
@@ -1109,10 +1023,33 @@ xlog_print_record(
 	}
     }
     printf("\n");
-    free(buf);
     return NO_ERROR;
 }	/* xlog_print_record */
 
+/*
+ * Print a record from the log stream: complain if its CRC doesn't match,
+ * then print its ops, or return -1 if its data couldn't be unpacked.
+ */
+static int
+xlog_print_unit(
+	struct xlog		*log,
+	struct xlog_unit	*u,
+	int			num_ops,
+	int			len,
+	int			bad_hdr_warn)
+{
+    xlog_rec_header_t	*head = (xlog_rec_header_t *)u->u_buf;
+
+    /* a zero CRC was never calculated: v4 logs, or written by mkfs */
+    if (head->h_crc && u->u_crc != head->h_crc)
+	printf(_("log record CRC mismatch: found 0x%x, expected 0x%x\n"),
+		le32_to_cpu(head->h_crc), le32_to_cpu(u->u_crc));
+
+    if (len && u->u_status)
+	return -1;
+    return xlog_print_record(log, num_ops, len, u->u_data, bad_hdr_warn);
+}
+
 
 int
 xlog_print_rec_head(xlog_rec_header_t *head, int *len, int bad_hdr_warn)
@@ -1252,34 +1189,18 @@ print_xlog_bad_reqd_hdrs(xfs_daddr_t blkno, int num_reqd, int num_hdrs)
 	    xlog_exit(_("Not enough headers for data length."));
 }	/* print_xlog_bad_reqd_hdrs */
 
+/* for V2 logs print out each extra hdr */
 static void
-xlog_reallocate_xhdrs(int num_hdrs, xlog_rec_ext_header_t **ret_xhdrs)
-{
-	int len = (num_hdrs-1) * sizeof(xlog_rec_ext_header_t);
-
-	*ret_xhdrs = (xlog_rec_ext_header_t *)realloc(*ret_xhdrs, len);
-	if (*ret_xhdrs == NULL) {
-		fprintf(stderr, _("%s: xlog_print: malloc failed for ext hdrs\n"), progname);
-		exit(1);
-	}
-}
-
-/* for V2 logs read each extra hdr and print it out */
-static int
 xlog_print_extended_headers(
-	int			fd,
+	struct xlog_unit	*u,
 	int			len,
-	xfs_daddr_t		*blkno,
-	xlog_rec_header_t	*hdr,
-	int 			*ret_num_hdrs,
-	xlog_rec_ext_header_t	**ret_xhdrs)
+	xfs_daddr_t		*blkno)
 {
-	int			i, j;
+	xlog_rec_header_t	*hdr = (xlog_rec_header_t *)u->u_buf;
+	int			i;
 	int			coverage_bb;
 	int 			num_hdrs;
 	int 			num_required;
-	char			xhbuf[XLOG_HEADER_SIZE];
-	xlog_rec_ext_header_t	*x;
 
 	num_required = howmany(len, XLOG_HEADER_CYCLE_SIZE);
 	num_hdrs = be32_to_cpu(hdr->h_size) / XLOG_HEADER_CYCLE_SIZE;
@@ -1288,75 +1209,37 @@ xlog_print_extended_headers(
 	    print_xlog_bad_reqd_hdrs((*blkno)-1, num_required, num_hdrs);
 	}
 
-	if (num_hdrs == 1) {
-	    free(*ret_xhdrs);
-	    *ret_xhdrs = NULL;
-	    *ret_num_hdrs = 1;
-	    return 0;
-	}
-
-	if (*ret_xhdrs == NULL || num_hdrs > *ret_num_hdrs) {
-	    xlog_reallocate_xhdrs(num_hdrs, ret_xhdrs);
-	}
-
-	*ret_num_hdrs = num_hdrs;
-
 	/* don't include 1st header */
-	for (i = 1, x = *ret_xhdrs; i < num_hdrs; i++, (*blkno)++, x++) {
-	    /* read one extra header blk */
-	    if (read(fd, xhbuf, 512) == 0) {
-		printf(_("%s: physical end of log\n"), progname);
-		print_xlog_record_line();
-		/* reached the end so return 1 */
-		return 1;
-	    }
-	    if (print_only_data) {
-		printf(_("BLKNO: %lld\n"), (long long)*blkno);
-		xlog_recover_print_data(xhbuf, 512);
+	for (i = 1; i < u->u_hblks; i++, (*blkno)++) {
+	    if (i == num_hdrs - 1) {
+		/* last header */
+		coverage_bb = BTOBB(len) %
+				(XLOG_HEADER_CYCLE_SIZE / BBSIZE);
 	    }
 	    else {
-		if (i == num_hdrs - 1) {
-		    /* last header */
-		    coverage_bb = BTOBB(len) %
-				    (XLOG_HEADER_CYCLE_SIZE / BBSIZE);
-		}
-		else {
-		    /* earliear header */
-		    coverage_bb = XLOG_HEADER_CYCLE_SIZE / BBSIZE;
-		}
-		xlog_print_rec_xhead((xlog_rec_ext_header_t*)xhbuf, coverage_bb);
-	    }
-
-	    /* Copy from buffer into xhdrs array for later.
-	     * Could endian convert here but then code later on
-	     * will look asymmetric with the 1 hdr normal case
-	     * which does endian coversion on access.
-	     */
-	    x->xh_cycle = ((xlog_rec_ext_header_t*)xhbuf)->xh_cycle;
-	    for (j = 0; j < XLOG_HEADER_CYCLE_SIZE / BBSIZE; j++) {
-		x->xh_cycle_data[j] =
-		    ((xlog_rec_ext_header_t*)xhbuf)->xh_cycle_data[j];
+		/* earliear header */
+		coverage_bb = XLOG_HEADER_CYCLE_SIZE / BBSIZE;
 	    }
+	    xlog_print_rec_xhead((xlog_rec_ext_header_t *)
+			xlog_unit_block(u, u->u_blkno + i), coverage_bb);
 	}
-	return 0;
 }
 
 
 /*
- * This code is gross and needs to be rewritten.
+ * Print the log one record at a time.  The records come from the log
+ * stream, which reads and unpacks them ahead of us.
  */
 void xfs_log_print(struct xlog  *log,
 		   int          fd,
 		   int		print_block_start)
 {
-    char			hbuf[XLOG_HEADER_SIZE];
-    xlog_rec_header_t		*hdr = (xlog_rec_header_t *)&hbuf[0];
-    xlog_rec_ext_header_t 	*xhdrs = NULL;
-    int				num_ops, len, num_hdrs = 1;
+    xlog_rec_header_t		*hdr;
+    struct xlog_stream		*stream;
+    struct xlog_unit		*u;
+    int				num_ops, len;
     xfs_daddr_t			block_end = 0, block_start, blkno, error;
     xfs_daddr_t			zeroed_blkno = 0, cleared_blkno = 0;
-    int				read_type = FULL_READ;
-    xfs_caddr_t			partial_buf;
     int				zeroed = 0;
     int				cleared = 0;
     int				first_hdr_found = 0;
@@ -1376,18 +1259,21 @@ void xfs_log_print(struct xlog  *log,
 	block_start = block_end;
     else
 	block_start = print_block_start;
-    xlog_print_lseek(log, fd, block_start, SEEK_SET);
+    if (block_start < 0 || block_start >= logBBsize) {
+	fprintf(stderr, _("%s: start block %lld is outside the log\n"),
+		progname, (long long)block_start);
+	return;
+    }
+    stream = xlog_stream_init(log, fd, block_start, print_only_data,
+			      print_threads);
     blkno = block_start;
 
     for (;;) {
-	if (read(fd, hbuf, 512) == 0) {
-	    printf(_("%s: physical end of log\n"), progname);
-	    print_xlog_record_line();
-	    break;
-	}
+	u = xlog_stream_get(stream, blkno);
+	hdr = (xlog_rec_header_t *)xlog_unit_block(u, blkno);
 	if (print_only_data) {
 	    printf(_("BLKNO: %lld\n"), (long long)blkno);
-	    xlog_recover_print_data(hbuf, 512);
+	    xlog_recover_print_data((xfs_caddr_t)hdr, 512);
 	    blkno++;
 	    goto loop;
 	}
@@ -1420,19 +1306,32 @@ void xfs_log_print(struct xlog  *log,
 		if (!first_hdr_found)
 			block_start = blkno;
 		else
-			print_xlog_bad_header(blkno-1, hbuf);
+			print_xlog_bad_header(blkno-1, (xfs_caddr_t)hdr);
 	    }
 
 	    goto loop;
 	}
 
-	if (be32_to_cpu(hdr->h_version) == 2) {
-	    if (xlog_print_extended_headers(fd, len, &blkno, hdr, &num_hdrs, &xhdrs) != 0)
-		break;
+	if (be32_to_cpu(hdr->h_version) == 2)
+	    xlog_print_extended_headers(u, len, &blkno);
+
+	if (u->u_wrapped) {
+	    /* finish the record once we're back at the start of the log */
+	    first_hdr_found++;
+	    print_xlog_record_line();
+	    printf(_("%s: physical end of log\n"), progname);
+	    print_xlog_record_line();
+	    blkno = 0;
+	    /*
+	     * We may have hit the end of the log when we started at 0.
+	     * In this case, just end.
+	     */
+	    if (block_start == 0)
+		goto end;
+	    goto partial_log_read;
 	}
 
-	error =	xlog_print_record(log, fd, num_ops, len, &read_type, &partial_buf,
-				  hdr, xhdrs, first_hdr_found);
+	error = xlog_print_unit(log, u, num_ops, len, first_hdr_found);
 	first_hdr_found++;
 	switch (error) {
 	    case 0: {
@@ -1447,23 +1346,8 @@ void xfs_log_print(struct xlog  *log,
 		if (print_block_start != -1 &&
 		    blkno >= block_end)		/* If start specified, */
 			goto end;		/* we end early */
-		xlog_print_lseek(log, fd, blkno, SEEK_SET);
 		goto loop;
 	    }
-	    case PARTIAL_READ: {
-		print_xlog_record_line();
-		printf(_("%s: physical end of log\n"), progname);
-		print_xlog_record_line();
-		blkno = 0;
-		xlog_print_lseek(log, fd, 0, SEEK_SET);
-		/*
-		 * We may have hit the end of the log when we started at 0.
-		 * In this case, just end.
-		 */
-		if (block_start == 0)
-			goto end;
-		goto partial_log_read;
-	    }
 	    default: xlog_panic(_("illegal value"));
 	}
 	print_xlog_record_line();
@@ -1498,14 +1382,12 @@ loop:
     /* Do we need to print the first part of physical log? */
     if (block_start != 0) {
 	blkno = 0;
-	xlog_print_lseek(log, fd, 0, SEEK_SET);
 	for (;;) {
-	    if (read(fd, hbuf, 512) == 0) {
-		xlog_panic(_("xlog_find_head: bad read"));
-	    }
+	    u = xlog_stream_get(stream, blkno);
+	    hdr = (xlog_rec_header_t *)xlog_unit_block(u, blkno);
 	    if (print_only_data) {
 		printf(_("BLKNO: %lld\n"), (long long)blkno);
-		xlog_recover_print_data(hbuf, 512);
+		xlog_recover_print_data((xfs_caddr_t)hdr, 512);
 		blkno++;
 		goto loop2;
 	    }
@@ -1519,30 +1401,22 @@ loop:
 		 * entries at the end of the _physical_ log,
 		 * so treat them the same as bad blocks here
 		 */
-		print_xlog_bad_header(blkno-1, hbuf);
+		print_xlog_bad_header(blkno-1, (xfs_caddr_t)hdr);
 
 		if (blkno >= block_end)
 		    break;
 		continue;
 	    }
 
-	    if (be32_to_cpu(hdr->h_version) == 2) {
-		if (xlog_print_extended_headers(fd, len, &blkno, hdr, &num_hdrs, &xhdrs) != 0)
-		    break;
-	    }
+	    if (be32_to_cpu(hdr->h_version) == 2)
+		xlog_print_extended_headers(u, len, &blkno);
 
 partial_log_read:
-	    error= xlog_print_record(log, fd, num_ops, len, &read_type,
-				    &partial_buf, (xlog_rec_header_t *)hbuf,
-				    xhdrs, first_hdr_found);
-	    if (read_type != FULL_READ)
-		len -= read_type;
-	    read_type = FULL_READ;
+	    error = xlog_print_unit(log, u, num_ops, len, first_hdr_found);
 	    if (!error)
-		blkno += BTOBB(len);
+		blkno = u->u_wrapped ? u->u_next : blkno + BTOBB(len);
 	    else {
 		print_xlog_bad_data(blkno-1);
-		xlog_print_lseek(log, fd, blkno, SEEK_SET);
 		goto loop2;
 	    }
 	    print_xlog_record_line();
@@ -1553,57 +1427,11 @@ loop2:
     }
 
 end:
+    xlog_stream_destroy(stream);
     printf(_("%s: logical end of log\n"), progname);
     print_xlog_record_line();
 }
 
-/*
- * if necessary, convert an xfs_inode_log_format struct from 32bit or 64 bit versions
- * (which can have different field alignments) to the native version
- */
-xfs_inode_log_format_t *
-xfs_inode_item_format_convert(char *src_buf, uint len, xfs_inode_log_format_t *in_f)
-{
-	/* if we have native format then just return buf without copying data */
-	if (len == sizeof(xfs_inode_log_format_t)) {
-		return (xfs_inode_log_format_t *)src_buf;
-	}
-
-	if (len == sizeof(xfs_inode_log_format_32_t)) {
-		xfs_inode_log_format_32_t *in_f32;
-
-		in_f32 = (xfs_inode_log_format_32_t *)src_buf;
-		in_f->ilf_type = in_f32->ilf_type;
-		in_f->ilf_size = in_f32->ilf_size;
-		in_f->ilf_fields = in_f32->ilf_fields;
-		in_f->ilf_asize = in_f32->ilf_asize;
-		in_f->ilf_dsize = in_f32->ilf_dsize;
-		in_f->ilf_ino = in_f32->ilf_ino;
-		/* copy biggest */
-		memcpy(&in_f->ilf_u.ilfu_uuid, &in_f32->ilf_u.ilfu_uuid, sizeof(uuid_t));
-		in_f->ilf_blkno = in_f32->ilf_blkno;
-		in_f->ilf_len = in_f32->ilf_len;
-		in_f->ilf_boffset = in_f32->ilf_boffset;
-	} else {
-		xfs_inode_log_format_64_t *in_f64;
-
-		ASSERT(len == sizeof(xfs_inode_log_format_64_t));
-		in_f64 = (xfs_inode_log_format_64_t *)src_buf;
-		in_f->ilf_type = in_f64->ilf_type;
-		in_f->ilf_size = in_f64->ilf_size;
-		in_f->ilf_fields = in_f64->ilf_fields;
-		in_f->ilf_asize = in_f64->ilf_asize;
-		in_f->ilf_dsize = in_f64->ilf_dsize;
-		in_f->ilf_ino = in_f64->ilf_ino;
-		/* copy biggest */
-		memcpy(&in_f->ilf_u.ilfu_uuid, &in_f64->ilf_u.ilfu_uuid, sizeof(uuid_t));
-		in_f->ilf_blkno = in_f64->ilf_blkno;
-		in_f->ilf_len = in_f64->ilf_len;
-		in_f->ilf_boffset = in_f64->ilf_boffset;
-	}
-	return in_f;
-}
-
 int
 xfs_efi_copy_format(
 	char			  *buf,
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2000-2001,2005 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "logprint.h"
+
+/*
+ * Machine readable transactional view (-j).
+ *
+ * One JSON object is written per line.  The first line has "type":"log"
+ * and gives the tail and head of the log.  Every other line is a log item
+ * from a committed transaction, with "type" set to the item type (buf,
+ * inode, dquot, quotaoff, efi, efd or icreate), the cycle and block of the
+ * LSN the transaction started at, its tid and transaction type, and the
+ * fields of the item's log format header.  Only the headers are decoded;
+ * the logged regions themselves are not written out.
+ */
+
+static void
+json_end(void)
+{
+	fputs("}\n", stdout);
+}
+
+void
+xlog_json_print_log(
+	xfs_daddr_t	tail_blk,
+	xfs_daddr_t	head_blk)
+{
+	printf("{\"type\":\"log\",\"tail\":%lld,\"head\":%lld,\"dirty\":%s",
+		(long long)tail_blk, (long long)head_blk,
+		tail_blk == head_blk ? "false" : "true");
+	json_end();
+}
+
+static void
+json_print_buf(
+	struct xlog_recover_item *item)
+{
+	xfs_buf_log_format_t	*f;
+
+	f = (xfs_buf_log_format_t *)item->ri_buf[0].i_addr;
+	printf(",\"blkno\":%lld,\"len\":%u,\"flags\":%u,\"regions\":%d",
+		(long long)f->blf_blkno, f->blf_len, f->blf_flags,
+		f->blf_size - 1);
+}
+
+static void
+json_print_inode(
+	struct xlog_recover_item *item)
+{
+	xfs_inode_log_format_t	f_buf, *f;
+	xfs_icdinode_t		*di;
+
+	f = xfs_inode_item_format_convert(item->ri_buf[0].i_addr,
+			item->ri_buf[0].i_len, &f_buf);
+	printf(",\"ino\":%llu,\"blkno\":%lld,\"len\":%d,\"boffset\":%d,"
+		"\"fields\":%u,\"regions\":%d",
+		(unsigned long long)f->ilf_ino, (long long)f->ilf_blkno,
+		f->ilf_len, f->ilf_boffset, f->ilf_fields, f->ilf_size);
+	if (item->ri_cnt < 2)
+		return;
+	/* the core is logged in host order */
+	di = (xfs_icdinode_t *)item->ri_buf[1].i_addr;
+	printf(",\"mode\":%u,\"nlink\":%u,\"size\":%lld,\"nblocks\":%llu,"
+		"\"nextents\":%d,\"gen\":%u",
+		di->di_mode, di->di_nlink, (long long)di->di_size,
+		(unsigned long long)di->di_nblocks, di->di_nextents,
+		di->di_gen);
+}
+
+static void
+json_print_dquot(
+	struct xlog_recover_item *item,
+	struct xfs_mount	*mp)
+{
+	xfs_dq_logformat_t	*f;
+	int			len;
+
+	f = (xfs_dq_logformat_t *)item->ri_buf[0].i_addr;
+	printf(",\"id\":%u,\"blkno\":%lld,\"boffset\":%u",
+		f->qlf_id, (long long)f->qlf_blkno, f->qlf_boffset);
+	/* in basic blocks like the others, so left out without geometry */
+	len = xlog_recover_dquot_bblen(f, mp);
+	if (len)
+		printf(",\"len\":%d", len);
+}
+
+static void
+json_print_quotaoff(
+	struct xlog_recover_item *item)
+{
+	xfs_qoff_logformat_t	*f;
+
+	f = (xfs_qoff_logformat_t *)item->ri_buf[0].i_addr;
+	printf(",\"flags\":%u", f->qf_flags);
+}
+
+static void
+json_print_efi(
+	struct xlog_recover_item *item)
+{
+	xfs_efi_log_format_t	*f;
+	int			i;
+
+	f = xlog_recover_efi_format(item);
+	if (!f)
+		return;
+	printf(",\"id\":%llu,\"extents\":[", (unsigned long long)f->efi_id);
+	for (i = 0; i < f->efi_nextents; i++)
+		printf("%s[%llu,%u]", i ? "," : "",
+			(unsigned long long)f->efi_extents[i].ext_start,
+			f->efi_extents[i].ext_len);
+	putchar(']');
+	free(f);
+}
+
+static void
+json_print_efd(
+	struct xlog_recover_item *item)
+{
+	xfs_efd_log_format_t	*f;
+
+	f = (xfs_efd_log_format_t *)item->ri_buf[0].i_addr;
+	printf(",\"id\":%llu,\"nextents\":%u",
+		(unsigned long long)f->efd_efi_id, f->efd_nextents);
+}
+
+static void
+json_print_icreate(
+	struct xlog_recover_item *item)
+{
+	struct xfs_icreate_log	*icl;
+
+	icl = (struct xfs_icreate_log *)item->ri_buf[0].i_addr;
+	printf(",\"agno\":%u,\"agbno\":%u,\"length\":%u,\"count\":%u,"
+		"\"isize\":%u,\"gen\":%u",
+		be32_to_cpu(icl->icl_ag), be32_to_cpu(icl->icl_agbno),
+		be32_to_cpu(icl->icl_length), be32_to_cpu(icl->icl_count),
+		be32_to_cpu(icl->icl_isize), be32_to_cpu(icl->icl_gen));
+}
+
+void
+xlog_json_print_trans(
+	xlog_recover_t		*trans,
+	struct xfs_mount	*mp)
+{
+	xlog_recover_item_t	*item;
+	uint			type;
+	int			i = 0;
+
+	list_for_each_entry(item, &trans->r_itemq, ri_list) {
+		i++;
+		if (!xlog_recover_filter_item(item, mp))
+			continue;
+		type = ITEM_TYPE(item);
+		printf("{\"type\":\"%s\",\"cycle\":%u,\"block\":%u,"
+			"\"tid\":%u,\"trans\":\"%s\",\"item\":%d",
+			xlog_item_type_name(type),
+			CYCLE_LSN(trans->r_lsn), BLOCK_LSN(trans->r_lsn),
+			trans->r_log_tid,
+			trans_type[trans->r_theader.th_type], i);
+		switch (type) {
+		case XFS_LI_BUF:
+			json_print_buf(item);
+			break;
+		case XFS_LI_INODE:
+			json_print_inode(item);
+			break;
+		case XFS_LI_DQUOT:
+			json_print_dquot(item, mp);
+			break;
+		case XFS_LI_QUOTAOFF:
+			json_print_quotaoff(item);
+			break;
+		case XFS_LI_EFI:
+			json_print_efi(item);
+			break;
+		case XFS_LI_EFD:
+			json_print_efd(item);
+			break;
+		case XFS_LI_ICREATE:
+			json_print_icreate(item);
+			break;
+		}
+		json_end();
+	}
+}
@@ -34,7 +34,25 @@ xlog_recover_do_trans(
 	xlog_recover_t	*trans,
 	int		pass)
 {
-	xlog_recover_print_trans(trans, &trans->r_itemq, 3);
+	xlog_recover_item_t	*item;
+
+	if (print_json) {
+		xlog_json_print_trans(trans, log->l_mp);
+		return 0;
+	}
+	if (!print_filter.active) {
+		xlog_recover_print_trans(trans, &trans->r_itemq, 3);
+		return 0;
+	}
+
+	/* only the items that match, and nothing if none of them do */
+	if (!xlog_recover_filter_trans(trans, log->l_mp))
+		return 0;
+	print_xlog_record_line();
+	xlog_recover_print_trans_head(trans);
+	list_for_each_entry(item, &trans->r_itemq, ri_list)
+		if (xlog_recover_filter_item(item, log->l_mp))
+			xlog_recover_print_item(item);
 	return 0;
 }
 
@@ -53,18 +71,24 @@ xfs_log_print_trans(
 		exit(1);
 	}
 
-	printf(_("    log tail: %lld head: %lld state: %s\n"),
-		(long long)tail_blk,
-		(long long)head_blk,
-		(tail_blk == head_blk)?"<CLEAN>":"<DIRTY>");
+	if (print_json) {
+		if (print_block_start != -1)
+			tail_blk = print_block_start;
+		xlog_json_print_log(tail_blk, head_blk);
+	} else {
+		printf(_("    log tail: %lld head: %lld state: %s\n"),
+			(long long)tail_blk,
+			(long long)head_blk,
+			(tail_blk == head_blk)?"<CLEAN>":"<DIRTY>");
 
-	if (print_block_start != -1) {
-		printf(_("    override tail: %d\n"), print_block_start);
-		tail_blk = print_block_start;
-	}
-	printf("\n");
+		if (print_block_start != -1) {
+			printf(_("    override tail: %d\n"), print_block_start);
+			tail_blk = print_block_start;
+		}
+		printf("\n");
 
-	print_record_header = 1;
+		print_record_header = 1;
+	}
 
 	if (head_blk == tail_blk)
 		return;
@@ -78,7 +102,7 @@ xfs_log_print_trans(
 	if (XFS_SB_VERSION_NUM(&log->l_mp->m_sb) == XFS_SB_VERSION_5 &&
 	    xfs_sb_has_incompat_log_feature(&log->l_mp->m_sb,
 				XFS_SB_FEAT_INCOMPAT_LOG_UNKNOWN)) {
-		printf(_(
+		fprintf(print_json ? stderr : stdout, _(
 "Superblock has unknown incompatible log features (0x%x) enabled.\n"
 "Output may be incomplete or inaccurate. It is recommended that you\n"
 "upgrade your xfsprogs installation to match the filesystem features.\n"),
@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2000-2004 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "logprint.h"
+#include <pthread.h>
+
+/*
+ * Reading the log for the log record view.
+ *
+ * A reader thread streams the log in large contiguous chunks, from where
+ * printing starts and on round the physical end, and splits it up into
+ * units: log records, and runs of blocks that don't start a record.  A pool
+ * of threads checks the CRC of each record and unpacks its cycle data,
+ * while the printer takes the units back in log order.
+ *
+ * The reader assumes the printer goes from each unit to the one after it.
+ * When the printer goes somewhere else, such as the block after the header
+ * of a record with bad data, the stream is restarted from there.
+ *
+ * With no threads, the printer splits up and decodes each unit itself when
+ * it gets to it.
+ */
+
+#define STREAM_CHUNK_BLKS	8192	/* blocks read from the log at once */
+#define STREAM_RUN_BLKS		256	/* most blocks in a unit that isn't a record */
+#define STREAM_DEPTH		64	/* units read ahead of the printer */
+
+struct xlog_stream {
+	struct xlog		*s_log;
+	int			s_fd;
+	int			s_raw;		/* don't look for records */
+	int			s_nthreads;	/* decode threads, 0 for none */
+
+	/* only used by the reader */
+	xfs_daddr_t		s_pos;		/* where the next unit starts */
+	char			*s_chunk;
+	xfs_daddr_t		s_chunk_blk;
+	int			s_chunk_len;	/* blocks in s_chunk */
+
+	pthread_mutex_t		s_lock;
+	pthread_cond_t		s_cond;
+	struct xlog_unit	*s_units[STREAM_DEPTH];
+	__uint64_t		s_head;		/* next unit the reader adds */
+	__uint64_t		s_tail;		/* unit the printer is on */
+	__uint64_t		s_decode;	/* next unit to decode */
+	int			s_stop;
+	pthread_t		s_reader;
+	pthread_t		*s_workers;
+};
+
+static void
+stream_fill(
+	struct xlog_stream	*s,
+	xfs_daddr_t		blk)
+{
+	struct xlog		*log = s->s_log;
+	xfs_off_t		offset;
+	size_t			len, done = 0;
+	ssize_t			ret;
+
+	s->s_chunk_blk = blk;
+	s->s_chunk_len = MIN(STREAM_CHUNK_BLKS, log->l_logBBsize - blk);
+	len = BBTOB(s->s_chunk_len);
+	offset = BBTOB((xfs_off_t)(log->l_logBBstart + blk));
+
+	while (done < len) {
+		ret = pread64(s->s_fd, s->s_chunk + done, len - done,
+			      offset + done);
+		if (ret < 0) {
+			fprintf(stderr, _("%s: read of log block %lld failed: %s\n"),
+				progname, (long long)blk, strerror(errno));
+			exit(1);
+		}
+		if (ret == 0)
+			break;
+		done += ret;
+	}
+	/* past the end of a log file */
+	memset(s->s_chunk + done, 0, len - done);
+}
+
+/*
+ * Blocks of the log, going round the physical end.
+ */
+static char *
+stream_block(
+	struct xlog_stream	*s,
+	xfs_daddr_t		blk)
+{
+	if (blk < s->s_chunk_blk || blk >= s->s_chunk_blk + s->s_chunk_len)
+		stream_fill(s, blk);
+	return s->s_chunk + BBTOB(blk - s->s_chunk_blk);
+}
+
+static void
+stream_read(
+	struct xlog_stream	*s,
+	xfs_daddr_t		blk,
+	int			nblks,
+	char			*buf)
+{
+	int			n;
+
+	while (nblks > 0) {
+		if (blk >= s->s_log->l_logBBsize)
+			blk = 0;
+		stream_block(s, blk);
+		n = MIN(nblks, s->s_chunk_blk + s->s_chunk_len - blk);
+		memcpy(buf, s->s_chunk + BBTOB(blk - s->s_chunk_blk),
+		       BBTOB(n));
+		buf += BBTOB(n);
+		blk += n;
+		nblks -= n;
+	}
+}
+
+/*
+ * Does a record start here?  This has to agree with what
+ * xlog_print_rec_head() makes of the block.
+ */
+static int
+stream_record_start(
+	struct xlog_stream	*s,
+	xfs_daddr_t		blk)
+{
+	xlog_rec_header_t	*head;
+
+	head = (xlog_rec_header_t *)stream_block(s, blk);
+	if (be32_to_cpu(head->h_magicno) != XLOG_HEADER_MAGIC_NUM)
+		return 0;
+	/* cleared by xlog_clear_stale_blocks() */
+	return head->h_len || head->h_crc || head->h_prev_block ||
+	       head->h_num_logops || head->h_size;
+}
+
+static struct xlog_unit *
+stream_alloc_unit(
+	xfs_daddr_t		blkno,
+	int			nblks)
+{
+	struct xlog_unit	*u;
+
+	u = calloc(1, sizeof(*u) + BBTOB(nblks));
+	if (!u) {
+		fprintf(stderr, _("%s: %s: malloc failed\n"),
+			progname, __FUNCTION__);
+		exit(1);
+	}
+	u->u_blkno = blkno;
+	u->u_nblks = nblks;
+	u->u_buf = (char *)(u + 1);
+	return u;
+}
+
+/*
+ * Split the next unit off the log at s_pos.
+ */
+static struct xlog_unit *
+stream_split(
+	struct xlog_stream	*s)
+{
+	int			logBBsize = s->s_log->l_logBBsize;
+	xfs_daddr_t		pos = s->s_pos;
+	xlog_rec_header_t	*head;
+	struct xlog_unit	*u;
+	int			hblks = 1, bblks, len, max, n;
+	int			bad = 0;
+
+	if (s->s_raw || !stream_record_start(s, pos)) {
+		max = MIN(STREAM_RUN_BLKS, logBBsize - pos);
+		for (n = 1; n < max; n++)
+			if (!s->s_raw && stream_record_start(s, pos + n))
+				break;
+		u = stream_alloc_unit(pos, n);
+		stream_read(s, pos, n, u->u_buf);
+		u->u_done = 1;
+		s->s_pos = (pos + n) % logBBsize;
+		u->u_next = s->s_pos;
+		return u;
+	}
+
+	/* the extended headers are read along with the first */
+	head = (xlog_rec_header_t *)stream_block(s, pos);
+	if (be32_to_cpu(head->h_version) == 2)
+		hblks = be32_to_cpu(head->h_size) / XLOG_HEADER_CYCLE_SIZE;
+	if (hblks < 1)
+		hblks = 1;
+	if (hblks > XLOG_MAX_RECORD_BSIZE / XLOG_HEADER_CYCLE_SIZE) {
+		hblks = 1;
+		bad = 1;
+	}
+	len = be32_to_cpu(head->h_len);
+	bblks = BTOBB(len);
+	if (len < 0 || bblks > logBBsize - hblks) {
+		bblks = 0;
+		bad = 1;
+	}
+
+	u = stream_alloc_unit(pos, hblks + bblks);
+	stream_read(s, pos, hblks + bblks, u->u_buf);
+	head = (xlog_rec_header_t *)u->u_buf;
+	u->u_record = 1;
+	u->u_hblks = hblks;
+	u->u_bblks = bblks;
+	u->u_data = u->u_buf + BBTOB(hblks);
+	u->u_wrapped = pos + hblks + bblks > logBBsize;
+	u->u_crc = head->h_crc;
+	if (bad) {
+		u->u_status = -1;
+		u->u_done = 1;
+	}
+	s->s_pos = (pos + hblks + bblks) % logBBsize;
+	u->u_next = s->s_pos;
+	return u;
+}
+
+/*
+ * Check the CRC of a record, then put the cycle data saved in the headers
+ * back into the first word of each data block.  The data must start with
+ * the record's cycle number in every block, or with the next one in a
+ * record that wraps round the physical end of the log.
+ */
+static void
+stream_decode(
+	struct xlog_stream	*s,
+	struct xlog_unit	*u)
+{
+	xlog_rec_header_t	*rhead = (xlog_rec_header_t *)u->u_buf;
+	xlog_rec_ext_header_t	*xhdr;
+	__uint32_t		cycle = be32_to_cpu(rhead->h_cycle);
+	__uint32_t		data_cycle;
+	char			*ptr = u->u_data;
+	int			i, j, k;
+
+	u->u_crc = xlog_cksum(s->s_log, rhead, u->u_data,
+			      be32_to_cpu(rhead->h_len));
+
+	for (i = 0; i < u->u_bblks; i++, ptr += BBSIZE) {
+		data_cycle = be32_to_cpu(*(__be32 *)ptr);
+		if (data_cycle == XLOG_HEADER_MAGIC_NUM)
+			goto bad;
+		if (data_cycle != cycle &&
+		    (!u->u_wrapped || data_cycle != cycle + 1))
+			goto bad;
+
+		j = i / (XLOG_HEADER_CYCLE_SIZE / BBSIZE);
+		k = i % (XLOG_HEADER_CYCLE_SIZE / BBSIZE);
+		if (j == 0) {
+			*(__be32 *)ptr = rhead->h_cycle_data[k];
+		} else {
+			if (j >= u->u_hblks)
+				goto bad;
+			xhdr = (xlog_rec_ext_header_t *)
+					(u->u_buf + BBTOB(j));
+			*(__be32 *)ptr = xhdr->xh_cycle_data[k];
+		}
+	}
+	return;
+bad:
+	u->u_status = -1;
+}
+
+static void *
+stream_reader(
+	void			*arg)
+{
+	struct xlog_stream	*s = arg;
+	struct xlog_unit	*u;
+
+	pthread_mutex_lock(&s->s_lock);
+	for (;;) {
+		while (!s->s_stop && s->s_head - s->s_tail >= STREAM_DEPTH)
+			pthread_cond_wait(&s->s_cond, &s->s_lock);
+		if (s->s_stop)
+			break;
+		pthread_mutex_unlock(&s->s_lock);
+
+		u = stream_split(s);
+
+		pthread_mutex_lock(&s->s_lock);
+		s->s_units[s->s_head++ % STREAM_DEPTH] = u;
+		pthread_cond_broadcast(&s->s_cond);
+	}
+	pthread_mutex_unlock(&s->s_lock);
+	return NULL;
+}
+
+static void *
+stream_worker(
+	void			*arg)
+{
+	struct xlog_stream	*s = arg;
+	struct xlog_unit	*u;
+
+	pthread_mutex_lock(&s->s_lock);
+	for (;;) {
+		/* the printer may have skipped past units */
+		if (s->s_decode < s->s_tail)
+			s->s_decode = s->s_tail;
+		if (s->s_stop)
+			break;
+		if (s->s_decode == s->s_head) {
+			pthread_cond_wait(&s->s_cond, &s->s_lock);
+			continue;
+		}
+		u = s->s_units[s->s_decode++ % STREAM_DEPTH];
+		if (u->u_done)
+			continue;
+		pthread_mutex_unlock(&s->s_lock);
+
+		stream_decode(s, u);
+
+		pthread_mutex_lock(&s->s_lock);
+		u->u_done = 1;
+		pthread_cond_broadcast(&s->s_cond);
+	}
+	pthread_mutex_unlock(&s->s_lock);
+	return NULL;
+}
+
+static void
+stream_start(
+	struct xlog_stream	*s,
+	xfs_daddr_t		blkno)
+{
+	int			i, err;
+
+	s->s_pos = blkno;
+	s->s_head = s->s_tail = s->s_decode = 0;
+	s->s_stop = 0;
+	if (!s->s_nthreads)
+		return;
+
+	err = pthread_create(&s->s_reader, NULL, stream_reader, s);
+	for (i = 0; !err && i < s->s_nthreads; i++)
+		err = pthread_create(&s->s_workers[i], NULL, stream_worker, s);
+	if (err) {
+		fprintf(stderr, _("%s: cannot create log reading threads: %s\n"),
+			progname, strerror(err));
+		exit(1);
+	}
+}
+
+static void
+stream_stop(
+	struct xlog_stream	*s)
+{
+	int			i;
+
+	if (s->s_nthreads) {
+		pthread_mutex_lock(&s->s_lock);
+		s->s_stop = 1;
+		pthread_cond_broadcast(&s->s_cond);
+		pthread_mutex_unlock(&s->s_lock);
+
+		pthread_join(s->s_reader, NULL);
+		for (i = 0; i < s->s_nthreads; i++)
+			pthread_join(s->s_workers[i], NULL);
+	}
+	for (; s->s_tail < s->s_head; s->s_tail++)
+		free(s->s_units[s->s_tail % STREAM_DEPTH]);
+}
+
+struct xlog_stream *
+xlog_stream_init(
+	struct xlog		*log,
+	int			fd,
+	xfs_daddr_t		blkno,
+	int			raw,
+	int			nthreads)
+{
+	struct xlog_stream	*s;
+
+	s = calloc(1, sizeof(*s));
+	if (s)
+		s->s_chunk = malloc(BBTOB(STREAM_CHUNK_BLKS));
+	if (s && nthreads > 0)
+		s->s_workers = calloc(nthreads, sizeof(pthread_t));
+	if (!s || !s->s_chunk || (nthreads > 0 && !s->s_workers)) {
+		fprintf(stderr, _("%s: %s: malloc failed\n"),
+			progname, __FUNCTION__);
+		exit(1);
+	}
+	s->s_log = log;
+	s->s_fd = fd;
+	s->s_raw = raw;
+	s->s_nthreads = MAX(nthreads, 0);
+	s->s_chunk_blk = -1;
+	pthread_mutex_init(&s->s_lock, NULL);
+	pthread_cond_init(&s->s_cond, NULL);
+	stream_start(s, blkno);
+	return s;
+}
+
+void
+xlog_stream_destroy(
+	struct xlog_stream	*s)
+{
+	stream_stop(s);
+	pthread_mutex_destroy(&s->s_lock);
+	pthread_cond_destroy(&s->s_cond);
+	free(s->s_workers);
+	free(s->s_chunk);
+	free(s);
+}
+
+/*
+ * Get the unit that starts at blkno, or the run of blocks it is in.
+ * Units before it are dropped; if it isn't where the stream is, the stream
+ * is started again from there.
+ */
+struct xlog_unit *
+xlog_stream_get(
+	struct xlog_stream	*s,
+	xfs_daddr_t		blkno)
+{
+	struct xlog_unit	*u;
+
+	pthread_mutex_lock(&s->s_lock);
+	for (;;) {
+		if (s->s_tail == s->s_head) {
+			if (s->s_nthreads) {
+				pthread_cond_wait(&s->s_cond, &s->s_lock);
+				continue;
+			}
+			u = stream_split(s);
+			if (!u->u_done) {
+				stream_decode(s, u);
+				u->u_done = 1;
+			}
+			s->s_units[s->s_head++ % STREAM_DEPTH] = u;
+		}
+		u = s->s_units[s->s_tail % STREAM_DEPTH];
+
+		if (blkno == u->u_blkno ||
+		    (!u->u_record && blkno > u->u_blkno &&
+		     blkno < u->u_blkno + u->u_nblks))
+			break;
+
+		if (blkno == u->u_next) {
+			/* don't free it from under a decode thread */
+			while (!u->u_done)
+				pthread_cond_wait(&s->s_cond, &s->s_lock);
+			free(u);
+			s->s_tail++;
+			pthread_cond_broadcast(&s->s_cond);
+			continue;
+		}
+
+		pthread_mutex_unlock(&s->s_lock);
+		stream_stop(s);
+		stream_start(s, blkno);
+		pthread_mutex_lock(&s->s_lock);
+	}
+	while (!u->u_done)
+		pthread_cond_wait(&s->s_cond, &s->s_lock);
+	pthread_mutex_unlock(&s->s_lock);
+	return u;
+}
+
+/*
+ * The block at blkno in a unit from xlog_stream_get(); the header block
+ * for a record.
+ */
+char *
+xlog_unit_block(
+	struct xlog_unit	*u,
+	xfs_daddr_t		blkno)
+{
+	return u->u_buf + BBTOB(blkno - u->u_blkno);
+}
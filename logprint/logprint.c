@@ -34,6 +34,8 @@ int	print_overwrite;
 int     print_no_data;
 int     print_no_print;
 int     print_exit = 1; /* -e is now default. specify -c to override */
+int	print_json;
+int	print_threads = -1;	/* -1: one per CPU */
 int	print_operation = OP_PRINT;
 
 void
@@ -50,11 +52,19 @@ Options:\n\
     -n	            don't try and interpret log data\n\
     -o	            print buffer data in hex\n\
     -s <start blk>  block # to start printing\n\
+    -P <threads>    threads checking and unpacking log records (0 for none)\n\
     -v              print \"overwrite\" data\n\
     -t	            print out transactional view\n\
 	-b          in transactional view, extract buffer info\n\
 	-i          in transactional view, extract inode info\n\
 	-q          in transactional view, extract quota info\n\
+    -j              print the transactional view as JSON, one item per line\n\
+    -I <ino>        only show items logging inode ino\n\
+    -a <daddr>[-<daddr>] only show items for blocks in this daddr range\n\
+    -T <type>[,...] only show items of these types (buf, inode, dquot,\n\
+                    quotaoff, efi, efd, icreate)\n\
+    -L <lsn>[-<lsn>] only show transactions starting in this LSN range;\n\
+                    an LSN is <cycle>[:<block>]\n\
     -D              print only data; no decoding\n\
     -V              print version information\n"),
 	progname);
@@ -91,6 +101,7 @@ logstat(xfs_mount_t *mp)
 		sb = &mp->m_sb;
 		libxfs_sb_from_disk(sb, (xfs_dsb_t *)buf);
 		mp->m_blkbb_log = sb->sb_blocklog - BBSHIFT;
+		mp->m_agino_log = sb->sb_inopblog + sb->sb_agblklog;
 
 		x.logBBsize = XFS_FSB_TO_BB(mp, sb->sb_logblocks);
 		x.logBBstart = XFS_FSB_TO_DADDR(mp, sb->sb_logstart);
@@ -136,6 +147,7 @@ main(int argc, char **argv)
 	char		*copy_file = NULL;
 	struct xlog     log = {0};
 	xfs_mount_t	mount;
+	xfs_lsn_t	lsn_start = 0, lsn_end = 0;
 
 	setlocale(LC_ALL, "");
 	bindtextdomain(PACKAGE, LOCALEDIR);
@@ -143,8 +155,44 @@ main(int argc, char **argv)
 	memset(&mount, 0, sizeof(mount));
 
 	progname = basename(argv[0]);
-	while ((c = getopt(argc, argv, "bC:cdefl:iqnors:tDVv")) != EOF) {
+	while ((c = getopt(argc, argv, "a:bC:cdefI:jl:iqL:norP:s:tT:DVv")) != EOF) {
 		switch (c) {
+			case 'a':
+				if (logprint_filter_daddr(optarg)) {
+					fprintf(stderr,
+						_("%s: bad daddr range %s\n"),
+						progname, optarg);
+					usage();
+				}
+				break;
+			case 'I':
+				if (logprint_filter_ino(optarg)) {
+					fprintf(stderr,
+						_("%s: bad inode number %s\n"),
+						progname, optarg);
+					usage();
+				}
+				break;
+			case 'j':
+				print_json++;
+				break;
+			case 'L':
+				if (logprint_filter_lsn(optarg, &lsn_start,
+							&lsn_end)) {
+					fprintf(stderr,
+						_("%s: bad LSN range %s\n"),
+						progname, optarg);
+					usage();
+				}
+				break;
+			case 'T':
+				if (logprint_filter_types(optarg)) {
+					fprintf(stderr,
+						_("%s: bad item type in %s\n"),
+						progname, optarg);
+					usage();
+				}
+				break;
 			case 'D':
 				print_only_data++;
 				print_data++;
@@ -190,6 +238,11 @@ main(int argc, char **argv)
 			case 'o':
 				print_data++;
 				break;
+			case 'P':
+				print_threads = atoi(optarg);
+				if (print_threads < 0)
+					usage();
+				break;
 			case 's':
 				print_start = atoi(optarg);
 				break;
@@ -210,13 +263,23 @@ main(int argc, char **argv)
 	if (argc - optind != 1)
 		usage();
 
+	/* the filters and -j only make sense for the transactional view */
+	if ((print_json || print_filter.active || lsn_start || lsn_end) &&
+	    print_operation == OP_PRINT)
+		print_operation = OP_PRINT_TRANS;
+	if (print_json && print_operation != OP_PRINT_TRANS)
+		usage();
+	if (print_threads < 0)
+		print_threads = platform_nproc();
+
 	x.dname = argv[optind];
 
 	if (x.dname == NULL)
 		usage();
 
 	x.isreadonly = LIBXFS_ISINACTIVE;
-	printf(_("xfs_logprint:\n"));
+	if (!print_json)
+		printf(_("xfs_logprint:\n"));
 	if (!libxfs_init(&x))
 		exit(1);
 
@@ -225,16 +288,20 @@ main(int argc, char **argv)
 
 	logfd = (x.logfd < 0) ? x.dfd : x.logfd;
 
-	printf(_("    data device: 0x%llx\n"), (unsigned long long)x.ddev);
+	if (!print_json) {
+		printf(_("    data device: 0x%llx\n"),
+			(unsigned long long)x.ddev);
 
-	if (x.logname) {
-		printf(_("    log file: \"%s\" "), x.logname);
-	} else {
-		printf(_("    log device: 0x%llx "), (unsigned long long)x.logdev);
-	}
+		if (x.logname) {
+			printf(_("    log file: \"%s\" "), x.logname);
+		} else {
+			printf(_("    log device: 0x%llx "),
+				(unsigned long long)x.logdev);
+		}
 
-	printf(_("daddr: %lld length: %lld\n\n"),
-		(long long)x.logBBstart, (long long)x.logBBsize);
+		printf(_("daddr: %lld length: %lld\n\n"),
+			(long long)x.logBBstart, (long long)x.logBBsize);
+	}
 
 	ASSERT(x.logBBsize <= INT_MAX);
 
@@ -244,6 +311,8 @@ main(int argc, char **argv)
 	log.l_logBBsize   = x.logBBsize;
 	log.l_sectBBsize  = BTOBB(x.lbsize);
 	log.l_mp          = &mount;
+	log.l_recover_start = lsn_start;
+	log.l_recover_end = lsn_end;
 
 	switch (print_operation) {
 	case OP_PRINT:
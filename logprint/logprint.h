@@ -30,6 +30,20 @@ extern int	print_transactions;
 extern int	print_overwrite;
 extern int	print_no_data;
 extern int	print_no_print;
+extern int	print_json;
+extern int	print_threads;
+
+/* -I, -a and -T filters for the transactional view, see log_filter.c */
+struct logprint_filter {
+	int		active;
+	int		has_ino;
+	xfs_ino_t	ino;
+	int		has_daddr;
+	xfs_daddr_t	daddr_start;
+	xfs_daddr_t	daddr_end;	/* inclusive */
+	uint		types;		/* item types wanted, 0 for all */
+};
+extern struct logprint_filter	print_filter;
 
 /* exports */
 extern char *trans_type[];
@@ -44,9 +58,48 @@ extern void xfs_log_print_trans(struct xlog *, int);
 extern void print_xlog_record_line(void);
 extern void print_xlog_op_line(void);
 extern void print_stars(void);
+extern void xlog_recover_print_item(struct xlog_recover_item *);
 
-extern xfs_inode_log_format_t *
-	xfs_inode_item_format_convert(char *, uint, xfs_inode_log_format_t *);
 extern int xfs_efi_copy_format(char *, uint, xfs_efi_log_format_t *, int);
 
+extern int logprint_filter_ino(char *);
+extern int logprint_filter_daddr(char *);
+extern int logprint_filter_types(char *);
+extern int logprint_filter_lsn(char *, xfs_lsn_t *, xfs_lsn_t *);
+extern char *xlog_item_type_name(uint);
+extern xfs_efi_log_format_t *xlog_recover_efi_format(struct xlog_recover_item *);
+extern int xlog_recover_dquot_bblen(xfs_dq_logformat_t *, struct xfs_mount *);
+extern int xlog_recover_filter_item(struct xlog_recover_item *,
+				    struct xfs_mount *);
+extern int xlog_recover_filter_trans(xlog_recover_t *, struct xfs_mount *);
+
+extern void xlog_json_print_log(xfs_daddr_t, xfs_daddr_t);
+extern void xlog_json_print_trans(xlog_recover_t *, struct xfs_mount *);
+
+/*
+ * A log record, or a run of blocks that aren't records, read and decoded
+ * ahead of the printer by the log stream.  See log_stream.c.
+ */
+struct xlog_unit {
+	xfs_daddr_t	u_blkno;	/* first block */
+	xfs_daddr_t	u_next;		/* block the next unit starts at */
+	int		u_nblks;	/* blocks in the unit */
+	int		u_record;	/* a record, not a run of blocks */
+	int		u_hblks;	/* record header blocks */
+	int		u_bblks;	/* record data blocks */
+	int		u_wrapped;	/* record goes round the physical end */
+	int		u_status;	/* -1 if the data couldn't be unpacked */
+	__le32		u_crc;		/* CRC calculated for the record */
+	int		u_done;		/* decoded */
+	char		*u_buf;		/* the blocks, headers first */
+	char		*u_data;	/* unpacked record data */
+};
+struct xlog_stream;
+
+extern struct xlog_stream *xlog_stream_init(struct xlog *, int, xfs_daddr_t,
+					    int, int);
+extern void xlog_stream_destroy(struct xlog_stream *);
+extern struct xlog_unit *xlog_stream_get(struct xlog_stream *, xfs_daddr_t);
+extern char *xlog_unit_block(struct xlog_unit *, xfs_daddr_t);
+
 #endif	/* LOGPRINT_H */
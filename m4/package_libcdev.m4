@@ -153,6 +153,26 @@ AC_DEFUN([AC_HAVE_PREADV],
     AC_SUBST(have_preadv)
   ])
 
+#
+# Check if we have the io_uring system calls (Linux)
+#
+AC_DEFUN([AC_HAVE_IO_URING],
+  [ AC_MSG_CHECKING([for io_uring])
+    AC_TRY_COMPILE([
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+    ], [
+         struct io_uring_params p;
+         syscall(__NR_io_uring_setup, 0, &p);
+         syscall(__NR_io_uring_enter, 0, 0, 0, IORING_ENTER_GETEVENTS, 0, 0);
+         return IORING_OP_READ;
+    ], have_io_uring=yes
+       AC_MSG_RESULT(yes),
+       AC_MSG_RESULT(no))
+    AC_SUBST(have_io_uring)
+  ])
+
 #
 # Check if we have a sync_file_range libc call (Linux)
 #
@@ -0,0 +1,11 @@
+#
+# Check for zlib, used to compress metadump images if it is there
+#
+AC_DEFUN([AC_HAVE_ZLIB],
+  [ AC_CHECK_HEADER([zlib.h],
+	[ AC_CHECK_LIB(z, deflateBound,
+		[ have_zlib=yes
+		  libz="-lz" ]) ])
+    AC_SUBST(have_zlib)
+    AC_SUBST(libz)
+  ])
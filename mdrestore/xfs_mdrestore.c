@@ -17,11 +17,19 @@
  */
 
 #include <libxfs.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 #include "xfs_metadump.h"
 
 char 		*progname;
 int		show_progress = 0;
 int		progress_since_warning = 0;
+int		nr_threads;
+int		nr_writers = 4;
+int		direct_io;
 
 static void
 fatal(const char *msg, ...)
@@ -50,6 +58,360 @@ print_progress(const char *fmt, ...)
 	progress_since_warning = 1;
 }
 
+/*
+ * The dump starts with the primary superblock.  Mark it as in progress
+ * until the restore is done, and make sure the target can hold the
+ * filesystem.
+ */
+static void
+prepare_target(
+	char			*block_buffer,
+	xfs_sb_t		*sb,
+	int			dst_fd,
+	int			is_target_file)
+{
+	libxfs_sb_from_disk(sb, (xfs_dsb_t *)block_buffer);
+
+	if (sb->sb_magicnum != XFS_SB_MAGIC)
+		fatal("bad magic number for primary superblock\n");
+
+	((xfs_dsb_t*)block_buffer)->sb_inprogress = 1;
+
+	if (is_target_file)  {
+		/* ensure regular files are correctly sized */
+
+		if (ftruncate64(dst_fd, sb->sb_dblocks * sb->sb_blocksize))
+			fatal("cannot set filesystem image size: %s\n",
+				strerror(errno));
+	} else  {
+		/* ensure device is sufficiently large enough */
+
+		char		*lb[XFS_MAX_SECTORSIZE] = { NULL };
+		off64_t		off;
+
+		off = sb->sb_dblocks * sb->sb_blocksize - sizeof(lb);
+		if (pwrite64(dst_fd, lb, sizeof(lb), off) < 0)
+			fatal("failed to write last block, is target too "
+				"small? (error: %s)\n", strerror(errno));
+	}
+}
+
+/*
+ * Everything is restored, clear the in progress flag again.
+ */
+static void
+finish_target(
+	xfs_sb_t		*sb,
+	int			dst_fd)
+{
+	char			*block_buffer;
+
+	block_buffer = calloc(1, sb->sb_sectsize);
+	if (block_buffer == NULL)
+		fatal("memory allocation failure\n");
+
+	sb->sb_inprogress = 0;
+	libxfs_sb_to_disk((xfs_dsb_t *)block_buffer, sb, XFS_SB_ALL_BITS);
+	if (xfs_sb_version_hascrc(sb)) {
+		xfs_update_cksum(block_buffer, sb->sb_sectsize,
+				 offsetof(struct xfs_sb, sb_crc));
+	}
+
+	if (pwrite(dst_fd, block_buffer, sb->sb_sectsize, 0) < 0)
+		fatal("error writing primary superblock: %s\n", strerror(errno));
+
+	free(block_buffer);
+}
+
+/*
+ * Blocks are not written as they come out of the dump, but gathered into
+ * batches.  A full batch is sorted by daddr so that adjacent blocks go out
+ * in one pwritev, and the runs of blocks are shared out among the writer
+ * threads while the main thread fills the other batch.  A batch is only
+ * started once the one before it is done, so a later copy of a block in
+ * the dump still overwrites an earlier one.
+ */
+#define	WBATCH_BLOCKS	8192		/* 4MB of basic blocks */
+
+struct wblock {
+	__int64_t		daddr;
+	int			seq;		/* order in the batch */
+};
+
+struct wrun {
+	__int64_t		daddr;
+	int			first;		/* index of the first wblock */
+	int			count;
+};
+
+struct wbatch {
+	char			*buf;		/* block data, in dump order */
+	struct wblock		*blocks;
+	int			nblocks;
+	struct wrun		*runs;
+	int			nruns;
+	int			next_run;	/* next run for a writer */
+	int			runs_done;
+};
+
+static struct {
+	int			fd;		/* for direct I/O if asked */
+	int			buffered_fd;	/* for what direct I/O can't do */
+	struct wbatch		batch[2];
+	struct wbatch		*fill;		/* being filled */
+	struct wbatch		*active;	/* being written */
+	pthread_t		*threads;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	int			exit;
+} wr;
+
+static int
+wblock_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct wblock	*wa = a;
+	const struct wblock	*wb = b;
+
+	if (wa->daddr != wb->daddr)
+		return wa->daddr < wb->daddr ? -1 : 1;
+	return wa->seq - wb->seq;
+}
+
+static void
+write_run(
+	struct wbatch		*b,
+	struct wrun		*run)
+{
+	struct iovec		iov[64];
+	struct wblock		*wb = &b->blocks[run->first];
+	off64_t			off = run->daddr << BBSHIFT;
+	ssize_t			len, ret;
+	int			done, n, i;
+
+	for (done = 0; done < run->count; done += n) {
+		n = MIN(run->count - done, 64);
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = b->buf +
+					((size_t)wb[done + i].seq << BBSHIFT);
+			iov[i].iov_len = BBSIZE;
+		}
+		len = (ssize_t)n << BBSHIFT;
+		ret = pwritev(wr.fd, iov, n, off);
+		if (ret < 0 && errno == EINVAL && wr.fd != wr.buffered_fd)
+			ret = pwritev(wr.buffered_fd, iov, n, off);
+		if (ret != len)
+			fatal("error writing block %llu: %s\n",
+				(unsigned long long)off,
+				ret < 0 ? strerror(errno) : "short write");
+		off += len;
+	}
+}
+
+static void *
+writer_thread(
+	void			*arg)
+{
+	struct wbatch		*b;
+	int			r;
+
+	pthread_mutex_lock(&wr.lock);
+	for (;;) {
+		b = wr.active;
+		if (b && b->next_run < b->nruns) {
+			r = b->next_run++;
+			pthread_mutex_unlock(&wr.lock);
+			write_run(b, &b->runs[r]);
+			pthread_mutex_lock(&wr.lock);
+			if (++b->runs_done == b->nruns)
+				pthread_cond_broadcast(&wr.cond);
+			continue;
+		}
+		if (wr.exit)
+			break;
+		pthread_cond_wait(&wr.cond, &wr.lock);
+	}
+	pthread_mutex_unlock(&wr.lock);
+	return NULL;
+}
+
+/*
+ * Wait for the batch being written to be finished.
+ */
+static void
+wait_batch(void)
+{
+	struct wbatch		*b;
+
+	pthread_mutex_lock(&wr.lock);
+	b = wr.active;
+	while (b && b->runs_done < b->nruns)
+		pthread_cond_wait(&wr.cond, &wr.lock);
+	wr.active = NULL;
+	pthread_mutex_unlock(&wr.lock);
+	if (b) {
+		b->nblocks = 0;
+		b->nruns = 0;
+	}
+}
+
+/*
+ * Sort the batch being filled and hand it to the writers.  Of several
+ * copies of a block only the last one in the dump is written.
+ */
+static void
+submit_batch(void)
+{
+	struct wbatch		*b = wr.fill;
+	struct wrun		*run = NULL;
+	int			i, n;
+
+	if (b->nblocks == 0)
+		return;
+
+	qsort(b->blocks, b->nblocks, sizeof(struct wblock), wblock_cmp);
+	for (i = 0, n = 0; i < b->nblocks; i++) {
+		if (i + 1 < b->nblocks &&
+		    b->blocks[i + 1].daddr == b->blocks[i].daddr)
+			continue;
+		b->blocks[n] = b->blocks[i];
+		if (run && run->daddr + run->count == b->blocks[n].daddr) {
+			run->count++;
+		} else {
+			run = &b->runs[b->nruns++];
+			run->daddr = b->blocks[n].daddr;
+			run->first = n;
+			run->count = 1;
+		}
+		n++;
+	}
+	b->next_run = 0;
+	b->runs_done = 0;
+
+	wait_batch();
+	if (!wr.threads) {
+		for (i = 0; i < b->nruns; i++)
+			write_run(b, &b->runs[i]);
+		b->nblocks = 0;
+		b->nruns = 0;
+		return;
+	}
+
+	pthread_mutex_lock(&wr.lock);
+	wr.active = b;
+	pthread_cond_broadcast(&wr.cond);
+	pthread_mutex_unlock(&wr.lock);
+	wr.fill = (b == &wr.batch[0]) ? &wr.batch[1] : &wr.batch[0];
+}
+
+/*
+ * Queue len bytes of blocks starting at daddr for writing.
+ */
+static void
+queue_write(
+	__int64_t		daddr,
+	char			*data,
+	int			len)
+{
+	struct wbatch		*b;
+
+	for (; len > 0; len -= BBSIZE, data += BBSIZE, daddr++) {
+		b = wr.fill;
+		if (b->nblocks == WBATCH_BLOCKS) {
+			submit_batch();
+			b = wr.fill;
+		}
+		memcpy(b->buf + ((size_t)b->nblocks << BBSHIFT), data, BBSIZE);
+		b->blocks[b->nblocks].daddr = daddr;
+		b->blocks[b->nblocks].seq = b->nblocks;
+		b->nblocks++;
+	}
+}
+
+static void
+init_writers(
+	char			*target,
+	int			dst_fd)
+{
+	struct wbatch		*b;
+	int			err;
+	int			i;
+
+	wr.fd = wr.buffered_fd = dst_fd;
+	if (direct_io) {
+		wr.fd = open(target, O_RDWR | O_DIRECT);
+		if (wr.fd < 0)
+			fatal("cannot open target \"%s\" for direct I/O: %s\n",
+				target, strerror(errno));
+	}
+
+	for (i = 0; i < 2; i++) {
+		b = &wr.batch[i];
+		b->buf = memalign(getpagesize(),
+				  (size_t)WBATCH_BLOCKS << BBSHIFT);
+		b->blocks = malloc(WBATCH_BLOCKS * sizeof(struct wblock));
+		b->runs = malloc(WBATCH_BLOCKS * sizeof(struct wrun));
+		if (!b->buf || !b->blocks || !b->runs)
+			fatal("memory allocation failure\n");
+	}
+	wr.fill = &wr.batch[0];
+
+	pthread_mutex_init(&wr.lock, NULL);
+	pthread_cond_init(&wr.cond, NULL);
+	if (nr_writers <= 1)
+		return;
+
+	wr.threads = calloc(nr_writers, sizeof(pthread_t));
+	if (wr.threads == NULL)
+		fatal("memory allocation failure\n");
+	for (i = 0; i < nr_writers; i++) {
+		err = pthread_create(&wr.threads[i], NULL, writer_thread, NULL);
+		if (err)
+			fatal("cannot create writer thread: %s\n",
+				strerror(err));
+	}
+}
+
+/*
+ * Write out whatever is still queued and wait for it to get there.
+ */
+static void
+flush_writes(void)
+{
+	submit_batch();
+	wait_batch();
+}
+
+static void
+exit_writers(void)
+{
+	int			i;
+
+	flush_writes();
+	if (wr.threads) {
+		pthread_mutex_lock(&wr.lock);
+		wr.exit = 1;
+		pthread_cond_broadcast(&wr.cond);
+		pthread_mutex_unlock(&wr.lock);
+		for (i = 0; i < nr_writers; i++)
+			pthread_join(wr.threads[i], NULL);
+		free(wr.threads);
+	}
+	for (i = 0; i < 2; i++) {
+		free(wr.batch[i].buf);
+		free(wr.batch[i].blocks);
+		free(wr.batch[i].runs);
+	}
+	if (wr.fd != wr.buffered_fd)
+		close(wr.fd);
+	pthread_mutex_destroy(&wr.lock);
+	pthread_cond_destroy(&wr.cond);
+}
+
+static void	perform_restore_v2(FILE *src_f, xfs_metablock_t *tmb,
+				   int dst_fd, int is_target_file);
+
 static void
 perform_restore(
 	FILE			*src_f,
@@ -76,6 +438,10 @@ perform_restore(
 	if (fread(&tmb, sizeof(tmb), 1, src_f) != 1)
 		fatal("error reading from file: %s\n", strerror(errno));
 
+	if (be32_to_cpu(tmb.mb_magic) == XFS_MD2_MAGIC) {
+		perform_restore_v2(src_f, &tmb, dst_fd, is_target_file);
+		return;
+	}
 	if (be32_to_cpu(tmb.mb_magic) != XFS_MD_MAGIC)
 		fatal("specified file is not a metadata dump\n");
 
@@ -104,30 +470,7 @@ perform_restore(
 			1, src_f) != 1)
 		fatal("error reading from file: %s\n", strerror(errno));
 
-	libxfs_sb_from_disk(&sb, (xfs_dsb_t *)block_buffer);
-
-	if (sb.sb_magicnum != XFS_SB_MAGIC)
-		fatal("bad magic number for primary superblock\n");
-
-	((xfs_dsb_t*)block_buffer)->sb_inprogress = 1;
-
-	if (is_target_file)  {
-		/* ensure regular files are correctly sized */
-
-		if (ftruncate64(dst_fd, sb.sb_dblocks * sb.sb_blocksize))
-			fatal("cannot set filesystem image size: %s\n",
-				strerror(errno));
-	} else  {
-		/* ensure device is sufficiently large enough */
-
-		char		*lb[XFS_MAX_SECTORSIZE] = { NULL };
-		off64_t		off;
-
-		off = sb.sb_dblocks * sb.sb_blocksize - sizeof(lb);
-		if (pwrite64(dst_fd, lb, sizeof(lb), off) < 0)
-			fatal("failed to write last block, is target too "
-				"small? (error: %s)\n", strerror(errno));
-	}
+	prepare_target(block_buffer, &sb, dst_fd, is_target_file);
 
 	bytes_read = 0;
 
@@ -135,15 +478,10 @@ perform_restore(
 		if (show_progress && (bytes_read & ((1 << 20) - 1)) == 0)
 			print_progress("%lld MB read\n", bytes_read >> 20);
 
-		for (cur_index = 0; cur_index < mb_count; cur_index++) {
-			if (pwrite64(dst_fd, &block_buffer[cur_index <<
-					tmb.mb_blocklog], block_size,
-					be64_to_cpu(block_index[cur_index]) <<
-						BBSHIFT) < 0)
-				fatal("error writing block %llu: %s\n",
-					be64_to_cpu(block_index[cur_index]) << BBSHIFT,
-					strerror(errno));
-		}
+		for (cur_index = 0; cur_index < mb_count; cur_index++)
+			queue_write(be64_to_cpu(block_index[cur_index]),
+				&block_buffer[cur_index << tmb.mb_blocklog],
+				block_size);
 		if (mb_count < max_indicies)
 			break;
 
@@ -166,24 +504,392 @@ perform_restore(
 	if (progress_since_warning)
 		putchar('\n');
 
-	memset(block_buffer, 0, sb.sb_sectsize);
-	sb.sb_inprogress = 0;
-	libxfs_sb_to_disk((xfs_dsb_t *)block_buffer, &sb, XFS_SB_ALL_BITS);
-	if (xfs_sb_version_hascrc(&sb)) {
-		xfs_update_cksum(block_buffer, sb.sb_sectsize,
-				 offsetof(struct xfs_sb, sb_crc));
+	flush_writes();
+	finish_target(&sb, dst_fd);
+
+	free(metablock);
+}
+
+/*
+ * Version 2 dumps are a stream of chunks, each holding up to mh_chunk_blocks
+ * basic blocks and compressed on its own.  They can be restored straight
+ * from a pipe, but if the dump is a file the index at the end tells us
+ * where each chunk is, and the chunks are read and decompressed by a pool
+ * of threads while the main thread writes them out in order.
+ */
+struct md2_restore {
+	int			compress;	/* from the dump header */
+	int			chunk_blocks;
+	size_t			raw_size;	/* largest chunk in the dump */
+	size_t			data_size;	/* largest decoded chunk */
+	int			dst_fd;
+	int			is_target_file;
+	int			first;		/* no chunk written yet */
+	xfs_sb_t		sb;
+	__int64_t		bytes_read;
+};
+
+/*
+ * A chunk being read and decoded by one of the threads.
+ */
+struct md2_slot {
+	int			chunk;		/* -1 if the slot is free */
+	int			ready;
+	int			count;
+	char			*raw;		/* chunk header and data */
+	char			*data;		/* room to decompress into */
+	char			*out;		/* decoded daddrs and blocks */
+};
+
+struct md2_pool {
+	struct md2_restore	*rs;
+	int			src_fd;
+	xfs_metadump_chunkrec_t	*recs;
+	int			nchunks;
+	int			next;		/* next chunk to read */
+	struct md2_slot		*slots;
+	int			nslots;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+};
+
+static void
+check_chunk(
+	struct md2_restore	*rs,
+	xfs_metadump_chunk_t	*hdr)
+{
+	if (be32_to_cpu(hdr->mc_magic) != XFS_MD2_CHUNK_MAGIC)
+		fatal("bad chunk magic number\n");
+	if (be32_to_cpu(hdr->mc_count) > rs->chunk_blocks)
+		fatal("bad chunk block count: %u\n",
+			be32_to_cpu(hdr->mc_count));
+	if (be32_to_cpu(hdr->mc_len) > rs->raw_size)
+		fatal("bad chunk length: %u\n", be32_to_cpu(hdr->mc_len));
+}
+
+/*
+ * Turn the chunk data into an array of daddrs followed by the blocks.
+ * Returns the decoded data, which is raw itself for uncompressed chunks.
+ */
+static char *
+decode_chunk(
+	xfs_metadump_chunk_t	*hdr,
+	char			*raw,
+	char			*data)
+{
+	size_t			len = be32_to_cpu(hdr->mc_len);
+	size_t			want;
+
+	want = (size_t)be32_to_cpu(hdr->mc_count) *
+			(sizeof(__be64) + BBSIZE);
+
+	switch (be32_to_cpu(hdr->mc_compress)) {
+	case XFS_MD2_COMPRESS_NONE:
+		if (len != want)
+			fatal("bad chunk length: %zu\n", len);
+		return raw;
+#ifdef HAVE_ZLIB
+	case XFS_MD2_COMPRESS_ZLIB: {
+		uLongf		outlen = want;
+
+		if (uncompress((Bytef *)data, &outlen, (Bytef *)raw,
+				len) != Z_OK || outlen != want)
+			fatal("corrupt compressed chunk\n");
+		return data;
+	}
+#endif
+	default:
+		fatal("unsupported chunk compression method %u\n",
+			be32_to_cpu(hdr->mc_compress));
 	}
+	return NULL;
+}
 
-	if (pwrite(dst_fd, block_buffer, sb.sb_sectsize, 0) < 0)
-		fatal("error writing primary superblock: %s\n", strerror(errno));
+/*
+ * Write out the blocks in a decoded chunk.  Chunks have to go out in the
+ * order they are in the dump, a later copy of a block wins.
+ */
+static void
+restore_chunk(
+	struct md2_restore	*rs,
+	char			*data,
+	int			count)
+{
+	__be64			*block_index = (__be64 *)data;
+	char			*block_buffer = data + count * sizeof(__be64);
+	int			i;
+
+	if (count == 0)
+		return;
+
+	if (rs->first) {
+		if (block_index[0] != 0)
+			fatal("first block is not the primary superblock\n");
+		prepare_target(block_buffer, &rs->sb, rs->dst_fd,
+				rs->is_target_file);
+		rs->first = 0;
+	}
 
-	free(metablock);
+	for (i = 0; i < count; i++)
+		queue_write(be64_to_cpu(block_index[i]),
+			    &block_buffer[i << BBSHIFT], BBSIZE);
+
+	if (show_progress)
+		print_progress("%lld MB read", rs->bytes_read >> 20);
+}
+
+static void
+restore_stream(
+	struct md2_restore	*rs,
+	FILE			*src_f)
+{
+	xfs_metadump_chunk_t	hdr;
+	char			*raw, *data;
+	int			count;
+
+	raw = malloc(rs->raw_size);
+	data = malloc(rs->data_size);
+	if (raw == NULL || data == NULL)
+		fatal("memory allocation failure\n");
+
+	for (;;) {
+		if (fread(&hdr, sizeof(hdr), 1, src_f) != 1)
+			fatal("error reading from file: %s\n", strerror(errno));
+		check_chunk(rs, &hdr);
+		count = be32_to_cpu(hdr.mc_count);
+		if (count == 0)
+			break;
+		if (fread(raw, be32_to_cpu(hdr.mc_len), 1, src_f) != 1)
+			fatal("error reading from file: %s\n", strerror(errno));
+		rs->bytes_read += sizeof(hdr) + be32_to_cpu(hdr.mc_len);
+		restore_chunk(rs, decode_chunk(&hdr, raw, data), count);
+	}
+
+	free(raw);
+	free(data);
+}
+
+static void *
+md2_reader(
+	void			*arg)
+{
+	struct md2_pool		*pool = arg;
+	struct md2_restore	*rs = pool->rs;
+	struct md2_slot		*slot;
+	xfs_metadump_chunkrec_t	*rec;
+	xfs_metadump_chunk_t	*hdr;
+	size_t			len;
+	char			*data;
+	int			chunk;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->next < pool->nchunks &&
+		       pool->slots[pool->next % pool->nslots].chunk != -1)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		if (pool->next >= pool->nchunks) {
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		chunk = pool->next++;
+		slot = &pool->slots[chunk % pool->nslots];
+		slot->chunk = chunk;
+		slot->ready = 0;
+		pthread_mutex_unlock(&pool->lock);
+
+		rec = &pool->recs[chunk];
+		len = sizeof(xfs_metadump_chunk_t) + be32_to_cpu(rec->mr_len);
+		if (be32_to_cpu(rec->mr_len) > rs->raw_size)
+			fatal("bad dump index entry for chunk %d\n", chunk);
+		if (pread64(pool->src_fd, slot->raw, len,
+				be64_to_cpu(rec->mr_offset)) != len)
+			fatal("error reading from file: %s\n", strerror(errno));
+
+		hdr = (xfs_metadump_chunk_t *)slot->raw;
+		check_chunk(rs, hdr);
+		if (hdr->mc_count != rec->mr_count || hdr->mc_len != rec->mr_len)
+			fatal("dump index doesn't match chunk %d\n", chunk);
+		data = decode_chunk(hdr, slot->raw + sizeof(*hdr), slot->data);
+
+		pthread_mutex_lock(&pool->lock);
+		slot->count = be32_to_cpu(hdr->mc_count);
+		slot->out = data;
+		slot->ready = 1;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/*
+ * Read the index at the end of a dump file.  Returns the number of chunks,
+ * or -1 if there is no usable index.
+ */
+static int
+read_md2_index(
+	int			src_fd,
+	xfs_metadump_chunkrec_t	**recsp)
+{
+	xfs_metadump_trailer_t	trailer;
+	xfs_metadump_chunkrec_t	*recs;
+	struct stat64		st;
+	size_t			len;
+	int			nchunks;
+
+	if (fstat64(src_fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size < sizeof(trailer))
+		return -1;
+	if (pread64(src_fd, &trailer, sizeof(trailer),
+			st.st_size - sizeof(trailer)) != sizeof(trailer) ||
+	    be32_to_cpu(trailer.mt_magic) != XFS_MD2_INDEX_MAGIC)
+		return -1;
+
+	nchunks = be32_to_cpu(trailer.mt_nchunks);
+	len = nchunks * sizeof(xfs_metadump_chunkrec_t);
+	if (be64_to_cpu(trailer.mt_index) + len > st.st_size)
+		return -1;
+	recs = malloc(len + 1);
+	if (recs == NULL)
+		fatal("memory allocation failure\n");
+	if (pread64(src_fd, recs, len, be64_to_cpu(trailer.mt_index)) != len) {
+		free(recs);
+		return -1;
+	}
+	*recsp = recs;
+	return nchunks;
+}
+
+static void
+restore_parallel(
+	struct md2_restore	*rs,
+	int			src_fd,
+	xfs_metadump_chunkrec_t	*recs,
+	int			nchunks)
+{
+	struct md2_pool		pool;
+	struct md2_slot		*slot;
+	pthread_t		*threads;
+	int			chunk;
+	int			err;
+	int			i;
+
+	memset(&pool, 0, sizeof(pool));
+	pool.rs = rs;
+	pool.src_fd = src_fd;
+	pool.recs = recs;
+	pool.nchunks = nchunks;
+	pool.nslots = nr_threads * 2;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+
+	pool.slots = calloc(pool.nslots, sizeof(struct md2_slot));
+	threads = calloc(nr_threads, sizeof(pthread_t));
+	if (pool.slots == NULL || threads == NULL)
+		fatal("memory allocation failure\n");
+	for (i = 0; i < pool.nslots; i++) {
+		slot = &pool.slots[i];
+		slot->chunk = -1;
+		slot->raw = malloc(sizeof(xfs_metadump_chunk_t) +
+				   rs->raw_size);
+		slot->data = malloc(rs->data_size);
+		if (slot->raw == NULL || slot->data == NULL)
+			fatal("memory allocation failure\n");
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		err = pthread_create(&threads[i], NULL, md2_reader, &pool);
+		if (err)
+			fatal("cannot create reader thread: %s\n",
+				strerror(err));
+	}
+
+	for (chunk = 0; chunk < nchunks; chunk++) {
+		slot = &pool.slots[chunk % pool.nslots];
+
+		pthread_mutex_lock(&pool.lock);
+		while (slot->chunk != chunk || !slot->ready)
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+
+		rs->bytes_read += sizeof(xfs_metadump_chunk_t) +
+				  be32_to_cpu(recs[chunk].mr_len);
+		restore_chunk(rs, slot->out, slot->count);
+
+		pthread_mutex_lock(&pool.lock);
+		slot->chunk = -1;
+		pthread_cond_broadcast(&pool.cond);
+		pthread_mutex_unlock(&pool.lock);
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < pool.nslots; i++) {
+		free(pool.slots[i].raw);
+		free(pool.slots[i].data);
+	}
+	free(pool.slots);
+	free(threads);
+	pthread_mutex_destroy(&pool.lock);
+	pthread_cond_destroy(&pool.cond);
+}
+
+static void
+perform_restore_v2(
+	FILE			*src_f,
+	xfs_metablock_t		*tmb,
+	int			dst_fd,
+	int			is_target_file)
+{
+	xfs_metadump_header_t	hdr;
+	xfs_metadump_chunkrec_t	*recs = NULL;
+	struct md2_restore	rs;
+	int			nchunks = -1;
+
+	/* the first part of the header was read as a v1 metablock */
+	memcpy(&hdr, tmb, sizeof(*tmb));
+	if (fread((char *)&hdr + sizeof(*tmb), sizeof(hdr) - sizeof(*tmb), 1,
+			src_f) != 1)
+		fatal("error reading from file: %s\n", strerror(errno));
+
+	memset(&rs, 0, sizeof(rs));
+	rs.compress = be32_to_cpu(hdr.mh_compress);
+	rs.chunk_blocks = be32_to_cpu(hdr.mh_chunk_blocks);
+	if (rs.chunk_blocks == 0 || rs.chunk_blocks > XFS_MD2_MAX_CHUNK_BLOCKS)
+		fatal("bad chunk size: %u\n", rs.chunk_blocks);
+#ifndef HAVE_ZLIB
+	if (rs.compress == XFS_MD2_COMPRESS_ZLIB)
+		fatal("dump is compressed with zlib, which %s was built "
+			"without\n", progname);
+#endif
+	rs.data_size = (size_t)rs.chunk_blocks * (sizeof(__be64) + BBSIZE);
+	rs.raw_size = rs.data_size;
+	rs.dst_fd = dst_fd;
+	rs.is_target_file = is_target_file;
+	rs.first = 1;
+
+	if (nr_threads > 1)
+		nchunks = read_md2_index(fileno(src_f), &recs);
+	if (nchunks >= 0)
+		restore_parallel(&rs, fileno(src_f), recs, nchunks);
+	else
+		restore_stream(&rs, src_f);
+	free(recs);
+
+	if (rs.first)
+		fatal("dump holds no blocks\n");
+
+	if (progress_since_warning)
+		putchar('\n');
+
+	flush_writes();
+	finish_target(&rs.sb, dst_fd);
 }
 
 static void
 usage(void)
 {
-	fprintf(stderr, "Usage: %s [-V] [-g] source target\n", progname);
+	fprintf(stderr, "Usage: %s [-V] [-dg] [-t threads] [-w writers] "
+		"source target\n", progname);
 	exit(1);
 }
 
@@ -202,12 +908,26 @@ main(
 	int		is_target_file;
 
 	progname = basename(argv[0]);
+	nr_threads = MIN(sysconf(_SC_NPROCESSORS_ONLN), 16);
 
-	while ((c = getopt(argc, argv, "gV")) != EOF) {
+	while ((c = getopt(argc, argv, "dgt:w:V")) != EOF) {
 		switch (c) {
+			case 'd':
+				direct_io = 1;
+				break;
 			case 'g':
 				show_progress = 1;
 				break;
+			case 't':
+				nr_threads = atoi(optarg);
+				if (nr_threads <= 0)
+					usage();
+				break;
+			case 'w':
+				nr_writers = atoi(optarg);
+				if (nr_writers <= 0)
+					usage();
+				break;
 			case 'V':
 				printf("%s version %s\n", progname, VERSION);
 				exit(0);
@@ -255,7 +975,9 @@ main(
 	if (dst_fd < 0)
 		fatal("couldn't open target \"%s\"\n", argv[optind]);
 
+	init_writers(argv[optind], dst_fd);
 	perform_restore(src_f, dst_fd, is_target_file);
+	exit_writers();
 
 	close(dst_fd);
 	if (src_f != stdin)
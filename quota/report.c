@@ -72,6 +72,71 @@ report_help(void)
 "\n"));
 }
 
+/*
+ * Find the first dquot at or after id.  Returns 1 if there is one, 0 if
+ * there isn't, or -1 if the lookup failed.  The first lookup of a walk
+ * failing means the kernel can't do them, and the caller falls back to
+ * asking about every ID; a later one is an error.
+ */
+static int
+get_next_dquot(
+	fs_disk_quota_t	*d,
+	uint		id,
+	uint		type,
+	char		*dev)
+{
+	if (xfsquotactl(XFS_GETNEXTQUOTA, dev, type, id, (void *)d) == 0)
+		return 1;
+	if (errno == ENOENT || errno == ESRCH)
+		return 0;
+	return -1;
+}
+
+static char *
+id_to_name(
+	uint		id,
+	uint		type)
+{
+	switch (type) {
+	case XFS_USER_QUOTA:
+		return uid_to_name(id);
+	case XFS_GROUP_QUOTA:
+		return gid_to_name(id);
+	case XFS_PROJ_QUOTA:
+		return prid_to_name(id);
+	}
+	return NULL;
+}
+
+static void
+dump_dquot(
+	FILE		*fp,
+	fs_disk_quota_t	*d,
+	uint		id,
+	char		*dev)
+{
+	if (!d->d_blk_softlimit && !d->d_blk_hardlimit &&
+	    !d->d_ino_softlimit && !d->d_ino_hardlimit &&
+	    !d->d_rtb_softlimit && !d->d_rtb_hardlimit)
+		return;
+	fprintf(fp, "fs = %s\n", dev);
+	/* this branch is for backward compatibility reasons */
+	if (d->d_rtb_softlimit || d->d_rtb_hardlimit)
+		fprintf(fp, "%-10d %7llu %7llu %7llu %7llu %7llu %7llu\n", id,
+			(unsigned long long)d->d_blk_softlimit,
+			(unsigned long long)d->d_blk_hardlimit,
+			(unsigned long long)d->d_ino_softlimit,
+			(unsigned long long)d->d_ino_hardlimit,
+			(unsigned long long)d->d_rtb_softlimit,
+			(unsigned long long)d->d_rtb_hardlimit);
+	else
+		fprintf(fp, "%-10d %7llu %7llu %7llu %7llu\n", id,
+			(unsigned long long)d->d_blk_softlimit,
+			(unsigned long long)d->d_blk_hardlimit,
+			(unsigned long long)d->d_ino_softlimit,
+			(unsigned long long)d->d_ino_hardlimit);
+}
+
 static void
 dump_file(
 	FILE		*fp,
@@ -86,26 +151,41 @@ dump_file(
 			perror("XFS_GETQUOTA");
 		return;
 	}
-	if (!d.d_blk_softlimit && !d.d_blk_hardlimit &&
-	    !d.d_ino_softlimit && !d.d_ino_hardlimit &&
-	    !d.d_rtb_softlimit && !d.d_rtb_hardlimit)
-		return;
-	fprintf(fp, "fs = %s\n", dev);
-	/* this branch is for backward compatibility reasons */
-	if (d.d_rtb_softlimit || d.d_rtb_hardlimit)
-		fprintf(fp, "%-10d %7llu %7llu %7llu %7llu %7llu %7llu\n", id,
-			(unsigned long long)d.d_blk_softlimit,
-			(unsigned long long)d.d_blk_hardlimit,
-			(unsigned long long)d.d_ino_softlimit,
-			(unsigned long long)d.d_ino_hardlimit,
-			(unsigned long long)d.d_rtb_softlimit,
-			(unsigned long long)d.d_rtb_hardlimit);
-	else
-		fprintf(fp, "%-10d %7llu %7llu %7llu %7llu\n", id,
-			(unsigned long long)d.d_blk_softlimit,
-			(unsigned long long)d.d_blk_hardlimit,
-			(unsigned long long)d.d_ino_softlimit,
-			(unsigned long long)d.d_ino_hardlimit);
+	dump_dquot(fp, &d, id, dev);
+}
+
+/*
+ * Dump the dquots that exist between lower and upper, rather than asking
+ * about every ID in the range or in the name database.  Returns 0 if the
+ * kernel can't iterate over the dquots, -1 if the walk failed partway.
+ */
+static int
+dump_dquots(
+	FILE		*fp,
+	uint		type,
+	char		*dev,
+	uint		lower,
+	uint		upper)
+{
+	fs_disk_quota_t	d;
+	uint		id = lower;
+	int		error;
+
+	while ((error = get_next_dquot(&d, id, type, dev)) > 0 &&
+	       d.d_id <= upper) {
+		dump_dquot(fp, &d, d.d_id, dev);
+		if (d.d_id == UINT_MAX)
+			break;
+		id = d.d_id + 1;
+	}
+	if (error < 0) {
+		if (id == lower)
+			return 0;
+		exitcode = 1;
+		perror("XFS_GETNEXTQUOTA");
+		return -1;
+	}
+	return 1;
 }
 
 static void
@@ -126,6 +206,10 @@ dump_limits_any_type(
 		return;
 	}
 
+	if (dump_dquots(fp, type, mount->fs_name,
+			lower, upper ? upper : UINT_MAX))
+		return;
+
 	if (upper) {
 		for (id = lower; id <= upper; id++)
 			dump_file(fp, id, type, mount->fs_name);
@@ -286,34 +370,26 @@ report_header(
 }
 
 static int
-report_mount(
+report_dquot(
 	FILE		*fp,
-	__uint32_t	id,
+	fs_disk_quota_t	*d,
 	char		*name,
 	uint		form,
 	uint		type,
 	fs_path_t	*mount,
 	uint		flags)
 {
-	fs_disk_quota_t	d;
-	char		*dev = mount->fs_name;
 	char		c[8], h[8], s[8];
 	uint		qflags;
 	int		count;
 
-	if (xfsquotactl(XFS_GETQUOTA, dev, type, id, (void *)&d) < 0) {
-		if (errno != ENOENT && errno != ENOSYS && errno != ESRCH)
-			perror("XFS_GETQUOTA");
-		return 0;
-	}
-
 	if (flags & TERSE_FLAG) {
 		count = 0;
-		if ((form & XFS_BLOCK_QUOTA) && d.d_bcount)
+		if ((form & XFS_BLOCK_QUOTA) && d->d_bcount)
 			count++;
-		if ((form & XFS_INODE_QUOTA) && d.d_icount)
+		if ((form & XFS_INODE_QUOTA) && d->d_icount)
 			count++;
-		if ((form & XFS_RTBLOCK_QUOTA) && d.d_rtbcount)
+		if ((form & XFS_RTBLOCK_QUOTA) && d->d_rtbcount)
 			count++;
 		if (!count)
 			return 0;
@@ -325,71 +401,143 @@ report_mount(
 	fprintf(fp, "%-10s", name);
 	if (form & XFS_BLOCK_QUOTA) {
 		qflags = (flags & HUMAN_FLAG);
-		if (d.d_blk_hardlimit && d.d_bcount > d.d_blk_hardlimit)
+		if (d->d_blk_hardlimit && d->d_bcount > d->d_blk_hardlimit)
 			qflags |= LIMIT_FLAG;
-		if (d.d_blk_softlimit && d.d_bcount > d.d_blk_softlimit)
+		if (d->d_blk_softlimit && d->d_bcount > d->d_blk_softlimit)
 			qflags |= QUOTA_FLAG;
 		if (flags & HUMAN_FLAG)
 			fprintf(fp, " %6s %6s %6s  %02d %8s",
-				bbs_to_string(d.d_bcount, c, sizeof(c)),
-				bbs_to_string(d.d_blk_softlimit, s, sizeof(s)),
-				bbs_to_string(d.d_blk_hardlimit, h, sizeof(h)),
-				d.d_bwarns,
-				time_to_string(d.d_btimer, qflags));
+				bbs_to_string(d->d_bcount, c, sizeof(c)),
+				bbs_to_string(d->d_blk_softlimit, s, sizeof(s)),
+				bbs_to_string(d->d_blk_hardlimit, h, sizeof(h)),
+				d->d_bwarns,
+				time_to_string(d->d_btimer, qflags));
 		else
 			fprintf(fp, " %10llu %10llu %10llu     %02d %9s",
-				(unsigned long long)d.d_bcount >> 1,
-				(unsigned long long)d.d_blk_softlimit >> 1,
-				(unsigned long long)d.d_blk_hardlimit >> 1,
-				d.d_bwarns,
-				time_to_string(d.d_btimer, qflags));
+				(unsigned long long)d->d_bcount >> 1,
+				(unsigned long long)d->d_blk_softlimit >> 1,
+				(unsigned long long)d->d_blk_hardlimit >> 1,
+				d->d_bwarns,
+				time_to_string(d->d_btimer, qflags));
 	}
 	if (form & XFS_INODE_QUOTA) {
 		qflags = (flags & HUMAN_FLAG);
-		if (d.d_ino_hardlimit && d.d_icount > d.d_ino_hardlimit)
+		if (d->d_ino_hardlimit && d->d_icount > d->d_ino_hardlimit)
 			qflags |= LIMIT_FLAG;
-		if (d.d_ino_softlimit && d.d_icount > d.d_ino_softlimit)
+		if (d->d_ino_softlimit && d->d_icount > d->d_ino_softlimit)
 			qflags |= QUOTA_FLAG;
 		if (flags & HUMAN_FLAG)
 			fprintf(fp, " %6s %6s %6s  %02d %8s",
-				num_to_string(d.d_icount, c, sizeof(c)),
-				num_to_string(d.d_ino_softlimit, s, sizeof(s)),
-				num_to_string(d.d_ino_hardlimit, h, sizeof(h)),
-				d.d_iwarns,
-				time_to_string(d.d_itimer, qflags));
+				num_to_string(d->d_icount, c, sizeof(c)),
+				num_to_string(d->d_ino_softlimit, s, sizeof(s)),
+				num_to_string(d->d_ino_hardlimit, h, sizeof(h)),
+				d->d_iwarns,
+				time_to_string(d->d_itimer, qflags));
 		else
 			fprintf(fp, " %10llu %10llu %10llu     %02d %9s",
-				(unsigned long long)d.d_icount,
-				(unsigned long long)d.d_ino_softlimit,
-				(unsigned long long)d.d_ino_hardlimit,
-				d.d_iwarns,
-				time_to_string(d.d_itimer, qflags));
+				(unsigned long long)d->d_icount,
+				(unsigned long long)d->d_ino_softlimit,
+				(unsigned long long)d->d_ino_hardlimit,
+				d->d_iwarns,
+				time_to_string(d->d_itimer, qflags));
 	}
 	if (form & XFS_RTBLOCK_QUOTA) {
 		qflags = (flags & HUMAN_FLAG);
-		if (d.d_rtb_hardlimit && d.d_rtbcount > d.d_rtb_hardlimit)
+		if (d->d_rtb_hardlimit && d->d_rtbcount > d->d_rtb_hardlimit)
 			qflags |= LIMIT_FLAG;
-		if (d.d_rtb_softlimit && d.d_rtbcount > d.d_rtb_softlimit)
+		if (d->d_rtb_softlimit && d->d_rtbcount > d->d_rtb_softlimit)
 			qflags |= QUOTA_FLAG;
 		if (flags & HUMAN_FLAG)
 			fprintf(fp, " %6s %6s %6s  %02d %8s",
-				bbs_to_string(d.d_rtbcount, c, sizeof(c)),
-				bbs_to_string(d.d_rtb_softlimit, s, sizeof(s)),
-				bbs_to_string(d.d_rtb_hardlimit, h, sizeof(h)),
-				d.d_rtbwarns,
-				time_to_string(d.d_rtbtimer, qflags));
+				bbs_to_string(d->d_rtbcount, c, sizeof(c)),
+				bbs_to_string(d->d_rtb_softlimit, s, sizeof(s)),
+				bbs_to_string(d->d_rtb_hardlimit, h, sizeof(h)),
+				d->d_rtbwarns,
+				time_to_string(d->d_rtbtimer, qflags));
 		else
 			fprintf(fp, " %10llu %10llu %10llu     %02d %9s",
-				(unsigned long long)d.d_rtbcount >> 1,
-				(unsigned long long)d.d_rtb_softlimit >> 1,
-				(unsigned long long)d.d_rtb_hardlimit >> 1,
-				d.d_rtbwarns,
-				time_to_string(d.d_rtbtimer, qflags));
+				(unsigned long long)d->d_rtbcount >> 1,
+				(unsigned long long)d->d_rtb_softlimit >> 1,
+				(unsigned long long)d->d_rtb_hardlimit >> 1,
+				d->d_rtbwarns,
+				time_to_string(d->d_rtbtimer, qflags));
 	}
 	fputc('\n', fp);
 	return 1;
 }
 
+static int
+report_mount(
+	FILE		*fp,
+	__uint32_t	id,
+	char		*name,
+	uint		form,
+	uint		type,
+	fs_path_t	*mount,
+	uint		flags)
+{
+	fs_disk_quota_t	d;
+
+	if (xfsquotactl(XFS_GETQUOTA, mount->fs_name, type, id, (void *)&d) < 0) {
+		if (errno != ENOENT && errno != ENOSYS && errno != ESRCH)
+			perror("XFS_GETQUOTA");
+		return 0;
+	}
+	return report_dquot(fp, &d, name, form, type, mount, flags);
+}
+
+/*
+ * Report on the dquots that exist, from lower up to upper if a range was
+ * given, instead of asking about every ID in the range or in the name
+ * database.  Only the IDs found are looked up, through the name caches.
+ * Returns 0 if the kernel can't iterate over the dquots, -1 if the walk
+ * failed partway.
+ */
+static int
+report_dquots(
+	FILE		*fp,
+	uint		form,
+	uint		type,
+	fs_path_t	*mount,
+	uint		lower,
+	uint		upper,
+	uint		flags)
+{
+	fs_disk_quota_t	d;
+	char		n[NMAX];
+	char		*name;
+	uint		id = lower;
+	uint		last = upper ? upper : UINT_MAX;
+	int		error;
+
+	while ((error = get_next_dquot(&d, id, type, mount->fs_name)) > 0 &&
+	       d.d_id <= last) {
+		name = NULL;
+		/* ranges have always been reported by ID */
+		if (!upper && !(flags & NO_LOOKUP_FLAG))
+			name = id_to_name(d.d_id, type);
+		if (!name) {
+			snprintf(n, sizeof(n)-1, "#%u", d.d_id);
+			name = n;
+		}
+		if (report_dquot(fp, &d, name, form, type, mount, flags))
+			flags |= NO_HEADER_FLAG;
+		if (d.d_id == UINT_MAX)
+			break;
+		id = d.d_id + 1;
+	}
+	if (error < 0) {
+		if (id == lower)
+			return 0;
+		exitcode = 1;
+		perror("XFS_GETNEXTQUOTA");
+	}
+
+	if (flags & NO_HEADER_FLAG)
+		fputc('\n', fp);
+	return error < 0 ? -1 : 1;
+}
+
 static void
 report_user_mount(
 	FILE		*fp,
@@ -403,6 +551,9 @@ report_user_mount(
 	char		n[NMAX];
 	uint		id;
 
+	if (report_dquots(fp, form, XFS_USER_QUOTA, mount, lower, upper, flags))
+		return;
+
 	if (upper) {	/* identifier range specified */
 		for (id = lower; id <= upper; id++) {
 			snprintf(n, sizeof(n)-1, "#%u", id);
@@ -441,6 +592,9 @@ report_group_mount(
 	char		n[NMAX];
 	uint		id;
 
+	if (report_dquots(fp, form, XFS_GROUP_QUOTA, mount, lower, upper, flags))
+		return;
+
 	if (upper) {	/* identifier range specified */
 		for (id = lower; id <= upper; id++) {
 			snprintf(n, sizeof(n)-1, "#%u", id);
@@ -478,6 +632,9 @@ report_project_mount(
 	char		n[NMAX];
 	uint		id;
 
+	if (report_dquots(fp, form, XFS_PROJ_QUOTA, mount, lower, upper, flags))
+		return;
+
 	if (upper) {	/* identifier range specified */
 		for (id = lower; id <= upper; id++) {
 			snprintf(n, sizeof(n)-1, "#%u", id);
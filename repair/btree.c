@@ -30,25 +30,21 @@
 
 struct btree_node {
 	unsigned long		num_keys;
-	unsigned long		keys[BTREE_KEY_MAX];
+	__uint64_t		keys[BTREE_KEY_MAX];
 	struct btree_node	*ptrs[BTREE_PTR_MAX];
 };
 
-struct btree_cursor {
-	struct btree_node	*node;
-	int			index;
-};
-
 struct btree_root {
 	struct btree_node	*root_node;
 	struct btree_cursor	*cursor;	/* track path to end leaf */
 	int			height;
+	unsigned long		gen;		/* changed by insert/delete */
 	/* lookup cache */
 	int			keys_valid;	/* set if the cache is valid */
-	unsigned long		cur_key;
-	unsigned long		next_key;
+	__uint64_t		cur_key;
+	__uint64_t		next_key;
 	void			*next_value;
-	unsigned long		prev_key;
+	__uint64_t		prev_key;
 	void			*prev_value;
 #ifdef BTREE_STATS
 	struct btree_stats {
@@ -77,6 +73,19 @@ struct btree_root {
 };
 
 
+/*
+ * Generations are unique over all trees, so a tree allocated where a freed
+ * one used to be can't be mistaken for it by an iterator.
+ */
+static unsigned long	btree_generation;
+
+static inline void
+btree_new_gen(
+	struct btree_root	*root)
+{
+	root->gen = __sync_add_and_fetch(&btree_generation, 1);
+}
+
 static struct btree_node *
 btree_node_alloc(void)
 {
@@ -108,6 +117,7 @@ __btree_init(
 	struct btree_root	*root)
 {
 	memset(root, 0, sizeof(struct btree_root));
+	btree_new_gen(root);
 	root->height = 1;
 	root->cursor = calloc(1, sizeof(struct btree_cursor));
 	root->root_node = btree_node_alloc();
@@ -153,6 +163,34 @@ btree_destroy(
 	free(root);
 }
 
+static size_t
+btree_count_nodes(
+	struct btree_node	*node,
+	int			level)
+{
+	size_t			count = 1;
+	int			i;
+
+	if (level)
+		for (i = 0; i <= node->num_keys; i++)
+			count += btree_count_nodes(node->ptrs[i], level - 1);
+	return count;
+}
+
+/*
+ * Memory used by the tree, in bytes. This walks the whole tree, so it
+ * is only meant for reporting.
+ */
+size_t
+btree_mem_usage(
+	struct btree_root	*root)
+{
+	return sizeof(struct btree_root) +
+		root->height * sizeof(struct btree_cursor) +
+		btree_count_nodes(root->root_node, root->height - 1) *
+			sizeof(struct btree_node);
+}
+
 int
 btree_is_empty(
 	struct btree_root	*root)
@@ -168,7 +206,7 @@ btree_invalidate_cursor(
 	root->keys_valid = 0;
 }
 
-static inline unsigned long
+static inline __uint64_t
 btree_key_of_cursor(
 	struct btree_cursor	*cursor,
 	int			height)
@@ -181,7 +219,7 @@ btree_key_of_cursor(
 static void *
 btree_get_prev(
 	struct btree_root	*root,
-	unsigned long		*key)
+	__uint64_t		*key)
 {
 	struct btree_cursor	*cur = root->cursor;
 	int			level = 0;
@@ -217,7 +255,7 @@ btree_get_prev(
 static void *
 btree_get_next(
 	struct btree_root	*root,
-	unsigned long		*key)
+	__uint64_t		*key)
 {
 	struct btree_cursor	*cur = root->cursor;
 	int			level = 0;
@@ -249,13 +287,18 @@ btree_get_next(
  * Lookup/Search functions
  */
 
+/*
+ * Fill in @cursor with the path to the first key >= @key, and return that
+ * key in @found_key.  Returns 0 if there is no such key.
+ */
 static int
-btree_do_search(
+btree_search_path(
 	struct btree_root	*root,
-	unsigned long		key)
+	struct btree_cursor	*cursor,
+	__uint64_t		key,
+	__uint64_t		*found_key)
 {
-	unsigned long		k = 0;
-	struct btree_cursor	*cur = root->cursor + root->height;
+	struct btree_cursor	*cur = cursor + root->height;
 	struct btree_node	*node = root->root_node;
 	int			height = root->height;
 	int			key_found = 0;
@@ -265,7 +308,7 @@ btree_do_search(
 		cur--;
 		for (i = 0; i < node->num_keys; i++)
 			if (node->keys[i] >= key) {
-				k = node->keys[i];
+				*found_key = node->keys[i];
 				key_found = 1;
 				break;
 			}
@@ -273,8 +316,18 @@ btree_do_search(
 		cur->index = i;
 		node = node->ptrs[i];
 	}
-	root->keys_valid = key_found;
-	if (!key_found)
+	return key_found;
+}
+
+static int
+btree_do_search(
+	struct btree_root	*root,
+	__uint64_t		key)
+{
+	__uint64_t		k = 0;
+
+	root->keys_valid = btree_search_path(root, root->cursor, key, &k);
+	if (!root->keys_valid)
 		return 0;
 
 	root->cur_key = k;
@@ -286,7 +339,7 @@ btree_do_search(
 static int
 btree_search(
 	struct btree_root	*root,
-	unsigned long		key)
+	__uint64_t		key)
 {
 	if (root->keys_valid && key <= root->cur_key &&
 				(!root->prev_value || key > root->prev_key)) {
@@ -304,8 +357,8 @@ btree_search(
 void *
 btree_find(
 	struct btree_root	*root,
-	unsigned long		key,
-	unsigned long		*actual_key)
+	__uint64_t		key,
+	__uint64_t		*actual_key)
 {
 #ifdef BTREE_STATS
 	root->stats.find += 1;
@@ -321,7 +374,7 @@ btree_find(
 void *
 btree_lookup(
 	struct btree_root	*root,
-	unsigned long		key)
+	__uint64_t		key)
 {
 #ifdef BTREE_STATS
 	root->stats.lookup += 1;
@@ -334,7 +387,7 @@ btree_lookup(
 void *
 btree_peek_prev(
 	struct btree_root	*root,
-	unsigned long		*key)
+	__uint64_t		*key)
 {
 	if (!root->keys_valid)
 		return NULL;
@@ -346,7 +399,7 @@ btree_peek_prev(
 void *
 btree_peek_next(
 	struct btree_root	*root,
-	unsigned long		*key)
+	__uint64_t		*key)
 {
 	if (!root->keys_valid)
 		return NULL;
@@ -359,27 +412,28 @@ btree_peek_next(
 
 static void *
 btree_move_cursor_to_next(
-	struct btree_root	*root,
-	unsigned long		*key)
+	struct btree_cursor	*cursor,
+	int			height,
+	__uint64_t		*key)
 {
-	struct btree_cursor	*cur = root->cursor;
+	struct btree_cursor	*cur = cursor;
 	int			level = 0;
 
 	while (cur->index == cur->node->num_keys) {
-		if (++level == root->height)
+		if (++level == height)
 			return NULL;
 		cur++;
 	}
 	cur->index++;
 	if (level == 0) {
 		if (key)
-			*key = btree_key_of_cursor(cur, root->height);
+			*key = btree_key_of_cursor(cur, height);
 		return cur->node->ptrs[cur->index];
 	}
 
 	while (--level >= 0) {
-		root->cursor[level].node = cur->node->ptrs[cur->index];
-		root->cursor[level].index = 0;
+		cursor[level].node = cur->node->ptrs[cur->index];
+		cursor[level].index = 0;
 		cur--;
 	}
 	if (key)
@@ -390,7 +444,7 @@ btree_move_cursor_to_next(
 void *
 btree_lookup_next(
 	struct btree_root	*root,
-	unsigned long		*key)
+	__uint64_t		*key)
 {
 	void			*value;
 
@@ -400,7 +454,8 @@ btree_lookup_next(
 	root->prev_key = root->cur_key;
 	root->prev_value = root->cursor->node->ptrs[root->cursor->index];
 
-	value = btree_move_cursor_to_next(root, &root->cur_key);
+	value = btree_move_cursor_to_next(root->cursor, root->height,
+					  &root->cur_key);
 	if (!value) {
 		btree_invalidate_cursor(root);
 		return NULL;
@@ -414,7 +469,7 @@ btree_lookup_next(
 static void *
 btree_move_cursor_to_prev(
 	struct btree_root	*root,
-	unsigned long		*key)
+	__uint64_t		*key)
 {
 	struct btree_cursor	*cur = root->cursor;
 	int			level = 0;
@@ -439,7 +494,7 @@ btree_move_cursor_to_prev(
 void *
 btree_lookup_prev(
 	struct btree_root	*root,
-	unsigned long		*key)
+	__uint64_t		*key)
 {
 	void			*value;
 
@@ -456,27 +511,182 @@ btree_lookup_prev(
 	return value;
 }
 
+/*
+ * Cursor-less (ie. uncached) lookups.
+ *
+ * These walk down from the root with nothing but local state, so unlike
+ * the cached functions above they can be called from several threads at
+ * once, as long as nobody is modifying the tree at the same time.
+ *
+ * A key stored in an interior node has its value in the last pointer slot
+ * of the rightmost leaf of the subtree to its left, see btree_key_of_cursor.
+ */
+
+/*
+ * Find the first key >= @key.
+ */
 void *
-btree_uncached_lookup(
+btree_uncached_find(
 	struct btree_root	*root,
-	unsigned long		key)
+	__uint64_t		key,
+	__uint64_t		*actual_key)
 {
-	/* cursor-less (ie. uncached) lookup */
-	int			height = root->height - 1;
 	struct btree_node	*node = root->root_node;
-	int			i;
-	int			key_found = 0;
+	struct btree_node	*parent = NULL;
+	int			height = root->height;
+	int			pindex = 0;
+	int			i = 0;
 
-	while (height >= 0) {
+	while (--height >= 0) {
 		for (i = 0; i < node->num_keys; i++)
-			if (node->keys[i] >= key) {
-				key_found = node->keys[i] == key;
+			if (node->keys[i] >= key)
 				break;
+		if (height == 0)
+			break;
+		if (i < node->num_keys) {
+			parent = node;
+			pindex = i;
+		}
+		node = node->ptrs[i];
+	}
+
+	if (i < node->num_keys) {
+		if (actual_key)
+			*actual_key = node->keys[i];
+		return node->ptrs[i];
+	}
+	if (!parent)
+		return NULL;
+	if (actual_key)
+		*actual_key = parent->keys[pindex];
+	return node->ptrs[node->num_keys];
+}
+
+/*
+ * Find the last key <= @key.
+ */
+void *
+btree_uncached_find_le(
+	struct btree_root	*root,
+	__uint64_t		key,
+	__uint64_t		*actual_key)
+{
+	struct btree_node	*node = root->root_node;
+	struct btree_node	*prev = NULL;
+	int			height = root->height;
+	int			prev_height = 0;
+	int			pindex = 0;
+	int			i;
+
+	while (--height >= 0) {
+		for (i = 0; i < node->num_keys; i++) {
+			if (node->keys[i] == key) {
+				if (actual_key)
+					*actual_key = key;
+				if (height == 0)
+					return node->ptrs[i];
+				/* value is at the far right of the left subtree */
+				node = node->ptrs[i];
+				while (--height >= 0)
+					node = node->ptrs[node->num_keys];
+				return node;
 			}
+			if (node->keys[i] > key)
+				break;
+		}
+		if (i > 0) {
+			prev = node;
+			prev_height = height;
+			pindex = i - 1;
+		}
 		node = node->ptrs[i];
-		height--;
 	}
-	return key_found ? node : NULL;
+
+	if (!prev)
+		return NULL;
+	if (actual_key)
+		*actual_key = prev->keys[pindex];
+	node = prev->ptrs[pindex];
+	while (--prev_height >= 0)
+		node = node->ptrs[node->num_keys];
+	return node;
+}
+
+/*
+ * Exact match lookup.
+ */
+void *
+btree_uncached_lookup(
+	struct btree_root	*root,
+	__uint64_t		key)
+{
+	__uint64_t		k;
+	void			*value;
+
+	value = btree_uncached_find(root, key, &k);
+	if (!value || k != key)
+		return NULL;
+	return value;
+}
+
+/*
+ * Iterators.
+ *
+ * Walking a tree with btree_uncached_find(key + 1) costs a search from the
+ * root for every step.  An iterator keeps its own copy of the path to the
+ * last value it returned instead, so the next one is usually found by
+ * moving along the same leaf.  Like the uncached lookups, iterators never
+ * write to the tree.  The path is only trusted while the tree is still at
+ * the generation it was found in; every insert and delete changes that.
+ */
+
+/*
+ * Find the first key >= @key and point @iter at it.
+ */
+void *
+btree_iter_find(
+	struct btree_iter	*iter,
+	struct btree_root	*root,
+	__uint64_t		key,
+	__uint64_t		*actual_key)
+{
+	iter->root = NULL;
+	if (root->height > BTREE_ITER_HEIGHT)
+		return btree_uncached_find(root, key, actual_key);
+	if (!btree_search_path(root, iter->path, key, &iter->key))
+		return NULL;
+
+	iter->root = root;
+	iter->gen = root->gen;
+	if (actual_key)
+		*actual_key = iter->key;
+	return iter->path[0].node->ptrs[iter->path[0].index];
+}
+
+/*
+ * Find the first key > @key.  If @iter is still at @key this just steps on
+ * from there, otherwise it searches.  @iter is left at the key found.
+ */
+void *
+btree_iter_next(
+	struct btree_iter	*iter,
+	struct btree_root	*root,
+	__uint64_t		key,
+	__uint64_t		*actual_key)
+{
+	void			*value;
+
+	if (iter->root != root || iter->gen != root->gen || iter->key != key)
+		return btree_iter_find(iter, root, key + 1, actual_key);
+
+	value = btree_move_cursor_to_next(iter->path, root->height, &iter->key);
+	if (!value) {
+		iter->root = NULL;
+		return NULL;
+	}
+	if (actual_key)
+		*actual_key = iter->key;
+	return value;
 }
 
 /* Update functions */
@@ -486,7 +696,7 @@ btree_update_node_key(
 	struct btree_root	*root,
 	struct btree_cursor	*cursor,
 	int			level,
-	unsigned long		new_key)
+	__uint64_t		new_key)
 {
 	int			i;
 
@@ -507,8 +717,8 @@ btree_update_node_key(
 int
 btree_update_key(
 	struct btree_root	*root,
-	unsigned long		old_key,
-	unsigned long		new_key)
+	__uint64_t		old_key,
+	__uint64_t		new_key)
 {
 	if (!btree_search(root, old_key) || root->cur_key != old_key)
 		return ENOENT;
@@ -528,7 +738,7 @@ btree_update_key(
 int
 btree_update_value(
 	struct btree_root	*root,
-	unsigned long		key,
+	__uint64_t		key,
 	void			*new_value)
 {
 	if (!new_value)
@@ -631,7 +841,7 @@ btree_shift_to_prev(
 	struct btree_node	*node;
 	struct btree_node	*prev_node;
 	int			num_remain;	/* # of keys left in "node" */
-	unsigned long		key;
+	__uint64_t		key;
 	int			i;
 
 	if (!prev_cursor || !num_children)
@@ -797,7 +1007,7 @@ static int
 btree_insert_item(
 	struct btree_root	*root,
 	int			level,
-	unsigned long		key,
+	__uint64_t		key,
 	void			*value);
 
 
@@ -805,7 +1015,7 @@ static struct btree_node *
 btree_split(
 	struct btree_root	*root,
 	int			level,
-	unsigned long		key,
+	__uint64_t		key,
 	int			*index)
 {
 	struct btree_node	*node = root->cursor[level].node;
@@ -892,7 +1102,7 @@ static int
 btree_insert_item(
 	struct btree_root	*root,
 	int			level,
-	unsigned long		key,
+	__uint64_t		key,
 	void			*value)
 {
 	struct btree_node	*node = root->cursor[level].node;
@@ -938,7 +1148,7 @@ insert:
 int
 btree_insert(
 	struct btree_root	*root,
-	unsigned long		key,
+	__uint64_t		key,
 	void			*value)
 {
 	int			result;
@@ -957,6 +1167,7 @@ btree_insert(
 	result = btree_insert_item(root, 0, key, value);
 
 	btree_invalidate_cursor(root);
+	btree_new_gen(root);
 
 	return result;
 }
@@ -1183,7 +1394,7 @@ btree_delete_key(
 void *
 btree_delete(
 	struct btree_root	*root,
-	unsigned long		key)
+	__uint64_t		key)
 {
 	void			*value;
 
@@ -1199,6 +1410,7 @@ btree_delete(
 	btree_delete_key(root, 0);
 
 	btree_invalidate_cursor(root);
+	btree_new_gen(root);
 
 	return value;
 }
@@ -21,6 +21,26 @@
 
 
 struct btree_root;
+struct btree_node;
+
+struct btree_cursor {
+	struct btree_node	*node;
+	int			index;
+};
+
+/*
+ * Position in a tree for walking it in key order, see btree_iter_next().
+ * Unlike the cursor behind the cached lookups it belongs to the caller,
+ * so several threads can walk the same tree at once.
+ */
+#define BTREE_ITER_HEIGHT	32
+
+struct btree_iter {
+	struct btree_root	*root;		/* NULL if not positioned */
+	unsigned long		gen;		/* tree generation of path */
+	__uint64_t		key;
+	struct btree_cursor	path[BTREE_ITER_HEIGHT];
+};
 
 void
 btree_init(
@@ -37,61 +57,96 @@ btree_is_empty(
 void *
 btree_lookup(
 	struct btree_root	*root,
-	unsigned long		key);
+	__uint64_t		key);
 
 void *
 btree_find(
 	struct btree_root	*root,
-	unsigned long		key,
-	unsigned long		*actual_key);
+	__uint64_t		key,
+	__uint64_t		*actual_key);
 
 void *
 btree_peek_prev(
 	struct btree_root	*root,
-	unsigned long		*key);
+	__uint64_t		*key);
 
 void *
 btree_peek_next(
 	struct btree_root	*root,
-	unsigned long		*key);
+	__uint64_t		*key);
 
 void *
 btree_lookup_next(
 	struct btree_root	*root,
-	unsigned long		*key);
+	__uint64_t		*key);
 
 void *
 btree_lookup_prev(
 	struct btree_root	*root,
-	unsigned long		*key);
+	__uint64_t		*key);
+
+void *
+btree_uncached_find(
+	struct btree_root	*root,
+	__uint64_t		key,
+	__uint64_t		*actual_key);
+
+void *
+btree_uncached_find_le(
+	struct btree_root	*root,
+	__uint64_t		key,
+	__uint64_t		*actual_key);
+
+void *
+btree_uncached_lookup(
+	struct btree_root	*root,
+	__uint64_t		key);
+
+void *
+btree_iter_find(
+	struct btree_iter	*iter,
+	struct btree_root	*root,
+	__uint64_t		key,
+	__uint64_t		*actual_key);
+
+void *
+btree_iter_next(
+	struct btree_iter	*iter,
+	struct btree_root	*root,
+	__uint64_t		key,
+	__uint64_t		*actual_key);
 
 int
 btree_insert(
 	struct btree_root	*root,
-	unsigned long		key,
+	__uint64_t		key,
 	void			*value);
 
 void *
 btree_delete(
 	struct btree_root	*root,
-	unsigned long		key);
+	__uint64_t		key);
 
 int
 btree_update_key(
 	struct btree_root	*root,
-	unsigned long		old_key,
-	unsigned long		new_key);
+	__uint64_t		old_key,
+	__uint64_t		new_key);
 
 int
 btree_update_value(
 	struct btree_root	*root,
-	unsigned long		key,
+	__uint64_t		key,
 	void 			*new_value);
 
 void
 btree_clear(
 	struct btree_root	*root);
 
+size_t
+btree_mem_usage(
+	struct btree_root	*root);
+
 #ifdef BTREE_STATS
 void
 btree_print_stats(
@@ -0,0 +1,751 @@
+/*
+ * Checkpoints of the incore state built by phases 2 to 4.
+ *
+ * Phases 2 to 4 read through the whole filesystem to build the block map,
+ * the inode trees, the uncertain inode lists, the duplicate extent trees,
+ * the list of directories with broken leaf/node linkage and a handful of
+ * globals.  On the way they only clear things like unlinked lists and bad
+ * inodes; phase 5 and later rebuild the metadata from that state.  With
+ * -o checkpoint=file the state is written to the file at the end of each
+ * of phases 2 to 4, and a later run against the same filesystem loads it
+ * and carries on with the next phase.
+ *
+ * The file is only believed if the superblock and AG headers (the first
+ * NUM_AGH_SECTS sectors of every AG) are exactly what they were when it
+ * was written, and it was written by a run with the same no-modify
+ * setting.  The log is replayed and cleared before the checkpoint is
+ * looked at, and a replay means it isn't loaded at all.  Whatever a
+ * phase fixed is flushed to disk before the state is written, so the
+ * header checksum is taken from the disk the state describes.  Phase 5
+ * rewrites the AG headers, so a checkpoint stops matching as soon as
+ * phase 5 has written anything.  A run killed part way through a phase
+ * starts that phase again, and in modify mode sees whatever it had
+ * already fixed, just like a fresh run would.
+ *
+ * The format is native endian and only meant to be read back by the same
+ * xfs_repair on the same host.  It is written under a temporary name and
+ * renamed into place, and ends with a crc32c of everything before it.
+ */
+
+#include <libxfs.h>
+#include "globals.h"
+#include "versions.h"
+#include "incore.h"
+#include "dir2.h"
+#include "err_protos.h"
+#include "checkpoint.h"
+
+#define XR_CKPT_MAGIC		0x58524350	/* XRCP */
+#define XR_CKPT_VERSION		1
+
+struct ckpt_hdr {
+	__uint32_t	ch_magic;
+	__uint32_t	ch_version;
+	__uint32_t	ch_phase;	/* last phase completed */
+	__uint32_t	ch_no_modify;
+	__uint32_t	ch_agcount;
+	__uint32_t	ch_blocksize;
+	__uint64_t	ch_dblocks;
+	__uint64_t	ch_rextents;
+	uuid_t		ch_uuid;
+	__uint32_t	ch_aghdr_crc;	/* crc32c of all AG headers */
+	__uint32_t	ch_pad;
+};
+
+/* globals set by phases 2 to 4 that the later phases look at */
+struct ckpt_globals {
+	__int32_t	cg_bad_ino_btree;
+	__int32_t	cg_fs_is_dirty;
+	__int32_t	cg_need_root_inode;
+	__int32_t	cg_need_root_dotdot;
+	__int32_t	cg_need_rbmino;
+	__int32_t	cg_need_rsumino;
+	__int32_t	cg_lost_quotas;
+	__int32_t	cg_lost_uquotino;
+	__int32_t	cg_lost_gquotino;
+	__int32_t	cg_lost_pquotino;
+	__int32_t	cg_fs_quotas;
+	__int32_t	cg_pad;
+	__uint64_t	cg_uquotino;	/* may be cleared in phases 3/4 */
+	__uint64_t	cg_gquotino;
+	__uint64_t	cg_pquotino;
+};
+
+/* block map runs and dup extents, a zero length ends a list */
+struct ckpt_ext {
+	__uint64_t	ce_start;
+	__uint64_t	ce_len;
+	__uint32_t	ce_state;
+	__uint32_t	ce_pad;
+};
+
+/*
+ * Inode records.  Records from the inode trees are followed by their link
+ * counts, their file types if the filesystem has them, and one parent
+ * for each bit in ci_pmask.  For uncertain inodes only the free and
+ * confirmed masks mean anything.  NULLAGINO ends a list.
+ */
+struct ckpt_irec {
+	__uint32_t	ci_startnum;
+	__uint32_t	ci_nlink_size;
+	__uint64_t	ci_free;
+	__uint64_t	ci_confirmed;
+	__uint64_t	ci_isa_dir;
+	__uint64_t	ci_pmask;
+};
+
+struct ckpt {
+	FILE		*fp;
+	__uint32_t	crc;
+	int		error;
+};
+
+static void
+ckpt_put(
+	struct ckpt	*ck,
+	const void	*buf,
+	size_t		len)
+{
+	if (ck->error || !len)
+		return;
+	if (fwrite(buf, len, 1, ck->fp) != 1) {
+		ck->error = errno ? errno : EIO;
+		return;
+	}
+	ck->crc = crc32c(ck->crc, buf, len);
+}
+
+/*
+ * The whole file has been checksummed before we load anything from it,
+ * so running out of it half way means someone is changing it under us.
+ */
+static void
+ckpt_get(
+	struct ckpt	*ck,
+	void		*buf,
+	size_t		len)
+{
+	if (len && fread(buf, len, 1, ck->fp) != 1)
+		do_error(_("checkpoint %s is truncated\n"), checkpoint_path);
+}
+
+static void
+ckpt_put_ext(
+	struct ckpt	*ck,
+	__uint64_t	start,
+	__uint64_t	len,
+	int		state)
+{
+	struct ckpt_ext	ce = { 0 };
+
+	ce.ce_start = start;
+	ce.ce_len = len;
+	ce.ce_state = state;
+	ckpt_put(ck, &ce, sizeof(ce));
+}
+
+static int
+ckpt_get_ext(
+	struct ckpt	*ck,
+	struct ckpt_ext	*ce)
+{
+	ckpt_get(ck, ce, sizeof(*ce));
+	if (ce->ce_len && ce->ce_state > XR_E_BAD_STATE)
+		do_error(_("bad block state %u in checkpoint %s\n"),
+			ce->ce_state, checkpoint_path);
+	return ce->ce_len != 0;
+}
+
+/*
+ * Checksum the superblock and AG headers of every AG straight off the
+ * disk, so that what is in the buffer cache doesn't matter.
+ */
+static int
+aghdr_crc(
+	struct xfs_mount	*mp,
+	__uint32_t		*crcp)
+{
+	int			fd = libxfs_device_to_fd(mp->m_ddev_targp->dev);
+	size_t			len = NUM_AGH_SECTS * mp->m_sb.sb_sectsize;
+	__uint32_t		crc = XFS_CRC_SEED;
+	xfs_agnumber_t		agno;
+	char			*buf;
+	int			error = 0;
+
+	buf = memalign(libxfs_device_alignment(), len);
+	if (!buf)
+		do_error(_("couldn't allocate %zu bytes for AG headers\n"),
+			len);
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		if (pread64(fd, buf, len, BBTOB(XFS_AG_DADDR(mp, agno, 0))) !=
+				(ssize_t)len) {
+			error = errno ? errno : EIO;
+			break;
+		}
+		crc = crc32c(crc, buf, len);
+	}
+
+	free(buf);
+	*crcp = crc;
+	return error;
+}
+
+static void
+write_globals(
+	struct ckpt		*ck,
+	struct xfs_mount	*mp)
+{
+	struct ckpt_globals	cg = { 0 };
+
+	cg.cg_bad_ino_btree = bad_ino_btree;
+	cg.cg_fs_is_dirty = fs_is_dirty;
+	cg.cg_need_root_inode = need_root_inode;
+	cg.cg_need_root_dotdot = need_root_dotdot;
+	cg.cg_need_rbmino = need_rbmino;
+	cg.cg_need_rsumino = need_rsumino;
+	cg.cg_lost_quotas = lost_quotas;
+	cg.cg_lost_uquotino = lost_uquotino;
+	cg.cg_lost_gquotino = lost_gquotino;
+	cg.cg_lost_pquotino = lost_pquotino;
+	cg.cg_fs_quotas = fs_quotas;
+	cg.cg_uquotino = mp->m_sb.sb_uquotino;
+	cg.cg_gquotino = mp->m_sb.sb_gquotino;
+	cg.cg_pquotino = mp->m_sb.sb_pquotino;
+	ckpt_put(ck, &cg, sizeof(cg));
+}
+
+static void
+load_globals(
+	struct ckpt		*ck,
+	struct xfs_mount	*mp)
+{
+	struct ckpt_globals	cg;
+
+	ckpt_get(ck, &cg, sizeof(cg));
+	bad_ino_btree = cg.cg_bad_ino_btree;
+	fs_is_dirty |= cg.cg_fs_is_dirty;
+	need_root_inode = cg.cg_need_root_inode;
+	need_root_dotdot = cg.cg_need_root_dotdot;
+	need_rbmino = cg.cg_need_rbmino;
+	need_rsumino = cg.cg_need_rsumino;
+	lost_quotas = cg.cg_lost_quotas;
+	lost_uquotino = cg.cg_lost_uquotino;
+	lost_gquotino = cg.cg_lost_gquotino;
+	lost_pquotino = cg.cg_lost_pquotino;
+	fs_quotas = cg.cg_fs_quotas;
+	mp->m_sb.sb_uquotino = cg.cg_uquotino;
+	mp->m_sb.sb_gquotino = cg.cg_gquotino;
+	mp->m_sb.sb_pquotino = cg.cg_pquotino;
+}
+
+static xfs_agblock_t
+ag_end(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno)
+{
+	if (agno < mp->m_sb.sb_agcount - 1)
+		return mp->m_sb.sb_agblocks;
+	return mp->m_sb.sb_dblocks -
+		(xfs_drfsbno_t)mp->m_sb.sb_agblocks * agno;
+}
+
+static void
+write_bmaps(
+	struct ckpt		*ck,
+	struct xfs_mount	*mp)
+{
+	xfs_agnumber_t		agno;
+	xfs_agblock_t		agbno;
+	xfs_agblock_t		end;
+	xfs_extlen_t		blen;
+	xfs_drtbno_t		bno;
+	xfs_drtbno_t		rtend;
+	int			state;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		end = ag_end(mp, agno);
+		for (agbno = 0; agbno < end; agbno += blen) {
+			state = get_bmap_ext(agno, agbno, end, &blen);
+			ckpt_put_ext(ck, agbno, blen, state);
+		}
+		ckpt_put_ext(ck, 0, 0, 0);
+	}
+
+	for (bno = 0; bno < mp->m_sb.sb_rextents; bno = rtend) {
+		state = get_rtbmap(bno);
+		for (rtend = bno + 1; rtend < mp->m_sb.sb_rextents; rtend++)
+			if (get_rtbmap(rtend) != state)
+				break;
+		ckpt_put_ext(ck, bno, rtend - bno, state);
+	}
+	ckpt_put_ext(ck, 0, 0, 0);
+}
+
+/*
+ * The maps have just been set up by init_bmaps(), with the whole realtime
+ * map free.
+ */
+static void
+load_bmaps(
+	struct ckpt		*ck,
+	struct xfs_mount	*mp)
+{
+	struct ckpt_ext		ce;
+	xfs_agnumber_t		agno;
+	xfs_drtbno_t		bno;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		while (ckpt_get_ext(ck, &ce))
+			set_bmap_ext(agno, ce.ce_start, ce.ce_len, ce.ce_state);
+	}
+
+	while (ckpt_get_ext(ck, &ce)) {
+		if (ce.ce_state == XR_E_FREE)
+			continue;
+		for (bno = ce.ce_start; bno < ce.ce_start + ce.ce_len; bno++)
+			set_rtbmap(bno, ce.ce_state);
+	}
+}
+
+static void
+write_irec(
+	struct ckpt		*ck,
+	ino_tree_node_t		*irec,
+	int			uncertain)
+{
+	struct ckpt_irec	ci = { 0 };
+	parent_list_t		*ptbl = NULL;
+
+	ci.ci_startnum = irec->ino_startnum;
+	ci.ci_free = irec->ir_free;
+	ci.ci_confirmed = irec->ino_confirmed;
+	if (!uncertain) {
+		ci.ci_isa_dir = irec->ino_isa_dir;
+		ci.ci_nlink_size = irec->nlink_size;
+		ptbl = irec->ino_un.plist;
+		if (ptbl)
+			ci.ci_pmask = ptbl->pmask;
+	}
+	ckpt_put(ck, &ci, sizeof(ci));
+	if (uncertain)
+		return;
+
+	ckpt_put(ck, irec->disk_nlinks.un8,
+			XFS_INODES_PER_CHUNK * irec->nlink_size);
+	if (irec->ftypes)
+		ckpt_put(ck, irec->ftypes, XFS_INODES_PER_CHUNK);
+	if (ptbl)
+		ckpt_put(ck, ptbl->pentries,
+			__builtin_popcountll(ptbl->pmask) *
+				sizeof(parent_entry_t));
+}
+
+static void
+write_inodes(
+	struct ckpt		*ck,
+	struct xfs_mount	*mp)
+{
+	struct ckpt_irec	end = { 0 };
+	ino_tree_node_t		*irec;
+	xfs_agnumber_t		agno;
+
+	/* the extra phase 6/7 data doesn't exist yet */
+	ASSERT(!full_ino_ex_data);
+
+	end.ci_startnum = NULLAGINO;
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		for (irec = findfirst_inode_rec(agno); irec;
+		     irec = next_ino_rec(irec))
+			write_irec(ck, irec, 0);
+		ckpt_put(ck, &end, sizeof(end));
+
+		for (irec = findfirst_uncertain_inode_rec(agno); irec;
+		     irec = next_uncertain_inode_rec(irec))
+			write_irec(ck, irec, 1);
+		ckpt_put(ck, &end, sizeof(end));
+	}
+}
+
+static void
+load_irec(
+	struct ckpt		*ck,
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno,
+	struct ckpt_irec	*ci)
+{
+	ino_tree_node_t		*irec;
+	__uint32_t		nlinks[XFS_INODES_PER_CHUNK];
+	parent_entry_t		parents[XFS_INODES_PER_CHUNK];
+	__uint32_t		nlink;
+	int			i;
+	int			j;
+
+	if (ci->ci_nlink_size != sizeof(__uint8_t) &&
+	    ci->ci_nlink_size != sizeof(__uint16_t) &&
+	    ci->ci_nlink_size != sizeof(__uint32_t))
+		do_error(_("bad link count size %u in checkpoint %s\n"),
+			ci->ci_nlink_size, checkpoint_path);
+
+	irec = set_inode_free_alloc(mp, agno, ci->ci_startnum);
+	irec->ir_free = ci->ci_free;
+	irec->ino_confirmed = ci->ci_confirmed;
+	irec->ino_isa_dir = ci->ci_isa_dir;
+
+	ckpt_get(ck, nlinks, XFS_INODES_PER_CHUNK * ci->ci_nlink_size);
+	for (i = 0; i < XFS_INODES_PER_CHUNK; i++) {
+		switch (ci->ci_nlink_size) {
+		case sizeof(__uint8_t):
+			nlink = ((__uint8_t *)nlinks)[i];
+			break;
+		case sizeof(__uint16_t):
+			nlink = ((__uint16_t *)nlinks)[i];
+			break;
+		default:
+			nlink = nlinks[i];
+			break;
+		}
+		if (nlink)
+			set_inode_disk_nlinks(irec, i, nlink);
+	}
+
+	if (irec->ftypes)
+		ckpt_get(ck, irec->ftypes, XFS_INODES_PER_CHUNK);
+
+	ckpt_get(ck, parents, __builtin_popcountll(ci->ci_pmask) *
+			sizeof(parent_entry_t));
+	for (i = j = 0; i < XFS_INODES_PER_CHUNK; i++) {
+		if (ci->ci_pmask & IREC_MASK(i))
+			set_inode_parent(irec, i, parents[j++]);
+	}
+}
+
+static void
+load_inodes(
+	struct ckpt		*ck,
+	struct xfs_mount	*mp)
+{
+	struct ckpt_irec	ci;
+	xfs_agnumber_t		agno;
+	int			i;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		for (;;) {
+			ckpt_get(ck, &ci, sizeof(ci));
+			if (ci.ci_startnum == NULLAGINO)
+				break;
+			load_irec(ck, mp, agno, &ci);
+		}
+
+		for (;;) {
+			ckpt_get(ck, &ci, sizeof(ci));
+			if (ci.ci_startnum == NULLAGINO)
+				break;
+			for (i = 0; i < XFS_INODES_PER_CHUNK; i++) {
+				if (!(ci.ci_confirmed & IREC_MASK(i)))
+					continue;
+				add_aginode_uncertain(mp, agno,
+					ci.ci_startnum + i,
+					(ci.ci_free & XFS_INOBT_MASK(i)) != 0);
+			}
+		}
+		clear_uncertain_ino_cache(agno);
+	}
+}
+
+/*
+ * Phase 4 builds the per-AG dup extent trees and throws them away again
+ * as it goes, so only the realtime tree can have anything in it at a phase
+ * boundary.  They're all written anyway, they cost next to nothing.
+ */
+static void
+write_dups(
+	struct ckpt		*ck,
+	struct xfs_mount	*mp)
+{
+	xfs_agnumber_t		agno;
+	xfs_agblock_t		start;
+	xfs_agblock_t		end;
+	xfs_drtbno_t		rtstart;
+	xfs_extlen_t		rtlen;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		for (start = 0; findnext_dup_extent(agno, &start, &end);
+		     start++)
+			ckpt_put_ext(ck, start, end - start, 0);
+		ckpt_put_ext(ck, 0, 0, 0);
+	}
+
+	for (rtstart = 0; findnext_rt_dup_extent(&rtstart, &rtlen); rtstart++)
+		ckpt_put_ext(ck, rtstart, rtlen, 0);
+	ckpt_put_ext(ck, 0, 0, 0);
+}
+
+static void
+load_dups(
+	struct ckpt		*ck,
+	struct xfs_mount	*mp)
+{
+	struct ckpt_ext		ce;
+	xfs_agnumber_t		agno;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		while (ckpt_get_ext(ck, &ce))
+			add_dup_extent(agno, ce.ce_start, ce.ce_len);
+	}
+
+	while (ckpt_get_ext(ck, &ce))
+		add_rt_dup_extent(ce.ce_start, ce.ce_len);
+}
+
+static void
+write_badino(
+	xfs_ino_t		ino,
+	void			*arg)
+{
+	ckpt_put(arg, &ino, sizeof(ino));
+}
+
+static void
+write_badlist(
+	struct ckpt		*ck)
+{
+	xfs_ino_t		end = NULLFSINO;
+
+	dir2_walk_badlist(write_badino, ck);
+	ckpt_put(ck, &end, sizeof(end));
+}
+
+static void
+load_badlist(
+	struct ckpt		*ck)
+{
+	xfs_ino_t		ino;
+
+	for (;;) {
+		ckpt_get(ck, &ino, sizeof(ino));
+		if (ino == NULLFSINO)
+			break;
+		dir2_add_badlist(ino);
+	}
+}
+
+/*
+ * Write the state after @phase.  Failing to do so isn't a reason to stop
+ * the repair, we just won't be able to resume from here.
+ */
+void
+checkpoint_write(
+	struct xfs_mount	*mp,
+	int			phase)
+{
+	struct ckpt		ck = { 0 };
+	struct ckpt_hdr		hdr = { 0 };
+	char			*tmp;
+	int			error;
+
+	if (!checkpoint_path)
+		return;
+
+	do_log(_("        - writing checkpoint...\n"));
+
+	/*
+	 * everything fixed so far has to be on disk before the headers are
+	 * checksummed and the state claims to describe the disk.  Buffers
+	 * that fail their write verifier stay dirty in the cache, and later
+	 * phases see the fixes in them that the disk doesn't have.
+	 */
+	if (libxfs_bcache_flush()) {
+		do_log(
+	_("        - not all changes could be written back, no checkpoint\n"));
+		return;
+	}
+	if (!no_modify &&
+	    fsync(libxfs_device_to_fd(mp->m_ddev_targp->dev)) < 0) {
+		error = errno;
+		goto out_warn;
+	}
+
+	hdr.ch_magic = XR_CKPT_MAGIC;
+	hdr.ch_version = XR_CKPT_VERSION;
+	hdr.ch_phase = phase;
+	hdr.ch_no_modify = no_modify;
+	hdr.ch_agcount = mp->m_sb.sb_agcount;
+	hdr.ch_blocksize = mp->m_sb.sb_blocksize;
+	hdr.ch_dblocks = mp->m_sb.sb_dblocks;
+	hdr.ch_rextents = mp->m_sb.sb_rextents;
+	platform_uuid_copy(&hdr.ch_uuid, &mp->m_sb.sb_uuid);
+	error = aghdr_crc(mp, &hdr.ch_aghdr_crc);
+	if (error)
+		goto out_warn;
+
+	tmp = malloc(strlen(checkpoint_path) + 5);
+	if (!tmp)
+		do_error(_("couldn't malloc checkpoint file name\n"));
+	sprintf(tmp, "%s.tmp", checkpoint_path);
+
+	ck.fp = fopen(tmp, "w");
+	if (!ck.fp) {
+		error = errno;
+		goto out_free;
+	}
+	ck.crc = XFS_CRC_SEED;
+	ckpt_put(&ck, &hdr, sizeof(hdr));
+	write_globals(&ck, mp);
+	write_bmaps(&ck, mp);
+	write_inodes(&ck, mp);
+	write_dups(&ck, mp);
+	write_badlist(&ck);
+
+	/* the crc of everything before it goes last */
+	if (!ck.error && fwrite(&ck.crc, sizeof(ck.crc), 1, ck.fp) != 1)
+		ck.error = errno ? errno : EIO;
+	if (!ck.error && fflush(ck.fp))
+		ck.error = errno;
+	if (!ck.error && fsync(fileno(ck.fp)) < 0)
+		ck.error = errno;
+	if (fclose(ck.fp) && !ck.error)
+		ck.error = errno;
+	if (!ck.error && rename(tmp, checkpoint_path) < 0)
+		ck.error = errno;
+	error = ck.error;
+	if (error)
+		unlink(tmp);
+out_free:
+	free(tmp);
+out_warn:
+	if (error)
+		do_log(_("        - couldn't write checkpoint %s: %s\n"),
+			checkpoint_path, strerror(error));
+}
+
+/*
+ * Returns NULL if the checkpoint can be used, or why not.  On success
+ * the file is positioned right after the header.
+ */
+static const char *
+checkpoint_check(
+	struct ckpt		*ck,
+	struct xfs_mount	*mp,
+	struct ckpt_hdr		*hdr)
+{
+	struct stat		st;
+	__uint32_t		crc;
+	off_t			left;
+	size_t			len;
+	char			*buf;
+
+	if (fread(hdr, sizeof(*hdr), 1, ck->fp) != 1 ||
+	    hdr->ch_magic != XR_CKPT_MAGIC)
+		return _("not an xfs_repair checkpoint");
+	if (hdr->ch_version != XR_CKPT_VERSION)
+		return _("unsupported checkpoint version");
+	if (hdr->ch_phase < 2 || hdr->ch_phase > 4)
+		return _("checkpoint is corrupt");
+	if (hdr->ch_no_modify != no_modify)
+		return no_modify ? _("written by a run in modify mode") :
+				   _("written by a run in no-modify mode");
+	if (hdr->ch_agcount != mp->m_sb.sb_agcount ||
+	    hdr->ch_blocksize != mp->m_sb.sb_blocksize ||
+	    hdr->ch_dblocks != mp->m_sb.sb_dblocks ||
+	    hdr->ch_rextents != mp->m_sb.sb_rextents ||
+	    platform_uuid_compare(&hdr->ch_uuid, &mp->m_sb.sb_uuid))
+		return _("written for a different filesystem");
+	if (aghdr_crc(mp, &crc))
+		return _("couldn't read the AG headers");
+	if (crc != hdr->ch_aghdr_crc)
+		return _("the superblock or AG headers have changed");
+
+	/* now make sure the rest of it is all there */
+	if (fstat(fileno(ck->fp), &st) < 0 ||
+	    st.st_size < sizeof(*hdr) + sizeof(crc))
+		return _("checkpoint is corrupt");
+	buf = malloc(1 << 20);
+	if (!buf)
+		do_error(_("couldn't malloc checkpoint read buffer\n"));
+	ck->crc = crc32c(XFS_CRC_SEED, hdr, sizeof(*hdr));
+	for (left = st.st_size - sizeof(*hdr) - sizeof(crc); left > 0;
+	     left -= len) {
+		len = MIN(left, 1 << 20);
+		if (fread(buf, len, 1, ck->fp) != 1)
+			break;
+		ck->crc = crc32c(ck->crc, buf, len);
+	}
+	free(buf);
+	if (left > 0 || fread(&crc, sizeof(crc), 1, ck->fp) != 1 ||
+	    crc != ck->crc)
+		return _("checkpoint is corrupt");
+
+	if (fseeko(ck->fp, sizeof(*hdr), SEEK_SET) < 0)
+		return _("checkpoint is corrupt");
+	return NULL;
+}
+
+/*
+ * Load the state from the checkpoint, if there is one and it is still
+ * good for this filesystem.  Returns the last phase it covers, or 0 if
+ * we have to start from phase 2.  If replaying the log has changed the
+ * filesystem since, the checkpoint can't be trusted whatever it says.
+ */
+int
+checkpoint_load(
+	struct xfs_mount	*mp)
+{
+	struct ckpt		ck = { 0 };
+	struct ckpt_hdr		hdr;
+	const char		*why;
+
+	if (!checkpoint_path)
+		return 0;
+
+	ck.fp = fopen(checkpoint_path, "r");
+	if (!ck.fp) {
+		if (errno != ENOENT)
+			do_log(_("        - ignoring checkpoint %s: %s\n"),
+				checkpoint_path, strerror(errno));
+		return 0;
+	}
+
+	if (log_replayed)
+		why = _("the log was replayed");
+	else
+		why = checkpoint_check(&ck, mp, &hdr);
+	if (why) {
+		do_log(_("        - ignoring checkpoint %s: %s\n"),
+			checkpoint_path, why);
+		fclose(ck.fp);
+		return 0;
+	}
+
+	do_log(_("        - resuming after phase %d from checkpoint %s\n"),
+		hdr.ch_phase, checkpoint_path);
+	load_globals(&ck, mp);
+	load_bmaps(&ck, mp);
+	load_inodes(&ck, mp);
+	load_dups(&ck, mp);
+	load_badlist(&ck);
+	fclose(ck.fp);
+
+	return hdr.ch_phase;
+}
+
+/*
+ * Once phase 5 has run the checkpoint no longer matches the disk, and
+ * after a no-modify run there is nothing left to resume.
+ */
+void
+checkpoint_remove(void)
+{
+	char			*tmp;
+
+	if (!checkpoint_path)
+		return;
+
+	unlink(checkpoint_path);
+	tmp = malloc(strlen(checkpoint_path) + 5);
+	if (!tmp)
+		return;
+	sprintf(tmp, "%s.tmp", checkpoint_path);
+	unlink(tmp);
+	free(tmp);
+}
@@ -0,0 +1,13 @@
+#ifndef _XR_CHECKPOINT_H
+#define _XR_CHECKPOINT_H
+
+/*
+ * Checkpointing of the incore state built by phases 2 to 4, so that a
+ * repair that gets killed can pick up after the last phase it finished.
+ * See checkpoint.c.
+ */
+int	checkpoint_load(struct xfs_mount *mp);
+void	checkpoint_write(struct xfs_mount *mp, int phase);
+void	checkpoint_remove(void);
+
+#endif /* _XR_CHECKPOINT_H */
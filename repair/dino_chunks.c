@@ -17,7 +17,6 @@
  */
 
 #include <libxfs.h>
-#include "avl.h"
 #include "globals.h"
 #include "agheader.h"
 #include "incore.h"
@@ -291,7 +290,7 @@ verify_inode_chunk(xfs_mount_t		*mp,
 	 * if we have known inode chunks in our search range, establish
 	 * their start and end-points to tighten our search range.  range
 	 * is [start, end) -- e.g. max/end agbno is one beyond the
-	 * last block to be examined.  the avl routines work this way.
+	 * last block to be examined.  the inode tree lookups work this way.
 	 */
 	if (irec_before_p)  {
 		/*
@@ -984,15 +983,39 @@ process_aginodes(
 	int 			ino_discovery,
 	int 			check_dups,
 	int 			extra_attr_check)
+{
+	process_aginode_range(mp, pf_args, agno, findfirst_inode_rec(agno),
+			NULL, ino_discovery, check_dups, extra_attr_check);
+}
+
+/*
+ * process_aginodes() for the inode records from @first_ino_rec up to but
+ * not including @end, or to the end of the AG if @end is NULL.  Both have
+ * to be the first record of an inode allocation, so that separate ranges
+ * of an AG never share inode buffers and can be processed at the same
+ * time.  Inode records can't be freed while that's done, so only the
+ * whole AG can be processed with inode discovery.
+ */
+void
+process_aginode_range(
+	xfs_mount_t		*mp,
+	prefetch_args_t		*pf_args,
+	xfs_agnumber_t		agno,
+	ino_tree_node_t		*first_ino_rec,
+	ino_tree_node_t		*end,
+	int 			ino_discovery,
+	int 			check_dups,
+	int 			extra_attr_check)
 {
 	int 			num_inos, bogus;
-	ino_tree_node_t 	*ino_rec, *first_ino_rec, *prev_ino_rec;
+	ino_tree_node_t 	*ino_rec, *prev_ino_rec;
 #ifdef XR_PF_TRACE
 	int			count;
 #endif
-	first_ino_rec = ino_rec = findfirst_inode_rec(agno);
+	ASSERT(!ino_discovery || end == NULL);
+	ino_rec = first_ino_rec;
 
-	while (ino_rec != NULL)  {
+	while (ino_rec != end)  {
 		/*
 		 * paranoia - step through inode records until we step
 		 * through a full allocation of inodes.  this could
@@ -20,6 +20,7 @@
 
 struct blkmap;
 struct prefetch_args;
+struct ino_tree_node;
 
 int
 verify_agbno(xfs_mount_t	*mp,
@@ -109,6 +110,16 @@ process_aginodes(xfs_mount_t		*mp,
 		int			check_dups,
 		int			extra_attr_check);
 
+void
+process_aginode_range(xfs_mount_t		*mp,
+		struct prefetch_args	*pf_args,
+		xfs_agnumber_t		agno,
+		struct ino_tree_node	*first_ino_rec,
+		struct ino_tree_node	*end,
+		int			check_dirs,
+		int			check_dups,
+		int			extra_attr_check);
+
 void
 check_uncertain_aginodes(xfs_mount_t	*mp,
 			xfs_agnumber_t	agno);
@@ -119,6 +130,10 @@ get_agino_buf(xfs_mount_t	*mp,
 		xfs_agino_t	agino,
 		xfs_dinode_t	**dipp);
 
+int
+clear_dinode(xfs_mount_t	*mp,
+		xfs_dinode_t	*dino,
+		xfs_ino_t	ino_num);
 
 void dinode_bmbt_translation_init(void);
 char * get_forkname(int whichfork);
@@ -17,7 +17,6 @@
  */
 
 #include <libxfs.h>
-#include "avl.h"
 #include "globals.h"
 #include "incore.h"
 #include "err_protos.h"
@@ -38,7 +37,7 @@ typedef struct dir2_bad {
 
 static dir2_bad_t *dir2_bad_list;
 
-static void
+void
 dir2_add_badlist(
 	xfs_ino_t	ino)
 {
@@ -67,6 +66,20 @@ dir2_is_badino(
 	return 0;
 }
 
+/*
+ * hand every known bad inode to fn, for checkpointing
+ */
+void
+dir2_walk_badlist(
+	void		(*fn)(xfs_ino_t ino, void *arg),
+	void		*arg)
+{
+	dir2_bad_t	*l;
+
+	for (l = dir2_bad_list; l; l = l->next)
+		fn(l->ino, arg);
+}
+
 /*
  * takes a name and length (name need not be null-terminated)
  * and returns 1 if the name contains a '/' or a \0, returns 0
@@ -80,6 +80,15 @@ int
 dir2_is_badino(
 	xfs_ino_t	ino);
 
+void
+dir2_add_badlist(
+	xfs_ino_t	ino);
+
+void
+dir2_walk_badlist(
+	void		(*fn)(xfs_ino_t ino, void *arg),
+	void		*arg);
+
 int
 namecheck(
 	char		*name,
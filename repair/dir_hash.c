@@ -0,0 +1,304 @@
+/*
+ * Directory entry table for phase 6, see dir_hash.h.
+ */
+
+#include <libxfs.h>
+#include "err_protos.h"
+#include "dir_hash.h"
+
+#define	DIR_HASH_MIN_BITS	4
+#define	DIR_HASH_INIT_ENTS	65536	/* most entries to guess up front */
+
+/*
+ * Multiplicative hashing, so that runs of addresses and of similar name
+ * hashes spread over the table rather than filling neighbouring slots.
+ */
+static inline __uint32_t
+dir_hash_slot(
+	dir_hash_tab_t		*hashtab,
+	__uint32_t		key)
+{
+	return (key * 2654435761U) >> (32 - hashtab->hashbits);
+}
+
+static inline __uint32_t
+dir_hash_mask(
+	dir_hash_tab_t		*hashtab)
+{
+	return (1U << hashtab->hashbits) - 1;
+}
+
+static void
+dir_hash_insert(
+	dir_hash_tab_t		*hashtab,
+	__uint32_t		*slots,
+	__uint32_t		key,
+	__uint32_t		idx)
+{
+	__uint32_t		mask = dir_hash_mask(hashtab);
+	__uint32_t		i;
+
+	for (i = dir_hash_slot(hashtab, key); slots[i]; i = (i + 1) & mask)
+		;
+	slots[i] = idx + 1;
+}
+
+/*
+ * Size the entry array and both slot tables for 2^(hashbits - 1) entries
+ * and put back the entries we already have.
+ */
+static void
+dir_hash_resize(
+	dir_hash_tab_t		*hashtab,
+	int			hashbits)
+{
+	size_t			nslots = (size_t)1 << hashbits;
+	dir_hash_ent_t		*p;
+	__uint32_t		i;
+
+	hashtab->maxents = nslots / 2;
+	hashtab->ents = realloc(hashtab->ents,
+			sizeof(dir_hash_ent_t) * hashtab->maxents);
+	if (!hashtab->ents)
+		do_error(_("couldn't grow directory hash to %u entries\n"),
+			hashtab->maxents);
+
+	free(hashtab->byhash);
+	hashtab->byhash = calloc(nslots * 2, sizeof(__uint32_t));
+	if (!hashtab->byhash)
+		do_error(_("couldn't grow directory hash to %u entries\n"),
+			hashtab->maxents);
+	hashtab->byaddr = hashtab->byhash + nslots;
+	hashtab->hashbits = hashbits;
+
+	for (i = 0; i < hashtab->nents; i++) {
+		p = &hashtab->ents[i];
+		dir_hash_insert(hashtab, hashtab->byaddr, p->address, i);
+		if (!p->junkit)
+			dir_hash_insert(hashtab, hashtab->byhash, p->hashval, i);
+	}
+}
+
+dir_hash_tab_t *
+dir_hash_init(
+	xfs_fsize_t		size)
+{
+	dir_hash_tab_t		*hashtab;
+	__uint64_t		nents;
+	int			hashbits = DIR_HASH_MIN_BITS;
+
+	/*
+	 * Guess at one entry per 64 bytes, but don't believe the size of a
+	 * corrupt directory too far.  The tables grow if we guessed low.
+	 */
+	nents = size > 0 ? MIN(size / 64, DIR_HASH_INIT_ENTS) : 0;
+	while (((__uint64_t)1 << (hashbits - 1)) < nents)
+		hashbits++;
+
+	if ((hashtab = calloc(1, sizeof(dir_hash_tab_t))) == NULL)
+		do_error(_("calloc failed in dir_hash_init\n"));
+	dir_hash_resize(hashtab, hashbits);
+	return hashtab;
+}
+
+void
+dir_hash_done(
+	dir_hash_tab_t		*hashtab)
+{
+	free(hashtab->names);
+	free(hashtab->ents);
+	free(hashtab->byhash);
+	free(hashtab);
+}
+
+/*
+ * Returns 0 if the name already exists (ie. a duplicate)
+ */
+int
+dir_hash_add(
+	xfs_mount_t		*mp,
+	dir_hash_tab_t		*hashtab,
+	__uint32_t		addr,
+	xfs_ino_t		inum,
+	int			namelen,
+	unsigned char		*name,
+	__uint8_t		ftype)
+{
+	xfs_dahash_t		hash = 0;
+	dir_hash_ent_t		*p;
+	__uint32_t		mask;
+	__uint32_t		i = 0;
+	int			dup;
+	short			junk;
+	struct xfs_name		xname;
+
+	ASSERT(!hashtab->names_duped);
+
+	if (hashtab->nents == hashtab->maxents) {
+		if (hashtab->hashbits == 31)
+			do_error(_("too many entries in directory hash\n"));
+		dir_hash_resize(hashtab, hashtab->hashbits + 1);
+	}
+	mask = dir_hash_mask(hashtab);
+
+	xname.name = name;
+	xname.len = namelen;
+	xname.type = ftype;
+
+	junk = name[0] == '/';
+	dup = 0;
+
+	if (!junk) {
+		hash = mp->m_dirnameops->hashname(&xname);
+
+		/*
+		 * search for an existing entry with this name.  If there
+		 * isn't one, we stop at the free slot the new entry goes in.
+		 */
+		for (i = dir_hash_slot(hashtab, hash); hashtab->byhash[i];
+		     i = (i + 1) & mask) {
+			p = &hashtab->ents[hashtab->byhash[i] - 1];
+			if (p->hashval == hash && p->name.len == namelen &&
+			    memcmp(p->name.name, name, namelen) == 0) {
+				dup = 1;
+				junk = 1;
+				break;
+			}
+		}
+	}
+
+	if (!junk)
+		hashtab->byhash[i] = hashtab->nents + 1;
+	dir_hash_insert(hashtab, hashtab->byaddr, addr, hashtab->nents);
+
+	p = &hashtab->ents[hashtab->nents++];
+	p->hashval = hash;
+	p->address = addr;
+	p->inum = inum;
+	p->junkit = junk;
+	p->seen = 0;
+	p->name = xname;
+	hashtab->nameslen += namelen;
+
+	return !dup;
+}
+
+/*
+ * checks to see if any data entries are not in the leaf blocks
+ */
+int
+dir_hash_unseen(
+	dir_hash_tab_t		*hashtab)
+{
+	__uint32_t		i;
+
+	for (i = 0; i < hashtab->nents; i++) {
+		if (hashtab->ents[i].seen == 0)
+			return 1;
+	}
+	return 0;
+}
+
+int
+dir_hash_see(
+	dir_hash_tab_t		*hashtab,
+	xfs_dahash_t		hash,
+	xfs_dir2_dataptr_t	addr)
+{
+	__uint32_t		mask = dir_hash_mask(hashtab);
+	__uint32_t		i;
+	dir_hash_ent_t		*p;
+
+	for (i = dir_hash_slot(hashtab, addr); hashtab->byaddr[i];
+	     i = (i + 1) & mask) {
+		p = &hashtab->ents[hashtab->byaddr[i] - 1];
+		if (p->address != addr)
+			continue;
+		if (p->seen)
+			return DIR_HASH_CK_DUPLEAF;
+		if (p->junkit == 0 && p->hashval != hash)
+			return DIR_HASH_CK_BADHASH;
+		p->seen = 1;
+		return DIR_HASH_CK_OK;
+	}
+	return DIR_HASH_CK_NODATA;
+}
+
+void
+dir_hash_update_ftype(
+	dir_hash_tab_t		*hashtab,
+	xfs_dir2_dataptr_t	addr,
+	__uint8_t		ftype)
+{
+	__uint32_t		mask = dir_hash_mask(hashtab);
+	__uint32_t		i;
+	dir_hash_ent_t		*p;
+
+	for (i = dir_hash_slot(hashtab, addr); hashtab->byaddr[i];
+	     i = (i + 1) & mask) {
+		p = &hashtab->ents[hashtab->byaddr[i] - 1];
+		if (p->address != addr)
+			continue;
+		p->name.type = ftype;
+	}
+}
+
+/*
+ * checks to make sure leafs match a data entry, and that the stale
+ * count is valid.
+ */
+int
+dir_hash_see_all(
+	dir_hash_tab_t		*hashtab,
+	xfs_dir2_leaf_entry_t	*ents,
+	int			count,
+	int			stale)
+{
+	int			i;
+	int			j;
+	int			rval;
+
+	for (i = j = 0; i < count; i++) {
+		if (be32_to_cpu(ents[i].address) == XFS_DIR2_NULL_DATAPTR) {
+			j++;
+			continue;
+		}
+		rval = dir_hash_see(hashtab, be32_to_cpu(ents[i].hashval),
+					be32_to_cpu(ents[i].address));
+		if (rval != DIR_HASH_CK_OK)
+			return rval;
+	}
+	return j == stale ? DIR_HASH_CK_OK : DIR_HASH_CK_BADSTALE;
+}
+
+/*
+ * Copy the names out of the directory buffers into one block of our own.
+ * This must only be done after all the entries have been added.
+ */
+void
+dir_hash_dup_names(
+	dir_hash_tab_t		*hashtab)
+{
+	unsigned char		*name;
+	dir_hash_ent_t		*p;
+	__uint32_t		i;
+
+	if (hashtab->names_duped)
+		return;
+
+	if (hashtab->nameslen) {
+		hashtab->names = malloc(hashtab->nameslen);
+		if (!hashtab->names)
+			do_error(
+	_("couldn't malloc %zu bytes of directory entry names\n"),
+				hashtab->nameslen);
+	}
+	name = hashtab->names;
+	for (i = 0; i < hashtab->nents; i++) {
+		p = &hashtab->ents[i];
+		memcpy(name, p->name.name, p->name.len);
+		p->name.name = name;
+		name += p->name.len;
+	}
+	hashtab->names_duped = 1;
+}
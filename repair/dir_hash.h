@@ -0,0 +1,59 @@
+#ifndef _XR_DIR_HASH_H
+#define	_XR_DIR_HASH_H
+
+/*
+ * Table of the entries found in the data blocks of a directory, used by
+ * phase 6 to find duplicate names and to match the leaf/node hash entries
+ * against the data entries.  If the directory needs rebuilding, the
+ * entries are re-added in the order they were found.
+ *
+ * The entries live in one array, in the order they were added.  Two open
+ * addressing tables of array indexes (plus one, zero is an empty slot)
+ * look them up by name hash and by address.  Both are kept at most half
+ * full and doubled as the directory turns out to be bigger than its size
+ * suggested.
+ */
+typedef struct dir_hash_ent {
+	xfs_dahash_t		hashval;	/* hash value of name */
+	__uint32_t		address;	/* offset of data entry */
+	xfs_ino_t 		inum;		/* inode num of entry */
+	short			junkit;		/* name starts with / */
+	short			seen;		/* have seen leaf entry */
+	struct xfs_name		name;
+} dir_hash_ent_t;
+
+typedef struct dir_hash_tab {
+	__uint32_t		nents;		/* entries added */
+	__uint32_t		maxents;	/* size of ents array */
+	int			hashbits;	/* log2 of slots per table */
+	int			names_duped;	/* 1 = ent names copied */
+	size_t			nameslen;	/* total length of names */
+	unsigned char		*names;		/* copied names */
+	dir_hash_ent_t		*ents;		/* entries in order added */
+	__uint32_t		*byhash;	/* name hash slots */
+	__uint32_t		*byaddr;	/* address slots */
+} dir_hash_tab_t;
+
+#define	DIR_HASH_CK_OK		0
+#define	DIR_HASH_CK_DUPLEAF	1
+#define	DIR_HASH_CK_BADHASH	2
+#define	DIR_HASH_CK_NODATA	3
+#define	DIR_HASH_CK_NOLEAF	4
+#define	DIR_HASH_CK_BADSTALE	5
+#define	DIR_HASH_CK_TOTAL	6
+
+dir_hash_tab_t	*dir_hash_init(xfs_fsize_t size);
+void		dir_hash_done(dir_hash_tab_t *hashtab);
+int		dir_hash_add(xfs_mount_t *mp, dir_hash_tab_t *hashtab,
+			__uint32_t addr, xfs_ino_t inum, int namelen,
+			unsigned char *name, __uint8_t ftype);
+int		dir_hash_see(dir_hash_tab_t *hashtab, xfs_dahash_t hash,
+			xfs_dir2_dataptr_t addr);
+int		dir_hash_see_all(dir_hash_tab_t *hashtab,
+			xfs_dir2_leaf_entry_t *ents, int count, int stale);
+int		dir_hash_unseen(dir_hash_tab_t *hashtab);
+void		dir_hash_update_ftype(dir_hash_tab_t *hashtab,
+			xfs_dir2_dataptr_t addr, __uint8_t ftype);
+void		dir_hash_dup_names(dir_hash_tab_t *hashtab);
+
+#endif /* _XR_DIR_HASH_H */
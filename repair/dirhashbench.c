@@ -0,0 +1,393 @@
+/*
+ * Microbenchmark for the phase 6 directory entry table in dir_hash.c.
+ *
+ * Synthetic directories of increasing size are fed through the same calls
+ * phase 6 makes for a long form directory: every data entry is added,
+ * then every leaf entry is looked up by address in hash order, then the
+ * table is checked for unseen entries.  The same is done with the chained
+ * hash phase 6 used before, which is kept here for comparison.  It is not
+ * built by default; use "make dirhashbench" in this directory.
+ */
+
+#include <libxfs.h>
+#include <sys/time.h>
+#include "err_protos.h"
+#include "dir_hash.h"
+
+static unsigned long	maxents = 4096000;
+static int		nruns = 3;
+static xfs_mount_t	bench_mount;
+
+void
+do_error(char const *msg, ...)
+{
+	va_list		args;
+
+	va_start(args, msg);
+	vfprintf(stderr, msg, args);
+	va_end(args);
+	exit(1);
+}
+
+/*
+ * The chained hash as it was: a bucket array sized from the directory
+ * size and capped at 63336 buckets, and a malloc per entry.
+ */
+typedef struct old_ent {
+	struct old_ent		*nextbyaddr;
+	struct old_ent		*nextbyhash;
+	struct old_ent		*nextbyorder;
+	xfs_dahash_t		hashval;
+	__uint32_t		address;
+	xfs_ino_t		inum;
+	short			junkit;
+	short			seen;
+	struct xfs_name		name;
+} old_ent_t;
+
+typedef struct old_tab {
+	int			size;
+	old_ent_t		*first;
+	old_ent_t		*last;
+	old_ent_t		**byhash;
+	old_ent_t		**byaddr;
+} old_tab_t;
+
+static old_tab_t *
+old_init(
+	xfs_fsize_t		size)
+{
+	old_tab_t		*hashtab;
+	int			hsize;
+
+	hsize = size / (16 * 4);
+	if (hsize > 65536)
+		hsize = 63336;
+	else if (hsize < 16)
+		hsize = 16;
+	hashtab = calloc(1, sizeof(old_tab_t) +
+			sizeof(old_ent_t *) * hsize * 2);
+	if (!hashtab)
+		do_error("%s: out of memory\n", progname);
+	hashtab->size = hsize;
+	hashtab->byhash = (old_ent_t **)(hashtab + 1);
+	hashtab->byaddr = hashtab->byhash + hsize;
+	return hashtab;
+}
+
+static int
+old_add(
+	xfs_mount_t		*mp,
+	old_tab_t		*hashtab,
+	__uint32_t		addr,
+	xfs_ino_t		inum,
+	int			namelen,
+	unsigned char		*name,
+	__uint8_t		ftype)
+{
+	xfs_dahash_t		hash = 0;
+	int			byaddr;
+	int			byhash = 0;
+	old_ent_t		*p;
+	int			dup = 0;
+	short			junk;
+	struct xfs_name		xname;
+
+	xname.name = name;
+	xname.len = namelen;
+	xname.type = ftype;
+
+	junk = name[0] == '/';
+	byaddr = addr % hashtab->size;
+	if (!junk) {
+		hash = mp->m_dirnameops->hashname(&xname);
+		byhash = hash % hashtab->size;
+		for (p = hashtab->byhash[byhash]; p; p = p->nextbyhash) {
+			if (p->hashval == hash && p->name.len == namelen &&
+			    memcmp(p->name.name, name, namelen) == 0) {
+				dup = 1;
+				junk = 1;
+				break;
+			}
+		}
+	}
+
+	if ((p = malloc(sizeof(*p))) == NULL)
+		do_error("%s: out of memory\n", progname);
+	p->nextbyaddr = hashtab->byaddr[byaddr];
+	hashtab->byaddr[byaddr] = p;
+	if (hashtab->last)
+		hashtab->last->nextbyorder = p;
+	else
+		hashtab->first = p;
+	p->nextbyorder = NULL;
+	hashtab->last = p;
+	if (!(p->junkit = junk)) {
+		p->hashval = hash;
+		p->nextbyhash = hashtab->byhash[byhash];
+		hashtab->byhash[byhash] = p;
+	}
+	p->address = addr;
+	p->inum = inum;
+	p->seen = 0;
+	p->name = xname;
+	return !dup;
+}
+
+static int
+old_see(
+	old_tab_t		*hashtab,
+	xfs_dahash_t		hash,
+	xfs_dir2_dataptr_t	addr)
+{
+	old_ent_t		*p;
+
+	for (p = hashtab->byaddr[addr % hashtab->size]; p; p = p->nextbyaddr) {
+		if (p->address != addr)
+			continue;
+		if (p->seen)
+			return DIR_HASH_CK_DUPLEAF;
+		if (p->junkit == 0 && p->hashval != hash)
+			return DIR_HASH_CK_BADHASH;
+		p->seen = 1;
+		return DIR_HASH_CK_OK;
+	}
+	return DIR_HASH_CK_NODATA;
+}
+
+static int
+old_unseen(
+	old_tab_t		*hashtab)
+{
+	old_ent_t		*p;
+	int			i;
+
+	for (i = 0; i < hashtab->size; i++)
+		for (p = hashtab->byaddr[i]; p; p = p->nextbyaddr)
+			if (p->seen == 0)
+				return 1;
+	return 0;
+}
+
+static void
+old_done(
+	old_tab_t		*hashtab)
+{
+	old_ent_t		*n;
+	old_ent_t		*p;
+	int			i;
+
+	for (i = 0; i < hashtab->size; i++) {
+		for (p = hashtab->byaddr[i]; p; p = n) {
+			n = p->nextbyaddr;
+			free(p);
+		}
+	}
+	free(hashtab);
+}
+
+/*
+ * A synthetic directory: unique names of up to 40 characters, laid out in
+ * data blocks the way the kernel would, and the leaf entries sorted by hash.
+ */
+struct bench_dir {
+	unsigned long		nents;
+	xfs_fsize_t		size;
+	unsigned char		*names;
+	int			*namelens;
+	unsigned char		**nameptrs;
+	__uint32_t		*addrs;
+	xfs_dir2_leaf_entry_t	*leaf;
+};
+
+static int
+leaf_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const xfs_dir2_leaf_entry_t *la = a;
+	const xfs_dir2_leaf_entry_t *lb = b;
+
+	if (be32_to_cpu(la->hashval) < be32_to_cpu(lb->hashval))
+		return -1;
+	return be32_to_cpu(la->hashval) > be32_to_cpu(lb->hashval);
+}
+
+static void
+make_dir(
+	struct bench_dir	*dir,
+	unsigned long		nents)
+{
+	struct xfs_name		xname;
+	unsigned char		*name;
+	__uint64_t		off = 16;
+	unsigned long		i;
+	unsigned int		seed = 1;
+	int			len;
+
+	dir->nents = nents;
+	dir->names = malloc(nents * 48);
+	dir->namelens = malloc(nents * sizeof(int));
+	dir->nameptrs = malloc(nents * sizeof(unsigned char *));
+	dir->addrs = malloc(nents * sizeof(__uint32_t));
+	dir->leaf = malloc(nents * sizeof(xfs_dir2_leaf_entry_t));
+	if (!dir->names || !dir->namelens || !dir->nameptrs || !dir->addrs ||
+	    !dir->leaf)
+		do_error("%s: out of memory\n", progname);
+
+	name = dir->names;
+	for (i = 0; i < nents; i++) {
+		len = snprintf((char *)name, 48, "f%lu.%0*u", i,
+				rand_r(&seed) % 32, 0);
+		dir->nameptrs[i] = name;
+		dir->namelens[i] = len;
+		name += len + 1;
+
+		/* 8 byte aligned data entries after a header in 4k blocks */
+		if ((off & 4095) + ((len + 19) & ~7) > 4096)
+			off = ((off + 4095) & ~4095ULL) + 16;
+		dir->addrs[i] = off >> XFS_DIR2_DATA_ALIGN_LOG;
+		off += (len + 19) & ~7;
+
+		xname.name = dir->nameptrs[i];
+		xname.len = len;
+		dir->leaf[i].hashval = cpu_to_be32(
+				bench_mount.m_dirnameops->hashname(&xname));
+		dir->leaf[i].address = cpu_to_be32(dir->addrs[i]);
+	}
+	dir->size = (off + 4095) & ~4095ULL;
+	qsort(dir->leaf, nents, sizeof(xfs_dir2_leaf_entry_t), leaf_cmp);
+}
+
+static void
+free_dir(
+	struct bench_dir	*dir)
+{
+	free(dir->names);
+	free(dir->namelens);
+	free(dir->nameptrs);
+	free(dir->addrs);
+	free(dir->leaf);
+}
+
+static double
+now(void)
+{
+	struct timeval		tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+bench_old(
+	struct bench_dir	*dir,
+	double			*addt,
+	double			*seet)
+{
+	old_tab_t		*hashtab;
+	unsigned long		i;
+	double			t;
+
+	t = now();
+	hashtab = old_init(dir->size);
+	for (i = 0; i < dir->nents; i++)
+		if (!old_add(&bench_mount, hashtab, dir->addrs[i], 128 + i,
+				dir->namelens[i], dir->nameptrs[i], 0))
+			do_error("%s: unexpected duplicate\n", progname);
+	*addt += now() - t;
+
+	t = now();
+	for (i = 0; i < dir->nents; i++)
+		if (old_see(hashtab, be32_to_cpu(dir->leaf[i].hashval),
+				be32_to_cpu(dir->leaf[i].address)))
+			do_error("%s: lookup failed\n", progname);
+	if (old_unseen(hashtab))
+		do_error("%s: unseen entries\n", progname);
+	old_done(hashtab);
+	*seet += now() - t;
+}
+
+static void
+bench_new(
+	struct bench_dir	*dir,
+	double			*addt,
+	double			*seet)
+{
+	dir_hash_tab_t		*hashtab;
+	unsigned long		i;
+	double			t;
+
+	t = now();
+	hashtab = dir_hash_init(dir->size);
+	for (i = 0; i < dir->nents; i++)
+		if (!dir_hash_add(&bench_mount, hashtab, dir->addrs[i], 128 + i,
+				dir->namelens[i], dir->nameptrs[i], 0))
+			do_error("%s: unexpected duplicate\n", progname);
+	*addt += now() - t;
+
+	t = now();
+	if (dir_hash_see_all(hashtab, dir->leaf, dir->nents, 0))
+		do_error("%s: lookup failed\n", progname);
+	if (dir_hash_unseen(hashtab))
+		do_error("%s: unseen entries\n", progname);
+	dir_hash_done(hashtab);
+	*seet += now() - t;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: %s [-n maxentries] [-r runs]\n", progname);
+	exit(1);
+}
+
+int
+main(
+	int			argc,
+	char			**argv)
+{
+	struct bench_dir	dir;
+	unsigned long		nents;
+	double			oadd, osee, nadd, nsee;
+	int			c;
+	int			r;
+
+	progname = basename(argv[0]);
+	while ((c = getopt(argc, argv, "n:r:")) != EOF) {
+		switch (c) {
+		case 'n':
+			maxents = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nruns = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!maxents || nruns <= 0)
+		usage();
+
+	bench_mount.m_dirnameops = &xfs_default_nameops;
+
+	printf("%10s %20s %20s %20s\n", "",
+		"add ns/entry", "lookup ns/entry", "total ms");
+	printf("%10s %10s %9s %10s %9s %10s %9s\n", "entries",
+		"chained", "open", "chained", "open", "chained", "open");
+	for (nents = 1000; nents <= maxents; nents *= 4) {
+		make_dir(&dir, nents);
+		oadd = osee = nadd = nsee = 0;
+		for (r = 0; r < nruns; r++) {
+			bench_old(&dir, &oadd, &osee);
+			bench_new(&dir, &nadd, &nsee);
+		}
+		printf("%10lu %10.1f %9.1f %10.1f %9.1f %10.1f %9.1f\n", nents,
+			oadd * 1e9 / nruns / nents, nadd * 1e9 / nruns / nents,
+			osee * 1e9 / nruns / nents, nsee * 1e9 / nruns / nents,
+			(oadd + osee) * 1e3 / nruns,
+			(nadd + nsee) * 1e3 / nruns);
+		free_dir(&dir);
+	}
+	return 0;
+}
@@ -124,6 +124,7 @@ EXTERN int		primary_sb_modified;
 EXTERN int		bad_ino_btree;
 EXTERN int		copied_sunit;
 EXTERN int		fs_is_dirty;
+EXTERN int		log_replayed;	/* phase 2 replayed the log */
 
 /* for hunting down the root inode */
 
@@ -196,4 +197,11 @@ EXTERN __uint64_t 	*prog_rpt_done;
 EXTERN int		ag_stride;
 EXTERN int		thread_count;
 
+EXTERN long		max_mem_specified;	/* -m, in megabytes */
+EXTERN long		spill_limit;		/* -o spill_limit, in megabytes */
+EXTERN char		*spill_dir;		/* -o spill_dir */
+EXTERN char		*checkpoint_path;	/* -o checkpoint */
+EXTERN char		*stats_path;		/* -o stats */
+EXTERN int		stats_fd;		/* -o stats_fd, -1 if unset */
+
 #endif /* _XFS_REPAIR_GLOBAL_H */
@@ -17,7 +17,6 @@
  */
 
 #include <libxfs.h>
-#include "avl.h"
 #include "btree.h"
 #include "globals.h"
 #include "incore.h"
@@ -37,19 +36,21 @@ static int states[16] =
 	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
 
 static struct btree_root	**ag_bmap;
+static xfs_agnumber_t		ag_bmap_count;
+static __uint64_t		ag_bmap_flat_size;	/* as a 4 bit map */
 
 static void
 update_bmap(
 	struct btree_root	*bmap,
-	unsigned long		offset,
+	__uint64_t		offset,
 	xfs_extlen_t		blen,
 	void			*new_state)
 {
-	unsigned long		end = offset + blen;
+	__uint64_t		end = offset + blen;
 	int			*cur_state;
-	unsigned long		cur_key;
+	__uint64_t		cur_key;
 	int			*next_state;
-	unsigned long		next_key;
+	__uint64_t		next_key;
 	int			*prev_state;
 
 	cur_state = btree_find(bmap, offset, &cur_key);
@@ -144,40 +145,60 @@ set_bmap_ext(
 	update_bmap(ag_bmap[agno], agbno, blen, &states[state]);
 }
 
-int
-get_bmap_ext(
-	xfs_agnumber_t		agno,
-	xfs_agblock_t		agbno,
-	xfs_agblock_t		maxbno,
+static int
+lookup_bmap(
+	struct btree_root	*bmap,
+	__uint64_t		offset,
+	__uint64_t		maxoff,
 	xfs_extlen_t		*blen)
 {
 	int			*statep;
-	unsigned long		key;
+	__uint64_t		key;
 
-	statep = btree_find(ag_bmap[agno], agbno, &key);
+	statep = btree_find(bmap, offset, &key);
 	if (!statep)
 		return -1;
 
-	if (key == agbno) {
+	if (key == offset) {
 		if (blen) {
-			if (!btree_peek_next(ag_bmap[agno], &key))
+			if (!btree_peek_next(bmap, &key))
 				return -1;
-			*blen = MIN(maxbno, key) - agbno;
+			*blen = MIN(maxoff, key) - offset;
 		}
 		return *statep;
 	}
 
-	statep = btree_peek_prev(ag_bmap[agno], NULL);
+	statep = btree_peek_prev(bmap, NULL);
 	if (!statep)
 		return -1;
 	if (blen)
-		*blen = MIN(maxbno, key) - agbno;
+		*blen = MIN(maxoff, key) - offset;
 
 	return *statep;
 }
 
+int
+get_bmap_ext(
+	xfs_agnumber_t		agno,
+	xfs_agblock_t		agbno,
+	xfs_agblock_t		maxbno,
+	xfs_extlen_t		*blen)
+{
+	return lookup_bmap(ag_bmap[agno], agbno, maxbno, blen);
+}
+
+/*
+ * The realtime map is normally a flat array of 4 bit states, one per rt
+ * extent. If that would take more than a sixteenth of the memory repair
+ * may use, the rt extents are tracked in an extent btree like the AG maps
+ * instead. The btree is shared by all AGs' inodes, so it needs a lock.
+ */
+#define XR_RT_BMAP_MEM_SHIFT	4
+
 static uint64_t		*rt_bmap;
 static size_t		rt_bmap_size;
+static struct btree_root *rt_bmap_tree;
+static pthread_mutex_t	rt_bmap_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* block records fit into __uint64_t's units */
 #define XR_BB_UNIT	64			/* number of bits/unit */
@@ -192,6 +213,14 @@ int
 get_rtbmap(
 	xfs_drtbno_t	bno)
 {
+	int		state;
+
+	if (rt_bmap_tree) {
+		pthread_mutex_lock(&rt_bmap_lock);
+		state = lookup_bmap(rt_bmap_tree, bno, bno + 1, NULL);
+		pthread_mutex_unlock(&rt_bmap_lock);
+		return state;
+	}
 	return (*(rt_bmap + bno /  XR_BB_NUM) >>
 		((bno % XR_BB_NUM) * XR_BB)) & XR_BB_MASK;
 }
@@ -201,6 +230,12 @@ set_rtbmap(
 	xfs_drtbno_t	bno,
 	int		state)
 {
+	if (rt_bmap_tree) {
+		pthread_mutex_lock(&rt_bmap_lock);
+		update_bmap(rt_bmap_tree, bno, 1, &states[state]);
+		pthread_mutex_unlock(&rt_bmap_lock);
+		return;
+	}
 	*(rt_bmap + bno / XR_BB_NUM) =
 	 ((*(rt_bmap + bno / XR_BB_NUM) &
 	  (~((__uint64_t) XR_BB_MASK << ((bno % XR_BB_NUM) * XR_BB)))) |
@@ -208,22 +243,41 @@ set_rtbmap(
 }
 
 static void
-reset_rt_bmap(void)
+reset_rt_bmap(
+	xfs_mount_t	*mp)
 {
 	if (rt_bmap)
 		memset(rt_bmap, 0x22, rt_bmap_size);	/* XR_E_FREE */
+	if (rt_bmap_tree) {
+		btree_clear(rt_bmap_tree);
+		btree_insert(rt_bmap_tree, 0, &states[XR_E_FREE]);
+		btree_insert(rt_bmap_tree, mp->m_sb.sb_rextents,
+				&states[XR_E_BAD_STATE]);
+	}
 }
 
 static void
 init_rt_bmap(
 	xfs_mount_t	*mp)
 {
+	__uint64_t	max_mem;
+
 	if (mp->m_sb.sb_rextents == 0)
 		return;
 
 	rt_bmap_size = roundup(mp->m_sb.sb_rextents / (NBBY / XR_BB),
 			       sizeof(__uint64_t));
 
+	max_mem = max_mem_specified ? (__uint64_t)max_mem_specified << 20 :
+				(__uint64_t)libxfs_physmem() * 3 / 4 << 10;
+	if (rt_bmap_size > max_mem >> XR_RT_BMAP_MEM_SHIFT) {
+		if (verbose)
+			do_log(
+	_("        - using extent tree for realtime block map\n"));
+		btree_init(&rt_bmap_tree);
+		return;
+	}
+
 	rt_bmap = memalign(sizeof(__uint64_t), rt_bmap_size);
 	if (!rt_bmap) {
 		do_error(
@@ -238,6 +292,36 @@ free_rt_bmap(xfs_mount_t *mp)
 {
 	free(rt_bmap);
 	rt_bmap = NULL;
+	if (rt_bmap_tree) {
+		btree_destroy(rt_bmap_tree);
+		rt_bmap_tree = NULL;
+	}
+}
+
+/*
+ * Report the memory used by the block maps and how much flat maps with 4
+ * bits per block would have needed, in bytes.
+ */
+void
+bmap_mem_usage(
+	__uint64_t	*used,
+	__uint64_t	*flat)
+{
+	xfs_agnumber_t	agno;
+
+	*used = *flat = 0;
+	if (!ag_bmap)
+		return;
+
+	for (agno = 0; agno < ag_bmap_count; agno++)
+		*used += btree_mem_usage(ag_bmap[agno]);
+	*flat = ag_bmap_flat_size;
+
+	if (rt_bmap_tree)
+		*used += btree_mem_usage(rt_bmap_tree);
+	else
+		*used += rt_bmap_size;
+	*flat += rt_bmap_size;
 }
 
 
@@ -282,7 +366,7 @@ reset_bmaps(xfs_mount_t *mp)
 			     mp->m_sb.sb_logblocks, XR_E_INUSE_FS);
 	}
 
-	reset_rt_bmap();
+	reset_rt_bmap(mp);
 }
 
 void
@@ -302,6 +386,8 @@ init_bmaps(xfs_mount_t *mp)
 		btree_init(&ag_bmap[i]);
 		pthread_mutex_init(&ag_locks[i].lock, NULL);
 	}
+	ag_bmap_count = mp->m_sb.sb_agcount;
+	ag_bmap_flat_size = mp->m_sb.sb_dblocks / (NBBY / XR_BB);
 
 	init_rt_bmap(mp);
 	reset_bmaps(mp);
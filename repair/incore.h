@@ -19,7 +19,7 @@
 #ifndef XFS_REPAIR_INCORE_H
 #define XFS_REPAIR_INCORE_H
 
-#include "avl.h"
+#include "btree.h"
 
 
 /*
@@ -43,6 +43,8 @@ int		get_bmap_ext(xfs_agnumber_t agno, xfs_agblock_t agbno,
 void		set_rtbmap(xfs_drtbno_t bno, int state);
 int		get_rtbmap(xfs_drtbno_t bno);
 
+void		bmap_mem_usage(__uint64_t *used, __uint64_t *flat);
+
 static inline void
 set_bmap(xfs_agnumber_t agno, xfs_agblock_t agbno, int state)
 {
@@ -66,32 +68,20 @@ get_bmap(xfs_agnumber_t agno, xfs_agblock_t agbno)
 
 typedef unsigned char extent_state_t;
 
+/*
+ * The bno and bcnt trees are B+trees indexed by start block and by
+ * (size, start block) respectively, each extent has a node in both.
+ */
 typedef struct extent_tree_node  {
-	avlnode_t		avl_node;
 	xfs_agblock_t		ex_startblock;	/* starting block (agbno) */
 	xfs_extlen_t		ex_blockcount;	/* number of blocks in extent */
 	extent_state_t		ex_state;	/* see state flags below */
-
-	struct extent_tree_node		*next;	/* for bcnt extent lists */
-	struct extent_tree_node		*last;	/* for bcnt extent list anchors */
 #if 0
 	xfs_ino_t		ex_inode;	/* owner, NULL if free or  */
 						/*	multiply allocated */
 #endif
 } extent_tree_node_t;
 
-typedef struct rt_extent_tree_node  {
-	avlnode_t		avl_node;
-	xfs_drtbno_t		rt_startblock;	/* starting realtime block */
-	xfs_extlen_t		rt_blockcount;	/* number of blocks in extent */
-	extent_state_t		rt_state;	/* see state flags below */
-
-#if 0
-	xfs_ino_t		ex_inode;	/* owner, NULL if free or  */
-						/*	multiply allocated */
-#endif
-} rt_extent_tree_node_t;
-
 /* extent states, prefix with XR_ to avoid conflict with buffer cache defines */
 
 #define XR_E_UNKNOWN	0	/* unknown state */
@@ -138,8 +128,8 @@ find_bno_extent(xfs_agnumber_t agno, xfs_agblock_t agbno);
 extent_tree_node_t *
 findfirst_bno_extent(xfs_agnumber_t agno);
 
-#define findnext_bno_extent(exent_ptr)	\
-		((extent_tree_node_t *) ((exent_ptr)->avl_node.avl_nextino))
+extent_tree_node_t *
+findnext_bno_extent(xfs_agnumber_t agno, extent_tree_node_t *ext);
 
 void
 get_bno_extent(xfs_agnumber_t agno, extent_tree_node_t *ext);
@@ -177,6 +167,10 @@ int		search_dup_extent(xfs_agnumber_t agno,
 			xfs_agblock_t start_agbno, xfs_agblock_t end_agbno);
 void		add_rt_dup_extent(xfs_drtbno_t	startblock,
 				xfs_extlen_t	blockcount);
+int		findnext_dup_extent(xfs_agnumber_t agno,
+			xfs_agblock_t *startblock, xfs_agblock_t *endblock);
+int		findnext_rt_dup_extent(xfs_drtbno_t *startblock,
+			xfs_extlen_t *blockcount);
 
 int		search_rt_dup_extent(xfs_mount_t	*mp,
 					xfs_drtbno_t	bno);
@@ -211,6 +205,26 @@ void		incore_ext_init(xfs_mount_t *);
 void		incore_ext_teardown(xfs_mount_t *mp);
 void		incore_ino_init(xfs_mount_t *);
 
+/*
+ * accounted (and possibly spilled) memory for the incore inode state,
+ * see incore_mem.c
+ */
+#define XR_MEM_INO_RECS		0
+#define XR_MEM_NLINKS		1
+#define XR_MEM_PARENTS		2
+#define XR_MEM_FTYPES		3
+#define XR_MEM_EX_DATA		4
+#define XR_MEM_NTYPES		5
+
+void		incore_mem_init(xfs_mount_t *mp, __uint64_t budget);
+void		*incore_alloc(xfs_agnumber_t agno, int type, size_t size);
+void		*incore_zalloc(xfs_agnumber_t agno, int type, size_t size);
+void		incore_free(xfs_agnumber_t agno, int type, void *ptr,
+			    size_t size);
+void		incore_mem_usage(int type, __uint64_t *resident,
+				 __uint64_t *spilled);
+const char	*incore_mem_type_name(int type);
+
 int		count_bno_extents(xfs_agnumber_t);
 int		count_bno_extents_blocks(xfs_agnumber_t, uint *);
 int		count_bcnt_extents(xfs_agnumber_t);
@@ -281,9 +295,14 @@ typedef struct ino_ex_data  {
 	union ino_nlink		counted_nlinks;/* counted nlinks in P6 */
 } ino_ex_data_t;
 
+/*
+ * Inode records are kept in one B+tree per AG indexed by ino_startnum.
+ * The tree only holds pointers to the records, so a record stays put for
+ * as long as it is in the tree.
+ */
 typedef struct ino_tree_node  {
-	avlnode_t		avl_node;
 	xfs_agino_t		ino_startnum;	/* starting inode # */
+	xfs_agnumber_t		ino_agno;	/* AG the record belongs to */
 	xfs_inofree_t		ir_free;	/* inode free bit mask */
 	__uint64_t		ino_confirmed;	/* confirmed bitmask */
 	__uint64_t		ino_isa_dir;	/* bit == 1 if a directory */
@@ -312,7 +331,8 @@ void		free_inode_rec(xfs_agnumber_t agno, ino_tree_node_t *ino_rec);
 void		get_inode_rec(struct xfs_mount *mp, xfs_agnumber_t agno,
 			      ino_tree_node_t *ino_rec);
 
-extern avltree_desc_t     **inode_tree_ptrs;
+extern struct btree_root	**inode_tree_ptrs;
+extern __thread struct btree_iter	ino_rec_iter;
 
 static inline int
 get_inode_offset(struct xfs_mount *mp, xfs_ino_t ino, ino_tree_node_t *irec)
@@ -322,18 +342,22 @@ get_inode_offset(struct xfs_mount *mp, xfs_ino_t ino, ino_tree_node_t *irec)
 static inline ino_tree_node_t *
 findfirst_inode_rec(xfs_agnumber_t agno)
 {
-	return((ino_tree_node_t *) inode_tree_ptrs[agno]->avl_firstino);
+	return btree_iter_find(&ino_rec_iter, inode_tree_ptrs[agno], 0, NULL);
 }
 static inline ino_tree_node_t *
 find_inode_rec(struct xfs_mount *mp, xfs_agnumber_t agno, xfs_agino_t ino)
 {
+	ino_tree_node_t		*irec;
+
 	/*
 	 * Is the AG inside the file system
 	 */
 	if (agno >= mp->m_sb.sb_agcount)
 		return NULL;
-	return((ino_tree_node_t *)
-		avl_findrange(inode_tree_ptrs[agno], ino));
+	irec = btree_uncached_find_le(inode_tree_ptrs[agno], ino, NULL);
+	if (irec && ino - irec->ino_startnum < XFS_INODES_PER_CHUNK)
+		return irec;
+	return NULL;
 }
 void		find_inode_rec_range(struct xfs_mount *mp, xfs_agnumber_t agno,
 			xfs_agino_t start_ino, xfs_agino_t end_ino,
@@ -356,6 +380,7 @@ void		print_uncertain_inode_list(xfs_agnumber_t agno);
  * separate trees for uncertain inodes (they may not exist).
  */
 ino_tree_node_t		*findfirst_uncertain_inode_rec(xfs_agnumber_t agno);
+ino_tree_node_t		*next_uncertain_inode_rec(ino_tree_node_t *irec);
 ino_tree_node_t		*find_uncertain_inode_rec(xfs_agnumber_t agno,
 						xfs_agino_t ino);
 void			add_inode_uncertain(xfs_mount_t *mp,
@@ -370,15 +395,17 @@ void			clear_uncertain_ino_cache(xfs_agnumber_t agno);
 
 /*
  * return next in-order inode tree node.  takes an "ino_tree_node_t *"
+ * from the good inode tree; the record itself may already have been
+ * pulled out of the tree.  Each thread remembers where in the tree the
+ * last record it stepped to was, so a walk from findfirst_inode_rec()
+ * doesn't search the tree for every record.
  */
-#define next_ino_rec(ino_node_ptr)	\
-		((ino_tree_node_t *) ((ino_node_ptr)->avl_node.avl_nextino))
-/*
- * return the next linked inode (forward avl tree link)-- meant to be used
- * by linked list routines (uncertain inode routines/records)
- */
-#define next_link_rec(ino_node_ptr)	\
-		((ino_tree_node_t *) ((ino_node_ptr)->avl_node.avl_forw))
+static inline ino_tree_node_t *
+next_ino_rec(ino_tree_node_t *irec)
+{
+	return btree_iter_next(&ino_rec_iter, inode_tree_ptrs[irec->ino_agno],
+			       irec->ino_startnum, NULL);
+}
 
 /*
  * finobt helpers
@@ -498,11 +525,9 @@ static inline int is_inode_reached(struct ino_tree_node *irec, int offset)
 	return (irec->ino_un.ex_data->ino_reached & IREC_MASK(offset)) != 0;
 }
 
-static inline void add_inode_reached(struct ino_tree_node *irec, int offset)
-{
-	add_inode_ref(irec, offset);
-	irec->ino_un.ex_data->ino_reached |= IREC_MASK(offset);
-}
+void add_inode_reached(struct ino_tree_node *irec, int offset);
+int reach_dir_inode(struct ino_tree_node *irec, int offset,
+		xfs_ino_t parent, xfs_ino_t *old_parent);
 
 /*
  * get/set inode filetype. Only used if the superblock feature bit is set
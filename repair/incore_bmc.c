@@ -17,7 +17,6 @@
  */
 
 #include <libxfs.h>
-#include "avl.h"
 #include "globals.h"
 #include "incore.h"
 #include "agheader.h"
@@ -17,7 +17,6 @@
  */
 
 #include <libxfs.h>
-#include "avl.h"
 #include "globals.h"
 #include "incore.h"
 #include "agheader.h"
@@ -28,24 +27,50 @@
 /*
  * array of inode tree ptrs, one per ag
  */
-avltree_desc_t	**inode_tree_ptrs;
+struct btree_root	**inode_tree_ptrs;
+__thread struct btree_iter	ino_rec_iter;	/* see next_ino_rec() */
 
 /*
  * ditto for uncertain inodes
  */
-static avltree_desc_t	**inode_uncertain_tree_ptrs;
+static struct btree_root **inode_uncertain_tree_ptrs;
+static __thread struct btree_iter	uncertain_rec_iter;
+
+/*
+ * Phase 6 checks several directories at once, and their entries can point
+ * to inodes in any AG.  The counted link counts, reached bits and parents
+ * of a record are only changed under the lock of the record's AG.
+ */
+static struct aglock	*inode_rec_locks;
+
+static inline void
+lock_inode_rec(
+	struct ino_tree_node	*irec)
+{
+	pthread_mutex_lock(&inode_rec_locks[irec->ino_agno].lock);
+}
+
+static inline void
+unlock_inode_rec(
+	struct ino_tree_node	*irec)
+{
+	pthread_mutex_unlock(&inode_rec_locks[irec->ino_agno].lock);
+}
 
 /* memory optimised nlink counting for all inodes */
 
 static void *
-alloc_nlink_array(__uint8_t nlink_size)
+alloc_nlink_array(xfs_agnumber_t agno, __uint8_t nlink_size)
 {
-	void *ptr;
+	return incore_zalloc(agno, XR_MEM_NLINKS,
+			XFS_INODES_PER_CHUNK * nlink_size);
+}
 
-	ptr = calloc(XFS_INODES_PER_CHUNK, nlink_size);
-	if (!ptr)
-		do_error(_("could not allocate nlink array\n"));
-	return ptr;
+static void
+free_nlink_mem(xfs_agnumber_t agno, void *ptr, __uint8_t nlink_size)
+{
+	incore_free(agno, XR_MEM_NLINKS, ptr,
+			XFS_INODES_PER_CHUNK * nlink_size);
 }
 
 static void
@@ -56,19 +81,21 @@ nlink_grow_8_to_16(ino_tree_node_t *irec)
 
 	irec->nlink_size = sizeof(__uint16_t);
 
-	new_nlinks = alloc_nlink_array(irec->nlink_size);
+	new_nlinks = alloc_nlink_array(irec->ino_agno, irec->nlink_size);
 	for (i = 0; i < XFS_INODES_PER_CHUNK; i++)
 		new_nlinks[i] = irec->disk_nlinks.un8[i];
-	free(irec->disk_nlinks.un8);
+	free_nlink_mem(irec->ino_agno, irec->disk_nlinks.un8, sizeof(__uint8_t));
 	irec->disk_nlinks.un16 = new_nlinks;
 
 	if (full_ino_ex_data) {
-		new_nlinks = alloc_nlink_array(irec->nlink_size);
+		new_nlinks = alloc_nlink_array(irec->ino_agno, irec->nlink_size);
 		for (i = 0; i < XFS_INODES_PER_CHUNK; i++) {
 			new_nlinks[i] =
 				irec->ino_un.ex_data->counted_nlinks.un8[i];
 		}
-		free(irec->ino_un.ex_data->counted_nlinks.un8);
+		free_nlink_mem(irec->ino_agno,
+				irec->ino_un.ex_data->counted_nlinks.un8,
+				sizeof(__uint8_t));
 		irec->ino_un.ex_data->counted_nlinks.un16 = new_nlinks;
 	}
 }
@@ -81,25 +108,28 @@ nlink_grow_16_to_32(ino_tree_node_t *irec)
 
 	irec->nlink_size = sizeof(__uint32_t);
 
-	new_nlinks = alloc_nlink_array(irec->nlink_size);
+	new_nlinks = alloc_nlink_array(irec->ino_agno, irec->nlink_size);
 	for (i = 0; i < XFS_INODES_PER_CHUNK; i++)
 		new_nlinks[i] = irec->disk_nlinks.un16[i];
-	free(irec->disk_nlinks.un16);
+	free_nlink_mem(irec->ino_agno, irec->disk_nlinks.un16, sizeof(__uint16_t));
 	irec->disk_nlinks.un32 = new_nlinks;
 
 	if (full_ino_ex_data) {
-		new_nlinks = alloc_nlink_array(irec->nlink_size);
+		new_nlinks = alloc_nlink_array(irec->ino_agno, irec->nlink_size);
 
 		for (i = 0; i < XFS_INODES_PER_CHUNK; i++) {
 			new_nlinks[i] =
 				irec->ino_un.ex_data->counted_nlinks.un16[i];
 		}
-		free(irec->ino_un.ex_data->counted_nlinks.un16);
+		free_nlink_mem(irec->ino_agno,
+				irec->ino_un.ex_data->counted_nlinks.un16,
+				sizeof(__uint16_t));
 		irec->ino_un.ex_data->counted_nlinks.un32 = new_nlinks;
 	}
 }
 
-void add_inode_ref(struct ino_tree_node *irec, int ino_offset)
+static void
+__add_inode_ref(struct ino_tree_node *irec, int ino_offset)
 {
 	ASSERT(irec->ino_un.ex_data != NULL);
 
@@ -126,12 +156,61 @@ void add_inode_ref(struct ino_tree_node *irec, int ino_offset)
 	}
 }
 
+void add_inode_ref(struct ino_tree_node *irec, int ino_offset)
+{
+	lock_inode_rec(irec);
+	__add_inode_ref(irec, ino_offset);
+	unlock_inode_rec(irec);
+}
+
+void add_inode_reached(struct ino_tree_node *irec, int ino_offset)
+{
+	lock_inode_rec(irec);
+	__add_inode_ref(irec, ino_offset);
+	irec->ino_un.ex_data->ino_reached |= IREC_MASK(ino_offset);
+	unlock_inode_rec(irec);
+}
+
+/*
+ * Directory @parent has an entry for directory inode @ino_offset.  Mark
+ * the inode reached from @parent if its ".." agrees, or if it has no ".."
+ * at all, in which case @parent becomes its parent.  Returns 1 if the
+ * inode had already been reached, otherwise 0 with the parent it had
+ * before in @old_parent.  This has to be atomic as other directories
+ * claiming the same inode may be checked at the same time.
+ */
+int
+reach_dir_inode(
+	struct ino_tree_node	*irec,
+	int			ino_offset,
+	xfs_ino_t		parent,
+	xfs_ino_t		*old_parent)
+{
+	lock_inode_rec(irec);
+	if (is_inode_reached(irec, ino_offset)) {
+		unlock_inode_rec(irec);
+		return 1;
+	}
+
+	*old_parent = get_inode_parent(irec, ino_offset);
+	if (*old_parent == parent || *old_parent == NULLFSINO) {
+		if (*old_parent == NULLFSINO)
+			set_inode_parent(irec, ino_offset, parent);
+		__add_inode_ref(irec, ino_offset);
+		irec->ino_un.ex_data->ino_reached |= IREC_MASK(ino_offset);
+	}
+	unlock_inode_rec(irec);
+	return 0;
+}
+
 void drop_inode_ref(struct ino_tree_node *irec, int ino_offset)
 {
 	__uint32_t	refs = 0;
 
 	ASSERT(irec->ino_un.ex_data != NULL);
 
+	lock_inode_rec(irec);
+
 	switch (irec->nlink_size) {
 	case sizeof(__uint8_t):
 		ASSERT(irec->ino_un.ex_data->counted_nlinks.un8[ino_offset] > 0);
@@ -151,6 +230,7 @@ void drop_inode_ref(struct ino_tree_node *irec, int ino_offset)
 
 	if (refs == 0)
 		irec->ino_un.ex_data->ino_reached &= ~IREC_MASK(ino_offset);
+	unlock_inode_rec(irec);
 }
 
 __uint32_t num_inode_references(struct ino_tree_node *irec, int ino_offset)
@@ -213,17 +293,14 @@ __uint32_t get_inode_disk_nlinks(struct ino_tree_node *irec, int ino_offset)
 
 static __uint8_t *
 alloc_ftypes_array(
-	struct xfs_mount *mp)
+	struct xfs_mount *mp,
+	xfs_agnumber_t	agno)
 {
-	__uint8_t	*ptr;
-
 	if (!xfs_sb_version_hasftype(&mp->m_sb))
 		return NULL;
 
-	ptr = calloc(XFS_INODES_PER_CHUNK, sizeof(*ptr));
-	if (!ptr)
-		do_error(_("could not allocate ftypes array\n"));
-	return ptr;
+	return incore_zalloc(agno, XR_MEM_FTYPES,
+			XFS_INODES_PER_CHUNK * sizeof(__uint8_t));
 }
 
 /*
@@ -242,68 +319,118 @@ alloc_ftypes_array(
 static struct ino_tree_node *
 alloc_ino_node(
 	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno,
 	xfs_agino_t		starting_ino)
 {
 	struct ino_tree_node 	*irec;
 
-	irec = malloc(sizeof(*irec));
-	if (!irec)
-		do_error(_("inode map malloc failed\n"));
-
-	irec->avl_node.avl_nextino = NULL;
-	irec->avl_node.avl_forw = NULL;
-	irec->avl_node.avl_back = NULL;
+	irec = incore_alloc(agno, XR_MEM_INO_RECS, sizeof(*irec));
 
 	irec->ino_startnum = starting_ino;
+	irec->ino_agno = agno;
 	irec->ino_confirmed = 0;
 	irec->ino_isa_dir = 0;
 	irec->ir_free = (xfs_inofree_t) - 1;
 	irec->ino_un.ex_data = NULL;
 	irec->nlink_size = sizeof(__uint8_t);
-	irec->disk_nlinks.un8 = alloc_nlink_array(irec->nlink_size);
-	irec->ftypes = alloc_ftypes_array(mp);
+	irec->disk_nlinks.un8 = alloc_nlink_array(agno, irec->nlink_size);
+	irec->ftypes = alloc_ftypes_array(mp, agno);
 	return irec;
 }
 
 static void
-free_nlink_array(union ino_nlink nlinks, __uint8_t nlink_size)
+free_nlink_array(
+	xfs_agnumber_t		agno,
+	union ino_nlink		nlinks,
+	__uint8_t		nlink_size)
 {
 	switch (nlink_size) {
 	case sizeof(__uint8_t):
-		free(nlinks.un8);
+		free_nlink_mem(agno, nlinks.un8, nlink_size);
 		break;
 	case sizeof(__uint16_t):
-		free(nlinks.un16);
+		free_nlink_mem(agno, nlinks.un16, nlink_size);
 		break;
 	case sizeof(__uint32_t):
-		free(nlinks.un32);
+		free_nlink_mem(agno, nlinks.un32, nlink_size);
 		break;
 	default:
 		ASSERT(0);
 	}
 }
 
+static void
+free_parent_list(
+	xfs_agnumber_t		agno,
+	parent_list_t		*ptbl)
+{
+	if (ptbl == NULL)
+		return;
+
+	incore_free(agno, XR_MEM_PARENTS, ptbl->pentries,
+			__builtin_popcountll(ptbl->pmask) *
+				sizeof(parent_entry_t));
+	incore_free(agno, XR_MEM_PARENTS, ptbl, sizeof(parent_list_t));
+}
+
 static void
 free_ino_tree_node(
 	struct ino_tree_node	*irec)
 {
-	irec->avl_node.avl_nextino = NULL;
-	irec->avl_node.avl_forw = NULL;
-	irec->avl_node.avl_back = NULL;
+	xfs_agnumber_t		agno = irec->ino_agno;
 
-	free_nlink_array(irec->disk_nlinks, irec->nlink_size);
+	free_nlink_array(agno, irec->disk_nlinks, irec->nlink_size);
 	if (irec->ino_un.ex_data != NULL)  {
 		if (full_ino_ex_data) {
-			free(irec->ino_un.ex_data->parents);
-			free_nlink_array(irec->ino_un.ex_data->counted_nlinks,
+			free_parent_list(agno, irec->ino_un.ex_data->parents);
+			free_nlink_array(agno,
+					 irec->ino_un.ex_data->counted_nlinks,
 					 irec->nlink_size);
-		}
-		free(irec->ino_un.ex_data);
-
+			incore_free(agno, XR_MEM_EX_DATA, irec->ino_un.ex_data,
+					sizeof(ino_ex_data_t));
+		} else
+			free_parent_list(agno, irec->ino_un.plist);
 	}
 
-	free(irec->ftypes);
-	free(irec);
+	if (irec->ftypes)
+		incore_free(agno, XR_MEM_FTYPES, irec->ftypes,
+				XFS_INODES_PER_CHUNK * sizeof(__uint8_t));
+	incore_free(agno, XR_MEM_INO_RECS, irec, sizeof(*irec));
+}
+
+/*
+ * Find the record covering @agino, or failing that the first record
+ * after it.
+ */
+static struct ino_tree_node *
+find_ino_rec_from(
+	struct btree_root	*tree,
+	xfs_agino_t		agino)
+{
+	struct ino_tree_node	*irec;
+
+	irec = btree_uncached_find_le(tree, agino, NULL);
+	if (irec && agino - irec->ino_startnum < XFS_INODES_PER_CHUNK)
+		return irec;
+	return btree_uncached_find(tree, agino, NULL);
+}
+
+/*
+ * Insert a record into an inode tree.  Fails if the 64 inodes it covers
+ * overlap an existing record.
+ */
+static int
+insert_ino_rec(
+	struct btree_root	*tree,
+	struct ino_tree_node	*irec)
+{
+	struct ino_tree_node	*next;
+
+	next = find_ino_rec_from(tree, irec->ino_startnum);
+	if (next && next->ino_startnum <
+			irec->ino_startnum + XFS_INODES_PER_CHUNK)
+		return 0;
+	return btree_insert(tree, irec->ino_startnum, irec) == 0;
 }
 
 /*
@@ -353,13 +480,11 @@ add_aginode_uncertain(
 	 * check to see if record containing inode is already in the tree.
 	 * if not, add it
 	 */
-	ino_rec = (ino_tree_node_t *)
-		avl_findrange(inode_uncertain_tree_ptrs[agno], s_ino);
+	ino_rec = find_uncertain_inode_rec(agno, s_ino);
 	if (!ino_rec) {
-		ino_rec = alloc_ino_node(mp, s_ino);
+		ino_rec = alloc_ino_node(mp, agno, s_ino);
 
-		if (!avl_insert(inode_uncertain_tree_ptrs[agno],
-				&ino_rec->avl_node))
+		if (!insert_ino_rec(inode_uncertain_tree_ptrs[agno], ino_rec))
 			do_error(
 	_("add_aginode_uncertain - duplicate inode range\n"));
 	}
@@ -397,25 +522,34 @@ get_uncertain_inode_rec(struct xfs_mount *mp, xfs_agnumber_t agno,
 	ASSERT(agno < mp->m_sb.sb_agcount);
 	ASSERT(inode_tree_ptrs[agno] != NULL);
 
-	avl_delete(inode_uncertain_tree_ptrs[agno], &ino_rec->avl_node);
-
-	ino_rec->avl_node.avl_nextino = NULL;
-	ino_rec->avl_node.avl_forw = NULL;
-	ino_rec->avl_node.avl_back = NULL;
+	btree_delete(inode_uncertain_tree_ptrs[agno], ino_rec->ino_startnum);
 }
 
 ino_tree_node_t *
 findfirst_uncertain_inode_rec(xfs_agnumber_t agno)
 {
-	return((ino_tree_node_t *)
-		inode_uncertain_tree_ptrs[agno]->avl_firstino);
+	return btree_iter_find(&uncertain_rec_iter,
+			       inode_uncertain_tree_ptrs[agno], 0, NULL);
+}
+
+ino_tree_node_t *
+next_uncertain_inode_rec(ino_tree_node_t *irec)
+{
+	return btree_iter_next(&uncertain_rec_iter,
+			       inode_uncertain_tree_ptrs[irec->ino_agno],
+			       irec->ino_startnum, NULL);
 }
 
 ino_tree_node_t *
 find_uncertain_inode_rec(xfs_agnumber_t agno, xfs_agino_t ino)
 {
-	return((ino_tree_node_t *)
-		avl_findrange(inode_uncertain_tree_ptrs[agno], ino));
+	ino_tree_node_t		*irec;
+
+	irec = btree_uncached_find_le(inode_uncertain_tree_ptrs[agno], ino,
+				      NULL);
+	if (irec && ino - irec->ino_startnum < XFS_INODES_PER_CHUNK)
+		return irec;
+	return NULL;
 }
 
 void
@@ -426,7 +560,7 @@ clear_uncertain_ino_cache(xfs_agnumber_t agno)
 
 
 /*
- * Next comes the inode trees.  One per AG,  AVL trees of inode records, each
+ * Next comes the inode trees.  One per AG,  B+trees of inode records, each
  * inode record tracking 64 inodes
  */
 
@@ -454,8 +588,8 @@ add_inode(
 {
 	struct ino_tree_node	*irec;
 
-	irec = alloc_ino_node(mp, agino);
-	if (!avl_insert(inode_tree_ptrs[agno],	&irec->avl_node))
+	irec = alloc_ino_node(mp, agno, agino);
+	if (!insert_ino_rec(inode_tree_ptrs[agno], irec))
 		do_warn(_("add_inode - duplicate inode range\n"));
 	return irec;
 }
@@ -470,11 +604,10 @@ get_inode_rec(struct xfs_mount *mp, xfs_agnumber_t agno, ino_tree_node_t *ino_re
 	ASSERT(agno < mp->m_sb.sb_agcount);
 	ASSERT(inode_tree_ptrs[agno] != NULL);
 
-	avl_delete(inode_tree_ptrs[agno], &ino_rec->avl_node);
-
-	ino_rec->avl_node.avl_nextino = NULL;
-	ino_rec->avl_node.avl_forw = NULL;
-	ino_rec->avl_node.avl_back = NULL;
+	/* records that overlapped another one never made it into the tree */
+	if (btree_uncached_lookup(inode_tree_ptrs[agno],
+				  ino_rec->ino_startnum) == ino_rec)
+		btree_delete(inode_tree_ptrs[agno], ino_rec->ino_startnum);
 }
 
 /*
@@ -497,9 +630,19 @@ find_inode_rec_range(struct xfs_mount *mp, xfs_agnumber_t agno,
 	/*
 	 * Is the AG inside the file system ?
 	 */
-	if (agno < mp->m_sb.sb_agcount)
-		avl_findranges(inode_tree_ptrs[agno], start_ino,
-			end_ino, (avlnode_t **) first, (avlnode_t **) last);
+	if (agno >= mp->m_sb.sb_agcount || start_ino >= end_ino)
+		return;
+
+	/*
+	 * first and last records overlapping [start_ino, end_ino)
+	 */
+	*first = find_ino_rec_from(inode_tree_ptrs[agno], start_ino);
+	if (*first == NULL || (*first)->ino_startnum >= end_ino) {
+		*first = NULL;
+		return;
+	}
+	*last = btree_uncached_find_le(inode_tree_ptrs[agno], end_ino - 1,
+				       NULL);
 }
 
 /*
@@ -549,13 +692,16 @@ print_inode_list_int(xfs_agnumber_t agno, int uncertain)
 {
 	ino_tree_node_t *ino_rec;
 
+	struct btree_root	*tree;
+
 	if (!uncertain)  {
 		fprintf(stderr, _("good inode list is --\n"));
-		ino_rec = findfirst_inode_rec(agno);
+		tree = inode_tree_ptrs[agno];
 	} else  {
 		fprintf(stderr, _("uncertain inode list is --\n"));
-		ino_rec = findfirst_uncertain_inode_rec(agno);
+		tree = inode_uncertain_tree_ptrs[agno];
 	}
+	ino_rec = btree_uncached_find(tree, 0, NULL);
 
 	if (ino_rec == NULL)  {
 		fprintf(stderr, _("agno %d -- no inodes\n"), agno);
@@ -571,9 +717,8 @@ print_inode_list_int(xfs_agnumber_t agno, int uncertain)
 			ino_rec->ino_startnum,
 			(unsigned long long)ino_rec->ir_free,
 			(unsigned long long)ino_rec->ino_confirmed);
-		if (ino_rec->ino_startnum == 0)
-			ino_rec = ino_rec;
-		ino_rec = next_ino_rec(ino_rec);
+		ino_rec = btree_uncached_find(tree, ino_rec->ino_startnum + 1,
+					      NULL);
 	}
 }
 
@@ -615,9 +760,8 @@ set_inode_parent(
 		ptbl = irec->ino_un.plist;
 
 	if (ptbl == NULL)  {
-		ptbl = (parent_list_t *)malloc(sizeof(parent_list_t));
-		if (!ptbl)
-			do_error(_("couldn't malloc parent list table\n"));
+		ptbl = incore_alloc(irec->ino_agno, XR_MEM_PARENTS,
+				sizeof(parent_list_t));
 
 		if (full_ino_ex_data)
 			irec->ino_un.ex_data->parents = ptbl;
@@ -625,10 +769,8 @@ set_inode_parent(
 			irec->ino_un.plist = ptbl;
 
 		ptbl->pmask = 1LL << offset;
-		ptbl->pentries = (xfs_ino_t*)memalign(sizeof(xfs_ino_t),
-							sizeof(xfs_ino_t));
-		if (!ptbl->pentries)
-			do_error(_("couldn't memalign pentries table\n"));
+		ptbl->pentries = incore_alloc(irec->ino_agno, XR_MEM_PARENTS,
+				sizeof(parent_entry_t));
 #ifdef DEBUG
 		ptbl->cnt = 1;
 #endif
@@ -672,9 +814,8 @@ set_inode_parent(
 #endif
 	ASSERT(cnt >= target);
 
-	tmp = (xfs_ino_t*)memalign(sizeof(xfs_ino_t), (cnt + 1) * sizeof(xfs_ino_t));
-	if (!tmp)
-		do_error(_("couldn't memalign pentries table\n"));
+	tmp = incore_alloc(irec->ino_agno, XR_MEM_PARENTS,
+			(cnt + 1) * sizeof(parent_entry_t));
 
 	memmove(tmp, ptbl->pentries, target * sizeof(parent_entry_t));
 
@@ -682,7 +823,8 @@ set_inode_parent(
 		memmove(tmp + target + 1, ptbl->pentries + target,
 				(cnt - target) * sizeof(parent_entry_t));
 
-	free(ptbl->pentries);
+	incore_free(irec->ino_agno, XR_MEM_PARENTS, ptbl->pentries,
+			cnt * sizeof(parent_entry_t));
 
 	ptbl->pentries = tmp;
 
@@ -730,24 +872,23 @@ alloc_ex_data(ino_tree_node_t *irec)
 	parent_list_t 	*ptbl;
 
 	ptbl = irec->ino_un.plist;
-	irec->ino_un.ex_data  = (ino_ex_data_t *)calloc(1, sizeof(ino_ex_data_t));
-	if (irec->ino_un.ex_data == NULL)
-		do_error(_("could not malloc inode extra data\n"));
+	irec->ino_un.ex_data = incore_zalloc(irec->ino_agno, XR_MEM_EX_DATA,
+			sizeof(ino_ex_data_t));
 
 	irec->ino_un.ex_data->parents = ptbl;
 
 	switch (irec->nlink_size) {
 	case sizeof(__uint8_t):
 		irec->ino_un.ex_data->counted_nlinks.un8 =
-			alloc_nlink_array(irec->nlink_size);
+			alloc_nlink_array(irec->ino_agno, irec->nlink_size);
 		break;
 	case sizeof(__uint16_t):
 		irec->ino_un.ex_data->counted_nlinks.un16 =
-			alloc_nlink_array(irec->nlink_size);
+			alloc_nlink_array(irec->ino_agno, irec->nlink_size);
 		break;
 	case sizeof(__uint32_t):
 		irec->ino_un.ex_data->counted_nlinks.un32 =
-			alloc_nlink_array(irec->nlink_size);
+			alloc_nlink_array(irec->ino_agno, irec->nlink_size);
 		break;
 	default:
 		ASSERT(0);
@@ -771,25 +912,6 @@ add_ino_ex_data(xfs_mount_t *mp)
 	full_ino_ex_data = 1;
 }
 
-static __psunsigned_t
-avl_ino_start(avlnode_t *node)
-{
-	return((__psunsigned_t) ((ino_tree_node_t *) node)->ino_startnum);
-}
-
-static __psunsigned_t
-avl_ino_end(avlnode_t *node)
-{
-	return((__psunsigned_t) (
-		((ino_tree_node_t *) node)->ino_startnum +
-		XFS_INODES_PER_CHUNK));
-}
-
-avlops_t avl_ino_tree_ops = {
-	avl_ino_start,
-	avl_ino_end
-};
-
 void
 incore_ino_init(xfs_mount_t *mp)
 {
@@ -797,30 +919,27 @@ incore_ino_init(xfs_mount_t *mp)
 	int agcount = mp->m_sb.sb_agcount;
 
 	if ((inode_tree_ptrs = malloc(agcount *
-					sizeof(avltree_desc_t *))) == NULL)
+					sizeof(struct btree_root *))) == NULL)
 		do_error(_("couldn't malloc inode tree descriptor table\n"));
 	if ((inode_uncertain_tree_ptrs = malloc(agcount *
-					sizeof(avltree_desc_t *))) == NULL)
+					sizeof(struct btree_root *))) == NULL)
 		do_error(
 		_("couldn't malloc uncertain ino tree descriptor table\n"));
 
 	for (i = 0; i < agcount; i++)  {
-		if ((inode_tree_ptrs[i] =
-				malloc(sizeof(avltree_desc_t))) == NULL)
-			do_error(_("couldn't malloc inode tree descriptor\n"));
-		if ((inode_uncertain_tree_ptrs[i] =
-				malloc(sizeof(avltree_desc_t))) == NULL)
-			do_error(
-			_("couldn't malloc uncertain ino tree descriptor\n"));
-	}
-	for (i = 0; i < agcount; i++)  {
-		avl_init_tree(inode_tree_ptrs[i], &avl_ino_tree_ops);
-		avl_init_tree(inode_uncertain_tree_ptrs[i], &avl_ino_tree_ops);
+		btree_init(&inode_tree_ptrs[i]);
+		btree_init(&inode_uncertain_tree_ptrs[i]);
 	}
 
 	if ((last_rec = malloc(sizeof(ino_tree_node_t *) * agcount)) == NULL)
 		do_error(_("couldn't malloc uncertain inode cache area\n"));
 
+	inode_rec_locks = calloc(agcount, sizeof(struct aglock));
+	if (!inode_rec_locks)
+		do_error(_("couldn't malloc inode record locks\n"));
+	for (i = 0; i < agcount; i++)
+		pthread_mutex_init(&inode_rec_locks[i].lock, NULL);
+
 	memset(last_rec, 0, sizeof(ino_tree_node_t *) * agcount);
 
 	full_ino_ex_data = 0;
@@ -0,0 +1,363 @@
+/*
+ * Memory accounting for the incore inode state, and spilling of that state
+ * to a scratch file once it outgrows the memory budget.
+ *
+ * The inode records, nlink arrays, parent lists, ftype arrays and phase 6/7
+ * extra data are all allocated through incore_alloc().  Every allocation
+ * is counted against its type so we can report what repair actually uses.
+ * While the resident total stays below the budget the memory comes from
+ * malloc.  Past that, small allocations are carved out of an unlinked
+ * scratch file mapped shared into a reserved stretch of address space, so
+ * the kernel can write the cold pages back to the file instead of keeping
+ * them in RAM or swap.  Each AG allocates from its own chunks of the file,
+ * which keeps an AG's state together and lets the AGs that aren't being
+ * worked on go cold as a whole.
+ *
+ * Scratch memory is never given back to the file; freed blocks go on per-AG
+ * free lists by size class and are reused for later allocations.
+ */
+
+#include <libxfs.h>
+#include <sys/mman.h>
+#include "incore.h"
+#include "globals.h"
+#include "err_protos.h"
+
+#define SPILL_MIN_SHIFT		4		/* smallest class, 16 bytes */
+#define SPILL_NCLASSES		6		/* ... up to 512 bytes */
+#define SPILL_MAX_SIZE		(1 << (SPILL_MIN_SHIFT + SPILL_NCLASSES - 1))
+#define SPILL_CHUNK_SIZE	(1ULL << 20)	/* handed to an AG at a time */
+#define SPILL_GROW_SIZE		(16ULL << 20)	/* file/mapping growth step */
+
+struct spill_ag {
+	pthread_mutex_t		lock;
+	char			*next;		/* bump pointer into chunk */
+	char			*end;
+	void			*free[SPILL_NCLASSES];
+};
+
+static const char	*mem_type_names[XR_MEM_NTYPES] = {
+	[XR_MEM_INO_RECS]	= N_("inode records"),
+	[XR_MEM_NLINKS]		= N_("link counts"),
+	[XR_MEM_PARENTS]	= N_("parent lists"),
+	[XR_MEM_FTYPES]		= N_("file types"),
+	[XR_MEM_EX_DATA]	= N_("inode extra data"),
+};
+
+static __uint64_t	mem_budget;		/* bytes, 0 means unlimited */
+static __uint64_t	mem_resident;
+static __uint64_t	mem_used[XR_MEM_NTYPES];
+static __uint64_t	mem_spilled[XR_MEM_NTYPES];
+
+static pthread_mutex_t	spill_lock = PTHREAD_MUTEX_INITIALIZER;
+static int		spill_state;		/* 1 ready, -1 unusable */
+static int		spill_fd = -1;
+static char		*spill_base;
+static __uint64_t	spill_reserved;		/* address space reserved */
+static __uint64_t	spill_mapped;		/* ... of which backed by file */
+static __uint64_t	spill_used;		/* ... of which handed out */
+static struct spill_ag	*spill_ags;
+static xfs_agnumber_t	spill_agcount;
+
+static inline int
+spill_class(
+	size_t		size)
+{
+	int		class = 0;
+
+	while ((size_t)1 << (class + SPILL_MIN_SHIFT) < size)
+		class++;
+	return class;
+}
+
+static inline int
+is_spilled(
+	void		*ptr)
+{
+	return spill_base && (char *)ptr >= spill_base &&
+		(char *)ptr < spill_base + spill_reserved;
+}
+
+/*
+ * Create and map the scratch file.  Called with spill_lock held the first
+ * time we go over budget.  If anything goes wrong we say so once and carry
+ * on with malloc.
+ */
+static void
+spill_setup(void)
+{
+	const char	*dir = spill_dir;
+	char		*path;
+	void		*base;
+
+	spill_state = -1;
+	if (sizeof(void *) < 8) {
+		do_warn(
+_("no address space for a scratch file, keeping the incore state in memory\n"));
+		return;
+	}
+
+	if (!dir)
+		dir = getenv("TMPDIR");
+	if (!dir || !*dir)
+		dir = "/tmp";
+
+	path = malloc(strlen(dir) + sizeof("/xfs_repair.XXXXXX"));
+	if (!path)
+		do_error(_("couldn't malloc scratch file name\n"));
+	sprintf(path, "%s/xfs_repair.XXXXXX", dir);
+	spill_fd = mkstemp(path);
+	if (spill_fd < 0) {
+		do_warn(_("couldn't create scratch file in %s: %s\n"),
+			dir, strerror(errno));
+		goto out_free;
+	}
+	unlink(path);
+
+	base = mmap(NULL, spill_reserved, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		do_warn(_("couldn't reserve %" PRIu64 " MB for scratch file: %s\n"),
+			spill_reserved >> 20, strerror(errno));
+		close(spill_fd);
+		spill_fd = -1;
+		goto out_free;
+	}
+	spill_base = base;
+	spill_state = 1;
+
+	do_log(
+_("        - incore state exceeds %" PRIu64 " MB, spilling to scratch file in %s\n"),
+		mem_budget >> 20, dir);
+out_free:
+	free(path);
+}
+
+/*
+ * Hand a new chunk of the scratch file to an AG, growing the file and the
+ * mapping as needed.  The file is grown with real blocks rather than as a
+ * sparse file: touching a page of the mapping that the filesystem has no
+ * room for would kill us with SIGBUS.  Returns 0 if the scratch file can't
+ * be used.
+ */
+static int
+spill_refill(
+	struct spill_ag	*sag)
+{
+	void		*addr;
+	int		error;
+	int		ret = 0;
+
+	pthread_mutex_lock(&spill_lock);
+	if (!spill_state)
+		spill_setup();
+	if (spill_state < 0)
+		goto out_unlock;
+
+	if (spill_used + SPILL_CHUNK_SIZE > spill_mapped) {
+		if (spill_mapped + SPILL_GROW_SIZE > spill_reserved) {
+			do_warn(
+_("scratch file is full, keeping the rest of the incore state in memory\n"));
+			spill_state = -1;
+			goto out_unlock;
+		}
+		error = posix_fallocate(spill_fd, spill_mapped,
+				SPILL_GROW_SIZE);
+		if (error) {
+			do_warn(
+_("couldn't grow scratch file, keeping the rest of the incore state in memory: %s\n"),
+				strerror(error));
+			spill_state = -1;
+			goto out_unlock;
+		}
+		addr = mmap(spill_base + spill_mapped, SPILL_GROW_SIZE,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+				spill_fd, spill_mapped);
+		if (addr == MAP_FAILED) {
+			do_warn(_("couldn't map scratch file: %s\n"),
+				strerror(errno));
+			spill_state = -1;
+			goto out_unlock;
+		}
+		spill_mapped += SPILL_GROW_SIZE;
+	}
+
+	sag->next = spill_base + spill_used;
+	sag->end = sag->next + SPILL_CHUNK_SIZE;
+	spill_used += SPILL_CHUNK_SIZE;
+	ret = 1;
+out_unlock:
+	pthread_mutex_unlock(&spill_lock);
+	return ret;
+}
+
+static void *
+spill_alloc(
+	xfs_agnumber_t	agno,
+	size_t		size)
+{
+	struct spill_ag	*sag = &spill_ags[agno];
+	int		class = spill_class(size);
+	size_t		csize = (size_t)1 << (class + SPILL_MIN_SHIFT);
+	void		*ptr;
+
+	pthread_mutex_lock(&sag->lock);
+	ptr = sag->free[class];
+	if (ptr) {
+		sag->free[class] = *(void **)ptr;
+		goto out_unlock;
+	}
+	if ((size_t)(sag->end - sag->next) < csize && !spill_refill(sag))
+		goto out_unlock;
+	ptr = sag->next;
+	sag->next += csize;
+out_unlock:
+	pthread_mutex_unlock(&sag->lock);
+	return ptr;
+}
+
+static void
+spill_free(
+	xfs_agnumber_t	agno,
+	void		*ptr,
+	size_t		size)
+{
+	struct spill_ag	*sag = &spill_ags[agno];
+	int		class = spill_class(size);
+
+	pthread_mutex_lock(&sag->lock);
+	*(void **)ptr = sag->free[class];
+	sag->free[class] = ptr;
+	pthread_mutex_unlock(&sag->lock);
+}
+
+/*
+ * Allocate @size bytes of incore state of @type for AG @agno.  Never fails.
+ */
+void *
+incore_alloc(
+	xfs_agnumber_t	agno,
+	int		type,
+	size_t		size)
+{
+	void		*ptr;
+
+	ASSERT(type < XR_MEM_NTYPES);
+	__sync_fetch_and_add(&mem_used[type], size);
+
+	if (mem_budget && size <= SPILL_MAX_SIZE && agno < spill_agcount &&
+	    spill_state >= 0 &&
+	    __sync_fetch_and_add(&mem_resident, 0) + size > mem_budget) {
+		ptr = spill_alloc(agno, size);
+		if (ptr) {
+			__sync_fetch_and_add(&mem_spilled[type], size);
+			return ptr;
+		}
+	}
+
+	ptr = malloc(size);
+	if (!ptr)
+		do_error(_("couldn't allocate %zu bytes for %s\n"),
+			size, _(mem_type_names[type]));
+	__sync_fetch_and_add(&mem_resident, size);
+	return ptr;
+}
+
+void *
+incore_zalloc(
+	xfs_agnumber_t	agno,
+	int		type,
+	size_t		size)
+{
+	void		*ptr = incore_alloc(agno, type, size);
+
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+/*
+ * Free memory from incore_alloc().  @agno, @type and @size have to match
+ * the allocation.
+ */
+void
+incore_free(
+	xfs_agnumber_t	agno,
+	int		type,
+	void		*ptr,
+	size_t		size)
+{
+	if (!ptr)
+		return;
+
+	__sync_fetch_and_sub(&mem_used[type], size);
+	if (is_spilled(ptr)) {
+		__sync_fetch_and_sub(&mem_spilled[type], size);
+		spill_free(agno, ptr, size);
+		return;
+	}
+	__sync_fetch_and_sub(&mem_resident, size);
+	free(ptr);
+}
+
+/*
+ * Current usage in bytes: in memory and in the scratch file, in total or
+ * for one type (if @type is not XR_MEM_NTYPES).
+ */
+void
+incore_mem_usage(
+	int		type,
+	__uint64_t	*resident,
+	__uint64_t	*spilled)
+{
+	int		i;
+
+	*resident = *spilled = 0;
+	for (i = 0; i < XR_MEM_NTYPES; i++) {
+		if (type != XR_MEM_NTYPES && type != i)
+			continue;
+		*resident += mem_used[i] - mem_spilled[i];
+		*spilled += mem_spilled[i];
+	}
+}
+
+const char *
+incore_mem_type_name(
+	int		type)
+{
+	return _(mem_type_names[type]);
+}
+
+/*
+ * Set up the accounting.  @budget is the memory in KB the incore inode
+ * state may use before it's spilled, 0 for no limit.
+ */
+void
+incore_mem_init(
+	xfs_mount_t	*mp,
+	__uint64_t	budget)
+{
+	xfs_agnumber_t	agno;
+	__uint64_t	icount;
+
+	mem_budget = budget << 10;
+	spill_agcount = mp->m_sb.sb_agcount;
+	spill_ags = calloc(spill_agcount, sizeof(struct spill_ag));
+	if (!spill_ags)
+		do_error(_("couldn't malloc scratch file AG table\n"));
+	for (agno = 0; agno < spill_agcount; agno++)
+		pthread_mutex_init(&spill_ags[agno].lock, NULL);
+
+	/*
+	 * Reserve room for about 64 bytes per inode, which is more than the
+	 * state we can spill ever takes, plus a chunk per AG.  Don't trust a
+	 * corrupt inode count too far.
+	 */
+	icount = MIN(mp->m_sb.sb_icount, 1ULL << 34);
+	spill_reserved = roundup(icount * 64 +
+			(__uint64_t)spill_agcount * SPILL_CHUNK_SIZE,
+			SPILL_GROW_SIZE) + SPILL_GROW_SIZE;
+
+	if (verbose && mem_budget)
+		do_log(_("        - incore state memory budget %" PRIu64 " MB\n"),
+			mem_budget >> 20);
+}
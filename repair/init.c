@@ -22,7 +22,6 @@
 #include "protos.h"
 #include "err_protos.h"
 #include "pthread.h"
-#include "avl.h"
 #include "bmap.h"
 #include "incore.h"
 #include "prefetch.h"
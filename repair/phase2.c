@@ -17,7 +17,6 @@
  */
 
 #include <xfs/libxlog.h>
-#include "avl.h"
 #include "globals.h"
 #include "agheader.h"
 #include "protos.h"
@@ -25,8 +24,7 @@
 #include "incore.h"
 #include "progress.h"
 #include "scan.h"
-
-void	set_mp(xfs_mount_t *mpp);
+#include "versions.h"
 
 /* workaround craziness in the xlog routines */
 int xlog_recover_do_trans(struct xlog *log, xlog_recover_t *t, int p)
@@ -34,10 +32,64 @@ int xlog_recover_do_trans(struct xlog *log, xlog_recover_t *t, int p)
 	return 0;
 }
 
+/*
+ * Pick up what replaying the log changed in the primary superblock.  The
+ * log can't change the geometry repair has been set up for, but it does
+ * carry feature, quota and counter updates.
+ */
 static void
-zero_log(xfs_mount_t *mp)
+reread_sb(xfs_mount_t *mp)
+{
+	xfs_buf_t	*bp;
+	xfs_sb_t	sb;
+
+	bp = libxfs_readbuf(mp->m_dev, XFS_SB_DADDR, XFS_FSS_TO_BB(mp, 1), 0,
+			    &xfs_sb_buf_ops);
+	if (!bp || bp->b_error)
+		do_error(_("cannot read superblock after replaying the log\n"));
+	libxfs_sb_from_disk(&sb, XFS_BUF_TO_SBP(bp));
+	libxfs_putbuf(bp);
+
+	if (sb.sb_magicnum != XFS_SB_MAGIC ||
+	    sb.sb_blocksize != mp->m_sb.sb_blocksize ||
+	    sb.sb_inodesize != mp->m_sb.sb_inodesize ||
+	    sb.sb_agcount != mp->m_sb.sb_agcount ||
+	    sb.sb_agblocks != mp->m_sb.sb_agblocks ||
+	    sb.sb_dblocks != mp->m_sb.sb_dblocks ||
+	    sb.sb_rblocks != mp->m_sb.sb_rblocks ||
+	    sb.sb_logblocks != mp->m_sb.sb_logblocks)
+		do_error(_("filesystem geometry changed while replaying the log, "
+			   "please re-run xfs_repair\n"));
+
+	mp->m_sb.sb_versionnum = sb.sb_versionnum;
+	mp->m_sb.sb_features2 = sb.sb_features2;
+	mp->m_sb.sb_bad_features2 = sb.sb_bad_features2;
+	mp->m_sb.sb_features_compat = sb.sb_features_compat;
+	mp->m_sb.sb_features_ro_compat = sb.sb_features_ro_compat;
+	mp->m_sb.sb_features_incompat = sb.sb_features_incompat;
+	mp->m_sb.sb_features_log_incompat = sb.sb_features_log_incompat;
+	mp->m_sb.sb_qflags = sb.sb_qflags;
+	mp->m_sb.sb_uquotino = sb.sb_uquotino;
+	mp->m_sb.sb_gquotino = sb.sb_gquotino;
+	mp->m_sb.sb_pquotino = sb.sb_pquotino;
+	mp->m_sb.sb_icount = sb.sb_icount;
+	mp->m_sb.sb_ifree = sb.sb_ifree;
+	mp->m_sb.sb_fdblocks = sb.sb_fdblocks;
+	mp->m_sb.sb_frextents = sb.sb_frextents;
+
+	if (parse_sb_version(&mp->m_sb))
+		do_error(_("Found unsupported filesystem features after "
+			   "replaying the log.  Exiting now.\n"));
+}
+
+/*
+ * Returns 1 if the log had changes in it that were replayed.
+ */
+static int
+zero_log(xfs_mount_t *mp, int nthreads)
 {
 	int error;
+	int replayed = 0;
 	struct xlog	log;
 	xfs_daddr_t head_blk, tail_blk;
 
@@ -81,14 +133,24 @@ zero_log(xfs_mount_t *mp)
 "ALERT: The filesystem has valuable metadata changes in a log which is being\n"
 "destroyed because the -L option was used.\n"));
 			} else {
-				do_warn(_(
-"ERROR: The filesystem has valuable metadata changes in a log which needs to\n"
-"be replayed.  Mount the filesystem to replay the log, and unmount it before\n"
-"re-running xfs_repair.  If you are unable to mount the filesystem, then use\n"
-"the -L option to destroy the log and attempt a repair.\n"
+				do_log(_("        - replaying log...\n"));
+				error = xlog_recover_replay(&log, head_blk,
+							    tail_blk, nthreads);
+				if (error) {
+					do_warn(_(
+"ERROR: The filesystem has valuable metadata changes in a log which could\n"
+"not be replayed (error %d).  Mount the filesystem to replay the log, and\n"
+"unmount it before re-running xfs_repair.  If you are unable to mount the\n"
+"filesystem, then use the -L option to destroy the log and attempt a repair.\n"
 "Note that destroying the log may cause corruption -- please attempt a mount\n"
-"of the filesystem before doing this.\n"));
-				exit(2);
+"of the filesystem before doing this.\n"), error);
+					exit(2);
+				}
+
+				/* read everything back as the log left it */
+				libxfs_bcache_purge();
+				reread_sb(mp);
+				replayed = 1;
 			}
 		}
 	}
@@ -99,25 +161,20 @@ zero_log(xfs_mount_t *mp)
 		&mp->m_sb.sb_uuid,
 		xfs_sb_version_haslogv2(&mp->m_sb) ? 2 : 1,
 		mp->m_sb.sb_logsunit, XLOG_FMT);
+	return replayed;
 }
 
 /*
- * ok, at this point, the fs is mounted but the root inode may be
- * trashed and the ag headers haven't been checked.  So we have
- * a valid xfs_mount_t and superblock but that's about it.  That
- * means we can use macros that use mount/sb fields in calculations
- * but I/O or btree routines that depend on space maps or inode maps
- * being correct are verboten.
+ * Check for the log device and replay and clear the log.  This has to be
+ * done even when phases 2 to 4 are restored from a checkpoint, so it is
+ * kept apart from the scan.  Returns 1 if replaying the log changed the
+ * filesystem.
  */
-
-void
-phase2(
+int
+phase2_log(
 	struct xfs_mount	*mp,
-	int			scan_threads)
+	int			nthreads)
 {
-	int			j;
-	ino_tree_node_t		*ino_rec;
-
 	/* now we can start using the buffer cache routines */
 	set_mp(mp);
 
@@ -132,10 +189,28 @@ phase2(
 		do_log(_("Phase 2 - using internal log\n"));
 
 	/* Zero log if applicable */
-	if (!no_modify)  {
-		do_log(_("        - zero log...\n"));
-		zero_log(mp);
-	}
+	if (no_modify)
+		return 0;
+	do_log(_("        - zero log...\n"));
+	return zero_log(mp, nthreads);
+}
+
+/*
+ * ok, at this point, the fs is mounted but the root inode may be
+ * trashed and the ag headers haven't been checked.  So we have
+ * a valid xfs_mount_t and superblock but that's about it.  That
+ * means we can use macros that use mount/sb fields in calculations
+ * but I/O or btree routines that depend on space maps or inode maps
+ * being correct are verboten.
+ */
+
+void
+phase2(
+	struct xfs_mount	*mp,
+	int			scan_threads)
+{
+	int			j;
+	ino_tree_node_t		*ino_rec;
 
 	do_log(_("        - scan filesystem freespace and inode maps...\n"));
 
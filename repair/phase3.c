@@ -19,7 +19,6 @@
 #include <libxfs.h>
 #include "threads.h"
 #include "prefetch.h"
-#include "avl.h"
 #include "globals.h"
 #include "agheader.h"
 #include "incore.h"
@@ -27,8 +26,81 @@
 #include "err_protos.h"
 #include "dinode.h"
 #include "progress.h"
+#include "stats.h"
 
-static void
+/*
+ * Once the log has been replayed, the inodes on an unlinked list that have
+ * no links left are the ones a mount would free next: files removed while
+ * they were still open, or whose removal hadn't finished.  Free them here
+ * rather than have phase 6 find them disconnected and move them to
+ * lost+found.  Inodes that still have links are left alone, as log
+ * recovery leaves them.  Returns the number of inodes freed.
+ */
+static int
+free_unlinked_bucket(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno,
+	xfs_agino_t		agino)
+{
+	struct xfs_buf		*bp;
+	struct xfs_dinode	*dip;
+	ino_tree_node_t		*irec;
+	xfs_agino_t		next;
+	__uint64_t		left;
+	__uint32_t		nlink;
+	int			offset;
+	int			error;
+	int			freed = 0;
+
+	/* a list that loops through linked inodes stops here */
+	left = (__uint64_t)mp->m_sb.sb_agblocks << mp->m_sb.sb_inopblog;
+	for (; agino != NULLAGINO && left > 0; agino = next, left--) {
+		if (verify_aginum(mp, agno, agino))
+			break;
+		irec = find_inode_rec(mp, agno, agino);
+		if (!irec)
+			break;
+		offset = agino - irec->ino_startnum;
+		if (is_inode_free(irec, offset))
+			break;
+		bp = get_agino_buf(mp, agno, agino, &dip);
+		if (!bp)
+			break;
+		if (bp->b_error ||
+		    be16_to_cpu(dip->di_magic) != XFS_DINODE_MAGIC) {
+			libxfs_putbuf(bp);
+			break;
+		}
+
+		next = be32_to_cpu(dip->di_next_unlinked);
+		nlink = dip->di_version > 1 ? be32_to_cpu(dip->di_nlink) :
+					      be16_to_cpu(dip->di_onlink);
+		if (nlink || !dip->di_mode) {
+			libxfs_putbuf(bp);
+			continue;
+		}
+
+		/*
+		 * the chunk buffer overlaps the cluster buffers phase 3
+		 * reads the inode through, so it goes straight to disk.
+		 */
+		clear_dinode(mp, dip, XFS_AGINO_TO_INO(mp, agno, agino));
+		libxfs_dinode_calc_crc(mp, dip);
+		error = libxfs_writebufr(bp);
+		libxfs_putbuf(bp);
+		if (error) {
+			do_warn(
+	_("couldn't free unlinked inode %" PRIu64 ", error %d\n"),
+				XFS_AGINO_TO_INO(mp, agno, agino), error);
+			break;
+		}
+		set_inode_free(irec, offset);
+		freed++;
+	}
+	return freed;
+}
+
+static int
 process_agi_unlinked(
 	struct xfs_mount	*mp,
 	xfs_agnumber_t		agno)
@@ -37,6 +109,7 @@ process_agi_unlinked(
 	struct xfs_agi		*agip;
 	xfs_agnumber_t		i;
 	int			agi_dirty = 0;
+	int			freed = 0;
 
 	bp = libxfs_readbuf(mp->m_dev,
 			XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
@@ -51,6 +124,9 @@ process_agi_unlinked(
 
 	for (i = 0; i < XFS_AGI_UNLINKED_BUCKETS; i++)  {
 		if (agip->agi_unlinked[i] != cpu_to_be32(NULLAGINO)) {
+			if (log_replayed)
+				freed += free_unlinked_bucket(mp, agno,
+					be32_to_cpu(agip->agi_unlinked[i]));
 			agip->agi_unlinked[i] = cpu_to_be32(NULLAGINO);
 			agi_dirty = 1;
 		}
@@ -60,6 +136,7 @@ process_agi_unlinked(
 		libxfs_writebuf(bp, 0);
 	else
 		libxfs_putbuf(bp);
+	return freed;
 }
 
 static void
@@ -68,13 +145,17 @@ process_ag_func(
 	xfs_agnumber_t 		agno,
 	void			*arg)
 {
+	struct stats_ag_timer	timer;
+
 	/*
 	 * turn on directory processing (inode discovery) and
 	 * attribute processing (extra_attr_check)
 	 */
 	wait_for_inode_prefetch(arg);
 	do_log(_("        - agno = %d\n"), agno);
+	stats_ag_start(&timer);
 	process_aginodes(wq->mp, arg, agno, 1, 0, 1);
+	stats_ag_end(&timer, agno);
 	cleanup_inode_prefetch(arg);
 }
 
@@ -82,13 +163,14 @@ static void
 process_ags(
 	xfs_mount_t		*mp)
 {
-	do_inode_prefetch(mp, ag_stride, process_ag_func, false, false);
+	do_inode_prefetch(mp, ag_stride, process_ag_func, false);
 }
 
 void
 phase3(xfs_mount_t *mp)
 {
 	int 			i, j;
+	int			freed = 0;
 
 	do_log(_("Phase 3 - for each AG...\n"));
 	if (!no_modify)
@@ -101,7 +183,9 @@ phase3(xfs_mount_t *mp)
 	/* first clear the agi unlinked AGI list */
 	if (!no_modify) {
 		for (i = 0; i < mp->m_sb.sb_agcount; i++)
-			process_agi_unlinked(mp, i);
+			freed += process_agi_unlinked(mp, i);
+		if (freed)
+			do_log(_("        - freed %d unlinked inodes\n"), freed);
 	}
 
 	/* now look at possibly bogus inodes */
@@ -19,7 +19,6 @@
 #include <libxfs.h>
 #include "threads.h"
 #include "prefetch.h"
-#include "avl.h"
 #include "globals.h"
 #include "agheader.h"
 #include "incore.h"
@@ -30,6 +29,7 @@
 #include "versions.h"
 #include "dir2.h"
 #include "progress.h"
+#include "stats.h"
 
 
 /*
@@ -135,9 +135,13 @@ process_ag_func(
 	xfs_agnumber_t 		agno,
 	void			*arg)
 {
+	struct stats_ag_timer	timer;
+
 	wait_for_inode_prefetch(arg);
 	do_log(_("        - agno = %d\n"), agno);
+	stats_ag_start(&timer);
 	process_aginodes(wq->mp, arg, agno, 0, 1, 0);
+	stats_ag_end(&timer, agno);
 	cleanup_inode_prefetch(arg);
 
 	/*
@@ -146,11 +150,113 @@ process_ag_func(
 	release_dup_extent_tree(agno);
 }
 
+/*
+ * When nothing has been pushed out of the buffer cache there is nothing to
+ * prefetch, so each AG hands its inodes out in batches of inode records
+ * and idle threads pick them up.  That keeps all threads busy even when a
+ * few AGs hold most of the inodes.  The last batch of an AG to finish
+ * recycles the AG's duplicate extent records.
+ */
+#define INO_BATCH_RECS		64
+
+struct ino_batch {
+	ino_tree_node_t		*first;		/* first record in batch */
+	ino_tree_node_t		*end;		/* first record after it */
+	int			*pending;	/* batches of the AG not done */
+};
+
+static void
+ino_batch_done(
+	xfs_agnumber_t		agno,
+	int			*pending)
+{
+	if (__sync_sub_and_fetch(pending, 1))
+		return;
+	release_dup_extent_tree(agno);
+	free(pending);
+}
+
+static void
+process_ino_batch(
+	work_queue_t		*wq,
+	xfs_agnumber_t		agno,
+	void			*arg)
+{
+	struct ino_batch	*batch = arg;
+	struct stats_ag_timer	timer;
+
+	stats_ag_start(&timer);
+	process_aginode_range(wq->mp, NULL, agno, batch->first, batch->end,
+			0, 1, 0);
+	stats_ag_end(&timer, agno);
+	ino_batch_done(agno, batch->pending);
+	free(batch);
+}
+
+static void
+process_ag_batches(
+	work_queue_t		*wq,
+	xfs_agnumber_t		agno,
+	void			*arg)
+{
+	xfs_mount_t		*mp = wq->mp;
+	ino_tree_node_t		*irec;
+	struct ino_batch	*batch;
+	int			*pending;
+	int			n;
+
+	do_log(_("        - agno = %d\n"), agno);
+
+	/* hold a count ourselves so the AG isn't finished while queueing */
+	pending = malloc(sizeof(int));
+	if (!pending)
+		do_error(_("couldn't malloc inode batch count\n"));
+	*pending = 1;
+
+	irec = findfirst_inode_rec(agno);
+	while (irec) {
+		batch = malloc(sizeof(struct ino_batch));
+		if (!batch)
+			do_error(_("couldn't malloc inode batch\n"));
+		batch->first = irec;
+		batch->pending = pending;
+
+		/* batches have to end on an inode allocation boundary */
+		n = 0;
+		do {
+			irec = next_ino_rec(irec);
+			n++;
+		} while (irec && (n < INO_BATCH_RECS ||
+			 XFS_AGINO_TO_OFFSET(mp, irec->ino_startnum) != 0));
+		batch->end = irec;
+
+		__sync_fetch_and_add(pending, 1);
+		queue_work(wq, process_ino_batch, agno, batch);
+	}
+	ino_batch_done(agno, pending);
+}
+
 static void
 process_ags(
 	xfs_mount_t		*mp)
 {
-	do_inode_prefetch(mp, ag_stride, process_ag_func, true, false);
+	struct work_queue	queue;
+	xfs_agnumber_t		agno;
+
+	/*
+	 * If the previous phases of repair have not overflowed the buffer
+	 * cache, then we don't need to re-read any of the metadata in the
+	 * filesystem - it's all in the cache.
+	 */
+	if (!libxfs_bcache_overflowed()) {
+		create_work_queue(&queue, mp, libxfs_nproc());
+		for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)
+			queue_work(&queue, process_ag_batches, agno, NULL);
+		destroy_work_queue(&queue);
+		return;
+	}
+
+	do_inode_prefetch(mp, ag_stride, process_ag_func, false);
 }
 
 
@@ -17,7 +17,6 @@
  */
 
 #include <libxfs.h>
-#include "avl.h"
 #include "globals.h"
 #include "agheader.h"
 #include "incore.h"
@@ -28,6 +27,7 @@
 #include "versions.h"
 #include "threads.h"
 #include "progress.h"
+#include "stats.h"
 
 /*
  * we maintain the current slice (path from root to leaf)
@@ -146,7 +146,7 @@ mk_incore_fstree(xfs_mount_t *mp, xfs_agnumber_t agno)
 			if (in_extent)  {
 				/*
 				 * free extent ends here, add extent to the
-				 * 2 incore extent (avl-to-be-B+) trees
+				 * 2 incore extent B+trees
 				 */
 				in_extent = 0;
 #if defined(XR_BLD_FREE_TRACE) && defined(XR_BLD_ADD_EXTENT)
@@ -838,7 +838,7 @@ build_freespace_tree(xfs_mount_t *mp, xfs_agnumber_t agno,
 							ext_ptr->ex_blockcount);
 			freeblks += ext_ptr->ex_blockcount;
 			if (magic == XFS_ABTB_MAGIC)
-				ext_ptr = findnext_bno_extent(ext_ptr);
+				ext_ptr = findnext_bno_extent(agno, ext_ptr);
 			else
 				ext_ptr = findnext_bcnt_extent(agno, ext_ptr);
 #if 0
@@ -1543,9 +1543,11 @@ phase5_func(
 	xfs_agblock_t	num_extents;
 	__uint32_t	magic;
 	struct agi_stat	agi_stat = {0,};
+	struct stats_ag_timer	timer;
 
 	if (verbose)
 		do_log(_("        - agno = %d\n"), agno);
+	stats_ag_start(&timer);
 
 	{
 		/*
@@ -1717,12 +1719,28 @@ phase5_func(
 		release_agbcnt_extent_tree(agno);
 	}
 	PROG_RPT_INC(prog_rpt_done[agno], 1);
+	stats_ag_end(&timer, agno);
+}
+
+/*
+ * Each AG is rebuilt from its own incore extent and inode trees and
+ * only writes its own headers and per-AG counters, so AGs can be
+ * rebuilt in parallel.
+ */
+static void
+phase5_worker(
+	struct work_queue	*wq,
+	xfs_agnumber_t		agno,
+	void			*arg)
+{
+	phase5_func(wq->mp, agno);
 }
 
 void
 phase5(xfs_mount_t *mp)
 {
 	xfs_agnumber_t		agno;
+	work_queue_t		wq;
 
 	do_log(_("Phase 5 - rebuild AG headers and trees...\n"));
 	set_progress_msg(PROG_FMT_REBUILD_AG, (__uint64_t )glob_agcount);
@@ -1763,8 +1781,19 @@ phase5(xfs_mount_t *mp)
 	if (sb_fdblocks_ag == NULL)
 		do_error(_("cannot alloc sb_fdblocks_ag buffers\n"));
 
-	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)
-		phase5_func(mp, agno);
+	/*
+	 * use as many threads as the earlier phases, but queue each AG
+	 * separately so a few large AGs don't hold up the rest.
+	 */
+	if (ag_stride) {
+		create_work_queue(&wq, mp, thread_count);
+		for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)
+			queue_work(&wq, phase5_worker, agno, NULL);
+		destroy_work_queue(&wq);
+	} else {
+		for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)
+			phase5_func(mp, agno);
+	}
 
 	print_final_rpt();
 
@@ -19,16 +19,17 @@
 #include <libxfs.h>
 #include "threads.h"
 #include "prefetch.h"
-#include "avl.h"
 #include "globals.h"
 #include "agheader.h"
 #include "incore.h"
 #include "dir2.h"
+#include "dir_hash.h"
 #include "protos.h"
 #include "err_protos.h"
 #include "dinode.h"
 #include "progress.h"
 #include "versions.h"
+#include "stats.h"
 
 static struct cred		zerocr;
 static struct fsxattr 		zerofsx;
@@ -50,8 +51,34 @@ typedef struct dotdot_update {
 } dotdot_update_t;
 
 static LIST_HEAD(dotdot_update_list);
+static pthread_mutex_t		dotdot_lock = PTHREAD_MUTEX_INITIALIZER;
 static int			dotdot_update;
 
+/*
+ * Directories are checked by several threads at once, but libxfs doesn't
+ * honour trylocks and a transaction keeps its buffers locked until it
+ * commits, so two transactions fixing directories could each wait on a
+ * buffer the other holds.  Only one thread at a time runs the
+ * transactions that fix a directory; reading and checking the blocks
+ * around them still goes on in parallel.  Nothing is changed in no modify
+ * mode, so there is nothing to serialise.
+ */
+static pthread_mutex_t		dir_fix_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+dir_fix_lock(void)
+{
+	if (!no_modify)
+		pthread_mutex_lock(&dir_fix_mutex);
+}
+
+static void
+dir_fix_unlock(void)
+{
+	if (!no_modify)
+		pthread_mutex_unlock(&dir_fix_mutex);
+}
+
 static void
 add_dotdot_update(
 	xfs_agnumber_t		agno,
@@ -69,39 +96,11 @@ add_dotdot_update(
 	dir->agno = agno;
 	dir->ino_offset = ino_offset;
 
+	pthread_mutex_lock(&dotdot_lock);
 	list_add(&dir->list, &dotdot_update_list);
+	pthread_mutex_unlock(&dotdot_lock);
 }
 
-/*
- * Data structures and routines to keep track of directory entries
- * and whether their leaf entry has been seen. Also used for name
- * duplicate checking and rebuilding step if required.
- */
-typedef struct dir_hash_ent {
-	struct dir_hash_ent	*nextbyaddr;	/* next in addr bucket */
-	struct dir_hash_ent	*nextbyhash;	/* next in name bucket */
-	struct dir_hash_ent	*nextbyorder;	/* next in order added */
-	xfs_dahash_t		hashval;	/* hash value of name */
-	__uint32_t		address;	/* offset of data entry */
-	xfs_ino_t 		inum;		/* inode num of entry */
-	short			junkit;		/* name starts with / */
-	short			seen;		/* have seen leaf entry */
-	struct xfs_name		name;
-} dir_hash_ent_t;
-
-typedef struct dir_hash_tab {
-	int			size;		/* size of hash tables */
-	int			names_duped;	/* 1 = ent names malloced */
-	dir_hash_ent_t		*first;		/* ptr to first added entry */
-	dir_hash_ent_t		*last;		/* ptr to last added entry */
-	dir_hash_ent_t		**byhash;	/* ptr to name hash buckets */
-	dir_hash_ent_t		**byaddr;	/* ptr to addr hash buckets */
-} dir_hash_tab_t;
-
-#define	DIR_HASH_TAB_SIZE(n)	\
-	(sizeof(dir_hash_tab_t) + (sizeof(dir_hash_ent_t *) * (n) * 2))
-#define	DIR_HASH_FUNC(t,a)	((a) % (t)->size)
-
 /*
  * Track the contents of the freespace table in a directory.
  */
@@ -116,14 +115,6 @@ typedef struct freetab {
 #define	FREETAB_SIZE(n)	\
 	(offsetof(freetab_t, ents) + (sizeof(struct freetab_ent) * (n)))
 
-#define	DIR_HASH_CK_OK		0
-#define	DIR_HASH_CK_DUPLEAF	1
-#define	DIR_HASH_CK_BADHASH	2
-#define	DIR_HASH_CK_NODATA	3
-#define	DIR_HASH_CK_NOLEAF	4
-#define	DIR_HASH_CK_BADSTALE	5
-#define	DIR_HASH_CK_TOTAL	6
-
 /*
  * Need to handle CRC and validation errors specially here. If there is a
  * validator error, re-read without the verifier so that we get a buffer we can
@@ -163,100 +154,6 @@ dir_read_buf(
 	return 0;
 }
 
-/*
- * Returns 0 if the name already exists (ie. a duplicate)
- */
-static int
-dir_hash_add(
-	xfs_mount_t		*mp,
-	dir_hash_tab_t		*hashtab,
-	__uint32_t		addr,
-	xfs_ino_t		inum,
-	int			namelen,
-	unsigned char		*name,
-	__uint8_t		ftype)
-{
-	xfs_dahash_t		hash = 0;
-	int			byaddr;
-	int			byhash = 0;
-	dir_hash_ent_t		*p;
-	int			dup;
-	short			junk;
-	struct xfs_name		xname;
-
-	ASSERT(!hashtab->names_duped);
-
-	xname.name = name;
-	xname.len = namelen;
-	xname.type = ftype;
-
-	junk = name[0] == '/';
-	byaddr = DIR_HASH_FUNC(hashtab, addr);
-	dup = 0;
-
-	if (!junk) {
-		hash = mp->m_dirnameops->hashname(&xname);
-		byhash = DIR_HASH_FUNC(hashtab, hash);
-
-		/*
-		 * search hash bucket for existing name.
-		 */
-		for (p = hashtab->byhash[byhash]; p; p = p->nextbyhash) {
-			if (p->hashval == hash && p->name.len == namelen) {
-				if (memcmp(p->name.name, name, namelen) == 0) {
-					dup = 1;
-					junk = 1;
-					break;
-				}
-			}
-		}
-	}
-
-	if ((p = malloc(sizeof(*p))) == NULL)
-		do_error(_("malloc failed in dir_hash_add (%zu bytes)\n"),
-			sizeof(*p));
-
-	p->nextbyaddr = hashtab->byaddr[byaddr];
-	hashtab->byaddr[byaddr] = p;
-	if (hashtab->last)
-		hashtab->last->nextbyorder = p;
-	else
-		hashtab->first = p;
-	p->nextbyorder = NULL;
-	hashtab->last = p;
-
-	if (!(p->junkit = junk)) {
-		p->hashval = hash;
-		p->nextbyhash = hashtab->byhash[byhash];
-		hashtab->byhash[byhash] = p;
-	}
-	p->address = addr;
-	p->inum = inum;
-	p->seen = 0;
-	p->name = xname;
-
-	return !dup;
-}
-
-/*
- * checks to see if any data entries are not in the leaf blocks
- */
-static int
-dir_hash_unseen(
-	dir_hash_tab_t	*hashtab)
-{
-	int		i;
-	dir_hash_ent_t	*p;
-
-	for (i = 0; i < hashtab->size; i++) {
-		for (p = hashtab->byaddr[i]; p; p = p->nextbyaddr) {
-			if (p->seen == 0)
-				return 1;
-		}
-	}
-	return 0;
-}
-
 static int
 dir_hash_check(
 	dir_hash_tab_t	*hashtab,
@@ -289,136 +186,6 @@ dir_hash_check(
 	return 1;
 }
 
-static void
-dir_hash_done(
-	dir_hash_tab_t	*hashtab)
-{
-	int		i;
-	dir_hash_ent_t	*n;
-	dir_hash_ent_t	*p;
-
-	for (i = 0; i < hashtab->size; i++) {
-		for (p = hashtab->byaddr[i]; p; p = n) {
-			n = p->nextbyaddr;
-			if (hashtab->names_duped)
-				free((void *)p->name.name);
-			free(p);
-		}
-	}
-	free(hashtab);
-}
-
-static dir_hash_tab_t *
-dir_hash_init(
-	xfs_fsize_t	size)
-{
-	dir_hash_tab_t	*hashtab;
-	int		hsize;
-
-	hsize = size / (16 * 4);
-	if (hsize > 65536)
-		hsize = 63336;
-	else if (hsize < 16)
-		hsize = 16;
-	if ((hashtab = calloc(DIR_HASH_TAB_SIZE(hsize), 1)) == NULL)
-		do_error(_("calloc failed in dir_hash_init\n"));
-	hashtab->size = hsize;
-	hashtab->byhash = (dir_hash_ent_t**)((char *)hashtab +
-		sizeof(dir_hash_tab_t));
-	hashtab->byaddr = (dir_hash_ent_t**)((char *)hashtab +
-		sizeof(dir_hash_tab_t) + sizeof(dir_hash_ent_t*) * hsize);
-	return hashtab;
-}
-
-static int
-dir_hash_see(
-	dir_hash_tab_t		*hashtab,
-	xfs_dahash_t		hash,
-	xfs_dir2_dataptr_t	addr)
-{
-	int			i;
-	dir_hash_ent_t		*p;
-
-	i = DIR_HASH_FUNC(hashtab, addr);
-	for (p = hashtab->byaddr[i]; p; p = p->nextbyaddr) {
-		if (p->address != addr)
-			continue;
-		if (p->seen)
-			return DIR_HASH_CK_DUPLEAF;
-		if (p->junkit == 0 && p->hashval != hash)
-			return DIR_HASH_CK_BADHASH;
-		p->seen = 1;
-		return DIR_HASH_CK_OK;
-	}
-	return DIR_HASH_CK_NODATA;
-}
-
-static void
-dir_hash_update_ftype(
-	dir_hash_tab_t		*hashtab,
-	xfs_dir2_dataptr_t	addr,
-	__uint8_t		ftype)
-{
-	int			i;
-	dir_hash_ent_t		*p;
-
-	i = DIR_HASH_FUNC(hashtab, addr);
-	for (p = hashtab->byaddr[i]; p; p = p->nextbyaddr) {
-		if (p->address != addr)
-			continue;
-		p->name.type = ftype;
-	}
-}
-
-/*
- * checks to make sure leafs match a data entry, and that the stale
- * count is valid.
- */
-static int
-dir_hash_see_all(
-	dir_hash_tab_t		*hashtab,
-	xfs_dir2_leaf_entry_t	*ents,
-	int			count,
-	int			stale)
-{
-	int			i;
-	int			j;
-	int			rval;
-
-	for (i = j = 0; i < count; i++) {
-		if (be32_to_cpu(ents[i].address) == XFS_DIR2_NULL_DATAPTR) {
-			j++;
-			continue;
-		}
-		rval = dir_hash_see(hashtab, be32_to_cpu(ents[i].hashval),
-					be32_to_cpu(ents[i].address));
-		if (rval != DIR_HASH_CK_OK)
-			return rval;
-	}
-	return j == stale ? DIR_HASH_CK_OK : DIR_HASH_CK_BADSTALE;
-}
-
-/*
- * Convert name pointers into locally allocated memory.
- * This must only be done after all the entries have been added.
- */
-static void
-dir_hash_dup_names(dir_hash_tab_t *hashtab)
-{
-	unsigned char		*name;
-	dir_hash_ent_t		*p;
-
-	if (hashtab->names_duped)
-		return;
-
-	for (p = hashtab->first; p; p = p->nextbyorder) {
-		name = malloc(p->name.len);
-		memcpy(name, p->name.name, p->name.len);
-		p->name.name = name;
-	}
-	hashtab->names_duped = 1;
-}
-
 /*
  * Given a block number in a fork, return the next valid block number
  * (not a hole).
@@ -1003,7 +770,7 @@ mk_orphanage(xfs_mount_t *mp)
 		 * This inode is allocated from a newly created inode
 		 * chunk and therefore did not exist when inode chunks
 		 * were processed in phase3. Add this group of inodes to
-		 * the entry avl tree as if they were discovered in phase3.
+		 * the inode tree as if they were discovered in phase3.
 		 */
 		irec = set_inode_free_alloc(mp, XFS_INO_TO_AGNO(mp, ino),
 					    XFS_INO_TO_AGINO(mp, ino));
@@ -1304,6 +1071,7 @@ longform_dir2_rebuild(
 	xfs_bmap_free_t		flist;
 	xfs_inode_t		pip;
 	dir_hash_ent_t		*p;
+	__uint32_t		i;
 	int			committed;
 	int			done;
 
@@ -1327,6 +1095,7 @@ longform_dir2_rebuild(
 
 	xfs_bmap_init(&flist, &firstblock);
 
+	dir_fix_lock();
 	tp = libxfs_trans_alloc(mp, 0);
 	nres = XFS_REMOVE_SPACE_RES(mp);
 	error = libxfs_trans_reserve(tp, &M_RES(mp)->tr_remove, nres, 0);
@@ -1364,7 +1133,8 @@ longform_dir2_rebuild(
 
 	/* go through the hash list and re-add the inodes */
 
-	for (p = hashtab->first; p; p = p->nextbyorder) {
+	for (i = 0; i < hashtab->nents; i++) {
+		p = &hashtab->ents[i];
 
 		if (p->name.name[0] == '/' || (p->name.name[0] == '.' &&
 				(p->name.len == 1 || (p->name.len == 2 &&
@@ -1402,11 +1172,13 @@ _("name create failed in ino %" PRIu64 " (%d), filesystem may be out of space\n"
 				XFS_TRANS_RELEASE_LOG_RES|XFS_TRANS_SYNC);
 	}
 
+	dir_fix_unlock();
 	return;
 
 out_bmap_cancel:
 	libxfs_bmap_cancel(&flist);
 	libxfs_trans_cancel(tp, XFS_TRANS_RELEASE_LOG_RES | XFS_TRANS_ABORT);
+	dir_fix_unlock();
 	return;
 }
 
@@ -1430,6 +1202,7 @@ dir2_kill_block(
 	int		nres;
 	xfs_trans_t	*tp;
 
+	dir_fix_lock();
 	tp = libxfs_trans_alloc(mp, 0);
 	nres = XFS_REMOVE_SPACE_RES(mp);
 	error = libxfs_trans_reserve(tp, &M_RES(mp)->tr_remove, nres, 0);
@@ -1454,6 +1227,7 @@ dir2_kill_block(
 			ip->i_ino, da_bno);
 	libxfs_bmap_finish(&tp, &flist, &committed);
 	libxfs_trans_commit(tp, 0);
+	dir_fix_unlock();
 }
 
 /*
@@ -1617,6 +1391,7 @@ longform_dir2_entry_check_data(
 	if (freetab->nents < db + 1)
 		freetab->nents = db + 1;
 
+	dir_fix_lock();
 	tp = libxfs_trans_alloc(mp, 0);
 	error = libxfs_trans_reserve(tp, &M_RES(mp)->tr_remove, 0, 0);
 	if (error)
@@ -1864,8 +1639,6 @@ longform_dir2_entry_check_data(
 			add_inode_reached(irec, ino_offset);
 			continue;
 		}
-		parent = get_inode_parent(irec, ino_offset);
-		ASSERT(parent != 0);
 		junkit = 0;
 		/*
 		 * bump up the link counts in parent and child
@@ -1874,13 +1647,12 @@ longform_dir2_entry_check_data(
 		 * if the directory has already been reached,
 		 * blow away the entry also.
 		 */
-		if (is_inode_reached(irec, ino_offset))  {
+		if (reach_dir_inode(irec, ino_offset, ip->i_ino, &parent))  {
 			junkit = 1;
 			do_warn(
 _("entry \"%s\" in dir %" PRIu64" points to an already connected directory inode %" PRIu64 "\n"),
 				fname, ip->i_ino, inum);
 		} else if (parent == ip->i_ino)  {
-			add_inode_reached(irec, ino_offset);
 			add_inode_ref(current_irec, current_ino_offset);
 		} else if (parent == NULLFSINO) {
 			/* ".." was missing, but this entry refers to it,
@@ -1888,8 +1660,6 @@ _("entry \"%s\" in dir %" PRIu64" points to an already connected directory inode
 			do_warn(
 	_("entry \"%s\" in dir ino %" PRIu64 " doesn't have a .. entry, will set it in ino %" PRIu64 ".\n"),
 				fname, ip->i_ino, inum);
-			set_inode_parent(irec, ino_offset, ip->i_ino);
-			add_inode_reached(irec, ino_offset);
 			add_inode_ref(current_irec, current_ino_offset);
 			add_dotdot_update(XFS_INO_TO_AGNO(mp, inum), irec,
 								ino_offset);
@@ -1923,6 +1693,7 @@ _("entry \"%s\" in dir inode %" PRIu64 " inconsistent with .. value (%" PRIu64 "
 		libxfs_dir2_data_log_header(tp, bp);
 	libxfs_bmap_finish(&tp, &flist, &committed);
 	libxfs_trans_commit(tp, 0);
+	dir_fix_unlock();
 
 	/* record the largest free space in the freetab for later checking */
 	bf = xfs_dir3_data_bestfree_p(d);
@@ -2694,14 +2465,12 @@ _("entry \"%s\" (ino %" PRIu64 ") in dir %" PRIu64 " is a duplicate name"),
 			 */
 			add_inode_reached(irec, ino_offset);
 		} else  {
-			parent = get_inode_parent(irec, ino_offset);
-
 			/*
 			 * bump up the link counts in parent and child.
 			 * directory but if the link doesn't agree with
 			 * the .. in the child, blow out the entry
 			 */
-			if (is_inode_reached(irec, ino_offset))  {
+			if (reach_dir_inode(irec, ino_offset, ino, &parent))  {
 				do_warn(
 	_("entry \"%s\" in directory inode %" PRIu64
 	  " references already connected inode %" PRIu64 ".\n"),
@@ -2711,7 +2480,6 @@ _("entry \"%s\" (ino %" PRIu64 ") in dir %" PRIu64 " is a duplicate name"),
 						&bytes_deleted, ino_dirty);
 				continue;
 			} else if (parent == ino)  {
-				add_inode_reached(irec, ino_offset);
 				add_inode_ref(current_irec, current_ino_offset);
 			} else if (parent == NULLFSINO) {
 				/* ".." was missing, but this entry refers to it,
@@ -2719,8 +2487,6 @@ _("entry \"%s\" (ino %" PRIu64 ") in dir %" PRIu64 " is a duplicate name"),
 				do_warn(
 	_("entry \"%s\" in dir ino %" PRIu64 " doesn't have a .. entry, will set it in ino %" PRIu64 ".\n"),
 					fname, ino, lino);
-				set_inode_parent(irec, ino_offset, ino);
-				add_inode_reached(irec, ino_offset);
 				add_inode_ref(current_irec, current_ino_offset);
 				add_dotdot_update(XFS_INO_TO_AGNO(mp, lino),
 							irec, ino_offset);
@@ -2916,6 +2682,7 @@ process_dir_inode(
 			break;
 
 		case XFS_DINODE_FMT_LOCAL:
+			dir_fix_lock();
 			tp = libxfs_trans_alloc(mp, 0);
 			/*
 			 * using the remove reservation is overkill
@@ -2946,6 +2713,7 @@ process_dir_inode(
 				libxfs_trans_cancel(tp,
 					XFS_TRANS_RELEASE_LOG_RES);
 			}
+			dir_fix_unlock();
 			break;
 
 		default:
@@ -2968,6 +2736,7 @@ process_dir_inode(
 
 		do_warn(_("recreating root directory .. entry\n"));
 
+		dir_fix_lock();
 		tp = libxfs_trans_alloc(mp, 0);
 		ASSERT(tp != NULL);
 
@@ -2992,6 +2761,7 @@ process_dir_inode(
 		ASSERT(error == 0);
 		libxfs_trans_commit(tp, XFS_TRANS_RELEASE_LOG_RES |
 							XFS_TRANS_SYNC);
+		dir_fix_unlock();
 
 		need_root_dotdot = 0;
 	} else if (need_root_dotdot && ino == mp->m_sb.sb_rootino)  {
@@ -3028,6 +2798,7 @@ process_dir_inode(
 			do_warn(
 	_("creating missing \".\" entry in dir ino %" PRIu64 "\n"), ino);
 
+			dir_fix_lock();
 			tp = libxfs_trans_alloc(mp, 0);
 			ASSERT(tp != NULL);
 
@@ -3054,6 +2825,7 @@ process_dir_inode(
 			ASSERT(error == 0);
 			libxfs_trans_commit(tp, XFS_TRANS_RELEASE_LOG_RES
 					|XFS_TRANS_SYNC);
+			dir_fix_unlock();
 		}
 	}
 	IRELE(ip);
@@ -3162,6 +2934,28 @@ check_for_orphaned_inodes(
 	}
 }
 
+/*
+ * Check the directories in an inode record.  The root directory has
+ * already been done by the time we get here.
+ */
+static void
+traverse_inode_rec(
+	xfs_mount_t		*mp,
+	xfs_agnumber_t		agno,
+	ino_tree_node_t		*irec)
+{
+	int			i;
+
+	for (i = 0; i < XFS_INODES_PER_CHUNK; i++)  {
+		if (!inode_isadir(irec, i))
+			continue;
+		if (XFS_AGINO_TO_INO(mp, agno, irec->ino_startnum + i) ==
+		    mp->m_sb.sb_rootino)
+			continue;
+		process_dir_inode(mp, agno, irec, i);
+	}
+}
+
 static void
 traverse_function(
 	work_queue_t		*wq,
@@ -3169,13 +2963,17 @@ traverse_function(
 	void			*arg)
 {
 	ino_tree_node_t 	*irec;
+#ifdef XR_PF_TRACE
 	int			i;
+#endif
 	prefetch_args_t		*pf_args = arg;
+	struct stats_ag_timer	timer;
 
 	wait_for_inode_prefetch(pf_args);
 
 	if (verbose)
 		do_log(_("        - agno = %d\n"), agno);
+	stats_ag_start(&timer);
 
 	for (irec = findfirst_inode_rec(agno); irec; irec = next_ino_rec(irec)) {
 		if (irec->ino_isa_dir == 0)
@@ -3191,14 +2989,81 @@ traverse_function(
 #endif
 		}
 
-		for (i = 0; i < XFS_INODES_PER_CHUNK; i++)  {
-			if (inode_isadir(irec, i))
-				process_dir_inode(wq->mp, agno, irec, i);
-		}
+		traverse_inode_rec(wq->mp, agno, irec);
 	}
+	stats_ag_end(&timer, agno);
 	cleanup_inode_prefetch(pf_args);
 }
 
+/*
+ * When the directories are all in the buffer cache there's no prefetching
+ * to keep in order, so each AG hands its directories out in batches of
+ * inode records and idle threads pick them up.  That keeps all threads
+ * busy even when a few AGs hold most of the directories.
+ */
+#define DIR_BATCH_RECS		32
+
+struct dir_batch {
+	ino_tree_node_t		*first;		/* first record with dirs */
+	int			nrecs;		/* records with dirs in batch */
+};
+
+static void
+traverse_dir_batch(
+	work_queue_t		*wq,
+	xfs_agnumber_t		agno,
+	void			*arg)
+{
+	struct dir_batch	*batch = arg;
+	ino_tree_node_t		*irec;
+	struct stats_ag_timer	timer;
+	int			n = 0;
+
+	stats_ag_start(&timer);
+	for (irec = batch->first; irec && n < batch->nrecs;
+	     irec = next_ino_rec(irec)) {
+		if (irec->ino_isa_dir == 0)
+			continue;
+		traverse_inode_rec(wq->mp, agno, irec);
+		n++;
+	}
+	stats_ag_end(&timer, agno);
+	free(batch);
+}
+
+static void
+traverse_ag_batches(
+	work_queue_t		*wq,
+	xfs_agnumber_t		agno,
+	void			*arg)
+{
+	ino_tree_node_t		*irec;
+	struct dir_batch	*batch = NULL;
+
+	if (verbose)
+		do_log(_("        - agno = %d\n"), agno);
+
+	for (irec = findfirst_inode_rec(agno); irec; irec = next_ino_rec(irec)) {
+		if (irec->ino_isa_dir == 0)
+			continue;
+
+		if (!batch) {
+			batch = malloc(sizeof(struct dir_batch));
+			if (!batch)
+				do_error(
+			_("couldn't malloc directory batch\n"));
+			batch->first = irec;
+			batch->nrecs = 0;
+		}
+		if (++batch->nrecs == DIR_BATCH_RECS) {
+			queue_work(wq, traverse_dir_batch, agno, batch);
+			batch = NULL;
+		}
+	}
+	if (batch)
+		queue_work(wq, traverse_dir_batch, agno, batch);
+}
+
 static void
 update_missing_dotdot_entries(
 	xfs_mount_t		*mp)
@@ -3223,7 +3088,47 @@ static void
 traverse_ags(
 	struct xfs_mount	*mp)
 {
-	do_inode_prefetch(mp, 0, traverse_function, false, true);
+	struct work_queue	queue;
+	ino_tree_node_t		*irec;
+	xfs_agnumber_t		agno;
+	int			offset;
+
+	/*
+	 * Check the root directory first, on its own.  It decides which
+	 * inode is the orphanage, and that has to be settled before the
+	 * entries pointing at that inode from elsewhere are looked at.
+	 */
+	agno = XFS_INO_TO_AGNO(mp, mp->m_sb.sb_rootino);
+	irec = find_inode_rec(mp, agno,
+			XFS_INO_TO_AGINO(mp, mp->m_sb.sb_rootino));
+	if (irec) {
+		offset = XFS_INO_TO_AGINO(mp, mp->m_sb.sb_rootino) -
+				irec->ino_startnum;
+		if (inode_isadir(irec, offset))
+			process_dir_inode(mp, agno, irec, offset);
+	}
+
+	/*
+	 * Fixing a directory runs transactions that can touch any AG.  They
+	 * are serialised by dir_fix_lock(), but still rely on the buffer
+	 * locks to keep them apart from the checks in other threads, and
+	 * those are only used when prefetching.  In no modify mode we only
+	 * read.
+	 */
+	if (!do_prefetch && !no_modify) {
+		do_inode_prefetch(mp, 0, traverse_function, true);
+		return;
+	}
+
+	if (!libxfs_bcache_overflowed()) {
+		create_work_queue(&queue, mp, libxfs_nproc());
+		for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)
+			queue_work(&queue, traverse_ag_batches, agno, NULL);
+		destroy_work_queue(&queue);
+		return;
+	}
+
+	do_inode_prefetch(mp, ag_stride, traverse_function, true);
 }
 
 void
@@ -17,7 +17,6 @@
  */
 
 #include <libxfs.h>
-#include "avl.h"
 #include "globals.h"
 #include "agheader.h"
 #include "incore.h"
@@ -26,6 +25,8 @@
 #include "dinode.h"
 #include "versions.h"
 #include "progress.h"
+#include "stats.h"
+#include "threads.h"
 
 /* dinoc is a pointer to the IN-CORE dinode core */
 static void
@@ -58,17 +59,34 @@ _("would have reset inode %" PRIu64 " nlinks from %u to %u\n"),
 	}
 }
 
+/*
+ * Correct the link counts of a run of inodes in the same inode cluster in
+ * a single transaction. The cluster buffer is read up front and held in
+ * the transaction, so reading the inodes doesn't have to go back to the
+ * buffer cache for every inode and the whole cluster is written back once.
+ */
 static void
-update_inode_nlinks(
+update_cluster_nlinks(
 	xfs_mount_t 		*mp,
-	xfs_ino_t		ino,
-	__uint32_t		nlinks)
+	xfs_agnumber_t		agno,
+	ino_tree_node_t		*irec,
+	int			first,
+	int			last)
 {
 	xfs_trans_t		*tp;
 	xfs_inode_t		*ip;
+	xfs_inode_t		*ips[XFS_INODES_PER_CHUNK];
+	struct xfs_imap		imap;
+	struct xfs_dinode	*dip;
+	xfs_buf_t		*bp;
+	xfs_ino_t		ino;
+	__uint32_t		nrefs;
 	int			error;
 	int			dirty;
+	int			ndirty = 0;
+	int			nips = 0;
 	int			nres;
+	int			j;
 
 	tp = libxfs_trans_alloc(mp, XFS_TRANS_REMOVE);
 
@@ -76,67 +94,95 @@ update_inode_nlinks(
 	error = libxfs_trans_reserve(tp, &M_RES(mp)->tr_remove, nres, 0);
 	ASSERT(error == 0);
 
-	error = libxfs_trans_iget(mp, tp, ino, 0, 0, &ip);
-
-	if (error)  {
-		if (!no_modify)
-			do_error(
+	/*
+	 * if the cluster can't be read, the inode reads below will fail
+	 * too and report it for each inode.
+	 */
+	ino = XFS_AGINO_TO_INO(mp, agno, irec->ino_startnum + first);
+	if (!libxfs_imap(mp, tp, ino, &imap, 0))
+		libxfs_imap_to_bp(mp, tp, &imap, &dip, &bp, 0, 0);
+
+	for (j = first; j < last; j++)  {
+		if (is_inode_free(irec, j))
+			continue;
+
+		nrefs = num_inode_references(irec, j);
+		if (get_inode_disk_nlinks(irec, j) == nrefs)
+			continue;
+
+		ino = XFS_AGINO_TO_INO(mp, agno, irec->ino_startnum + j);
+		error = libxfs_trans_iget(mp, tp, ino, 0, 0, &ip);
+		if (error)  {
+			if (!no_modify)
+				do_error(
 	_("couldn't map inode %" PRIu64 ", err = %d\n"),
-				ino, error);
-		else  {
-			do_warn(
+					ino, error);
+			else  {
+				do_warn(
 	_("couldn't map inode %" PRIu64 ", err = %d, can't compare link counts\n"),
-				ino, error);
-			return;
+					ino, error);
+				continue;
+			}
 		}
-	}
-
-	dirty = 0;
+		ips[nips++] = ip;
 
-	/*
-	 * compare and set links for all inodes
-	 */
-	set_nlinks(&ip->i_d, ino, nlinks, &dirty);
+		/*
+		 * compare and set links for all inodes
+		 */
+		dirty = 0;
+		set_nlinks(&ip->i_d, ino, nrefs, &dirty);
+		if (dirty)  {
+			libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+			ndirty++;
+		}
+	}
 
-	if (!dirty)  {
+	if (!ndirty)  {
 		libxfs_trans_cancel(tp, XFS_TRANS_RELEASE_LOG_RES);
 	} else  {
-		libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
 		/*
 		 * no need to do a bmap finish since
 		 * we're not allocating anything
 		 */
-		ASSERT(error == 0);
 		error = libxfs_trans_commit(tp, XFS_TRANS_RELEASE_LOG_RES |
 				XFS_TRANS_SYNC);
 
 		ASSERT(error == 0);
 	}
-	IRELE(ip);
+	while (nips > 0)
+		IRELE(ips[--nips]);
 }
 
-void
-phase7(xfs_mount_t *mp)
+/*
+ * look at each inode in the AG, one inode cluster at a time.  If the
+ * number of links is bad for any of them, reset it and log the inode
+ * cores in a transaction per cluster.
+ */
+static void
+process_ag_nlinks(
+	xfs_mount_t		*mp,
+	xfs_agnumber_t		agno)
 {
 	ino_tree_node_t		*irec;
-	int			i;
+	int			inodes_per_cluster;
+	int			first;
+	int			need_update;
 	int			j;
 	__uint32_t		nrefs;
+	struct stats_ag_timer	timer;
 
-	if (!no_modify)
-		do_log(_("Phase 7 - verify and correct link counts...\n"));
-	else
-		do_log(_("Phase 7 - verify link counts...\n"));
+	stats_ag_start(&timer);
+	inodes_per_cluster = max(1, XFS_INODE_CLUSTER_SIZE(mp) >>
+					mp->m_sb.sb_inodelog);
+	inodes_per_cluster = min(inodes_per_cluster, XFS_INODES_PER_CHUNK);
 
-	/*
-	 * for each ag, look at each inode 1 at a time. If the number of
-	 * links is bad, reset it, log the inode core, commit the transaction
-	 */
-	for (i = 0; i < glob_agcount; i++)  {
-		irec = findfirst_inode_rec(i);
+	irec = findfirst_inode_rec(agno);
 
-		while (irec != NULL)  {
-			for (j = 0; j < XFS_INODES_PER_CHUNK; j++)  {
+	while (irec != NULL)  {
+		for (first = 0; first < XFS_INODES_PER_CHUNK;
+		     first += inodes_per_cluster)  {
+			need_update = 0;
+			for (j = first; j < first + inodes_per_cluster; j++)  {
 				ASSERT(is_inode_confirmed(irec, j));
 
 				if (is_inode_free(irec, j))
@@ -148,12 +194,47 @@ phase7(xfs_mount_t *mp)
 				ASSERT(no_modify || nrefs > 0);
 
 				if (get_inode_disk_nlinks(irec, j) != nrefs)
-					update_inode_nlinks(mp,
-						XFS_AGINO_TO_INO(mp, i,
-							irec->ino_startnum + j),
-						nrefs);
+					need_update = 1;
 			}
-			irec = next_ino_rec(irec);
+			if (need_update)
+				update_cluster_nlinks(mp, agno, irec, first,
+						first + inodes_per_cluster);
 		}
+		irec = next_ino_rec(irec);
+	}
+	stats_ag_end(&timer, agno);
+}
+
+static void
+phase7_worker(
+	struct work_queue	*wq,
+	xfs_agnumber_t		agno,
+	void			*arg)
+{
+	process_ag_nlinks(wq->mp, agno);
+}
+
+void
+phase7(xfs_mount_t *mp)
+{
+	work_queue_t		wq;
+	int			i;
+
+	if (!no_modify)
+		do_log(_("Phase 7 - verify and correct link counts...\n"));
+	else
+		do_log(_("Phase 7 - verify link counts...\n"));
+
+	/*
+	 * the link counts of each AG's inodes can be checked independently
+	 */
+	if (ag_stride) {
+		create_work_queue(&wq, mp, thread_count);
+		for (i = 0; i < glob_agcount; i++)
+			queue_work(&wq, phase7_worker, i, NULL);
+		destroy_work_queue(&wq);
+	} else {
+		for (i = 0; i < glob_agcount; i++)
+			process_ag_nlinks(mp, i);
 	}
 }
@@ -1,6 +1,6 @@
 #include <libxfs.h>
 #include <pthread.h>
-#include "avl.h"
+#include <sys/uio.h>
 #include "btree.h"
 #include "globals.h"
 #include "agheader.h"
@@ -14,8 +14,12 @@
 #include "threads.h"
 #include "prefetch.h"
 #include "progress.h"
+#include "uring.h"
+#include "stats.h"
 
 int do_prefetch = 1;
+int pf_io_engine = PF_IO_SYNC;
+int pf_io_depth = PF_IO_DEF_DEPTH;
 
 /*
  * Performs prefetching by priming the libxfs cache by using a dedicate thread
@@ -70,12 +74,48 @@ static void		pf_read_inode_dirs(prefetch_args_t *, xfs_buf_t *);
 
 #define IO_THRESHOLD	(MAX_BUFS * 2)
 
+/* one vector per buffer plus one for the gap in front of it */
+#define MAX_IOVECS	(MAX_BUFS * 2)
+
 typedef enum pf_which {
 	PF_PRIMARY,
 	PF_SECONDARY,
 	PF_META_ONLY
 } pf_which_t;
 
+/*
+ * A batch of buffers covered by a single read. The synchronous engine has
+ * exactly one of these per I/O worker, the io_uring engine keeps up to
+ * pf_io_depth batches in flight per worker so that the device queue stays
+ * busy while completed batches are being copied into the cache.
+ *
+ * Where possible a batch is read with a vectored read straight into the
+ * buffers, with the gaps between them going to the bounce buffer, which is
+ * then used purely as a discard sink. Batches ending in a discontiguous
+ * buffer are read into the bounce buffer and copied out as before.
+ */
+typedef struct pf_batch {
+	struct pf_batch		*next;
+	pf_which_t		which;
+	int			num;
+	int			niov;
+	off64_t			first_off;
+	off64_t			last_off;
+	void			*buf;
+	xfs_buf_t		*bplist[MAX_BUFS];
+	struct iovec		iov[MAX_IOVECS];
+} pf_batch_t;
+
+typedef struct pf_io_ctx {
+	pf_batch_t		*batches;
+	pf_batch_t		*free_batches;
+	int			nbatches;
+	int			inflight;
+	int			which_inflight[PF_META_ONLY + 1];
+	int			use_uring;
+	struct uring		ring;
+} pf_io_ctx_t;
+
 
 static inline void
 pf_start_processing(
@@ -135,6 +175,8 @@ pf_queue_io(
 	pthread_mutex_lock(&args->lock);
 
 	btree_insert(args->io_queue, fsbno, bp);
+	if (++args->bufs_queued > args->max_bufs_queued)
+		args->max_bufs_queued = args->bufs_queued;
 
 	if (fsbno > args->last_bno_read) {
 		if (B_IS_INODE(flag)) {
@@ -443,6 +485,211 @@ pf_read_inode_dirs(
 		XFS_BUF_SET_PRIORITY(bp, B_DIR_INODE);
 }
 
+/*
+ * Copy the data read for a batch into its xfs_buf_t's and release them.
+ * @len is the number of bytes read, or a negative error.
+ */
+static void
+pf_complete_batch(
+	prefetch_args_t		*args,
+	pf_io_ctx_t		*ctx,
+	pf_batch_t		*batch,
+	int			len)
+{
+	xfs_buf_t		**bplist = batch->bplist;
+	int			num = batch->num;
+	pf_which_t		which = batch->which;
+	off64_t			off;
+	int			size;
+	int			i;
+	char			*pbuf;
+
+	/*
+	 * Check the last buffer on the list to see if we need to
+	 * process a discontiguous buffer. The gather above loop
+	 * guarantees that only the last buffer in the list will be a
+	 * discontiguous buffer.
+	 */
+	if ((bplist[num - 1]->b_flags & LIBXFS_B_DISCONTIG)) {
+		libxfs_readbufr_map(mp->m_ddev_targp, bplist[num - 1], 0);
+		bplist[num - 1]->b_flags |= LIBXFS_B_UNCHECKED;
+		libxfs_putbuf(bplist[num - 1]);
+		num--;
+	}
+
+	if (len > 0) {
+		__sync_fetch_and_add(&args->reads, 1);
+		__sync_fetch_and_add(&args->read_bytes, len);
+
+		/*
+		 * go through the xfs_buf_t list copying from the
+		 * read buffer into the xfs_buf_t's (unless the data was
+		 * read into them directly) and release them.
+		 */
+		for (i = 0; i < num; i++) {
+
+			off = LIBXFS_BBTOOFF64(XFS_BUF_ADDR(bplist[i])) -
+							batch->first_off;
+			size = XFS_BUF_SIZE(bplist[i]);
+			if (batch->niov) {
+				if (off + size > len)
+					break;
+			} else {
+				pbuf = ((char *)batch->buf) + off;
+				if (len < size)
+					break;
+				memcpy(XFS_BUF_PTR(bplist[i]), pbuf, size);
+				len -= size;
+			}
+			bplist[i]->b_flags |= (LIBXFS_B_UPTODATE |
+					       LIBXFS_B_UNCHECKED);
+			if (B_IS_INODE(XFS_BUF_PRIORITY(bplist[i])))
+				pf_read_inode_dirs(args, bplist[i]);
+			else if (which == PF_META_ONLY)
+				XFS_BUF_SET_PRIORITY(bplist[i],
+							B_DIR_META_H);
+			else if (which == PF_PRIMARY && num == 1)
+				XFS_BUF_SET_PRIORITY(bplist[i],
+							B_DIR_META_S);
+		}
+	}
+	for (i = 0; i < num; i++) {
+		pftrace("putbuf %c %p (%llu) in AG %d",
+			B_IS_INODE(XFS_BUF_PRIORITY(bplist[i])) ? 'I' : 'M',
+			bplist[i], (long long)XFS_BUF_ADDR(bplist[i]),
+			args->agno);
+		libxfs_putbuf(bplist[i]);
+	}
+
+	batch->next = ctx->free_batches;
+	ctx->free_batches = batch;
+}
+
+/*
+ * Reap one completed asynchronous read and hand it to pf_complete_batch.
+ * Must be called without the prefetch lock held.
+ */
+static void
+pf_wait_batch(
+	prefetch_args_t		*args,
+	pf_io_ctx_t		*ctx)
+{
+	pf_batch_t		*batch;
+	void			*data;
+	int			res;
+	int			error;
+
+	ASSERT(ctx->inflight > 0);
+
+	error = uring_wait(&ctx->ring, &data, &res);
+	if (error)
+		do_error(_("failed to reap prefetch I/O: %s\n"),
+			strerror(-error));
+	batch = data;
+	ctx->inflight--;
+	ctx->which_inflight[batch->which]--;
+
+	pftrace("completed bbs %llu to %llu (%d bufs) in AG %d, res = %d",
+		(long long)XFS_BUF_ADDR(batch->bplist[0]),
+		(long long)XFS_BUF_ADDR(batch->bplist[batch->num - 1]),
+		batch->num, args->agno, res);
+
+	pf_complete_batch(args, ctx, batch, res);
+}
+
+/*
+ * Build the vector for reading a batch directly into its buffers. Returns
+ * 0 if the batch has to go through the bounce buffer instead, i.e. if it
+ * ends in a discontiguous buffer or the buffers overlap.
+ */
+static int
+pf_batch_iovec(
+	pf_batch_t		*batch)
+{
+	xfs_buf_t		*bp;
+	off64_t			pos = batch->first_off;
+	off64_t			off;
+	int			niov = 0;
+	int			i;
+
+	batch->niov = 0;
+	if (batch->bplist[batch->num - 1]->b_flags & LIBXFS_B_DISCONTIG)
+		return 0;
+
+	for (i = 0; i < batch->num; i++) {
+		bp = batch->bplist[i];
+		off = LIBXFS_BBTOOFF64(XFS_BUF_ADDR(bp));
+		if (off < pos)
+			return 0;
+		if (off > pos) {
+			/* gap smaller than the whole batch, fits in the sink */
+			batch->iov[niov].iov_base = batch->buf;
+			batch->iov[niov].iov_len = off - pos;
+			niov++;
+		}
+		batch->iov[niov].iov_base = XFS_BUF_PTR(bp);
+		batch->iov[niov].iov_len = XFS_BUF_SIZE(bp);
+		niov++;
+		pos = off + XFS_BUF_SIZE(bp);
+	}
+	ASSERT(pos == batch->last_off);
+
+	batch->niov = niov;
+	return 1;
+}
+
+/*
+ * Issue the read for a batch. The synchronous engine reads and completes
+ * the batch immediately; the io_uring engine only blocks once all of the
+ * worker's batches are in flight. Must be called without the prefetch lock
+ * held.
+ */
+static void
+pf_read_batch(
+	prefetch_args_t		*args,
+	pf_io_ctx_t		*ctx,
+	pf_batch_t		*batch)
+{
+	int			len = (int)(batch->last_off - batch->first_off);
+	int			error;
+
+	pf_batch_iovec(batch);
+
+	if (ctx->use_uring) {
+		if (batch->niov)
+			error = uring_prep_readv(&ctx->ring, mp_fd, batch->iov,
+					batch->niov, batch->first_off, batch);
+		else
+			error = uring_prep_read(&ctx->ring, mp_fd, batch->buf,
+					len, batch->first_off, batch);
+		if (!error) {
+			while ((error = uring_submit(&ctx->ring)) == -EAGAIN &&
+			       ctx->inflight)
+				pf_wait_batch(args, ctx);
+			if (error < 0)
+				do_error(_("failed to submit prefetch I/O: %s\n"),
+					strerror(-error));
+			ctx->inflight++;
+			ctx->which_inflight[batch->which]++;
+			if (!ctx->free_batches)
+				pf_wait_batch(args, ctx);
+			return;
+		}
+		/* no room in the ring, fall back to a synchronous read */
+	}
+
+#ifdef HAVE_PREADV
+	if (batch->niov) {
+		len = preadv(mp_fd, batch->iov, batch->niov, batch->first_off);
+		pf_complete_batch(args, ctx, batch, len);
+		return;
+	}
+#endif
+	batch->niov = 0;
+	len = pread64(mp_fd, batch->buf, len, batch->first_off);
+	pf_complete_batch(args, ctx, batch, len);
+}
+
 /*
  * pf_batch_read must be called with the lock locked.
  */
@@ -450,19 +697,22 @@ static void
 pf_batch_read(
 	prefetch_args_t		*args,
 	pf_which_t		which,
-	void			*buf)
+	pf_io_ctx_t		*ctx)
 {
-	xfs_buf_t		*bplist[MAX_BUFS];
+	pf_batch_t		*batch;
+	xfs_buf_t		**bplist;
 	unsigned int		num;
 	off64_t			first_off, last_off, next_off;
-	int			len, size;
 	int			i;
 	int			inode_bufs;
-	unsigned long		fsbno = 0;
-	unsigned long		max_fsbno;
-	char			*pbuf;
+	xfs_fsblock_t		fsbno = 0;
+	xfs_fsblock_t		max_fsbno;
 
 	for (;;) {
+		batch = ctx->free_batches;
+		ASSERT(batch != NULL);
+		bplist = batch->bplist;
+
 		num = 0;
 		if (which == PF_SECONDARY) {
 			bplist[0] = btree_find(args->io_queue, 0, &fsbno);
@@ -494,8 +744,24 @@ pf_batch_read(
 				break;
 			bplist[num] = btree_lookup_next(args->io_queue, &fsbno);
 		}
-		if (!num)
-			return;
+		if (!num) {
+			if (!ctx->which_inflight[which])
+				return;
+
+			/*
+			 * Completing the outstanding reads may queue more
+			 * directory blocks, so check the queue again once
+			 * they are all done. Only wait for the reads issued
+			 * from this queue: the metadata and secondary passes
+			 * run from inside the primary one and shouldn't stall
+			 * until the primary reads behind them are done too.
+			 */
+			pthread_mutex_unlock(&args->lock);
+			while (ctx->which_inflight[which])
+				pf_wait_batch(args, ctx);
+			pthread_mutex_lock(&args->lock);
+			continue;
+		}
 
 		/*
 		 * do a big read if 25% of the potential buffer is useful,
@@ -531,6 +797,7 @@ pf_batch_read(
 					XFS_BUF_ADDR(bplist[i]))) == NULL)
 				do_error(_("prefetch corruption\n"));
 		}
+		args->bufs_queued -= num;
 
 		if (which == PF_PRIMARY) {
 			for (inode_bufs = 0, i = 0; i < num; i++) {
@@ -554,53 +821,13 @@ pf_batch_read(
 		/*
 		 * now read the data and put into the xfs_but_t's
 		 */
-		len = pread64(mp_fd, buf, (int)(last_off - first_off), first_off);
+		ctx->free_batches = batch->next;
+		batch->which = which;
+		batch->num = num;
+		batch->first_off = first_off;
+		batch->last_off = last_off;
+		pf_read_batch(args, ctx, batch);
 
-		/*
-		 * Check the last buffer on the list to see if we need to
-		 * process a discontiguous buffer. The gather above loop
-		 * guarantees that only the last buffer in the list will be a
-		 * discontiguous buffer.
-		 */
-		if ((bplist[num - 1]->b_flags & LIBXFS_B_DISCONTIG)) {
-			libxfs_readbufr_map(mp->m_ddev_targp, bplist[num - 1], 0);
-			bplist[num - 1]->b_flags |= LIBXFS_B_UNCHECKED;
-			libxfs_putbuf(bplist[num - 1]);
-			num--;
-		}
-
-		if (len > 0) {
-			/*
-			 * go through the xfs_buf_t list copying from the
-			 * read buffer into the xfs_buf_t's and release them.
-			 */
-			for (i = 0; i < num; i++) {
-
-				pbuf = ((char *)buf) + (LIBXFS_BBTOOFF64(XFS_BUF_ADDR(bplist[i])) - first_off);
-				size = XFS_BUF_SIZE(bplist[i]);
-				if (len < size)
-					break;
-				memcpy(XFS_BUF_PTR(bplist[i]), pbuf, size);
-				bplist[i]->b_flags |= (LIBXFS_B_UPTODATE |
-						       LIBXFS_B_UNCHECKED);
-				len -= size;
-				if (B_IS_INODE(XFS_BUF_PRIORITY(bplist[i])))
-					pf_read_inode_dirs(args, bplist[i]);
-				else if (which == PF_META_ONLY)
-					XFS_BUF_SET_PRIORITY(bplist[i],
-								B_DIR_META_H);
-				else if (which == PF_PRIMARY && num == 1)
-					XFS_BUF_SET_PRIORITY(bplist[i],
-								B_DIR_META_S);
-			}
-		}
-		for (i = 0; i < num; i++) {
-			pftrace("putbuf %c %p (%llu) in AG %d",
-				B_IS_INODE(XFS_BUF_PRIORITY(bplist[i])) ? 'I' : 'M',
-				bplist[i], (long long)XFS_BUF_ADDR(bplist[i]),
-				args->agno);
-			libxfs_putbuf(bplist[i]);
-		}
 		pthread_mutex_lock(&args->lock);
 		if (which != PF_SECONDARY) {
 			pftrace("inode_bufs_queued for AG %d = %d", args->agno,
@@ -616,26 +843,82 @@ pf_batch_read(
 				pftrace("reading metadata bufs from primary queue for AG %d",
 					args->agno);
 
-				pf_batch_read(args, PF_META_ONLY, buf);
+				pf_batch_read(args, PF_META_ONLY, ctx);
 
 				pftrace("reading bufs from secondary queue for AG %d",
 					args->agno);
 
-				pf_batch_read(args, PF_SECONDARY, buf);
+				pf_batch_read(args, PF_SECONDARY, ctx);
 			}
 		}
 	}
 }
 
+static void
+pf_io_ctx_destroy(
+	pf_io_ctx_t		*ctx)
+{
+	int			i;
+
+	ASSERT(ctx->inflight == 0);
+
+	if (ctx->use_uring)
+		uring_exit(&ctx->ring);
+	for (i = 0; i < ctx->nbatches; i++)
+		free(ctx->batches[i].buf);
+	free(ctx->batches);
+}
+
+/*
+ * Set up the per-worker I/O state. If the io_uring engine was asked for but
+ * a ring can't be created for this worker, quietly fall back to synchronous
+ * reads so prefetch still makes progress.
+ */
+static int
+pf_io_ctx_init(
+	pf_io_ctx_t		*ctx)
+{
+	int			i;
+
+	memset(ctx, 0, sizeof(*ctx));
+
+	ctx->nbatches = 1;
+	if (pf_io_engine == PF_IO_URING &&
+	    uring_init(&ctx->ring, pf_io_depth) == 0) {
+		ctx->use_uring = 1;
+		ctx->nbatches = pf_io_depth;
+	}
+
+	ctx->batches = calloc(ctx->nbatches, sizeof(pf_batch_t));
+	if (!ctx->batches)
+		goto out_fail;
+
+	for (i = 0; i < ctx->nbatches; i++) {
+		ctx->batches[i].buf = memalign(libxfs_device_alignment(),
+						pf_max_bytes);
+		if (!ctx->batches[i].buf)
+			goto out_fail;
+		ctx->batches[i].next = ctx->free_batches;
+		ctx->free_batches = &ctx->batches[i];
+	}
+	return 1;
+
+out_fail:
+	if (ctx->batches)
+		pf_io_ctx_destroy(ctx);
+	else if (ctx->use_uring)
+		uring_exit(&ctx->ring);
+	return 0;
+}
+
 static void *
 pf_io_worker(
 	void			*param)
 {
 	prefetch_args_t		*args = param;
-	void			*buf = memalign(libxfs_device_alignment(),
-						pf_max_bytes);
+	pf_io_ctx_t		ctx;
 
-	if (buf == NULL)
+	if (!pf_io_ctx_init(&ctx))
 		return NULL;
 
 	pthread_mutex_lock(&args->lock);
@@ -647,8 +930,8 @@ pf_io_worker(
 
 		pftrace("starting prefetch I/O for AG %d", args->agno);
 
-		pf_batch_read(args, PF_PRIMARY, buf);
-		pf_batch_read(args, PF_SECONDARY, buf);
+		pf_batch_read(args, PF_PRIMARY, &ctx);
+		pf_batch_read(args, PF_SECONDARY, &ctx);
 
 		pftrace("ran out of bufs to prefetch for AG %d", args->agno);
 
@@ -657,7 +940,7 @@ pf_io_worker(
 	}
 	pthread_mutex_unlock(&args->lock);
 
-	free(buf);
+	pf_io_ctx_destroy(&ctx);
 
 	pftrace("finished prefetch I/O for AG %d", args->agno);
 
@@ -811,6 +1094,20 @@ init_prefetch(
 	pf_max_fsbs = pf_max_bytes >> mp->m_sb.sb_blocklog;
 	pf_batch_bytes = DEF_BATCH_BYTES;
 	pf_batch_fsbs = DEF_BATCH_BYTES >> (mp->m_sb.sb_blocklog + 1);
+
+	if (do_prefetch && pf_io_engine == PF_IO_URING) {
+		struct uring	ring;
+		int		error;
+
+		error = uring_init(&ring, pf_io_depth);
+		if (error) {
+			do_log(
+	_("io_uring unavailable (%s), using synchronous prefetch I/O\n"),
+				strerror(-error));
+			pf_io_engine = PF_IO_SYNC;
+		} else
+			uring_exit(&ring);
+	}
 }
 
 prefetch_args_t *
@@ -907,24 +1204,85 @@ prefetch_ag_range(
 	}
 }
 
+/*
+ * With more than one prefetch thread the AGs are split into ranges of
+ * @stride AGs, one per thread, so the threads start out spread over the
+ * volume.  A thread that has done its own range takes the last AG of the
+ * range with the most AGs left, so a few big AGs at the end of one range
+ * don't keep the others waiting.  Each thread still prefetches only one
+ * AG ahead of the one it is processing.
+ */
+struct pf_range {
+	xfs_agnumber_t		next;		/* next AG to claim */
+	xfs_agnumber_t		end;		/* AG after the range */
+	struct pf_work_args	*wargs;
+};
+
 struct pf_work_args {
-	xfs_agnumber_t	start_ag;
-	xfs_agnumber_t	end_ag;
-	bool		dirs_only;
-	void		(*func)(struct work_queue *, xfs_agnumber_t, void *);
+	pthread_mutex_t		lock;		/* protects the ranges */
+	struct pf_range		*ranges;
+	int			nranges;
+	bool			dirs_only;
+	void			(*func)(struct work_queue *, xfs_agnumber_t, void *);
 };
 
+static xfs_agnumber_t
+prefetch_claim_ag(
+	struct pf_range		*range)
+{
+	struct pf_work_args	*wargs = range->wargs;
+	struct pf_range		*victim = NULL;
+	struct pf_range		*r;
+	xfs_agnumber_t		agno = NULLAGNUMBER;
+	int			i;
+
+	pthread_mutex_lock(&wargs->lock);
+	if (range->next < range->end) {
+		agno = range->next++;
+		goto out_unlock;
+	}
+	for (i = 0; i < wargs->nranges; i++) {
+		r = &wargs->ranges[i];
+		if (r->next < r->end &&
+		    (!victim || r->end - r->next > victim->end - victim->next))
+			victim = r;
+	}
+	if (victim)
+		agno = --victim->end;
+out_unlock:
+	pthread_mutex_unlock(&wargs->lock);
+	return agno;
+}
+
 static void
 prefetch_ag_range_work(
 	struct work_queue	*work,
 	xfs_agnumber_t		unused,
 	void			*args)
 {
-	struct pf_work_args *wargs = args;
+	struct pf_range		*range = args;
+	struct pf_work_args	*wargs = range->wargs;
+	struct prefetch_args	*pf_args;
+	struct prefetch_args	*next_args = NULL;
+	xfs_agnumber_t		agno;
+	xfs_agnumber_t		next;
+
+	agno = prefetch_claim_ag(range);
+	if (agno == NULLAGNUMBER)
+		return;
 
-	prefetch_ag_range(work, wargs->start_ag, wargs->end_ag, 
-			  wargs->dirs_only, wargs->func);
-	free(args);
+	pf_args = start_inode_prefetch(agno, wargs->dirs_only, NULL);
+	for (;;) {
+		next = prefetch_claim_ag(range);
+		if (next != NULLAGNUMBER)
+			next_args = start_inode_prefetch(next,
+						wargs->dirs_only, pf_args);
+		wargs->func(work, agno, pf_args);
+		if (next == NULLAGNUMBER)
+			break;
+		agno = next;
+		pf_args = next_args;
+	}
 }
 
 /*
@@ -937,34 +1295,18 @@ do_inode_prefetch(
 	int			stride,
 	void			(*func)(struct work_queue *,
 					xfs_agnumber_t, void *),
-	bool			check_cache,
 	bool			dirs_only)
 {
 	int			i;
 	struct work_queue	queue;
-	struct work_queue	*queues;
-	int			queues_started = 0;
-
-	/*
-	 * If the previous phases of repair have not overflowed the buffer
-	 * cache, then we don't need to re-read any of the metadata in the
-	 * filesystem - it's all in the cache. In that case, run a thread per
-	 * CPU to maximise parallelism of the queue to be processed.
-	 */
-	if (check_cache && !libxfs_bcache_overflowed()) {
-		queue.mp = mp;
-		create_work_queue(&queue, mp, libxfs_nproc());
-		for (i = 0; i < mp->m_sb.sb_agcount; i++)
-			queue_work(&queue, func, i, NULL);
-		destroy_work_queue(&queue);
-		return;
-	}
+	struct pf_work_args	wargs;
 
 	/*
 	 * single threaded behaviour - single prefetch thread, processed
 	 * directly after each AG is queued.
 	 */
 	if (!stride) {
+		memset(&queue, 0, sizeof(queue));
 		queue.mp = mp;
 		prefetch_ag_range(&queue, 0, mp->m_sb.sb_agcount,
 				  dirs_only, func);
@@ -972,33 +1314,37 @@ do_inode_prefetch(
 	}
 
 	/*
-	 * create one worker thread for each segment of the volume
+	 * create one worker thread for each segment of the volume, all
+	 * sharing one queue so that any work the segments queue themselves
+	 * can be picked up by whichever thread is idle.
 	 */
-	queues = malloc(thread_count * sizeof(work_queue_t));
-	for (i = 0; i < thread_count; i++) {
-		struct pf_work_args *wargs;
-
-		wargs = malloc(sizeof(struct pf_work_args));
-		wargs->start_ag = i * stride;
-		wargs->end_ag = min((i + 1) * stride,
-				    mp->m_sb.sb_agcount);
-		wargs->dirs_only = dirs_only;
-		wargs->func = func;
-
-		create_work_queue(&queues[i], mp, 1);
-		queue_work(&queues[i], prefetch_ag_range_work, 0, wargs);
-		queues_started++;
-
-		if (wargs->end_ag >= mp->m_sb.sb_agcount)
-			break;
+	wargs.nranges = min(thread_count,
+			    (mp->m_sb.sb_agcount + stride - 1) / stride);
+	wargs.ranges = calloc(wargs.nranges, sizeof(struct pf_range));
+	if (!wargs.ranges)
+		do_error(_("couldn't malloc prefetch ranges\n"));
+	pthread_mutex_init(&wargs.lock, NULL);
+	wargs.dirs_only = dirs_only;
+	wargs.func = func;
+
+	create_work_queue(&queue, mp, wargs.nranges);
+	for (i = 0; i < wargs.nranges; i++) {
+		wargs.ranges[i].next = i * stride;
+		wargs.ranges[i].end = min((i + 1) * stride,
+					  mp->m_sb.sb_agcount);
+		if (i == wargs.nranges - 1)
+			wargs.ranges[i].end = mp->m_sb.sb_agcount;
+		wargs.ranges[i].wargs = &wargs;
+
+		queue_work(&queue, prefetch_ag_range_work, 0, &wargs.ranges[i]);
 	}
 
 	/*
 	 * wait for workers to complete
 	 */
-	for (i = 0; i < queues_started; i++)
-		destroy_work_queue(&queues[i]);
-	free(queues);
+	destroy_work_queue(&queue);
+	pthread_mutex_destroy(&wargs.lock);
+	free(wargs.ranges);
 }
 
 void
@@ -1034,6 +1380,9 @@ cleanup_inode_prefetch(
 
 	pftrace("AG %d prefetch done", args->agno);
 
+	stats_ag_prefetch(args->agno, args->reads, args->read_bytes,
+			  args->max_bufs_queued);
+
 	pthread_mutex_destroy(&args->lock);
 	pthread_cond_destroy(&args->start_reading);
 	pthread_cond_destroy(&args->start_processing);
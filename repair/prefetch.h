@@ -7,9 +7,19 @@
 struct work_queue;
 
 extern int 	do_prefetch;
+extern int	pf_io_engine;
+extern int	pf_io_depth;
 
 #define PF_THREAD_COUNT	4
 
+/* prefetch I/O engines, selected with -o pf_engine */
+#define PF_IO_SYNC	0
+#define PF_IO_URING	1
+
+/* reads kept in flight per prefetch I/O thread by the io_uring engine */
+#define PF_IO_DEF_DEPTH	8
+#define PF_IO_MAX_DEPTH	64
+
 typedef struct prefetch_args {
 	pthread_mutex_t		lock;
 	pthread_t		queuing_thread;
@@ -24,6 +34,10 @@ typedef struct prefetch_args {
 	volatile int		prefetch_done;
 	volatile int		queuing_done;
 	volatile int		inode_bufs_queued;
+	int			bufs_queued;	/* buffers on io_queue */
+	int			max_bufs_queued;
+	__uint64_t		reads;		/* reads issued and bytes */
+	__uint64_t		read_bytes;	/* ... read for this AG */
 	volatile xfs_fsblock_t	last_bno_read;
 	sem_t			ra_count;
 	struct prefetch_args	*next_args;
@@ -47,7 +61,6 @@ do_inode_prefetch(
 	int			stride,
 	void			(*func)(struct work_queue *,
 					xfs_agnumber_t, void *),
-	bool			check_cache,
 	bool			dirs_only);
 
 void
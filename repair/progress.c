@@ -3,6 +3,8 @@
 #include "globals.h"
 #include "progress.h"
 #include "err_protos.h"
+#include "incore.h"
+#include "stats.h"
 #include <signal.h>
 
 #define ONEMINUTE  60
@@ -97,6 +99,10 @@ typedef struct phase_times_s {
 	time_t		end;
 	time_t		duration;
 	__uint64_t	item_counts[4];
+	__uint64_t	bmap_mem;	/* block map memory at phase end */
+	__uint64_t	bmap_flat_mem;	/* ... as flat 4 bit maps */
+	__uint64_t	incore_mem;	/* incore inode state in memory */
+	__uint64_t	incore_spilled;	/* ... and in the scratch file */
 } phase_times_t;
 static phase_times_t phase_times[8];
 
@@ -392,6 +398,35 @@ timestamp(int end, int phase, char *buf)
 	if (end) {
 		phase_times[phase].end = now;
 		timediff(phase);
+		stats_phase_end(phase);
+
+		bmap_mem_usage(&phase_times[phase].bmap_mem,
+				&phase_times[phase].bmap_flat_mem);
+		if (verbose && phase_times[phase].bmap_mem)
+			do_log(
+	_("        - block map uses %" PRIu64 " KB, a flat map would use %" PRIu64 " KB\n"),
+				phase_times[phase].bmap_mem >> 10,
+				phase_times[phase].bmap_flat_mem >> 10);
+
+		incore_mem_usage(XR_MEM_NTYPES, &phase_times[phase].incore_mem,
+				&phase_times[phase].incore_spilled);
+		if (verbose)
+			do_log(
+	_("        - incore inode state uses %" PRIu64 " KB in memory, %" PRIu64 " KB spilled\n"),
+				phase_times[phase].incore_mem >> 10,
+				phase_times[phase].incore_spilled >> 10);
+		if (verbose > 1) {
+			__uint64_t	resident, spilled;
+			int		type;
+
+			for (type = 0; type < XR_MEM_NTYPES; type++) {
+				incore_mem_usage(type, &resident, &spilled);
+				do_log(
+	_("            %-20s %" PRIu64 " KB in memory, %" PRIu64 " KB spilled\n"),
+					incore_mem_type_name(type),
+					resident >> 10, spilled >> 10);
+			}
+		}
 
 		/* total time in slot zero */
 		phase_times[0].end = now;
@@ -400,11 +435,13 @@ timestamp(int end, int phase, char *buf)
 		if (phase < 7) {
 			phase_times[phase+1].start = now;
 			current_phase = phase + 1;
+			stats_phase_start(phase + 1);
 		}
 	}
 	else {
 		phase_times[phase].start = now;
 		current_phase = phase;
+		stats_phase_start(phase);
 	}
 
 	if (buf) {
@@ -532,4 +569,24 @@ summary_report(void)
 		}
 	}
 	do_log(_("\nTotal run time: %s\n"), duration(phase_times[0].duration, msgbuf));
+
+	do_log(_("\nPhase\t\tBlock map\tFlat map\tSaved\n"));
+	for (i = 1; i < 8; i++) {
+		if (!phase_times[i].bmap_mem)
+			continue;
+		do_log(_("Phase %d:\t%" PRIu64 " KB\t%" PRIu64 " KB\t%" PRId64 " KB\n"),
+			i, phase_times[i].bmap_mem >> 10,
+			phase_times[i].bmap_flat_mem >> 10,
+			(__int64_t)(phase_times[i].bmap_flat_mem >> 10) -
+			(__int64_t)(phase_times[i].bmap_mem >> 10));
+	}
+
+	do_log(_("\nPhase\t\tInode state\tSpilled\n"));
+	for (i = 1; i < 8; i++) {
+		if (!phase_times[i].end)
+			continue;
+		do_log(_("Phase %d:\t%" PRIu64 " KB\t%" PRIu64 " KB\n"),
+			i, phase_times[i].incore_mem >> 10,
+			phase_times[i].incore_spilled >> 10);
+	}
 }
@@ -38,6 +38,7 @@ extern char *timestamp(int end, int phase, char *buf);
 extern char *duration(int val, char *buf);
 extern int do_parallel;
 
-#define	PROG_RPT_INC(a,b) if (ag_stride && prog_rpt_done) (a) += (b)
+#define	PROG_RPT_INC(a,b) \
+	if (ag_stride && prog_rpt_done) __sync_fetch_and_add(&(a), (b))
 
 #endif	/* _XFS_REPAIR_PROGRESS_RPT_H_ */
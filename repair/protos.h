@@ -45,6 +45,7 @@ char	*err_string(int err_code);
 void	thread_init(void);
 
 void	phase1(struct xfs_mount *);
+int	phase2_log(struct xfs_mount *, int);
 void	phase2(struct xfs_mount *, int);
 void	phase3(struct xfs_mount *);
 void	phase4(struct xfs_mount *);
@@ -17,7 +17,6 @@
  */
 
 #include <libxfs.h>
-#include "avl.h"
 #include "globals.h"
 #include "agheader.h"
 #include "incore.h"
@@ -29,6 +28,7 @@
 #include "bmap.h"
 #include "progress.h"
 #include "threads.h"
+#include "stats.h"
 
 static xfs_mount_t	*mp = NULL;
 
@@ -851,7 +851,7 @@ _("inode chunk claims used block, inobt block - agno %d, bno %d, inopb %d\n"),
 	}
 
 	/*
-	 * ensure only one avl entry per chunk
+	 * ensure only one inode tree entry per chunk
 	 */
 	find_inode_rec_range(mp, agno, ino, ino + XFS_INODES_PER_CHUNK,
 			     &first_rec, &last_rec);
@@ -1122,7 +1122,7 @@ _("finobt record with no free inodes, inode chunk %d/%u\n"), agno, ino);
 
 /*
  * this one walks the inode btrees sucking the info there into
- * the incore avl tree.  We try and rescue corrupted btree records
+ * the incore inode tree.  We try and rescue corrupted btree records
  * to minimize our chances of losing inodes.  Inode info from potentially
  * corrupt sources could be bogus so rather than put the info straight
  * into the tree, instead we put it on a list and try and verify the
@@ -1501,6 +1501,9 @@ scan_ag(
 	int		sb_dirty = 0;
 	int		status;
 	char		*objname = NULL;
+	struct stats_ag_timer	timer;
+
+	stats_ag_start(&timer);
 
 	sb = (struct xfs_sb *)calloc(BBTOB(XFS_FSS_TO_BB(mp, 1)), 1);
 	if (!sb) {
@@ -1622,6 +1625,7 @@ scan_ag(
 		libxfs_putbuf(sbbuf);
 	free(sb);
 	PROG_RPT_INC(prog_rpt_done[agno], 1);
+	stats_ag_end(&timer, agno);
 
 #ifdef XR_INODE_TRACE
 	print_inode_list(i);
@@ -1636,6 +1640,7 @@ out_free_sbbuf:
 	libxfs_putbuf(sbbuf);
 out_free_sb:
 	free(sb);
+	stats_ag_end(&timer, agno);
 
 	if (objname)
 		do_error(_("can't get %s for ag %d\n"), objname, agno);
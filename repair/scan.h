@@ -20,6 +20,8 @@
 
 struct blkmap;
 
+void set_mp(struct xfs_mount *mpp);
+
 int scan_lbtree(
 	xfs_dfsbno_t	root,
 	int		nlevels,
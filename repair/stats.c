@@ -0,0 +1,358 @@
+/*
+ * Per-phase and per-AG statistics for profiling repair.
+ *
+ * With -o stats=file or -o stats_fd=fd, xfs_repair writes one JSON object
+ * per line describing how the run went.  The "type" member says what the
+ * line is:
+ *
+ *  start	written when the file is opened: version and device
+ *  fs		the filesystem geometry and the thread and prefetch setup,
+ *		written once those are known, which is after phase 1 has
+ *		ended, so the phase 1 line comes before it
+ *  phase	written at the end of each phase: elapsed time, I/O done
+ *		through libxfs and by prefetch, buffer cache hits, misses
+ *		and size, and how busy the worker threads were
+ *  ag		one per AG that did any work in the phase, written after
+ *		the phase line: time spent on the AG summed over all the
+ *		threads that worked on it, the I/O those threads did, and
+ *		what prefetch read for it and the most buffers it had queued
+ *  end		the total run time and exit status
+ *
+ * Times are in seconds.  The phase counters are deltas over the phase.
+ * Lines are flushed as they are written, so a run that dies part way
+ * through leaves a usable file behind.
+ */
+
+#include <libxfs.h>
+#include "globals.h"
+#include "err_protos.h"
+#include "threads.h"
+#include "prefetch.h"
+#include "stats.h"
+
+struct ag_stats {
+	__uint64_t		runs;		/* pieces of work timed */
+	__uint64_t		busy_ns;
+	__uint64_t		reads;
+	__uint64_t		read_bytes;
+	__uint64_t		writes;
+	__uint64_t		write_bytes;
+	__uint64_t		pf_reads;
+	__uint64_t		pf_read_bytes;
+	int			pf_max_queued;
+};
+
+struct stats_sample {
+	struct timespec		time;
+	struct libxfs_iostats	io;
+	unsigned long long	cache_hits;
+	unsigned long long	cache_misses;
+	struct work_stats	work;
+};
+
+static FILE			*stats_fp;
+static pthread_mutex_t		stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ag_stats		*ag_stats;
+static xfs_agnumber_t		ag_stats_count;
+static struct stats_sample	phase_sample;
+static struct timespec		run_start;
+
+static __uint64_t
+ts_diff_ns(
+	struct timespec		*start,
+	struct timespec		*end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000ULL +
+		end->tv_nsec - start->tv_nsec;
+}
+
+static double
+ns_to_secs(
+	__uint64_t		ns)
+{
+	return (double)ns / 1000000000.0;
+}
+
+/*
+ * Write a JSON string, escaping what has to be escaped.
+ */
+static void
+json_string(
+	const char		*s)
+{
+	fputc('"', stats_fp);
+	for (; s && *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(stats_fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(stats_fp, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, stats_fp);
+	}
+	fputc('"', stats_fp);
+}
+
+static void
+json_end(void)
+{
+	fputs("}\n", stats_fp);
+	fflush(stats_fp);
+}
+
+static void
+take_sample(
+	struct stats_sample	*s)
+{
+	clock_gettime(CLOCK_MONOTONIC, &s->time);
+	libxfs_iostats(&s->io, NULL);
+	if (libxfs_bcache) {
+		s->cache_hits = cache_hits(libxfs_bcache, NULL);
+		s->cache_misses = libxfs_bcache->c_misses;
+	} else {
+		s->cache_hits = 0;
+		s->cache_misses = 0;
+	}
+	work_queue_stats(&s->work);
+}
+
+void
+stats_open(void)
+{
+	struct timespec		now;
+
+	clock_gettime(CLOCK_MONOTONIC, &run_start);
+
+	if (stats_path) {
+		stats_fp = fopen(stats_path, "w");
+		if (!stats_fp)
+			do_error(_("cannot open stats file %s: %s\n"),
+				stats_path, strerror(errno));
+	} else if (stats_fd >= 0) {
+		stats_fp = fdopen(stats_fd, "w");
+		if (!stats_fp)
+			do_error(_("cannot write stats to fd %d: %s\n"),
+				stats_fd, strerror(errno));
+	} else
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	fprintf(stats_fp, "{\"type\":\"start\",\"time\":%ld.%03ld,\"version\":",
+		(long)now.tv_sec, now.tv_nsec / 1000000);
+	json_string(VERSION);
+	fputs(",\"device\":", stats_fp);
+	json_string(fs_name);
+	fprintf(stats_fp, ",\"no_modify\":%d", no_modify);
+	json_end();
+}
+
+/*
+ * Called once the geometry is known and the thread count has been worked
+ * out, before phase 2.
+ */
+void
+stats_init_ags(
+	struct xfs_mount	*mp)
+{
+	if (!stats_fp)
+		return;
+
+	ag_stats_count = mp->m_sb.sb_agcount;
+	ag_stats = calloc(ag_stats_count, sizeof(struct ag_stats));
+	if (!ag_stats)
+		do_error(_("cannot allocate AG statistics\n"));
+
+	fprintf(stats_fp, "{\"type\":\"fs\",\"agcount\":%u,\"agblocks\":%u,"
+		"\"blocksize\":%u,\"dblocks\":%llu,\"icount\":%llu,"
+		"\"ag_stride\":%d,\"threads\":%d,\"prefetch\":%d,"
+		"\"pf_engine\":\"%s\",\"pf_depth\":%d",
+		mp->m_sb.sb_agcount, mp->m_sb.sb_agblocks,
+		mp->m_sb.sb_blocksize,
+		(unsigned long long)mp->m_sb.sb_dblocks,
+		(unsigned long long)mp->m_sb.sb_icount,
+		ag_stride, thread_count, do_prefetch,
+		pf_io_engine == PF_IO_URING ? "uring" : "sync", pf_io_depth);
+	json_end();
+}
+
+void
+stats_close(
+	int			status)
+{
+	struct timespec		now;
+
+	if (!stats_fp)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fprintf(stats_fp, "{\"type\":\"end\",\"elapsed\":%.6f,\"status\":%d",
+		ns_to_secs(ts_diff_ns(&run_start, &now)), status);
+	json_end();
+	fclose(stats_fp);
+	stats_fp = NULL;
+	free(ag_stats);
+	ag_stats = NULL;
+}
+
+/*
+ * Phases are run one after the other from the main thread, so nothing else
+ * touches the AG counters while they are reset and written out.
+ */
+void
+stats_phase_start(
+	int			phase)
+{
+	if (!stats_fp)
+		return;
+
+	take_sample(&phase_sample);
+	if (ag_stats)
+		memset(ag_stats, 0, ag_stats_count * sizeof(struct ag_stats));
+}
+
+void
+stats_phase_end(
+	int			phase)
+{
+	struct stats_sample	now;
+	struct stats_sample	*then = &phase_sample;
+	struct ag_stats		*ag;
+	__uint64_t		busy, alive;
+	__uint64_t		pf_reads = 0, pf_read_bytes = 0;
+	int			pf_max_queued = 0;
+	xfs_agnumber_t		agno;
+
+	/* phase 0 is just the time it took to parse the arguments */
+	if (!stats_fp || phase == 0)
+		return;
+
+	take_sample(&now);
+
+	for (agno = 0; agno < ag_stats_count; agno++) {
+		ag = &ag_stats[agno];
+		pf_reads += ag->pf_reads;
+		pf_read_bytes += ag->pf_read_bytes;
+		pf_max_queued = max(pf_max_queued, ag->pf_max_queued);
+	}
+
+	busy = now.work.busy_ns - then->work.busy_ns;
+	alive = now.work.alive_ns - then->work.alive_ns;
+
+	fprintf(stats_fp, "{\"type\":\"phase\",\"phase\":%d,"
+		"\"elapsed\":%.6f,"
+		"\"reads\":%llu,\"read_bytes\":%llu,"
+		"\"writes\":%llu,\"write_bytes\":%llu,"
+		"\"pf_reads\":%llu,\"pf_read_bytes\":%llu,"
+		"\"pf_max_queued\":%d,",
+		phase, ns_to_secs(ts_diff_ns(&then->time, &now.time)),
+		now.io.reads - then->io.reads,
+		now.io.read_bytes - then->io.read_bytes,
+		now.io.writes - then->io.writes,
+		now.io.write_bytes - then->io.write_bytes,
+		(unsigned long long)pf_reads,
+		(unsigned long long)pf_read_bytes, pf_max_queued);
+	if (libxfs_bcache)
+		fprintf(stats_fp, "\"cache_hits\":%llu,\"cache_misses\":%llu,"
+			"\"cache_count\":%u,\"cache_max\":%u,"
+			"\"cache_maxcount\":%u,\"cache_overflowed\":%s,",
+			now.cache_hits - then->cache_hits,
+			now.cache_misses - then->cache_misses,
+			libxfs_bcache->c_count, libxfs_bcache->c_max,
+			libxfs_bcache->c_maxcount,
+			libxfs_bcache_overflowed() ? "true" : "false");
+	fprintf(stats_fp, "\"workers\":%llu,\"work_items\":%llu,"
+		"\"work_steals\":%llu,\"worker_busy\":%.6f,"
+		"\"worker_alive\":%.6f,\"worker_utilisation\":%.4f",
+		(unsigned long long)(now.work.threads - then->work.threads),
+		(unsigned long long)(now.work.items - then->work.items),
+		(unsigned long long)(now.work.steals - then->work.steals),
+		ns_to_secs(busy), ns_to_secs(alive),
+		alive ? (double)busy / alive : 0.0);
+	json_end();
+
+	for (agno = 0; agno < ag_stats_count; agno++) {
+		ag = &ag_stats[agno];
+		if (!ag->runs && !ag->pf_reads)
+			continue;
+		fprintf(stats_fp, "{\"type\":\"ag\",\"phase\":%d,\"agno\":%u,"
+			"\"runs\":%llu,\"busy\":%.6f,"
+			"\"reads\":%llu,\"read_bytes\":%llu,"
+			"\"writes\":%llu,\"write_bytes\":%llu,"
+			"\"pf_reads\":%llu,\"pf_read_bytes\":%llu,"
+			"\"pf_max_queued\":%d",
+			phase, agno,
+			(unsigned long long)ag->runs, ns_to_secs(ag->busy_ns),
+			(unsigned long long)ag->reads,
+			(unsigned long long)ag->read_bytes,
+			(unsigned long long)ag->writes,
+			(unsigned long long)ag->write_bytes,
+			(unsigned long long)ag->pf_reads,
+			(unsigned long long)ag->pf_read_bytes,
+			ag->pf_max_queued);
+		json_end();
+	}
+}
+
+/*
+ * Time a piece of per-AG work and count the I/O the calling thread did
+ * for it.  The work for one AG may be split over several threads, so the
+ * counters are added up.
+ */
+void
+stats_ag_start(
+	struct stats_ag_timer	*timer)
+{
+	if (!ag_stats)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &timer->start);
+	libxfs_iostats(NULL, &timer->io);
+}
+
+void
+stats_ag_end(
+	struct stats_ag_timer	*timer,
+	xfs_agnumber_t		agno)
+{
+	struct ag_stats		*ag;
+	struct libxfs_iostats	io;
+	struct timespec		now;
+
+	if (!ag_stats || agno >= ag_stats_count)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	libxfs_iostats(NULL, &io);
+
+	ag = &ag_stats[agno];
+	__sync_fetch_and_add(&ag->runs, 1);
+	__sync_fetch_and_add(&ag->busy_ns, ts_diff_ns(&timer->start, &now));
+	__sync_fetch_and_add(&ag->reads, io.reads - timer->io.reads);
+	__sync_fetch_and_add(&ag->read_bytes,
+			     io.read_bytes - timer->io.read_bytes);
+	__sync_fetch_and_add(&ag->writes, io.writes - timer->io.writes);
+	__sync_fetch_and_add(&ag->write_bytes,
+			     io.write_bytes - timer->io.write_bytes);
+}
+
+/*
+ * Called by prefetch when it is done with an AG.
+ */
+void
+stats_ag_prefetch(
+	xfs_agnumber_t		agno,
+	__uint64_t		reads,
+	__uint64_t		read_bytes,
+	int			max_queued)
+{
+	struct ag_stats		*ag;
+
+	if (!ag_stats || agno >= ag_stats_count)
+		return;
+
+	ag = &ag_stats[agno];
+	pthread_mutex_lock(&stats_lock);
+	ag->pf_reads += reads;
+	ag->pf_read_bytes += read_bytes;
+	ag->pf_max_queued = max(ag->pf_max_queued, max_queued);
+	pthread_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,25 @@
+#ifndef _XR_STATS_H
+#define _XR_STATS_H
+
+/*
+ * Machine readable per-phase and per-AG statistics, written as JSON lines
+ * with -o stats=file or -o stats_fd=fd.  See stats.c.
+ */
+struct stats_ag_timer {
+	struct timespec		start;
+	struct libxfs_iostats	io;
+};
+
+void	stats_open(void);
+void	stats_init_ags(struct xfs_mount *mp);
+void	stats_close(int status);
+
+void	stats_phase_start(int phase);
+void	stats_phase_end(int phase);
+
+void	stats_ag_start(struct stats_ag_timer *timer);
+void	stats_ag_end(struct stats_ag_timer *timer, xfs_agnumber_t agno);
+void	stats_ag_prefetch(xfs_agnumber_t agno, __uint64_t reads,
+			  __uint64_t read_bytes, int max_queued);
+
+#endif /* _XR_STATS_H */
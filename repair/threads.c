@@ -6,47 +6,199 @@
 #include "protos.h"
 #include "globals.h"
 
+/*
+ * Work items are allocated in chunks and recycled through the per-worker
+ * item caches; the chunks are only freed when the queue is destroyed.
+ */
+#define WORK_ITEM_CHUNK		64
+
+struct work_item_chunk {
+	struct list_head	list;
+	work_item_t		items[WORK_ITEM_CHUNK];
+};
+
+static pthread_key_t	worker_key;
+static pthread_once_t	worker_key_once = PTHREAD_ONCE_INIT;
+
+static struct work_stats	work_totals;
+
+static __uint64_t
+now_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+worker_key_create(void)
+{
+	pthread_key_create(&worker_key, NULL);
+}
+
+/*
+ * Return the calling thread's worker if it belongs to this queue.
+ */
+static work_worker_t *
+current_worker(
+	work_queue_t	*wq)
+{
+	work_worker_t	*worker = pthread_getspecific(worker_key);
+
+	if (worker && worker->queue == wq)
+		return worker;
+	return NULL;
+}
+
+/*
+ * Take a free work item from the worker's cache, refilling it if it is
+ * empty. Called with the worker locked.
+ */
+static work_item_t *
+get_work_item(
+	work_queue_t		*wq,
+	work_worker_t		*worker)
+{
+	struct work_item_chunk	*chunk;
+	work_item_t		*wi;
+	int			i;
+
+	if (list_empty(&worker->free_items)) {
+		chunk = malloc(sizeof(struct work_item_chunk));
+		if (chunk == NULL)
+			do_error(
+			_("cannot allocate worker item, error = [%d] %s\n"),
+				errno, strerror(errno));
+		for (i = 0; i < WORK_ITEM_CHUNK; i++)
+			list_add_tail(&chunk->items[i].list,
+				      &worker->free_items);
+
+		pthread_mutex_lock(&wq->lock);
+		list_add(&chunk->list, &wq->item_chunks);
+		pthread_mutex_unlock(&wq->lock);
+	}
+
+	wi = list_entry(worker->free_items.next, work_item_t, list);
+	list_del_init(&wi->list);
+	return wi;
+}
+
+/*
+ * Take the oldest item off a list, if there is one.
+ */
+static work_item_t *
+pop_oldest(
+	struct list_head	*head)
+{
+	work_item_t		*wi;
+
+	if (list_empty(head))
+		return NULL;
+	wi = list_entry(head->next, work_item_t, list);
+	list_del_init(&wi->list);
+	return wi;
+}
+
+/*
+ * Find the next item to run: the newest item on our own deque, the oldest
+ * item queued to us from outside, or failing that the oldest item of
+ * somebody else's.
+ */
+static work_item_t *
+next_work_item(
+	work_queue_t	*wq,
+	work_worker_t	*self)
+{
+	work_worker_t	*victim;
+	work_item_t	*wi = NULL;
+	int		start = self - wq->workers;
+	int		i;
+
+	pthread_mutex_lock(&self->lock);
+	if (!list_empty(&self->items)) {
+		wi = list_entry(self->items.prev, work_item_t, list);
+		list_del_init(&wi->list);
+	} else
+		wi = pop_oldest(&self->queued);
+	pthread_mutex_unlock(&self->lock);
+	if (wi)
+		return wi;
+
+	for (i = 1; i < wq->thread_count; i++) {
+		victim = &wq->workers[(start + i) % wq->thread_count];
+		pthread_mutex_lock(&victim->lock);
+		wi = pop_oldest(&victim->queued);
+		if (!wi)
+			wi = pop_oldest(&victim->items);
+		pthread_mutex_unlock(&victim->lock);
+		if (wi) {
+			self->nr_stolen++;
+			return wi;
+		}
+	}
+	return NULL;
+}
+
 static void *
 worker_thread(void *arg)
 {
-	work_queue_t	*wq;
+	work_worker_t	*self = arg;
+	work_queue_t	*wq = self->queue;
 	work_item_t	*wi;
+	__uint64_t	born = now_ns();
+	__uint64_t	busy = 0;
+	__uint64_t	start;
 
-	wq = (work_queue_t*)arg;
+	pthread_setspecific(worker_key, self);
 
 	/*
-	 * Loop pulling work from the passed in work queue.
-	 * Check for notification to exit after every chunk of work.
+	 * Loop pulling work from our own deque or stealing it from others.
+	 * We can only exit once the queue is being torn down and no work is
+	 * queued or running anywhere, as running items may queue more work.
 	 */
 	while (1) {
-		pthread_mutex_lock(&wq->lock);
-
-		/*
-		 * Wait for work.
-		 */
-		while (wq->next_item == NULL && !wq->terminate) {
-			ASSERT(wq->item_count == 0);
-			pthread_cond_wait(&wq->wakeup, &wq->lock);
-		}
-		if (wq->next_item == NULL && wq->terminate) {
+		wi = next_work_item(wq, self);
+		if (wi == NULL) {
+			pthread_mutex_lock(&wq->lock);
+			__sync_fetch_and_add(&wq->idle_count, 1);
+			while (__sync_fetch_and_add(&wq->item_count, 0) == 0 &&
+			       !(wq->terminate &&
+				 __sync_fetch_and_add(&wq->pending, 0) == 0))
+				pthread_cond_wait(&wq->wakeup, &wq->lock);
+			__sync_fetch_and_sub(&wq->idle_count, 1);
+			if (wq->item_count == 0) {
+				pthread_mutex_unlock(&wq->lock);
+				break;
+			}
 			pthread_mutex_unlock(&wq->lock);
-			break;
+			continue;
 		}
+		__sync_fetch_and_sub(&wq->item_count, 1);
 
-		/*
-		 *  Dequeue work from the head of the list.
-		 */
-		ASSERT(wq->item_count > 0);
-		wi = wq->next_item;
-		wq->next_item = wi->next;
-		wq->item_count--;
+		start = now_ns();
+		(wi->function)(wi->queue, wi->agno, wi->arg);
+		busy += now_ns() - start;
+		self->nr_run++;
 
-		pthread_mutex_unlock(&wq->lock);
+		pthread_mutex_lock(&self->lock);
+		list_add(&wi->list, &self->free_items);
+		pthread_mutex_unlock(&self->lock);
 
-		(wi->function)(wi->queue, wi->agno, wi->arg);
-		free(wi);
+		/* wake up idle workers if that was the last piece of work */
+		if (__sync_sub_and_fetch(&wq->pending, 1) == 0 &&
+		    __sync_fetch_and_add(&wq->terminate, 0)) {
+			pthread_mutex_lock(&wq->lock);
+			pthread_cond_broadcast(&wq->wakeup);
+			pthread_mutex_unlock(&wq->lock);
+		}
 	}
 
+	__sync_fetch_and_add(&work_totals.threads, 1);
+	__sync_fetch_and_add(&work_totals.items, self->nr_run);
+	__sync_fetch_and_add(&work_totals.steals, self->nr_stolen);
+	__sync_fetch_and_add(&work_totals.busy_ns, busy);
+	__sync_fetch_and_add(&work_totals.alive_ns, now_ns() - born);
 	return NULL;
 }
 
@@ -71,21 +223,39 @@ create_work_queue(
 	xfs_mount_t		*mp,
 	int			nworkers)
 {
+	work_worker_t		*worker;
 	int			err;
 	int			i;
 
+	ASSERT(nworkers > 0);
+	pthread_once(&worker_key_once, worker_key_create);
+
 	memset(wq, 0, sizeof(work_queue_t));
 
 	pthread_cond_init(&wq->wakeup, NULL);
 	pthread_mutex_init(&wq->lock, NULL);
+	list_head_init(&wq->item_chunks);
 
 	wq->mp = mp;
 	wq->thread_count = nworkers;
-	wq->threads = malloc(nworkers * sizeof(pthread_t));
+	wq->workers = calloc(nworkers, sizeof(work_worker_t));
+	if (wq->workers == NULL)
+		do_error(_("cannot allocate worker threads, error = [%d] %s\n"),
+			errno, strerror(errno));
 	wq->terminate = 0;
 
 	for (i = 0; i < nworkers; i++) {
-		err = pthread_create(&wq->threads[i], NULL, worker_thread, wq);
+		worker = &wq->workers[i];
+		list_head_init(&worker->items);
+		list_head_init(&worker->queued);
+		list_head_init(&worker->free_items);
+		pthread_mutex_init(&worker->lock, NULL);
+		worker->queue = wq;
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		err = pthread_create(&wq->workers[i].thread, NULL,
+				     worker_thread, &wq->workers[i]);
 		if (err != 0) {
 			do_error(_("cannot create worker threads, error = [%d] %s\n"),
 				err, strerror(err));
@@ -101,51 +271,84 @@ queue_work(
 	xfs_agnumber_t	agno,
 	void		*arg)
 {
+	work_worker_t	*worker;
 	work_item_t	*wi;
+	struct list_head *head;
 
-	wi = (work_item_t *)malloc(sizeof(work_item_t));
-	if (wi == NULL)
-		do_error(_("cannot allocate worker item, error = [%d] %s\n"),
-			errno, strerror(errno));
+	/*
+	 * Work queued by one of our own workers stays local, anything else
+	 * is handed out round robin.
+	 */
+	worker = current_worker(wq);
+	if (worker) {
+		head = &worker->items;
+	} else {
+		pthread_mutex_lock(&wq->lock);
+		worker = &wq->workers[wq->next_worker];
+		wq->next_worker = (wq->next_worker + 1) % wq->thread_count;
+		pthread_mutex_unlock(&wq->lock);
+		head = &worker->queued;
+	}
 
+	__sync_fetch_and_add(&wq->pending, 1);
+
+	pthread_mutex_lock(&worker->lock);
+	wi = get_work_item(wq, worker);
 	wi->function = func;
 	wi->agno = agno;
 	wi->arg = arg;
 	wi->queue = wq;
-	wi->next = NULL;
+	list_add_tail(&wi->list, head);
+	pthread_mutex_unlock(&worker->lock);
 
 	/*
-	 *  Now queue the new work structure to the work queue.
+	 * The item count has to be visible before we look for idle workers,
+	 * they check it again under wq->lock before going to sleep.
 	 */
-	pthread_mutex_lock(&wq->lock);
-	if (wq->next_item == NULL) {
-		wq->next_item = wi;
-		ASSERT(wq->item_count == 0);
+	__sync_fetch_and_add(&wq->item_count, 1);
+	if (__sync_fetch_and_add(&wq->idle_count, 0)) {
+		pthread_mutex_lock(&wq->lock);
 		pthread_cond_signal(&wq->wakeup);
-	} else {
-		wq->last_item->next = wi;
+		pthread_mutex_unlock(&wq->lock);
 	}
-	wq->last_item = wi;
-	wq->item_count++;
-	pthread_mutex_unlock(&wq->lock);
 }
 
 void
 destroy_work_queue(
 	work_queue_t	*wq)
 {
+	struct work_item_chunk	*chunk;
 	int		i;
 
 	pthread_mutex_lock(&wq->lock);
 	wq->terminate = 1;
+	pthread_cond_broadcast(&wq->wakeup);
 	pthread_mutex_unlock(&wq->lock);
 
-	pthread_cond_broadcast(&wq->wakeup);
+	for (i = 0; i < wq->thread_count; i++)
+		pthread_join(wq->workers[i].thread, NULL);
 
 	for (i = 0; i < wq->thread_count; i++)
-		pthread_join(wq->threads[i], NULL);
+		pthread_mutex_destroy(&wq->workers[i].lock);
+	free(wq->workers);
 
-	free(wq->threads);
+	while (!list_empty(&wq->item_chunks)) {
+		chunk = list_entry(wq->item_chunks.next,
+				   struct work_item_chunk, list);
+		list_del_init(&chunk->list);
+		free(chunk);
+	}
 	pthread_mutex_destroy(&wq->lock);
 	pthread_cond_destroy(&wq->wakeup);
 }
+
+void
+work_queue_stats(
+	struct work_stats	*stats)
+{
+	stats->threads = __sync_fetch_and_add(&work_totals.threads, 0);
+	stats->items = __sync_fetch_and_add(&work_totals.items, 0);
+	stats->steals = __sync_fetch_and_add(&work_totals.steals, 0);
+	stats->busy_ns = __sync_fetch_and_add(&work_totals.busy_ns, 0);
+	stats->alive_ns = __sync_fetch_and_add(&work_totals.alive_ns, 0);
+}
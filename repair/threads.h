@@ -8,19 +8,41 @@ struct  work_queue;
 typedef void work_func_t(struct work_queue *, xfs_agnumber_t, void *);
 
 typedef struct work_item {
-	struct work_item	*next;
+	struct list_head	list;
 	work_func_t		*function;
 	struct work_queue	*queue;
 	xfs_agnumber_t		agno;
 	void			*arg;
 } work_item_t;
 
+/*
+ * Each worker thread has its own deque of work items and a cache of free
+ * items. Work queued from a worker goes on that worker's deque and is run
+ * newest first; work queued from outside is spread over the workers and
+ * run in the order it was queued, after any work of the worker's own. A
+ * worker that runs out of work steals the oldest item from another
+ * worker, so work items may queue smaller pieces of work (e.g. ranges of
+ * an AG) and have them picked up by idle threads.
+ */
+typedef struct work_worker {
+	struct list_head	items;		/* work queued by this worker */
+	struct list_head	queued;		/* work queued from outside */
+	struct list_head	free_items;	/* item cache */
+	pthread_mutex_t		lock;
+	pthread_t		thread;
+	struct work_queue	*queue;
+	__uint64_t		nr_run;		/* items run */
+	__uint64_t		nr_stolen;	/* items stolen */
+} work_worker_t;
+
 typedef struct  work_queue {
-	work_item_t		*next_item;
-	work_item_t		*last_item;
-	int			item_count;
+	work_worker_t		*workers;
 	int			thread_count;
-	pthread_t		*threads;
+	int			next_worker;	/* round robin queueing */
+	int			item_count;	/* items on the deques */
+	int			pending;	/* queued plus running items */
+	int			idle_count;	/* workers waiting for work */
+	struct list_head	item_chunks;	/* work item allocations */
 	xfs_mount_t		*mp;
 	pthread_mutex_t		lock;
 	pthread_cond_t		wakeup;
@@ -44,4 +66,19 @@ void
 destroy_work_queue(
 	work_queue_t		*wq);
 
+/*
+ * Totals over all work queues, added to as each worker thread exits.
+ */
+struct work_stats {
+	__uint64_t		threads;	/* workers started */
+	__uint64_t		items;		/* work items run */
+	__uint64_t		steals;		/* ... taken from another worker */
+	__uint64_t		busy_ns;	/* time spent running items */
+	__uint64_t		alive_ns;	/* time the workers existed */
+};
+
+void
+work_queue_stats(
+	struct work_stats	*stats);
+
 #endif	/* _XFS_REPAIR_THREADS_H_ */
@@ -0,0 +1,319 @@
+/*
+ * A very small io_uring wrapper, talking to the kernel through the raw
+ * syscalls so we don't grow a dependency on liburing.  Only what the
+ * prefetch code needs is implemented: queueing reads, submitting them and
+ * waiting for completions one at a time.
+ *
+ * <linux/io_uring.h> drags in <linux/fs.h>, which clashes with the libxfs
+ * headers, so this file deliberately only uses system headers.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define uring_load_acquire(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define uring_store_release(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int
+sys_io_uring_setup(
+	unsigned int		entries,
+	struct io_uring_params	*p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(
+	int			fd,
+	unsigned int		to_submit,
+	unsigned int		min_complete,
+	unsigned int		flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			flags, NULL, 0);
+}
+
+int
+uring_init(
+	struct uring		*ring,
+	unsigned int		entries)
+{
+	struct io_uring_params	p;
+	int			error;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+
+	ring->fd = sys_io_uring_setup(entries, &p);
+	if (ring->fd < 0)
+		return -errno;
+
+	ring->entries = p.sq_entries;
+	ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(__u32);
+	ring->cq_ring_sz = p.cq_off.cqes +
+				p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_sz > ring->sq_ring_sz)
+			ring->sq_ring_sz = ring->cq_ring_sz;
+		ring->cq_ring_sz = ring->sq_ring_sz;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		goto out_close;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_sz,
+				PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring->fd,
+				IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED)
+			goto out_unmap_sq;
+	}
+
+	ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto out_unmap_cq;
+
+	ring->sq_khead = ring->sq_ring + p.sq_off.head;
+	ring->sq_ktail = ring->sq_ring + p.sq_off.tail;
+	ring->sq_mask = *(unsigned int *)(ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_array = ring->sq_ring + p.sq_off.array;
+	ring->sqe_tail = ring->sqe_submitted = *ring->sq_ktail;
+
+	ring->cq_khead = ring->cq_ring + p.cq_off.head;
+	ring->cq_ktail = ring->cq_ring + p.cq_off.tail;
+	ring->cq_mask = *(unsigned int *)(ring->cq_ring + p.cq_off.ring_mask);
+	ring->cqes = ring->cq_ring + p.cq_off.cqes;
+	return 0;
+
+out_unmap_cq:
+	error = -errno;
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_sz);
+	goto out_unmap;
+out_unmap_sq:
+	error = -errno;
+out_unmap:
+	munmap(ring->sq_ring, ring->sq_ring_sz);
+	close(ring->fd);
+	return error;
+out_close:
+	error = -errno;
+	close(ring->fd);
+	return error;
+}
+
+void
+uring_exit(
+	struct uring		*ring)
+{
+	munmap(ring->sqes, ring->sqes_sz);
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_sz);
+	munmap(ring->sq_ring, ring->sq_ring_sz);
+	close(ring->fd);
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(
+	struct uring		*ring)
+{
+	struct io_uring_sqe	*sqe;
+	unsigned int		head = uring_load_acquire(ring->sq_khead);
+	unsigned int		idx;
+
+	if (ring->sqe_tail - head >= ring->entries)
+		return NULL;
+
+	idx = ring->sqe_tail & ring->sq_mask;
+	ring->sq_array[idx] = idx;
+	sqe = (struct io_uring_sqe *)ring->sqes + idx;
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sqe_tail++;
+	return sqe;
+}
+
+/*
+ * Queue a read of @len bytes at @offset into @buf.  @data is handed back by
+ * uring_wait() when the read completes.  Returns -EBUSY if the submission
+ * queue is full.
+ */
+int
+uring_prep_read(
+	struct uring		*ring,
+	int			fd,
+	void			*buf,
+	unsigned int		len,
+	off64_t			offset,
+	void			*data)
+{
+	struct io_uring_sqe	*sqe = uring_get_sqe(ring);
+
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = (unsigned long)data;
+	return 0;
+}
+
+/*
+ * Queue a vectored read at @offset. The iovec array must stay valid until
+ * the read completes.
+ */
+int
+uring_prep_readv(
+	struct uring		*ring,
+	int			fd,
+	const struct iovec	*iov,
+	int			nr_vecs,
+	off64_t			offset,
+	void			*data)
+{
+	struct io_uring_sqe	*sqe = uring_get_sqe(ring);
+
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)iov;
+	sqe->len = nr_vecs;
+	sqe->off = offset;
+	sqe->user_data = (unsigned long)data;
+	return 0;
+}
+
+/*
+ * Hand all queued sqes to the kernel.  Returns the number submitted or a
+ * negative errno.
+ */
+int
+uring_submit(
+	struct uring		*ring)
+{
+	unsigned int		to_submit;
+	int			ret;
+
+	to_submit = ring->sqe_tail - ring->sqe_submitted;
+	if (!to_submit)
+		return 0;
+
+	uring_store_release(ring->sq_ktail, ring->sqe_tail);
+	do {
+		ret = sys_io_uring_enter(ring->fd, to_submit, 0, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+
+	ring->sqe_submitted += ret;
+	return ret;
+}
+
+/*
+ * Wait for the next completion, returning the caller's tag in @data and the
+ * read result (bytes transferred or negative errno) in @res.
+ */
+int
+uring_wait(
+	struct uring		*ring,
+	void			**data,
+	int			*res)
+{
+	struct io_uring_cqe	*cqe;
+	unsigned int		head;
+	int			ret;
+
+	for (;;) {
+		head = *ring->cq_khead;
+		if (head != uring_load_acquire(ring->cq_ktail))
+			break;
+		ret = sys_io_uring_enter(ring->fd, 0, 1,
+				IORING_ENTER_GETEVENTS);
+		if (ret < 0 && errno != EINTR)
+			return -errno;
+	}
+
+	cqe = (struct io_uring_cqe *)ring->cqes + (head & ring->cq_mask);
+	*data = (void *)(unsigned long)cqe->user_data;
+	*res = cqe->res;
+	uring_store_release(ring->cq_khead, head + 1);
+	return 0;
+}
+
+#else	/* !HAVE_IO_URING */
+
+int
+uring_init(
+	struct uring		*ring,
+	unsigned int		entries)
+{
+	return -ENOSYS;
+}
+
+void
+uring_exit(
+	struct uring		*ring)
+{
+}
+
+int
+uring_prep_read(
+	struct uring		*ring,
+	int			fd,
+	void			*buf,
+	unsigned int		len,
+	off64_t			offset,
+	void			*data)
+{
+	return -ENOSYS;
+}
+
+int
+uring_prep_readv(
+	struct uring		*ring,
+	int			fd,
+	const struct iovec	*iov,
+	int			nr_vecs,
+	off64_t			offset,
+	void			*data)
+{
+	return -ENOSYS;
+}
+
+int
+uring_submit(
+	struct uring		*ring)
+{
+	return -ENOSYS;
+}
+
+int
+uring_wait(
+	struct uring		*ring,
+	void			**data,
+	int			*res)
+{
+	return -ENOSYS;
+}
+
+#endif	/* HAVE_IO_URING */
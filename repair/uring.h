@@ -0,0 +1,46 @@
+#ifndef _XFS_REPAIR_URING_H
+#define	_XFS_REPAIR_URING_H
+
+struct iovec;
+
+/*
+ * Minimal io_uring submission/completion ring used by the prefetch code.
+ * A ring is owned by a single thread; there is no internal locking.
+ */
+
+struct uring {
+	int		fd;
+	unsigned int	entries;
+	unsigned int	sqe_tail;	/* next sqe to hand out */
+	unsigned int	sqe_submitted;	/* sqes already given to the kernel */
+
+	/* submission queue */
+	unsigned int	*sq_khead;
+	unsigned int	*sq_ktail;
+	unsigned int	sq_mask;
+	unsigned int	*sq_array;
+	void		*sqes;
+	void		*sq_ring;
+	size_t		sq_ring_sz;
+
+	/* completion queue */
+	unsigned int	*cq_khead;
+	unsigned int	*cq_ktail;
+	unsigned int	cq_mask;
+	void		*cqes;
+	void		*cq_ring;
+	size_t		cq_ring_sz;
+	size_t		sqes_sz;
+};
+
+int	uring_init(struct uring *ring, unsigned int entries);
+void	uring_exit(struct uring *ring);
+
+int	uring_prep_read(struct uring *ring, int fd, void *buf,
+			unsigned int len, off64_t offset, void *data);
+int	uring_prep_readv(struct uring *ring, int fd, const struct iovec *iov,
+			int nr_vecs, off64_t offset, void *data);
+int	uring_submit(struct uring *ring);
+int	uring_wait(struct uring *ring, void **data, int *res);
+
+#endif /* _XFS_REPAIR_URING_H */
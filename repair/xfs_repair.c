@@ -18,8 +18,6 @@
 
 #include <xfs/libxlog.h>
 #include <sys/resource.h>
-#include "avl.h"
-#include "avl64.h"
 #include "globals.h"
 #include "versions.h"
 #include "agheader.h"
@@ -30,6 +28,9 @@
 #include "threads.h"
 #include "progress.h"
 #include "dinode.h"
+#include "scan.h"
+#include "checkpoint.h"
+#include "stats.h"
 
 #define	rounddown(x, y)	(((x)/(y))*(y))
 
@@ -57,6 +58,22 @@ static char *o_opts[] = {
 	"force_geometry",
 #define PHASE2_THREADS	6
 	"phase2_threads",
+#define PF_ENGINE	7
+	"pf_engine",
+#define PF_DEPTH	8
+	"pf_depth",
+#define BCACHE_POLICY	9
+	"bcache_policy",
+#define SPILL_DIR	10
+	"spill_dir",
+#define SPILL_LIMIT	11
+	"spill_limit",
+#define CHECKPOINT	12
+	"checkpoint",
+#define STATS_FILE	13
+	"stats",
+#define STATS_FD	14
+	"stats_fd",
 	NULL
 };
 
@@ -71,7 +88,6 @@ static char *c_opts[] = {
 
 
 static int	bhash_option_used;
-static long	max_mem_specified;	/* in megabytes */
 static int	phase2_threads = 32;
 
 static void
@@ -209,6 +225,7 @@ process_args(int argc, char **argv)
 	ag_stride = 0;
 	thread_count = 1;
 	report_interval = PROG_RPT_DEFAULT;
+	stats_fd = -1;
 
 	/*
 	 * XXX have to add suboption processing here
@@ -264,6 +281,75 @@ process_args(int argc, char **argv)
 				case PHASE2_THREADS:
 					phase2_threads = (int)strtol(val, NULL, 0);
 					break;
+				case PF_ENGINE:
+					if (!val)
+						do_abort(
+		_("-o pf_engine requires a parameter\n"));
+					if (!strcmp(val, "sync"))
+						pf_io_engine = PF_IO_SYNC;
+					else if (!strcmp(val, "uring"))
+						pf_io_engine = PF_IO_URING;
+					else
+						do_abort(
+		_("-o pf_engine must be \"sync\" or \"uring\"\n"));
+					break;
+				case PF_DEPTH:
+					if (!val)
+						do_abort(
+		_("-o pf_depth requires a parameter\n"));
+					pf_io_depth = (int)strtol(val, NULL, 0);
+					if (pf_io_depth < 1 ||
+					    pf_io_depth > PF_IO_MAX_DEPTH)
+						do_abort(
+		_("-o pf_depth must be between 1 and %d\n"),
+							PF_IO_MAX_DEPTH);
+					break;
+				case BCACHE_POLICY:
+					if (!val)
+						do_abort(
+		_("-o bcache_policy requires a parameter\n"));
+					libxfs_bcache_operations.policy =
+						cache_policy_find(val);
+					if (!libxfs_bcache_operations.policy)
+						do_abort(
+		_("-o bcache_policy must be \"mru\" or \"2q\"\n"));
+					break;
+				case SPILL_DIR:
+					if (!val)
+						do_abort(
+		_("-o spill_dir requires a parameter\n"));
+					spill_dir = val;
+					break;
+				case SPILL_LIMIT:
+					if (!val)
+						do_abort(
+		_("-o spill_limit requires a parameter\n"));
+					spill_limit = strtol(val, NULL, 0);
+					if (spill_limit < 1)
+						do_abort(
+		_("-o spill_limit must be at least 1\n"));
+					break;
+				case CHECKPOINT:
+					if (!val)
+						do_abort(
+		_("-o checkpoint requires a parameter\n"));
+					checkpoint_path = val;
+					break;
+				case STATS_FILE:
+					if (!val)
+						do_abort(
+		_("-o stats requires a parameter\n"));
+					stats_path = val;
+					break;
+				case STATS_FD:
+					if (!val)
+						do_abort(
+		_("-o stats_fd requires a parameter\n"));
+					stats_fd = (int)strtol(val, NULL, 0);
+					if (stats_fd < 0)
+						do_abort(
+		_("-o stats_fd must not be negative\n"));
+					break;
 				default:
 					unknown('o', val);
 					break;
@@ -537,6 +623,8 @@ main(int argc, char **argv)
 	char		*msgbuf;
 	struct xfs_sb	psb;
 	int		rval;
+	int		resume_phase;
+	__uint64_t	incore_budget = 0;	/* KB, 0 is no limit */
 
 	progname = basename(argv[0]);
 	setlocale(LC_ALL, "");
@@ -548,6 +636,7 @@ main(int argc, char **argv)
 	setbuf(stdout, NULL);
 
 	process_args(argc, argv);
+	stats_open();
 	xfs_init(&x);
 
 	msgbuf = malloc(DURATION_BUF_SIZE);
@@ -665,6 +754,8 @@ main(int argc, char **argv)
 		}
 	}
 
+	stats_init_ags(mp);
+
 	if (ag_stride && report_interval) {
 		init_progress_rpt();
 		if (msgbuf) {
@@ -691,6 +782,8 @@ main(int argc, char **argv)
 	if (!bhash_option_used || max_mem_specified) {
 		unsigned long 	mem_used;
 		unsigned long	max_mem;
+		unsigned long	total_mem;
+		unsigned long	reserved;
 		struct rlimit	rlim;
 
 		libxfs_bcache_purge();
@@ -742,6 +835,7 @@ main(int argc, char **argv)
 			max_mem = mem_used;
 		}
 
+		total_mem = max_mem;
 		max_mem -= mem_used;
 		if (max_mem >= (1 << 30))
 			max_mem = 1 << 30;
@@ -754,6 +848,19 @@ main(int argc, char **argv)
 			do_log(_("        - block cache size set to %d entries\n"),
 				libxfs_bhash_size * HASH_CACHE_RATIO);
 
+		/*
+		 * The buffer cache only grows as far as it's used, so it
+		 * shares what the block map and the overhead leave over with
+		 * the incore inode state.  Give the inode state half of it,
+		 * but never less than the inode estimate above; past that
+		 * budget the inode state is spilled to a scratch file.
+		 */
+		reserved = mem_used - (mp->m_sb.sb_icount >> (10 - 2));
+		incore_budget = mp->m_sb.sb_icount >> (10 - 2);
+		if (total_mem > reserved)
+			incore_budget = MAX(incore_budget,
+					(total_mem - reserved) / 2);
+
 		libxfs_bcache = cache_init(0, libxfs_bhash_size,
 						&libxfs_bcache_operations);
 	}
@@ -767,6 +874,9 @@ main(int argc, char **argv)
 	 * initialize block alloc map
 	 */
 	init_bmaps(mp);
+	if (spill_limit)
+		incore_budget = (__uint64_t)spill_limit * 1024;
+	incore_mem_init(mp, incore_budget);
 	incore_ino_init(mp);
 	incore_ext_init(mp);
 
@@ -779,17 +889,38 @@ main(int argc, char **argv)
 		return(1);
 	}
 
+	/*
+	 * the log is checked, replayed and cleared even when resuming.  Then
+	 * pick up the state phases 2 to 4 left in a checkpoint, if there is
+	 * one for this filesystem, unless the replay has changed the
+	 * filesystem under it.
+	 */
+	log_replayed = phase2_log(mp, phase2_threads);
+	resume_phase = checkpoint_load(mp);
+
 	/* make sure the per-ag freespace maps are ok so we can mount the fs */
-	phase2(mp, phase2_threads);
+	if (resume_phase < 2) {
+		phase2(mp, phase2_threads);
+		checkpoint_write(mp, 2);
+	} else
+		do_log(_("        - scan restored from checkpoint\n"));
 	timestamp(PHASE_END, 2, NULL);
 
 	if (do_prefetch)
 		init_prefetch(mp);
 
-	phase3(mp);
+	if (resume_phase < 3) {
+		phase3(mp);
+		checkpoint_write(mp, 3);
+	} else
+		do_log(_("Phase 3 - restored from checkpoint\n"));
 	timestamp(PHASE_END, 3, NULL);
 
-	phase4(mp);
+	if (resume_phase < 4) {
+		phase4(mp);
+		checkpoint_write(mp, 4);
+	} else
+		do_log(_("Phase 4 - restored from checkpoint\n"));
 	timestamp(PHASE_END, 4, NULL);
 
 	if (no_modify)
@@ -875,8 +1006,10 @@ _("Warning:  project quota information would be cleared.\n"
 	if (no_modify)  {
 		do_log(
 	_("No modify flag set, skipping filesystem flush and exiting.\n"));
+		checkpoint_remove();
 		if (verbose)
 			summary_report();
+		stats_close(fs_is_dirty);
 		if (fs_is_dirty)
 			return(1);
 
@@ -918,6 +1051,7 @@ _("Note - stripe unit (%d) and width (%d) were copied from a backup superblock.\
 	if (x.logdev && x.logdev != x.ddev)
 		libxfs_device_close(x.logdev);
 	libxfs_device_close(x.ddev);
+	checkpoint_remove();
 
 	if (verbose)
 		summary_report();
@@ -928,6 +1062,7 @@ _("Note - stripe unit (%d) and width (%d) were copied from a backup superblock.\
 _("Repair of readonly mount complete.  Immediate reboot encouraged.\n"));
 
 	pftrace_done();
+	stats_close(0);
 
 	return (0);
 }